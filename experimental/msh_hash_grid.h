@@ -31,19 +31,33 @@
     - MSH_HG_REALLOC
     - MSH_HG_FREE
 
+  Large coordinates
+  -------------
+  By default all point coordinates are 'float'. Defining MSH_HASH_GRID_DOUBLE_PRECISION prior to
+  inclusion of this file makes 'msh_hg_real_t' (type of input points, query points, boxes and
+  frustum planes) a 'double'. The grid then keeps a double precision 'origin' at the corner of
+  the point set bounding box and stores points relative to it, so that datasets with large
+  coordinates (e.g. georeferenced data in UTM) are binned and searched without precision loss,
+  while the search itself still runs on floats. Distances returned by searches are unaffected,
+  as they do not depend on the origin.
+
   msh_hash_grid_init_2d
   ---------------------
     void msh_hash_grid_init_2d( msh_hash_grid_t* hg,
-                                const float* pts, const int32_t n_pts, const float radius );
+                                const msh_hg_real_t* pts, const int32_t n_pts, const float radius );
 
   Initializes the 2d hash grid 'hg' using the data passed in 'pts' where the cell size is
   selected to best serve queries with 'radius' search distance. 'pts' is expected to
   be continuous array of 2d point corrdinates.
 
+  2d grids store points without the z coordinate (12 instead of 16 bytes per point, in
+  'hg->data_buffer_2d'), and searches on them use separate 2d loops that only visit the cells of
+  a single slab and compute 2 component distances.
+
   msh_hash_grid_init_3d
   ---------------------
     void msh_hash_grid_init_3d( msh_hash_grid_t* hg,
-                                const float* pts, const int32_t n_pts, const float radius );
+                                const msh_hg_real_t* pts, const int32_t n_pts, const float radius );
 
   Initializes the 3d hash grid 'hg' using the data passed in 'pts' where the cell size is
   selected to best serve queries with 'radius' search distance. 'pts' is expected to
@@ -54,6 +68,34 @@
     void msh_hash_grid_term( msh_hash_grid_t* hg );
   
   Terminates storage for grid 'hg'. 'hg' should not be used after this call.
+
+  msh_hash_grid_save
+  ---------------------
+    int32_t msh_hash_grid_save( const msh_hash_grid_t* hg, const char* filename );
+
+  Writes grid 'hg' to 'filename' as a single flat snapshot - grid parameters, followed by
+  bin offsets, the bin directory and the point data. Each section is 64 byte aligned. Returns
+  MSH_HASH_GRID_NO_ERR on success. Snapshots are not portable between machines with different
+  endianness.
+
+  msh_hash_grid_load
+  ---------------------
+    int32_t msh_hash_grid_load( msh_hash_grid_t* hg, const char* filename );
+
+  Reads snapshot from 'filename' into a single allocation owned by 'hg', which is released
+  by 'msh_hash_grid_term'.
+
+  msh_hash_grid_init_from_snapshot
+  ---------------------
+    int32_t msh_hash_grid_init_from_snapshot( msh_hash_grid_t* hg,
+                                              const void* snapshot, const size_t snapshot_size );
+
+  Initializes 'hg' to use snapshot stored in memory, without copying it. This is intended for
+  snapshot files mapped read-only into memory (mmap / MapViewOfFile), so that a prebuilt grid can
+  be shared between processes. 'snapshot' needs to be 64 byte aligned and stay valid until
+  'msh_hash_grid_term' is called, which will not attempt to release it. Both functions validate
+  the whole snapshot, including bin ranges and the bin directory, and return
+  MSH_HASH_GRID_INVALID_SNAPSHOT_ERR if it is corrupted.
   
   
   msh_hash_grid_radius_search
@@ -65,11 +107,16 @@
   in 'search_desc'. Returns the total number of neighbors found. The members of 
   'msh_hash_grid_search_desc_t' are:
 
-  float* query_pts     - INPUT: array of query points. Provided and owned by the user
+  msh_hg_real_t* query_pts - INPUT: array of query points. Provided and owned by the user
   size_t n_query_pts   - INPUT: size of query points array. Provided by the user.
 
   float radius         - OPTION: radius within which we wish to find neighbors for each query
-  int sort             - OPTION: should the results be sorted from closest to farthest
+  int sort             - OPTION: how results should be sorted from closest to farthest:
+                                 MSH_HASH_GRID_SORT_NONE (0), MSH_HASH_GRID_SORT_FULL (1), or
+                                 MSH_HASH_GRID_SORT_PARTIAL (2), where only the closest
+                                 'sort_top_m' results are sorted and placed first, and the rest
+                                 follows in no particular order.
+  size_t sort_top_m    - OPTION: number of results sorted in partial mode. 0 sorts all of them.
   size_t max_n_neigh/k - OPTION: maximum number of neighbors allowed for each query.
 
   float* distances_sq  - OUTPUT: max_n_neigh * n_query_pts matrix of squared distances to neighbors 
@@ -84,19 +131,219 @@
                                  each of query pts. Note that for i-th points we could find less
                                  than max_n_neighbors. This array should be used when iterating over
                                  indices and distances_sq matrices.
+
+  msh_jobs_ctx_t* work_ctx - OPTION: only present if msh_jobs.h was included before this file. If
+                                 set, queries are distributed among workers of this context
+                                 with msh_jobs_parallel_for - the calling thread participates,
+                                 and searches may be issued from inside jobs as well.
+                                 Otherwise OpenMP is used when available.
   
+  Queries are processed in chunks that are dynamically handed out to worker threads, so uneven
+  query costs are balanced. Small batches are processed on the calling thread. The minimal chunk
+  size can be tuned by defining MSH_HG_MIN_GRAIN before including this file (default: 64).
+
+  Partial sorting selects the closest results with quickselect before sorting them. Results of up
+  to 32 elements are sorted with a branchless sorting network, which makes sorted kNN with small
+  'k' considerably cheaper than a general sort.
+
   Note that when doing searches, 'max_n_neigh' parameter is important - set it too low and
   you will not find all neighbors within the radius (the k returned will still be the k closest though).
   Set it too high, and there will be a decent amount of memory wasting and cache misses.
 
+  To avoid guessing 'max_n_neigh', radius search can also return results in compressed sparse
+  row (CSR) form, by setting following members of 'msh_hash_grid_search_desc_t':
+
+  int output_mode      - OPTION: MSH_HASH_GRID_OUTPUT_DENSE (default) or MSH_HASH_GRID_OUTPUT_CSR.
+  size_t* offsets      - OUTPUT: n_query_pts + 1 array, provided by the user. Neighbors of i-th
+                                 query pt are stored in range [offsets[i], offsets[i+1]) of
+                                 'indices' and 'distances_sq'.
+
+  In CSR mode 'indices' and 'distances_sq' are packed and sized exactly to the number of
+  neighbors found. They are allocated by the library with MSH_HG_MALLOC, and ownership is passed
+  to the user, who should release them with MSH_HG_FREE. 'max_n_neigh' is optional in CSR mode,
+  and when it is 0 all neighbors within radius are returned.
+
+  Searches are exact by default. When approximate neighbors are good enough, following members
+  of 'msh_hash_grid_search_desc_t' trade accuracy for speed:
+
+  float eps             - OPTION: cells whose distance to query d satisfies (1+eps)*d > radius are
+                                  not visited. Returned neighbors are always within radius, and
+                                  all points within radius/(1+eps) are guaranteed to be found.
+                                  For kNN search, i-th neighbor returned is at most (1+eps) times
+                                  farther than the true i-th nearest neighbor.
+  size_t max_n_examined - OPTION: stop visiting cells once this many points were tested for a
+                                  single query. Cells are visited closest first, so the nearest
+                                  neighbors are found first, but no error bound holds once the cap
+                                  is hit, and kNN search can return less than 'k' neighbors.
+                                  0 means no limit.
+
   msh_hash_grid_knn_search
   ---------------------
     size_t msh_hash_grid_knn_search( const msh_hash_grid_t* hg,
                                    msh_hash_grid_search_desc_t* search_desc );
 
   Exactly the same as 'msh_hash_grid_radius_search', except search will be performed until
-  'k' (specified in 'search_desc') neighbors will be found.  Depending on how large 'k' is, 
-  these queries might not be very fast.
+  'k' (specified in 'search_desc') neighbors will be found. Cells are visited in order of
+  increasing distance to the query, and search terminates once the next cell is farther than
+  the current k-th neighbor, so results are exact for any 'k' and any point density.
+
+  msh_hash_grid_brute_force_radius_search / msh_hash_grid_brute_force_knn_search
+  ---------------------
+    size_t msh_hash_grid_brute_force_radius_search( const msh_hg_real_t* pts, const int32_t n_pts,
+                                                    const int32_t dim,
+                                                    msh_hash_grid_search_desc_t* search_desc );
+    size_t msh_hash_grid_brute_force_knn_search( const msh_hg_real_t* pts, const int32_t n_pts,
+                                                 const int32_t dim,
+                                                 msh_hash_grid_search_desc_t* search_desc );
+
+  Same as 'msh_hash_grid_radius_search' and 'msh_hash_grid_knn_search', but without building a
+  grid - every query is tested against all 'n_pts' points of dimension 'dim' (2 or 3). When a
+  point set is searched only a few times (tens of queries for a few thousand points), this is as
+  fast or faster than 'msh_hash_grid_init_3d' followed by a search.
+  Once a grid exists, searching it is faster even for small point sets.
+  Queries are processed in small tiles against blocks of points stored as structure of arrays,
+  so distance computation vectorizes. Only dense output is supported, and results are always
+  exact ('eps' and 'max_n_examined' are ignored).
+
+  msh_hash_grid_aggregate_cells
+  ---------------------
+    size_t msh_hash_grid_aggregate_cells( const msh_hash_grid_t* hg,
+                                          msh_hash_grid_cell_desc_t* cell_desc );
+
+  Computes per cell statistics of the points binned in 'hg', which makes voxel grid
+  downsampling a matter of initializing the grid with radius equal to half of the voxel size.
+  Returns the number of non-empty cells, also available through 'msh_hash_grid_n_cells'. Cells
+  are reported in the order of 'hg->offsets', and all outputs are optional arrays, provided by
+  the user. The members of 'msh_hash_grid_cell_desc_t' are:
+
+  const float* attribs     - INPUT: n_pts x n_attribs array of per point attributes (colors,
+                                    normals etc.), in the same order as points passed to init.
+  size_t n_attribs         - INPUT: number of attributes per point.
+
+  uint32_t* counts         - OUTPUT: n_cells array of number of points in each cell.
+  msh_hg_real_t* centroids - OUTPUT: n_cells x dim array of cell centroids.
+  float* mean_attribs      - OUTPUT: n_cells x n_attribs array of mean attributes of each cell.
+  int32_t* representatives - OUTPUT: n_cells array of indices of points closest to the centroid.
+
+  Cells are processed in parallel, same as queries in 'msh_hash_grid_radius_search'.
+
+  msh_hash_grid_radius_pairs
+  ---------------------
+    size_t msh_hash_grid_radius_pairs( const msh_hash_grid_t* hg,
+                                       msh_hash_grid_pairs_desc_t* pairs_desc );
+
+  Finds all pairs of points from 'hg' that are closer than 'radius', i.e. the fixed radius
+  neighbor graph. Instead of querying every point, each cell is joined with itself and with
+  cells in its forward half of the neighborhood, so every pair is tested once. Cells are
+  processed in parallel. Returns the number of entries written to 'indices'. The members of
+  'msh_hash_grid_pairs_desc_t' are:
+
+  float radius          - INPUT: pairs closer than this are reported.
+  int symmetric         - OPTION: if set, edge (i, j) is stored in both rows i and j. Otherwise
+                                  it is stored once, in row min(i, j).
+  int sort              - OPTION: sort each row from closest to farthest.
+
+  size_t* offsets       - OUTPUT: n_pts + 1 array, provided by the user. Neighbors of i-th input
+                                  point are stored in range [offsets[i], offsets[i+1]).
+  int32_t* indices      - OUTPUT: neighbor indices, allocated with MSH_HG_MALLOC, owned by the user.
+  float* distances_sq   - OUTPUT: squared distances, allocated with MSH_HG_MALLOC, owned by the user.
+
+  msh_hash_grid_estimate_normals
+  ---------------------
+    size_t msh_hash_grid_estimate_normals( const msh_hash_grid_t* hg,
+                                           msh_hash_grid_normals_desc_t* normals_desc );
+
+  Estimates normal and curvature of every point of 3d grid 'hg' from the covariance of its
+  neighborhood. Neighbors are accumulated directly into the covariance as they are found, and
+  the eigenvector of the smallest eigenvalue is computed in closed form, so no neighbor lists
+  are ever stored. Points are processed in parallel, cell by cell. Returns the number of points
+  with at least 3 neighbors - normals and curvatures of the remaining ones are set to zero. The
+  members of 'msh_hash_grid_normals_desc_t' are:
+
+  float radius          - INPUT: neighborhood radius. Used if 'k' is 0.
+  size_t k              - OPTION: if set, neighborhood consists of k nearest neighbors instead.
+  const msh_hg_real_t* viewpoint - OPTION: if set, normals are flipped to face this point.
+                                  Otherwise their sign is arbitrary.
+
+  float* normals        - OUTPUT: n_pts x 3 array of unit normals, in the same order as points
+                                  passed to init. Provided by the user.
+  float* curvatures     - OUTPUT: n_pts array of surface variation l0 / (l0 + l1 + l2), where
+                                  l0 <= l1 <= l2 are the covariance eigenvalues. Optional.
+
+  msh_hash_grid_mr_init_2d / msh_hash_grid_mr_init_3d
+  ---------------------
+    void msh_hash_grid_mr_init_3d( msh_hash_grid_mr_t* hgmr, const msh_hg_real_t* pts, const int32_t n_pts,
+                                   const float min_radius, const float max_radius );
+
+  Initializes multi-resolution grid 'hgmr' for queries with radii in range
+  [min_radius, max_radius]. Level 0 is tuned for 'min_radius', and each following level doubles
+  the cell size, until 'max_radius' is covered. Points are stored once, sorted along a Morton
+  curve of finest cells, so every cell of every level is a contiguous range of the shared point
+  buffer. Each level is a regular 'msh_hash_grid_t' and can be passed to any search function.
+
+  msh_hash_grid_mr_select_level
+  ---------------------
+    const msh_hash_grid_t* msh_hash_grid_mr_select_level( const msh_hash_grid_mr_t* hgmr,
+                                                          const float radius );
+
+  Returns the level with cell size closest to the one 'msh_hash_grid_init_3d' would pick for
+  'radius'.
+
+  msh_hash_grid_mr_radius_search / msh_hash_grid_mr_knn_search
+  ---------------------
+    size_t msh_hash_grid_mr_radius_search( const msh_hash_grid_mr_t* hgmr,
+                                           msh_hash_grid_search_desc_t* search_desc );
+
+  Same as 'msh_hash_grid_radius_search' and 'msh_hash_grid_knn_search', but searching the level
+  selected for 'radius'. For kNN search 'radius' is an optional hint about the expected distance
+  to the k-th neighbor; the finest level is used if it is not set.
+
+  msh_hash_grid_mr_term
+  ---------------------
+    void msh_hash_grid_mr_term( msh_hash_grid_mr_t* hgmr );
+
+  Releases all levels and the shared point buffer.
+
+  msh_hash_grid_box_query
+  ---------------------
+    size_t msh_hash_grid_box_query( const msh_hash_grid_t* hg,
+                                    msh_hash_grid_range_desc_t* range_desc );
+
+  Finds indices of all points that lie within axis aligned boxes described in 'range_desc'.
+  Returns the total number of indices written. The members of 'msh_hash_grid_range_desc_t' are:
+
+  msh_hg_real_t* boxes  - INPUT: n_ranges boxes, each stored as min corner followed by max corner
+                                 (2*dim floats per box). Used by 'msh_hash_grid_box_query'.
+  msh_hg_real_t* frustums - INPUT: n_ranges frustums, each stored as 6 planes (a, b, c, d), where
+                                 point p is inside if a*p.x + b*p.y + c*p.z + d >= 0 for all
+                                 planes. Used by 'msh_hash_grid_frustum_query'.
+  size_t n_ranges       - INPUT: number of boxes/frustums.
+  size_t max_n_indices  - OPTION: maximum number of indices stored for each range.
+
+  int32_t* indices      - OUTPUT: max_n_indices * n_ranges matrix of indices of points that
+                                  lie within each range. Provided by the user.
+  size_t* n_indices     - OUTPUT: n_ranges array with number of indices stored for each range.
+
+  Cells that are fully contained within the range are emitted without testing the
+  individual points, and since points are stored sorted by cell, whole runs of such cells are
+  copied at once. Only cells that straddle the range boundary are tested point by point.
+
+  msh_hash_grid_frustum_query
+  ---------------------
+    size_t msh_hash_grid_frustum_query( const msh_hash_grid_t* hg,
+                                        msh_hash_grid_range_desc_t* range_desc );
+
+  Same as 'msh_hash_grid_box_query', but for view frustums given in 'frustums' member of
+  'range_desc'. Only supported for 3d grids.
+
+  msh_hash_grid_frustum_planes
+  ---------------------
+    void msh_hash_grid_frustum_planes( const float* view, const float* proj, msh_hg_real_t* planes );
+
+  Extracts 6 frustum planes (24 floats, in order left, right, bottom, top, near, far) from
+  column-major 4x4 'view' and 'proj' matrices, following OpenGL clip space conventions.
+  If msh_camera.h is included before this file, 'msh_hash_grid_frustum_planes_from_camera'
+  does the same, given 'msh_camera_t'.
 
   ==============================================================================
   DEPENDENCIES
@@ -192,16 +439,36 @@
 extern "C" {
 #endif
 
+#ifdef MSH_HASH_GRID_DOUBLE_PRECISION
+typedef double msh_hg_real_t;
+#else
+typedef float msh_hg_real_t;
+#endif
+
 typedef struct msh_hash_grid msh_hash_grid_t;
 
+typedef enum msh_hash_grid_output_mode
+{
+  MSH_HASH_GRID_OUTPUT_DENSE = 0,
+  MSH_HASH_GRID_OUTPUT_CSR   = 1
+} msh_hash_grid_output_mode_t;
+
+typedef enum msh_hash_grid_sort_mode
+{
+  MSH_HASH_GRID_SORT_NONE    = 0,
+  MSH_HASH_GRID_SORT_FULL    = 1,
+  MSH_HASH_GRID_SORT_PARTIAL = 2
+} msh_hash_grid_sort_mode_t;
+
 typedef struct msh_hash_grid_search_desc
 {
-  float* query_pts;
+  msh_hg_real_t* query_pts;
   size_t n_query_pts;
 
   float* distances_sq;
   int32_t* indices;
   size_t* n_neighbors;
+  size_t* offsets;
 
   float radius;
   union
@@ -210,26 +477,157 @@ typedef struct msh_hash_grid_search_desc
     size_t max_n_neigh;
   };
 
+  float eps;
+  size_t max_n_examined;
+
   int sort;
+  size_t sort_top_m;
+  int output_mode;
 #ifdef MSH_JOBS
   msh_jobs_ctx_t* work_ctx;
 #endif
 } msh_hash_grid_search_desc_t;
 
 void   msh_hash_grid_init_2d( msh_hash_grid_t* hg,
-                              const float* pts, const int32_t n_pts, const float radius );
+                              const msh_hg_real_t* pts, const int32_t n_pts, const float radius );
 
 void   msh_hash_grid_init_3d( msh_hash_grid_t* hg,
-                              const float* pts, const int32_t n_pts, const float radius );
+                              const msh_hg_real_t* pts, const int32_t n_pts, const float radius );
 
 void   msh_hash_grid_term( msh_hash_grid_t* hg );
 
+typedef enum msh_hash_grid_error_codes
+{
+  MSH_HASH_GRID_NO_ERR               = 0,
+  MSH_HASH_GRID_FILE_OPEN_ERR        = 1,
+  MSH_HASH_GRID_FILE_IO_ERR          = 2,
+  MSH_HASH_GRID_INVALID_SNAPSHOT_ERR = 3,
+  MSH_HASH_GRID_OUT_OF_MEMORY_ERR    = 4
+} msh_hash_grid_error_codes_t;
+
+int32_t msh_hash_grid_save( const msh_hash_grid_t* hg, const char* filename );
+
+int32_t msh_hash_grid_load( msh_hash_grid_t* hg, const char* filename );
+
+int32_t msh_hash_grid_init_from_snapshot( msh_hash_grid_t* hg,
+                                          const void* snapshot, const size_t snapshot_size );
+
+typedef struct msh_hash_grid_mr
+{
+  msh_hash_grid_t* levels;
+  uint32_t n_levels;
+  void* data_buffer;
+} msh_hash_grid_mr_t;
+
+void   msh_hash_grid_mr_init_2d( msh_hash_grid_mr_t* hgmr, const msh_hg_real_t* pts, const int32_t n_pts,
+                                 const float min_radius, const float max_radius );
+
+void   msh_hash_grid_mr_init_3d( msh_hash_grid_mr_t* hgmr, const msh_hg_real_t* pts, const int32_t n_pts,
+                                 const float min_radius, const float max_radius );
+
+void   msh_hash_grid_mr_term( msh_hash_grid_mr_t* hgmr );
+
+const msh_hash_grid_t* msh_hash_grid_mr_select_level( const msh_hash_grid_mr_t* hgmr,
+                                                      const float radius );
+
+size_t msh_hash_grid_mr_radius_search( const msh_hash_grid_mr_t* hgmr,
+                                       msh_hash_grid_search_desc_t* search_desc );
+
+size_t msh_hash_grid_mr_knn_search( const msh_hash_grid_mr_t* hgmr,
+                                    msh_hash_grid_search_desc_t* search_desc );
+
 size_t msh_hash_grid_radius_search( const msh_hash_grid_t* hg,
                                     msh_hash_grid_search_desc_t* search_desc );
 
 size_t msh_hash_grid_knn_search( const msh_hash_grid_t* hg,
                                  msh_hash_grid_search_desc_t* search_desc );
 
+size_t msh_hash_grid_brute_force_radius_search( const msh_hg_real_t* pts, const int32_t n_pts,
+                                                const int32_t dim,
+                                                msh_hash_grid_search_desc_t* search_desc );
+
+size_t msh_hash_grid_brute_force_knn_search( const msh_hg_real_t* pts, const int32_t n_pts,
+                                             const int32_t dim,
+                                             msh_hash_grid_search_desc_t* search_desc );
+
+typedef struct msh_hash_grid_range_desc
+{
+  msh_hg_real_t* boxes;
+  msh_hg_real_t* frustums;
+  size_t n_ranges;
+
+  int32_t* indices;
+  size_t* n_indices;
+  size_t max_n_indices;
+#ifdef MSH_JOBS
+  msh_jobs_ctx_t* work_ctx;
+#endif
+} msh_hash_grid_range_desc_t;
+
+size_t msh_hash_grid_box_query( const msh_hash_grid_t* hg,
+                                msh_hash_grid_range_desc_t* range_desc );
+
+size_t msh_hash_grid_frustum_query( const msh_hash_grid_t* hg,
+                                    msh_hash_grid_range_desc_t* range_desc );
+
+void   msh_hash_grid_frustum_planes( const float* view, const float* proj, msh_hg_real_t* planes );
+
+#ifdef MSH_CAMERA
+void   msh_hash_grid_frustum_planes_from_camera( const msh_camera_t* cam, msh_hg_real_t* planes );
+#endif
+
+typedef struct msh_hash_grid_cell_desc
+{
+  const float* attribs;
+  size_t n_attribs;
+
+  uint32_t* counts;
+  msh_hg_real_t* centroids;
+  float* mean_attribs;
+  int32_t* representatives;
+#ifdef MSH_JOBS
+  msh_jobs_ctx_t* work_ctx;
+#endif
+} msh_hash_grid_cell_desc_t;
+
+size_t msh_hash_grid_n_cells( const msh_hash_grid_t* hg );
+
+typedef struct msh_hash_grid_pairs_desc
+{
+  float radius;
+  int symmetric;
+  int sort;
+
+  size_t* offsets;
+  int32_t* indices;
+  float* distances_sq;
+#ifdef MSH_JOBS
+  msh_jobs_ctx_t* work_ctx;
+#endif
+} msh_hash_grid_pairs_desc_t;
+
+size_t msh_hash_grid_radius_pairs( const msh_hash_grid_t* hg,
+                                   msh_hash_grid_pairs_desc_t* pairs_desc );
+
+size_t msh_hash_grid_aggregate_cells( const msh_hash_grid_t* hg,
+                                      msh_hash_grid_cell_desc_t* cell_desc );
+
+typedef struct msh_hash_grid_normals_desc
+{
+  float radius;
+  size_t k;
+  const msh_hg_real_t* viewpoint;
+
+  float* normals;
+  float* curvatures;
+#ifdef MSH_JOBS
+  msh_jobs_ctx_t* work_ctx;
+#endif
+} msh_hash_grid_normals_desc_t;
+
+size_t msh_hash_grid_estimate_normals( const msh_hash_grid_t* hg,
+                                       msh_hash_grid_normals_desc_t* normals_desc );
+
 
 typedef struct msh_hg_v3
 {
@@ -242,6 +640,12 @@ typedef struct msh_hg_v3i
   int32_t i;
 } msh_hg_v3i_t;
 
+typedef struct msh_hg_v2i
+{
+  float x, y;
+  int32_t i;
+} msh_hg_v2i_t;
+
 typedef struct msh_hg_bin_data msh_hg__bin_data_t;
 typedef struct msh_hg_bin_info msh_hg__bin_info_t;
 typedef struct msh_hg_map msh_hg_map_t;
@@ -255,9 +659,14 @@ typedef struct msh_hash_grid
 
   msh_hg_v3_t min_pt;
   msh_hg_v3_t max_pt;
+  double origin[3];
 
   msh_hg_map_t* bin_table;
-  msh_hg_v3i_t* data_buffer;
+  union
+  {
+    msh_hg_v3i_t* data_buffer;
+    msh_hg_v2i_t* data_buffer_2d; // 2d grids store points without z coordinate
+  };
   msh_hg__bin_info_t* offsets;
 
   int32_t   _slab_size;
@@ -267,6 +676,9 @@ typedef struct msh_hash_grid
   int32_t _dont_use_omp;
   uint32_t max_n_pts_in_bin;
   size_t _n_pts;
+
+  void* _snapshot;
+  uint8_t _external_storage;
 } msh_hash_grid_t;
 
 typedef struct msh_hg_map
@@ -379,6 +791,44 @@ msh_hash_grid__bin_pt( const msh_hash_grid_t* hg, uint64_t ix, uint64_t iy, uint
   return bin_idx;
 }
 
+// Converts user point to coordinates relative to grid origin. Subtraction happens in double,
+// so large coordinates keep their precision as long as the grid extent itself is moderate.
+MSH_HG_INLINE msh_hg_v3_t
+msh_hash_grid__to_local( const msh_hash_grid_t* hg, const msh_hg_real_t* pt )
+{
+  msh_hg_v3_t local;
+  local.x = (float)( (double)pt[0] - hg->origin[0] );
+  local.y = (float)( (double)pt[1] - hg->origin[1] );
+  local.z = (hg->_pts_dim == 2) ? 0.0f : (float)( (double)pt[2] - hg->origin[2] );
+  return local;
+}
+
+// 2d grids store points as msh_hg_v2i_t, 3d grids as msh_hg_v3i_t. Search kernels have separate
+// loops for each layout, everything else goes through these.
+MSH_HG_INLINE size_t
+msh_hash_grid__pt_size( const int32_t dim )
+{
+  return (dim == 2) ? sizeof(msh_hg_v2i_t) : sizeof(msh_hg_v3i_t);
+}
+
+MSH_HG_INLINE void
+msh_hash_grid__store_pt( void* buffer, const int32_t dim, const size_t idx, const msh_hg_v3i_t pt )
+{
+  if( dim == 2 ) { ((msh_hg_v2i_t*)buffer)[idx] = (msh_hg_v2i_t){ pt.x, pt.y, pt.i }; }
+  else           { ((msh_hg_v3i_t*)buffer)[idx] = pt; }
+}
+
+MSH_HG_INLINE msh_hg_v3i_t
+msh_hash_grid__load_pt( const msh_hash_grid_t* hg, const size_t idx )
+{
+  if( hg->_pts_dim == 2 )
+  {
+    msh_hg_v2i_t pt = hg->data_buffer_2d[idx];
+    return (msh_hg_v3i_t){ pt.x, pt.y, 0.0f, pt.i };
+  }
+  return hg->data_buffer[idx];
+}
+
 int32_t 
 msh_hash_grid__uint64_compare( const void * a, const void * b )
 {
@@ -388,12 +838,8 @@ msh_hash_grid__uint64_compare( const void * a, const void * b )
 
 
 void
-msh_hash_grid__init( msh_hash_grid_t* hg,
-                     const float* pts, const int32_t n_pts, const int32_t dim,
-                     const float radius )
+msh_hash_grid__init_threads( msh_hash_grid_t* hg )
 {
-  assert( dim == 2 || dim == 3 );
-
   if( hg->_num_threads == 0 )
   {
     #if defined(_OPENMP)
@@ -408,32 +854,58 @@ msh_hash_grid__init( msh_hash_grid_t* hg,
   #if defined(_OPENMP)
   if( hg->_num_threads == 1 ) { hg->_dont_use_omp = 1; }
   #endif
+}
 
-  hg->_pts_dim = dim;
-
-  // Compute bbox
-  hg->min_pt = (msh_hg_v3_t){ .x =  1e9, .y =  1e9, .z =  1e9 };
-  hg->max_pt = (msh_hg_v3_t){ .x = -1e9, .y = -1e9, .z = -1e9 };
-
+void
+msh_hash_grid__compute_bbox( msh_hash_grid_t* hg, const msh_hg_real_t* pts, const int32_t n_pts,
+                             const int32_t dim )
+{
+  // Compute bbox in input precision
+  double min_pt[3] = {  1e30,  1e30,  1e30 };
+  double max_pt[3] = { -1e30, -1e30, -1e30 };
   for( int i = 0; i < n_pts; ++i )
   {
-    const float* pt_ptr = &pts[ dim * i ];
-
-    msh_hg_v3_t pt;
-    if( dim == 2 ) { pt = (msh_hg_v3_t){ .x = pt_ptr[0], .y = pt_ptr[1], .z = 0 }; }
-    else           { pt = (msh_hg_v3_t){ .x = pt_ptr[0], .y = pt_ptr[1], .z = pt_ptr[2] }; };
-
-    hg->min_pt.x = (hg->min_pt.x > pt.x) ? pt.x : hg->min_pt.x;
-    hg->min_pt.y = (hg->min_pt.y > pt.y) ? pt.y : hg->min_pt.y;
-    hg->min_pt.z = (hg->min_pt.z > pt.z) ? pt.z : hg->min_pt.z;
-
-    hg->max_pt.x = (hg->max_pt.x < pt.x) ? pt.x : hg->max_pt.x;
-    hg->max_pt.y = (hg->max_pt.y < pt.y) ? pt.y : hg->max_pt.y;
-    hg->max_pt.z = (hg->max_pt.z < pt.z) ? pt.z : hg->max_pt.z;
+    const msh_hg_real_t* pt_ptr = &pts[ dim * i ];
+    for( int j = 0; j < 3; ++j )
+    {
+      double v = (j < dim) ? pt_ptr[j] : 0.0;
+      min_pt[j] = (min_pt[j] > v) ? v : min_pt[j];
+      max_pt[j] = (max_pt[j] < v) ? v : max_pt[j];
+    }
+  }
 
+  // Double precision build stores points relative to the bbox corner
+  hg->_pts_dim = dim;
+  for( int j = 0; j < 3; ++j )
+  {
+#ifdef MSH_HASH_GRID_DOUBLE_PRECISION
+    hg->origin[j] = (n_pts > 0) ? min_pt[j] : 0.0;
+#else
+    hg->origin[j] = 0.0;
+#endif
   }
+  hg->min_pt = (msh_hg_v3_t){ (float)(min_pt[0] - hg->origin[0]),
+                              (float)(min_pt[1] - hg->origin[1]),
+                              (float)(min_pt[2] - hg->origin[2]) };
+  hg->max_pt = (msh_hg_v3_t){ (float)(max_pt[0] - hg->origin[0]),
+                              (float)(max_pt[1] - hg->origin[1]),
+                              (float)(max_pt[2] - hg->origin[2]) };
   hg->max_pt.x += 0.0001f; hg->max_pt.y += 0.0001f; hg->max_pt.z += 0.0001f;
   hg->min_pt.x -= 0.0001f; hg->min_pt.y -= 0.0001f; hg->min_pt.z -= 0.0001f;
+}
+
+void
+msh_hash_grid__init( msh_hash_grid_t* hg,
+                     const msh_hg_real_t* pts, const int32_t n_pts, const int32_t dim,
+                     const float radius )
+{
+  assert( dim == 2 || dim == 3 );
+
+  msh_hash_grid__init_threads( hg );
+
+  hg->_pts_dim = dim;
+
+  msh_hash_grid__compute_bbox( hg, pts, n_pts, dim );
 
   // Calculate dimensions
   float dim_x   = (hg->max_pt.x - hg->min_pt.x);
@@ -459,16 +931,8 @@ msh_hash_grid__init( msh_hash_grid_t* hg,
   uint64_t n_bins = 0;
   for( int i = 0 ; i < n_pts; ++i )
   {
-    const float* pt_ptr = &pts[ dim * i ];
-    msh_hg_v3i_t pt_data;
-    if( dim == 2 )
-    {
-      pt_data = (msh_hg_v3i_t){ .x = pt_ptr[0], .y = pt_ptr[1], .z = 0, .i = i };
-    }
-    else
-    {
-      pt_data = (msh_hg_v3i_t){ .x = pt_ptr[0], .y = pt_ptr[1], .z = pt_ptr[2], .i = i };
-    }
+    msh_hg_v3_t pt = msh_hash_grid__to_local( hg, &pts[ dim * i ] );
+    msh_hg_v3i_t pt_data = (msh_hg_v3i_t){ .x = pt.x, .y = pt.y, .z = pt.z, .i = i };
 
     uint64_t ix = (uint64_t)( ( pt_data.x - hg->min_pt.x ) * hg->_inv_cell_size );
     uint64_t iy = (uint64_t)( ( pt_data.y - hg->min_pt.y ) * hg->_inv_cell_size );
@@ -497,7 +961,7 @@ msh_hash_grid__init( msh_hash_grid_t* hg,
 
   // Prepare storage for linear data
   hg->offsets     = (msh_hg__bin_info_t*)MSH_HG_MALLOC( n_bins * sizeof(msh_hg__bin_info_t) );
-  hg->data_buffer = (msh_hg_v3i_t*)MSH_HG_MALLOC( n_pts * sizeof( msh_hg_v3i_t ) );
+  hg->data_buffer = (msh_hg_v3i_t*)MSH_HG_MALLOC( n_pts * msh_hash_grid__pt_size( dim ) );
   MSH_HG_MEMSET( hg->offsets, 0, n_bins * sizeof(msh_hg__bin_info_t) );
 
   // Gather indices of bins that have data in them from hash table
@@ -527,7 +991,7 @@ msh_hash_grid__init( msh_hash_grid_t* hg,
     hg->max_n_pts_in_bin = MSH_HG_MAX( n_bin_pts, hg->max_n_pts_in_bin );
     for( uint32_t j = 0; j < n_bin_pts; ++j )
     {
-      hg->data_buffer[ offset + j ] = bin->data[j] ;
+      msh_hash_grid__store_pt( hg->data_buffer, dim, offset + j, bin->data[j] );
     }
     hg->offsets[ *bin_index ] = (msh_hg__bin_info_t) { .offset = offset, .length = n_bin_pts };
     offset += n_bin_pts;
@@ -544,14 +1008,14 @@ msh_hash_grid__init( msh_hash_grid_t* hg,
 
 void
 msh_hash_grid_init_2d( msh_hash_grid_t* hg,
-                       const float* pts, const int32_t n_pts, const float radius)
+                       const msh_hg_real_t* pts, const int32_t n_pts, const float radius)
 {
   msh_hash_grid__init( hg, pts, n_pts, 2, radius );
 }
 
 void
 msh_hash_grid_init_3d( msh_hash_grid_t* hg,
-                       const float* pts, const int32_t n_pts, const float radius)
+                       const msh_hg_real_t* pts, const int32_t n_pts, const float radius)
 {
   msh_hash_grid__init( hg, pts, n_pts, 3, radius );
 }
@@ -569,9 +1033,306 @@ msh_hash_grid_term( msh_hash_grid_t* hg )
   hg->_slab_size     = 0.0f;
   hg->_inv_cell_size = 0.0f;
 
-  MSH_HG_FREE( hg->data_buffer ); hg->data_buffer = NULL;
-  MSH_HG_FREE( hg->offsets );     hg->offsets = NULL;
-  MSH_HG_FREE( hg->bin_table );   hg->bin_table = NULL;
+  // Snapshot backed grids point into a single block of memory
+  if( !hg->_snapshot && !hg->_external_storage )
+  {
+    MSH_HG_FREE( hg->data_buffer );
+    MSH_HG_FREE( hg->offsets );
+    if( hg->bin_table ) { msh_hg_map_free( hg->bin_table ); }
+  }
+  MSH_HG_FREE( hg->_snapshot );
+  MSH_HG_FREE( hg->bin_table );
+  hg->data_buffer       = NULL;
+  hg->offsets           = NULL;
+  hg->bin_table         = NULL;
+  hg->_snapshot         = NULL;
+  hg->_external_storage = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Snapshots
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#define MSH_HASH_GRID__SNAPSHOT_MAGIC "MSHHGRID"
+#define MSH_HASH_GRID__SNAPSHOT_VERSION 3
+#define MSH_HASH_GRID__SNAPSHOT_ALIGN 64
+
+typedef struct msh_hash_grid__snapshot_header
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t header_size;
+  uint32_t pts_dim;
+  uint32_t max_n_pts_in_bin;
+  uint64_t width;
+  uint64_t height;
+  uint64_t depth;
+  double cell_size;
+  float min_pt[4];
+  float max_pt[4];
+  double origin[4];
+  uint64_t n_pts;
+  uint64_t n_bins;
+  uint64_t map_cap;
+  uint64_t offsets_offset;
+  uint64_t keys_offset;
+  uint64_t vals_offset;
+  uint64_t data_offset;
+  uint64_t total_size;
+} msh_hash_grid__snapshot_header_t;
+
+MSH_HG_INLINE uint64_t
+msh_hash_grid__align_snapshot_offset( uint64_t offset )
+{
+  return (offset + MSH_HASH_GRID__SNAPSHOT_ALIGN - 1) & ~(uint64_t)(MSH_HASH_GRID__SNAPSHOT_ALIGN - 1);
+}
+
+void
+msh_hash_grid__fill_snapshot_header( const msh_hash_grid_t* hg, msh_hash_grid__snapshot_header_t* hdr )
+{
+  MSH_HG_MEMSET( hdr, 0, sizeof(msh_hash_grid__snapshot_header_t) );
+  memcpy( hdr->magic, MSH_HASH_GRID__SNAPSHOT_MAGIC, 8 );
+  hdr->version          = MSH_HASH_GRID__SNAPSHOT_VERSION;
+  hdr->header_size      = sizeof(msh_hash_grid__snapshot_header_t);
+  hdr->pts_dim          = hg->_pts_dim;
+  hdr->max_n_pts_in_bin = hg->max_n_pts_in_bin;
+  hdr->width            = hg->width;
+  hdr->height           = hg->height;
+  hdr->depth            = hg->depth;
+  hdr->cell_size        = hg->cell_size;
+  hdr->min_pt[0]        = hg->min_pt.x;
+  hdr->min_pt[1]        = hg->min_pt.y;
+  hdr->min_pt[2]        = hg->min_pt.z;
+  hdr->max_pt[0]        = hg->max_pt.x;
+  hdr->max_pt[1]        = hg->max_pt.y;
+  hdr->max_pt[2]        = hg->max_pt.z;
+  hdr->origin[0]        = hg->origin[0];
+  hdr->origin[1]        = hg->origin[1];
+  hdr->origin[2]        = hg->origin[2];
+  hdr->n_pts            = hg->_n_pts;
+  hdr->n_bins           = hg->bin_table->_len;
+  hdr->map_cap          = hg->bin_table->_cap;
+
+  uint64_t offset       = msh_hash_grid__align_snapshot_offset( sizeof(msh_hash_grid__snapshot_header_t) );
+  hdr->offsets_offset   = offset;
+  offset                = msh_hash_grid__align_snapshot_offset( offset + hdr->n_bins * sizeof(msh_hg__bin_info_t) );
+  hdr->keys_offset      = offset;
+  offset                = msh_hash_grid__align_snapshot_offset( offset + hdr->map_cap * sizeof(uint64_t) );
+  hdr->vals_offset      = offset;
+  offset                = msh_hash_grid__align_snapshot_offset( offset + hdr->map_cap * sizeof(uint64_t) );
+  hdr->data_offset      = offset;
+  hdr->total_size       = offset + hdr->n_pts * msh_hash_grid__pt_size( hg->_pts_dim );
+}
+
+int32_t
+msh_hash_grid__write_snapshot_section( FILE* fp, uint64_t* cur_offset, uint64_t section_offset,
+                                       const void* data, uint64_t size )
+{
+  static const char padding[MSH_HASH_GRID__SNAPSHOT_ALIGN] = {0};
+  uint64_t n_padding = section_offset - *cur_offset;
+  if( n_padding && fwrite( padding, 1, n_padding, fp ) != n_padding ) { return MSH_HASH_GRID_FILE_IO_ERR; }
+  if( size && fwrite( data, 1, size, fp ) != size ) { return MSH_HASH_GRID_FILE_IO_ERR; }
+  *cur_offset = section_offset + size;
+  return MSH_HASH_GRID_NO_ERR;
+}
+
+int32_t
+msh_hash_grid_save( const msh_hash_grid_t* hg, const char* filename )
+{
+  assert( hg->bin_table );
+
+  msh_hash_grid__snapshot_header_t hdr;
+  msh_hash_grid__fill_snapshot_header( hg, &hdr );
+
+  FILE* fp = fopen( filename, "wb" );
+  if( !fp ) { return MSH_HASH_GRID_FILE_OPEN_ERR; }
+
+  uint64_t cur_offset = 0;
+  int32_t err = msh_hash_grid__write_snapshot_section( fp, &cur_offset, 0, &hdr, sizeof(hdr) );
+  if( !err ) { err = msh_hash_grid__write_snapshot_section( fp, &cur_offset, hdr.offsets_offset,
+                                                            hg->offsets,
+                                                            hdr.n_bins * sizeof(msh_hg__bin_info_t) ); }
+  if( !err ) { err = msh_hash_grid__write_snapshot_section( fp, &cur_offset, hdr.keys_offset,
+                                                            hg->bin_table->keys,
+                                                            hdr.map_cap * sizeof(uint64_t) ); }
+  if( !err ) { err = msh_hash_grid__write_snapshot_section( fp, &cur_offset, hdr.vals_offset,
+                                                            hg->bin_table->vals,
+                                                            hdr.map_cap * sizeof(uint64_t) ); }
+  if( !err ) { err = msh_hash_grid__write_snapshot_section( fp, &cur_offset, hdr.data_offset,
+                                                            hg->data_buffer,
+                                                            hdr.n_pts * msh_hash_grid__pt_size( hdr.pts_dim ) ); }
+
+  if( fclose( fp ) && !err ) { err = MSH_HASH_GRID_FILE_IO_ERR; }
+  return err;
+}
+
+// NOTE(maciej): Section has to start past the header, be aligned and fit within the snapshot.
+// Size is compared against what is left after the offset, so that nothing here can overflow.
+int32_t
+msh_hash_grid__snapshot_section_is_valid( uint64_t offset, uint64_t count, uint64_t elem_size,
+                                          uint64_t total_size )
+{
+  if( offset < sizeof(msh_hash_grid__snapshot_header_t) || offset > total_size ) { return 0; }
+  if( offset & (MSH_HASH_GRID__SNAPSHOT_ALIGN - 1) ) { return 0; }
+  return count <= (total_size - offset) / elem_size;
+}
+
+int32_t
+msh_hash_grid__snapshot_header_is_valid( const msh_hash_grid__snapshot_header_t* hdr,
+                                         const uint64_t snapshot_size )
+{
+  if( memcmp( hdr->magic, MSH_HASH_GRID__SNAPSHOT_MAGIC, 8 ) ||
+      hdr->version != MSH_HASH_GRID__SNAPSHOT_VERSION ||
+      hdr->header_size != sizeof(msh_hash_grid__snapshot_header_t) ||
+      hdr->total_size > snapshot_size ||
+      (hdr->pts_dim != 2 && hdr->pts_dim != 3) ||
+      (hdr->map_cap & (hdr->map_cap - 1)) || hdr->n_bins >= hdr->map_cap )
+  {
+    return 0;
+  }
+
+  uint64_t total_size = hdr->total_size;
+  return msh_hash_grid__snapshot_section_is_valid( hdr->offsets_offset, hdr->n_bins,
+                                                   sizeof(msh_hg__bin_info_t), total_size ) &&
+         msh_hash_grid__snapshot_section_is_valid( hdr->keys_offset, hdr->map_cap,
+                                                   sizeof(uint64_t), total_size ) &&
+         msh_hash_grid__snapshot_section_is_valid( hdr->vals_offset, hdr->map_cap,
+                                                   sizeof(uint64_t), total_size ) &&
+         msh_hash_grid__snapshot_section_is_valid( hdr->data_offset, hdr->n_pts,
+                                                   msh_hash_grid__pt_size( hdr->pts_dim ),
+                                                   total_size );
+}
+
+// NOTE(maciej): Searches trust the grid completely, so everything they index with is checked -
+// bins have to stay within the point data, the bin directory can only point at existing bins and
+// cells, and point indices have to be valid. Runs once per load, linear in the snapshot size.
+int32_t
+msh_hash_grid__snapshot_data_is_valid( const msh_hash_grid__snapshot_header_t* hdr, const char* base )
+{
+  // 'x - x != 0' rejects both infinities and NaN
+  if( !(hdr->cell_size > 0.0) || hdr->cell_size - hdr->cell_size != 0.0 ) { return 0; }
+  if( !hdr->width || !hdr->height || !hdr->depth ) { return 0; }
+  if( hdr->pts_dim == 2 && hdr->depth != 1 ) { return 0; }
+  if( hdr->n_pts > INT32_MAX || hdr->height > INT32_MAX / hdr->width ) { return 0; }
+  uint64_t slab_size = hdr->width * hdr->height;
+  if( hdr->depth > UINT64_MAX / slab_size ) { return 0; }
+  uint64_t n_cells = slab_size * hdr->depth;
+
+  const msh_hg__bin_info_t* offsets = (const msh_hg__bin_info_t*)(base + hdr->offsets_offset);
+  uint32_t max_n_pts_in_bin = 0;
+  for( uint64_t i = 0; i < hdr->n_bins; ++i )
+  {
+    if( offsets[i].offset > hdr->n_pts || offsets[i].length > hdr->n_pts - offsets[i].offset )
+    {
+      return 0;
+    }
+    max_n_pts_in_bin = MSH_HG_MAX( max_n_pts_in_bin, offsets[i].length );
+  }
+  if( max_n_pts_in_bin != hdr->max_n_pts_in_bin ) { return 0; }
+
+  const uint64_t* keys = (const uint64_t*)(base + hdr->keys_offset);
+  const uint64_t* vals = (const uint64_t*)(base + hdr->vals_offset);
+  uint64_t n_occupied = 0;
+  for( uint64_t i = 0; i < hdr->map_cap; ++i )
+  {
+    if( !keys[i] ) { continue; }
+    if( keys[i] - 1 >= n_cells || vals[i] >= hdr->n_bins ) { return 0; }
+    n_occupied++;
+  }
+  if( n_occupied != hdr->n_bins ) { return 0; }
+
+  const char* data = base + hdr->data_offset;
+  size_t pt_size = msh_hash_grid__pt_size( hdr->pts_dim );
+  size_t idx_offset = (hdr->pts_dim == 2) ? offsetof(msh_hg_v2i_t, i) : offsetof(msh_hg_v3i_t, i);
+  for( uint64_t i = 0; i < hdr->n_pts; ++i )
+  {
+    int32_t pt_idx;
+    memcpy( &pt_idx, data + i * pt_size + idx_offset, sizeof(int32_t) );
+    if( pt_idx < 0 || (uint64_t)pt_idx >= hdr->n_pts ) { return 0; }
+  }
+  return 1;
+}
+
+int32_t
+msh_hash_grid_init_from_snapshot( msh_hash_grid_t* hg,
+                                  const void* snapshot, const size_t snapshot_size )
+{
+  const msh_hash_grid__snapshot_header_t* hdr = (const msh_hash_grid__snapshot_header_t*)snapshot;
+  if( !snapshot || snapshot_size < sizeof(msh_hash_grid__snapshot_header_t) ||
+      !msh_hash_grid__snapshot_header_is_valid( hdr, snapshot_size ) ||
+      !msh_hash_grid__snapshot_data_is_valid( hdr, (const char*)snapshot ) )
+  {
+    return MSH_HASH_GRID_INVALID_SNAPSHOT_ERR;
+  }
+  assert( ((uintptr_t)snapshot & (MSH_HASH_GRID__SNAPSHOT_ALIGN - 1)) == 0 );
+
+  const char* base = (const char*)snapshot;
+  hg->bin_table = (msh_hg_map_t*)MSH_HG_CALLOC( 1, sizeof(msh_hg_map_t) );
+  if( !hg->bin_table ) { return MSH_HASH_GRID_OUT_OF_MEMORY_ERR; }
+
+  // NOTE(maciej): Searches never write to the grid, so it is fine to point into read-only memory
+  hg->bin_table->keys = (uint64_t*)(base + hdr->keys_offset);
+  hg->bin_table->vals = (uint64_t*)(base + hdr->vals_offset);
+  hg->bin_table->_len = hdr->n_bins;
+  hg->bin_table->_cap = hdr->map_cap;
+  hg->offsets         = (msh_hg__bin_info_t*)(base + hdr->offsets_offset);
+  hg->data_buffer     = (msh_hg_v3i_t*)(base + hdr->data_offset);
+
+  hg->width             = hdr->width;
+  hg->height            = hdr->height;
+  hg->depth             = hdr->depth;
+  hg->cell_size         = hdr->cell_size;
+  hg->min_pt            = (msh_hg_v3_t){ hdr->min_pt[0], hdr->min_pt[1], hdr->min_pt[2] };
+  hg->max_pt            = (msh_hg_v3_t){ hdr->max_pt[0], hdr->max_pt[1], hdr->max_pt[2] };
+  hg->origin[0]         = hdr->origin[0];
+  hg->origin[1]         = hdr->origin[1];
+  hg->origin[2]         = hdr->origin[2];
+  hg->_inv_cell_size    = 1.0f / hg->cell_size;
+  hg->_slab_size        = hg->height * hg->width;
+  hg->_pts_dim          = hdr->pts_dim;
+  hg->max_n_pts_in_bin  = hdr->max_n_pts_in_bin;
+  hg->_n_pts            = hdr->n_pts;
+  hg->_external_storage = 1;
+  msh_hash_grid__init_threads( hg );
+
+  return MSH_HASH_GRID_NO_ERR;
+}
+
+int32_t
+msh_hash_grid_load( msh_hash_grid_t* hg, const char* filename )
+{
+  FILE* fp = fopen( filename, "rb" );
+  if( !fp ) { return MSH_HASH_GRID_FILE_OPEN_ERR; }
+
+  msh_hash_grid__snapshot_header_t hdr;
+  if( fread( &hdr, sizeof(hdr), 1, fp ) != 1 ) { fclose( fp ); return MSH_HASH_GRID_INVALID_SNAPSHOT_ERR; }
+  if( !msh_hash_grid__snapshot_header_is_valid( &hdr, hdr.total_size ) ||
+      hdr.total_size > SIZE_MAX - MSH_HASH_GRID__SNAPSHOT_ALIGN )
+  {
+    fclose( fp );
+    return MSH_HASH_GRID_INVALID_SNAPSHOT_ERR;
+  }
+
+  // Over-allocate, so that sections can be aligned regardless of the allocator
+  char* block = (char*)MSH_HG_MALLOC( hdr.total_size + MSH_HASH_GRID__SNAPSHOT_ALIGN );
+  if( !block ) { fclose( fp ); return MSH_HASH_GRID_OUT_OF_MEMORY_ERR; }
+  char* snapshot = (char*)msh_hash_grid__align_snapshot_offset( (uint64_t)(uintptr_t)block );
+
+  memcpy( snapshot, &hdr, sizeof(hdr) );
+  size_t n_left = hdr.total_size - sizeof(hdr);
+  int32_t err = MSH_HASH_GRID_NO_ERR;
+  if( fread( snapshot + sizeof(hdr), 1, n_left, fp ) != n_left )
+  {
+    err = ferror( fp ) ? MSH_HASH_GRID_FILE_IO_ERR : MSH_HASH_GRID_INVALID_SNAPSHOT_ERR;
+  }
+  fclose( fp );
+
+  if( !err ) { err = msh_hash_grid_init_from_snapshot( hg, snapshot, hdr.total_size ); }
+  if( err ) { MSH_HG_FREE( block ); return err; }
+
+  hg->_snapshot         = block;
+  hg->_external_storage = 0;
+  return MSH_HASH_GRID_NO_ERR;
 }
 
 
@@ -704,30 +1465,131 @@ msh_hash_grid__sort( float* dists, int32_t* indices, int n )
   msh_hash_grid__ins_sort( dists, indices, n );
 }
 
-// Heap implementation with a twist that we swap array of indices based on the distance heap
+#define MSH_HASH_GRID__NETWORK_SORT_MAX 32
+
+// Bitonic sorting network for small inputs, padded to a power of two. Squared distances are
+// non-negative, so their bit patterns order the same as unsigned integers, and each pair is packed
+// into a single 64 bit key. Compare-exchanges are then branchless min/max of keys, so there are
+// no mispredictions that insertion sort suffers from on random input.
 void
-msh_hash_grid__heapify( float *dists, int32_t* ind, size_t len, size_t cur )
+msh_hash_grid__network_sort( float* dists, int32_t* indices, int n )
 {
-  size_t max = cur;
-  const size_t left  = (cur<<1) + 1;
-  const size_t right = (cur<<1) + 2;
-
-  if( (left < len) && (dists[left] > dists[cur]) )   { max = left; }
-  if( (right < len) && (dists[right] > dists[max]) ) { max = right; }
-
-  if( max != cur ) // need to swap
+  assert( n <= MSH_HASH_GRID__NETWORK_SORT_MAX );
+  uint64_t keys[MSH_HASH_GRID__NETWORK_SORT_MAX];
+  int size = 2;
+  while( size < n ) { size <<= 1; }
+  for( int i = 0; i < n; ++i )
   {
-    float tmp_dist = dists[cur];
-    dists[cur] = dists[max];
-    dists[max] = tmp_dist;
-
-    int32_t tmp_idx = ind[cur];
-    ind[cur] = ind[max];
-    ind[max] = tmp_idx;
-    
-    msh_hash_grid__heapify( dists, ind, len, max );
+    uint32_t bits;
+    memcpy( &bits, dists + i, sizeof(uint32_t) );
+    keys[i] = ((uint64_t)bits << 32) | (uint32_t)indices[i];
   }
-}
+  for( int i = n; i < size; ++i ) { keys[i] = UINT64_MAX; }
+
+  for( int k = 2; k <= size; k <<= 1 )
+  {
+    for( int j = k >> 1; j > 0; j >>= 1 )
+    {
+      // Pairs (a, a + j) within each block of 2j are independent
+      for( int block = 0; block < size; block += 2 * j )
+      {
+        int descending = (block & k) != 0;
+        for( int t = 0; t < j; ++t )
+        {
+          uint64_t ka = keys[block + t];
+          uint64_t kb = keys[block + t + j];
+          uint64_t lo = ka < kb ? ka : kb;
+          uint64_t hi = ka < kb ? kb : ka;
+          keys[block + t]     = descending ? hi : lo;
+          keys[block + t + j] = descending ? lo : hi;
+        }
+      }
+    }
+  }
+
+  for( int i = 0; i < n; ++i )
+  {
+    uint32_t bits = (uint32_t)(keys[i] >> 32);
+    memcpy( dists + i, &bits, sizeof(uint32_t) );
+    indices[i] = (int32_t)(uint32_t)keys[i];
+  }
+}
+
+MSH_HG_INLINE void
+msh_hash_grid__swap_pair( float* dists, int32_t* indices, int a, int b )
+{
+  float dt = dists[a]; dists[a] = dists[b]; dists[b] = dt;
+  int32_t it = indices[a]; indices[a] = indices[b]; indices[b] = it;
+}
+
+// Reorders input so that first 'm' elements are the 'm' smallest ones, in no particular order
+void
+msh_hash_grid__select( float* dists, int32_t* indices, int n, int m )
+{
+  int lo = 0;
+  int hi = n - 1;
+  int target = m - 1;
+  while( hi > lo )
+  {
+    int mid = lo + ((hi - lo) >> 1);
+    if( dists[mid] < dists[lo] ) { msh_hash_grid__swap_pair( dists, indices, lo, mid ); }
+    if( dists[hi] < dists[lo] )  { msh_hash_grid__swap_pair( dists, indices, lo, hi ); }
+    if( dists[hi] < dists[mid] ) { msh_hash_grid__swap_pair( dists, indices, mid, hi ); }
+    float pivot = dists[mid];
+
+    int i = lo;
+    int j = hi;
+    while( i <= j )
+    {
+      while( dists[i] < pivot ) { ++i; }
+      while( dists[j] > pivot ) { --j; }
+      if( i <= j ) { msh_hash_grid__swap_pair( dists, indices, i, j ); ++i; --j; }
+    }
+
+    if( target <= j )      { hi = j; }
+    else if( target >= i ) { lo = i; }
+    else                   { break; }
+  }
+}
+
+void
+msh_hash_grid__sort_results( float* dists, int32_t* indices, size_t n,
+                             int sort_mode, size_t top_m )
+{
+  if( sort_mode == MSH_HASH_GRID_SORT_NONE || n < 2 ) { return; }
+  if( sort_mode == MSH_HASH_GRID_SORT_PARTIAL && top_m && top_m < n )
+  {
+    msh_hash_grid__select( dists, indices, (int)n, (int)top_m );
+    n = top_m;
+  }
+  if( n <= MSH_HASH_GRID__NETWORK_SORT_MAX ) { msh_hash_grid__network_sort( dists, indices, (int)n ); }
+  else                                        { msh_hash_grid__sort( dists, indices, (int)n ); }
+}
+
+// Heap implementation with a twist that we swap array of indices based on the distance heap
+void
+msh_hash_grid__heapify( float *dists, int32_t* ind, size_t len, size_t cur )
+{
+  size_t max = cur;
+  const size_t left  = (cur<<1) + 1;
+  const size_t right = (cur<<1) + 2;
+
+  if( (left < len) && (dists[left] > dists[cur]) )   { max = left; }
+  if( (right < len) && (dists[right] > dists[max]) ) { max = right; }
+
+  if( max != cur ) // need to swap
+  {
+    float tmp_dist = dists[cur];
+    dists[cur] = dists[max];
+    dists[max] = tmp_dist;
+
+    int32_t tmp_idx = ind[cur];
+    ind[cur] = ind[max];
+    ind[max] = tmp_idx;
+    
+    msh_hash_grid__heapify( dists, ind, len, max );
+  }
+}
 
 void msh_hash_grid__heap_make( real32_t* dists, int32_t* ind, size_t len )
 {
@@ -825,7 +1687,8 @@ msh_hash_grid_dist_storage_push( msh_hash_grid_dist_storage_t* q,
   else if ( q->max_dist <= dist ) { q->max_dist = dist; }
 }
 
-void
+// Returns number of points tested
+uint32_t
 msh_hash_grid__find_neighbors_in_bin( const msh_hash_grid_t* hg, const uint64_t bin_idx,
                                       const float radius_sq, const float* pt,
                                       msh_hash_grid_dist_storage_t* s )
@@ -833,16 +1696,32 @@ msh_hash_grid__find_neighbors_in_bin( const msh_hash_grid_t* hg, const uint64_t
   
   // issue this whole things stops working if we use doubles.
   uint64_t* bin_table_idx = msh_hg_map_get( hg->bin_table, bin_idx );
-  if( !bin_table_idx ) { return; }
+  if( !bin_table_idx ) { return 0; }
 
   msh_hg__bin_info_t bi = hg->offsets[ *bin_table_idx ];
   uint32_t n_pts = bi.length;
-  const msh_hg_v3i_t* data = &hg->data_buffer[bi.offset];
 
   float px = pt[0];
   float py = pt[1];
-  float pz = (hg->_pts_dim == 2 ) ? 0.0 : pt[2];
 
+  if( hg->_pts_dim == 2 )
+  {
+    const msh_hg_v2i_t* data = &hg->data_buffer_2d[bi.offset];
+    for( uint32_t i = 0; i < n_pts; ++i )
+    {
+      float vx = data[i].x - px;
+      float vy = data[i].y - py;
+      float dist_sq = vx * vx + vy * vy;
+      if( dist_sq < radius_sq )
+      {
+        msh_hash_grid_dist_storage_push( s, dist_sq, data[i].i );
+      }
+    }
+    return n_pts;
+  }
+
+  const msh_hg_v3i_t* data = &hg->data_buffer[bi.offset];
+  float pz = pt[2];
   for( uint32_t i = 0; i < n_pts; ++i )
   {
     // TODO(maciej): Maybe SSE?
@@ -861,437 +1740,839 @@ msh_hash_grid__find_neighbors_in_bin( const msh_hash_grid_t* hg, const uint64_t
       msh_hash_grid_dist_storage_push( s, dist_sq, dii );
     }
   }
+  return n_pts;
 }
 
-uint32_t
-msh_hash_grid__radius_search( const msh_hash_grid_t* hg, 
-                              msh_hash_grid_search_desc_t* hg_sd, 
-                              uint32_t start_idx, uint32_t end_idx  )
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Scheduling
+//
+// All queries are split into chunks of 'grain' consecutive items, which are handed out
+// dynamically to the workers - msh_jobs workers if 'work_ctx' was provided, OpenMP threads if
+// compiled with OpenMP support, or just the calling thread. Batches that fit in a single chunk
+// always run on the calling thread.
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef MSH_HG_MIN_GRAIN
+#define MSH_HG_MIN_GRAIN 64
+#endif
+
+#ifndef MSH_HG_CHUNKS_PER_WORKER
+#define MSH_HG_CHUNKS_PER_WORKER 8
+#endif
+
+typedef size_t (*msh_hash_grid__chunk_fn_t)( void* task, uint32_t chunk_idx,
+                                             uint32_t begin, uint32_t end );
+
+typedef struct msh_hash_grid__schedule
+{
+  uint32_t n_items;
+  uint32_t grain;
+  uint32_t n_chunks;
+  uint32_t n_workers;
+  void* work_ctx;
+} msh_hash_grid__schedule_t;
+
+msh_hash_grid__schedule_t
+msh_hash_grid__make_schedule( const msh_hash_grid_t* hg, void* work_ctx,
+                              const uint32_t n_items, const uint32_t min_grain )
 {
-  if( !hg || !hg_sd ) { return 0; }
-  enum { MAX_BIN_COUNT = 256 };
-  int32_t bin_indices[ MAX_BIN_COUNT ];
-  float bin_dists_sq[ MAX_BIN_COUNT ];
+  msh_hash_grid__schedule_t sched = {0};
+  sched.n_items   = n_items;
+  sched.work_ctx  = work_ctx;
+  sched.n_workers = 1;
+#ifdef MSH_JOBS
+  if( work_ctx ) { sched.n_workers = ((msh_jobs_ctx_t*)work_ctx)->thread_count + 1; }
+#endif
+#if defined(_OPENMP)
+  if( !work_ctx && !hg->_dont_use_omp ) { sched.n_workers = MSH_HG_MAX( hg->_num_threads, 1 ); }
+#else
+  (void)hg;
+#endif
+
+  sched.grain     = MSH_HG_MAX( n_items / (sched.n_workers * MSH_HG_CHUNKS_PER_WORKER), min_grain );
+  sched.grain     = MSH_HG_MAX( sched.grain, 1 );
+  sched.n_chunks  = (n_items + sched.grain - 1) / sched.grain;
+  sched.n_workers = MSH_HG_MIN( sched.n_workers, sched.n_chunks );
+  return sched;
+}
 
-  float radius          = hg_sd->radius;
-  double radius_sq      = (double)radius * (double)radius;
-  size_t row_size       = hg_sd->max_n_neigh;
+MSH_HG_INLINE size_t
+msh_hash_grid__run_chunk( const msh_hash_grid__schedule_t* sched, msh_hash_grid__chunk_fn_t fn,
+                          void* task, const uint32_t chunk_idx )
+{
+  uint32_t begin = chunk_idx * sched->grain;
+  uint32_t end   = MSH_HG_MIN( begin + sched->grain, sched->n_items );
+  return fn( task, chunk_idx, begin, end );
+}
 
-  msh_hash_grid_dist_storage_t storage;
+#ifdef MSH_JOBS
+typedef struct msh_hash_grid__jobs_task
+{
+  const msh_hash_grid__schedule_t* sched;
+  msh_hash_grid__chunk_fn_t fn;
+  void* task;
+  size_t* chunk_results;
+} msh_hash_grid__jobs_task_t;
 
-  uint32_t total_num_neighbors = 0;
-  for( uint32_t pt_idx = start_idx; pt_idx < end_idx; ++pt_idx )
+void
+msh_hash_grid__run_chunk_range( int32_t thread_idx, uint64_t begin, uint64_t end, void* user )
+{
+  (void)thread_idx;
+  msh_hash_grid__jobs_task_t* jt = (msh_hash_grid__jobs_task_t*)user;
+  for( uint64_t chunk_idx = begin; chunk_idx < end; ++chunk_idx )
   {
-    float* query_pt       = hg_sd->query_pts + (hg->_pts_dim * pt_idx);
-    size_t* n_neighbors   = hg_sd->n_neighbors ? (hg_sd->n_neighbors + pt_idx) : NULL;
-    float* dists_sq       = hg_sd->distances_sq + (pt_idx * row_size);
-    int32_t* indices      = hg_sd->indices + (pt_idx * row_size);
+    jt->chunk_results[chunk_idx] = msh_hash_grid__run_chunk( jt->sched, jt->fn, jt->task,
+                                                             (uint32_t)chunk_idx );
+  }
+}
+#endif
 
-    // Prep the storage for the next point
-    msh_hash_grid_dist_storage_init( &storage, row_size, dists_sq, indices );
+// Runs 'fn' over all chunks of 'sched' and returns the sum of values returned by 'fn'
+size_t
+msh_hash_grid__run( const msh_hash_grid__schedule_t* sched, msh_hash_grid__chunk_fn_t fn,
+                    void* task )
+{
+  if( !sched->n_chunks ) { return 0; }
+  size_t* chunk_results = (size_t*)MSH_HG_CALLOC( sched->n_chunks, sizeof(size_t) );
 
-    // Normalize query pt with respect to grid
-    msh_hg_v3_t q;
-    if( hg->_pts_dim == 2 )
+  if( sched->n_workers <= 1 )
+  {
+    for( uint32_t chunk_idx = 0; chunk_idx < sched->n_chunks; ++chunk_idx )
     {
-      q = (msh_hg_v3_t) { query_pt[0] - hg->min_pt.x,
-                          query_pt[1] - hg->min_pt.y,
-                          0.0 };
+      chunk_results[chunk_idx] = msh_hash_grid__run_chunk( sched, fn, task, chunk_idx );
     }
-    else
+  }
+#ifdef MSH_JOBS
+  else if( sched->work_ctx )
+  {
+    msh_jobs_ctx_t* work_ctx = (msh_jobs_ctx_t*)sched->work_ctx;
+    msh_hash_grid__jobs_task_t jobs_task = { sched, fn, task, chunk_results };
+    msh_jobs_parallel_for( work_ctx, 0, sched->n_chunks, 1, msh_hash_grid__run_chunk_range,
+                           &jobs_task );
+  }
+#endif
+  else
+  {
+    int64_t n_chunks = sched->n_chunks;
+#if defined(_OPENMP)
+    #pragma omp parallel for schedule(dynamic, 1) num_threads(sched->n_workers)
+#endif
+    for( int64_t chunk_idx = 0; chunk_idx < n_chunks; ++chunk_idx )
     {
-      q = (msh_hg_v3_t) { query_pt[0] - hg->min_pt.x,
-                          query_pt[1] - hg->min_pt.y,
-                          query_pt[2] - hg->min_pt.z };
+      chunk_results[chunk_idx] = msh_hash_grid__run_chunk( sched, fn, task, chunk_idx );
     }
+  }
 
-    // Get base bin idx for query pt
-    int64_t ix = (int64_t)( q.x * hg->_inv_cell_size );
-    int64_t iy = (int64_t)( q.y * hg->_inv_cell_size );
-    int64_t iz = (int64_t)( q.z * hg->_inv_cell_size );
-
-    // Decide where to look
-    int64_t px  = (int64_t)( (q.x + radius) * hg->_inv_cell_size );
-    int64_t nx  = (int64_t)( (q.x - radius) * hg->_inv_cell_size );
-    int64_t opx = px - ix;
-    int64_t onx = nx - ix;
+  size_t total = 0;
+  for( uint32_t chunk_idx = 0; chunk_idx < sched->n_chunks; ++chunk_idx )
+  {
+    total += chunk_results[chunk_idx];
+  }
+  MSH_HG_FREE( chunk_results );
+  return total;
+}
 
-    int64_t py  = (int64_t)( (q.y + radius) * hg->_inv_cell_size );
-    int64_t ny  = (int64_t)( (q.y - radius) * hg->_inv_cell_size );
-    int64_t opy = py - iy;
-    int64_t ony = ny - iy;
+MSH_HG_INLINE void*
+msh_hash_grid__work_ctx( const msh_hash_grid_search_desc_t* hg_sd )
+{
+#ifdef MSH_JOBS
+  return hg_sd->work_ctx;
+#else
+  (void)hg_sd;
+  return NULL;
+#endif
+}
 
-    int64_t pz  = (int64_t)( (q.z + radius) * hg->_inv_cell_size );
-    int64_t nz  = (int64_t)( (q.z - radius) * hg->_inv_cell_size );
-    int64_t opz = pz - iz;
-    int64_t onz = nz - iz;
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Radius search
+////////////////////////////////////////////////////////////////////////////////////////////////////
 
+// 2d version of 'msh_hash_grid__gather_bins' - visits a single slab, so with radius equal to the
+// one used at initialization it only looks at the 3x3 cells around the query.
+uint32_t
+msh_hash_grid__gather_bins_2d( const msh_hash_grid_t* hg, const float* query_pt, const double radius,
+                               msh_hg_array(int32_t)* bin_indices,
+                               msh_hg_array(float)* bin_dists_sq )
+{
+  double cs          = hg->cell_size;
+  double ics         = hg->_inv_cell_size;
+  int64_t w          = hg->width;
+  int64_t h          = hg->height;
+
+  float qx = query_pt[0] - hg->min_pt.x;
+  float qy = query_pt[1] - hg->min_pt.y;
+
+  int64_t ix = (int64_t)( qx * ics );
+  int64_t iy = (int64_t)( qy * ics );
+  int64_t x0 = MSH_HG_MAX( (int64_t)( (qx - radius) * ics ), 0 );
+  int64_t x1 = MSH_HG_MIN( (int64_t)( (qx + radius) * ics ), w - 1 );
+  int64_t y0 = MSH_HG_MAX( (int64_t)( (qy - radius) * ics ), 0 );
+  int64_t y1 = MSH_HG_MIN( (int64_t)( (qy + radius) * ics ), h - 1 );
+
+  if( *bin_indices )  { msh_hg_array__hdr( *bin_indices )->len = 0; }
+  if( *bin_dists_sq ) { msh_hg_array__hdr( *bin_dists_sq )->len = 0; }
+
+  float dx, dy;
+  for( int64_t cy = y0; cy <= y1; ++cy )
+  {
+    if( cy < iy )      { dy = qy - (cy + 1) * cs; }
+    else if( cy > iy ) { dy = cy * cs - qy; }
+    else               { dy = 0.0f; }
 
-    uint32_t n_visited_bins = 0;
-    float dx, dy, dz;
-    int64_t cx, cy, cz;
-    for( int64_t oz = onz; oz <= opz; ++oz )
+    for( int64_t cx = x0; cx <= x1; ++cx )
     {
-      cz = (int64_t)iz + oz;
-      if( cz < 0 || cz >= (int64_t)hg->depth ) { continue; }
-      uint64_t idx_z = cz * hg->_slab_size;
+      if( cx < ix )      { dx = qx - (cx + 1) * cs; }
+      else if( cx > ix ) { dx = cx * cs - qx; }
+      else               { dx = 0.0f; }
 
-      if( oz < 0 )      { dz = q.z - (cz + 1) * hg->cell_size; }
-      else if( oz > 0 ) { dz = cz * hg->cell_size - q.z; }
-      else              { dz = 0.0f; }
+      msh_hg_array_push( *bin_indices, (int32_t)(cy * w + cx) );
+      msh_hg_array_push( *bin_dists_sq, dy * dy + dx * dx );
+    }
+  }
 
-      for( int64_t oy = ony; oy <= opy; ++oy )
-      {
-        cy = iy + oy;
-        if( cy < 0 || cy >= (int64_t)hg->height ) { continue; }
-        uint64_t idx_y = cy * hg->width;
+  uint32_t n_visited_bins = msh_hg_array_len( *bin_indices );
+  msh_hash_grid__sort_results( *bin_dists_sq, *bin_indices, n_visited_bins,
+                               MSH_HASH_GRID_SORT_FULL, 0 );
+  return n_visited_bins;
+}
+
+// Collects bins that overlap the sphere of 'radius' around 'query_pt', sorted by their distance
+// to the query. Returns the number of bins written to 'bin_indices' and 'bin_dists_sq'.
+uint32_t
+msh_hash_grid__gather_bins( const msh_hash_grid_t* hg, const float* query_pt, const double radius,
+                            msh_hg_array(int32_t)* bin_indices,
+                            msh_hg_array(float)* bin_dists_sq )
+{
+  if( hg->_pts_dim == 2 )
+  {
+    return msh_hash_grid__gather_bins_2d( hg, query_pt, radius, bin_indices, bin_dists_sq );
+  }
 
-        if( oy < 0 )      { dy = q.y - (cy + 1) * hg->cell_size; }
-        else if( oy > 0 ) { dy = cy * hg->cell_size - q.y; }
-        else              { dy = 0.0f; }
+  uint64_t slab_size = hg->_slab_size;
+  double cs          = hg->cell_size;
+  double ics         = hg->_inv_cell_size;
+  int64_t w          = hg->width;
+  int64_t h          = hg->height;
+  int64_t d          = hg->depth;
+
+  // Normalize query pt with respect to grid
+  msh_hg_v3_t q = (msh_hg_v3_t) { query_pt[0] - hg->min_pt.x,
+                                  query_pt[1] - hg->min_pt.y,
+                                  query_pt[2] - hg->min_pt.z };
+
+  // Get base bin idx for query pt
+  int64_t ix = (int64_t)( q.x * ics );
+  int64_t iy = (int64_t)( q.y * ics );
+  int64_t iz = (int64_t)( q.z * ics );
+
+  // Decide where to look
+  int64_t px  = (int64_t)( (q.x + radius) * ics );
+  int64_t nx  = (int64_t)( (q.x - radius) * ics );
+  int64_t opx = px - ix;
+  int64_t onx = nx - ix;
+
+  int64_t py  = (int64_t)( (q.y + radius) * ics );
+  int64_t ny  = (int64_t)( (q.y - radius) * ics );
+  int64_t opy = py - iy;
+  int64_t ony = ny - iy;
+
+  int64_t pz  = (int64_t)( (q.z + radius) * ics );
+  int64_t nz  = (int64_t)( (q.z - radius) * ics );
+  int64_t opz = pz - iz;
+  int64_t onz = nz - iz;
+
+  if( *bin_indices )  { msh_hg_array__hdr( *bin_indices )->len = 0; }
+  if( *bin_dists_sq ) { msh_hg_array__hdr( *bin_dists_sq )->len = 0; }
+
+  float dx, dy, dz;
+  int64_t cx, cy, cz;
+  for( int64_t oz = onz; oz <= opz; ++oz )
+  {
+    cz = (int64_t)iz + oz;
+    if( cz < 0 || cz >= d ) { continue; }
+    uint64_t idx_z = cz * slab_size;
 
-        for( int64_t ox = onx; ox <= opx; ++ox )
-        {
-          cx = ix + ox;
-          if( cx < 0 || cx >= (int64_t)hg->width ) { continue; }
+    if( oz < 0 )      { dz = q.z - (cz + 1) * cs; }
+    else if( oz > 0 ) { dz = cz * cs - q.z; }
+    else              { dz = 0.0f; }
 
-          // assert( n_visited_bins < MAX_BIN_COUNT );
-          if( n_visited_bins >= MAX_BIN_COUNT ) { goto msh_hash_grid_lbl__find_neighbors2; }
+    for( int64_t oy = ony; oy <= opy; ++oy )
+    {
+      cy = iy + oy;
+      if( cy < 0 || cy >= h ) { continue; }
+      uint64_t idx_y = cy * w;
+
+      if( oy < 0 )      { dy = q.y - (cy + 1) * cs; }
+      else if( oy > 0 ) { dy = cy * cs - q.y; }
+      else              { dy = 0.0f; }
 
-          bin_indices[n_visited_bins] = idx_z + idx_y + cx;
+      for( int64_t ox = onx; ox <= opx; ++ox )
+      {
+        cx = ix + ox;
+        if( cx < 0 || cx >= w ) { continue; }
 
-          if( ox < 0 )      { dx = q.x - (cx + 1) * hg->cell_size; }
-          else if( ox > 0 ) { dx = cx * hg->cell_size - q.x; }
-          else              { dx = 0.0f; }
+        if( ox < 0 )      { dx = q.x - (cx + 1) * cs; }
+        else if( ox > 0 ) { dx = cx * cs - q.x; }
+        else              { dx = 0.0f; }
 
-          bin_dists_sq[n_visited_bins] = dz * dz + dy * dy + dx * dx;
-          n_visited_bins++;
-        }
+        msh_hg_array_push( *bin_indices, (int32_t)(idx_z + idx_y + cx) );
+        msh_hg_array_push( *bin_dists_sq, dz * dz + dy * dy + dx * dx );
       }
     }
+  }
 
-msh_hash_grid_lbl__find_neighbors2:
-    msh_hash_grid__sort( bin_dists_sq, bin_indices, n_visited_bins );
+  uint32_t n_visited_bins = msh_hg_array_len( *bin_indices );
+  msh_hash_grid__sort_results( *bin_dists_sq, *bin_indices, n_visited_bins,
+                               MSH_HASH_GRID_SORT_FULL, 0 );
+  return n_visited_bins;
+}
 
-    for( uint32_t i = 0; i < n_visited_bins; ++i )
+// Appends all points from bin 'bin_idx' that are within radius to growable arrays. Returns number
+// of points tested.
+uint32_t
+msh_hash_grid__append_neighbors_in_bin( const msh_hash_grid_t* hg, const uint64_t bin_idx,
+                                        const float radius_sq, const float* pt,
+                                        msh_hg_array(float)* dists,
+                                        msh_hg_array(int32_t)* indices )
+{
+  uint64_t* bin_table_idx = msh_hg_map_get( hg->bin_table, bin_idx );
+  if( !bin_table_idx ) { return 0; }
+
+  msh_hg__bin_info_t bi = hg->offsets[ *bin_table_idx ];
+  if( !bi.length ) { return 0; }
+
+  size_t len = msh_hg_array_len( *dists );
+  msh_hg_array_fit( *dists, len + bi.length );
+  msh_hg_array_fit( *indices, len + bi.length );
+
+  float px = pt[0];
+  float py = pt[1];
+
+  if( hg->_pts_dim == 2 )
+  {
+    const msh_hg_v2i_t* data = &hg->data_buffer_2d[bi.offset];
+    for( uint32_t i = 0; i < bi.length; ++i )
     {
-      msh_hash_grid__find_neighbors_in_bin( hg, bin_indices[i], radius_sq, query_pt, &storage );
-      if( storage.len >= row_size &&
-          storage.max_dist <= bin_dists_sq[i] )
+      float vx = data[i].x - px;
+      float vy = data[i].y - py;
+      float dist_sq = vx * vx + vy * vy;
+
+      if( dist_sq < radius_sq )
       {
-        break;
+        (*dists)[len]   = dist_sq;
+        (*indices)[len] = data[i].i;
+        len++;
       }
     }
+  }
+  else
+  {
+    const msh_hg_v3i_t* data = &hg->data_buffer[bi.offset];
+    float pz = pt[2];
+    for( uint32_t i = 0; i < bi.length; ++i )
+    {
+      float vx = data[i].x - px;
+      float vy = data[i].y - py;
+      float vz = data[i].z - pz;
+      float dist_sq = vx * vx + vy * vy + vz * vz;
 
-    if( hg_sd->sort ) { msh_hash_grid__sort( dists_sq, indices, storage.len ); }
+      if( dist_sq < radius_sq )
+      {
+        (*dists)[len]   = dist_sq;
+        (*indices)[len] = data[i].i;
+        len++;
+      }
+    }
+  }
+  msh_hg_array__hdr( *dists )->len   = len;
+  msh_hg_array__hdr( *indices )->len = len;
+  return bi.length;
+}
 
-    if( n_neighbors ) { (*n_neighbors++) = storage.len; }
+// Approximate search. Cell at distance d is only visited if (1+eps)*d is within the search
+// radius (or, for kNN, current k-th distance), and visiting stops after 'max_n_examined' points.
+typedef struct msh_hash_grid__approx
+{
+  float prune_sq;
+  size_t max_n_examined;
+} msh_hash_grid__approx_t;
 
-    total_num_neighbors += storage.len;
-  }
-  return total_num_neighbors;;
+MSH_HG_INLINE msh_hash_grid__approx_t
+msh_hash_grid__make_approx( const msh_hash_grid_search_desc_t* hg_sd )
+{
+  assert( hg_sd->eps >= 0.0f );
+  msh_hash_grid__approx_t approx;
+  approx.prune_sq       = (1.0f + hg_sd->eps) * (1.0f + hg_sd->eps);
+  approx.max_n_examined = hg_sd->max_n_examined ? hg_sd->max_n_examined : SIZE_MAX;
+  return approx;
 }
 
-#ifdef MSH_JOBS
-typedef struct msh_hash_grid__work_opts
+typedef struct msh_hash_grid__csr_buffer
+{
+  msh_hg_array(float) dists;
+  msh_hg_array(int32_t) indices;
+} msh_hash_grid__csr_buffer_t;
+
+typedef struct msh_hash_grid__search_task
 {
   const msh_hash_grid_t* hg;
   msh_hash_grid_search_desc_t* hg_sd;
-  uint32_t start_idx;
-  uint32_t end_idx;
-  uint32_t volatile *total_num_neighbors;
-} msh_hash_grid__work_opts_t;
+  msh_hash_grid__csr_buffer_t* csr_buffers;
+} msh_hash_grid__search_task_t;
 
-MSH_JOBS_JOB_SIGNATURE(msh_hash_grid__run_radius_search)
+size_t
+msh_hash_grid__radius_search_chunk( void* params, uint32_t chunk_idx, uint32_t begin, uint32_t end )
 {
-  msh_hash_grid__work_opts_t opts = *((msh_hash_grid__work_opts_t*)params);
-  uint32_t cur_num_neighbors = msh_hash_grid__radius_search( opts.hg, opts.hg_sd, opts.start_idx, opts.end_idx );
-  msh_jobs_atomic_add( opts.total_num_neighbors, cur_num_neighbors );
-  return 0;
+  (void)chunk_idx;
+  msh_hash_grid__search_task_t* task = (msh_hash_grid__search_task_t*)params;
+  const msh_hash_grid_t* hg = task->hg;
+  msh_hash_grid_search_desc_t* hg_sd = task->hg_sd;
+
+  size_t row_size  = hg_sd->max_n_neigh;
+  double radius    = hg_sd->radius;
+  double radius_sq = radius * radius;
+  msh_hash_grid__approx_t approx = msh_hash_grid__make_approx( hg_sd );
+  double cell_radius = radius / (1.0 + hg_sd->eps);
+  float cell_radius_sq = (hg_sd->eps > 0.0f) ? (float)(cell_radius * cell_radius) : 1e30f;
+
+  msh_hg_array(int32_t) bin_indices = NULL;
+  msh_hg_array(float) bin_dists_sq  = NULL;
+  msh_hash_grid_dist_storage_t storage;
+
+  size_t total_num_neighbors = 0;
+  for( uint32_t pt_idx = begin; pt_idx < end; ++pt_idx )
+  {
+    msh_hg_v3_t q     = msh_hash_grid__to_local( hg, hg_sd->query_pts + (size_t)pt_idx * hg->_pts_dim );
+    float* query_pt   = &q.x;
+    float* dists_sq   = hg_sd->distances_sq + (size_t)pt_idx * row_size;
+    int32_t* indices  = hg_sd->indices + (size_t)pt_idx * row_size;
+
+    // Prep the storage for the next point
+    msh_hash_grid_dist_storage_init( &storage, row_size, dists_sq, indices );
+
+    uint32_t n_visited_bins = msh_hash_grid__gather_bins( hg, query_pt, cell_radius,
+                                                          &bin_indices, &bin_dists_sq );
+
+    size_t n_examined = 0;
+    for( uint32_t i = 0; i < n_visited_bins; ++i )
+    {
+      // Bins are sorted, so none of the remaining ones can be close enough
+      if( bin_dists_sq[i] >= cell_radius_sq ) { break; }
+      n_examined += msh_hash_grid__find_neighbors_in_bin( hg, bin_indices[i], radius_sq,
+                                                          query_pt, &storage );
+      if( storage.len >= row_size &&
+          storage.max_dist <= approx.prune_sq * bin_dists_sq[i] )
+      {
+        break;
+      }
+      if( n_examined >= approx.max_n_examined ) { break; }
+    }
+
+    msh_hash_grid__sort_results( dists_sq, indices, storage.len, hg_sd->sort, hg_sd->sort_top_m );
+
+    if( hg_sd->n_neighbors ) { hg_sd->n_neighbors[pt_idx] = storage.len; }
+    total_num_neighbors += storage.len;
+  }
+
+  msh_hg_array_free( bin_indices );
+  msh_hg_array_free( bin_dists_sq );
+  return total_num_neighbors;
 }
-#endif
 
-size_t 
-msh_hash_grid_radius_search2( const msh_hash_grid_t* hg,
-                             msh_hash_grid_search_desc_t* hg_sd )
+// Each chunk gathers neighbors of its queries into its own growable buffers, while recording
+// per query counts in 'offsets'.
+size_t
+msh_hash_grid__radius_search_csr_chunk( void* params, uint32_t chunk_idx,
+                                        uint32_t begin, uint32_t end )
 {
-  assert( hg_sd->query_pts );
-  assert( hg_sd->distances_sq );
-  assert( hg_sd->indices );
-  assert( hg_sd->radius > 0.0 );
-  assert( hg_sd->n_query_pts > 0 );
-  assert( hg_sd->max_n_neigh > 0 );
+  msh_hash_grid__search_task_t* task = (msh_hash_grid__search_task_t*)params;
+  const msh_hash_grid_t* hg = task->hg;
+  msh_hash_grid_search_desc_t* hg_sd = task->hg_sd;
+
+  size_t max_n_neigh = hg_sd->max_n_neigh;
+  double radius      = hg_sd->radius;
+  double radius_sq   = radius * radius;
+  msh_hash_grid__approx_t approx = msh_hash_grid__make_approx( hg_sd );
+  double cell_radius = radius / (1.0 + hg_sd->eps);
+  float cell_radius_sq = (hg_sd->eps > 0.0f) ? (float)(cell_radius * cell_radius) : 1e30f;
+
+  msh_hg_array(int32_t) bin_indices = NULL;
+  msh_hg_array(float) bin_dists_sq  = NULL;
+  msh_hash_grid_dist_storage_t storage;
+  msh_hg_array(float) dists     = NULL;
+  msh_hg_array(int32_t) indices = NULL;
 
-#ifdef MSH_JOBS
-  uint32_t single_thread_limit = 64;
-  if( !hg_sd->work_ctx || hg_sd->n_query_pts < single_thread_limit )
+  // With a limit on neighbor count we keep the closest ones in scratch storage first
+  float* scratch_dists     = NULL;
+  int32_t* scratch_indices = NULL;
+  if( max_n_neigh )
   {
-    return msh_hash_grid__radius_search( hg, hg_sd, 0, hg_sd->n_query_pts );
+    scratch_dists   = (float*)MSH_HG_MALLOC( max_n_neigh * sizeof(float) );
+    scratch_indices = (int32_t*)MSH_HG_MALLOC( max_n_neigh * sizeof(int32_t) );
   }
-  else
+
+  for( uint32_t pt_idx = begin; pt_idx < end; ++pt_idx )
   {
-#if 1
-    uint32_t volatile total_num_neighbors = 0;
-    enum{ MSH_HASH_GRID__N_TASKS = 128 };
-    msh_hash_grid__work_opts_t work_array[MSH_HASH_GRID__N_TASKS];
-    uint32_t n_pts_per_task = hg_sd->n_query_pts / MSH_HASH_GRID__N_TASKS + 1;
-    n_pts_per_task = n_pts_per_task < single_thread_limit ? single_thread_limit : n_pts_per_task;
-    for( uint32_t work_idx = 0; work_idx < MSH_HASH_GRID__N_TASKS; ++work_idx )
+    msh_hg_v3_t q   = msh_hash_grid__to_local( hg, hg_sd->query_pts + (size_t)pt_idx * hg->_pts_dim );
+    float* query_pt = &q.x;
+    size_t first = msh_hg_array_len( dists );
+    uint32_t n_visited_bins = msh_hash_grid__gather_bins( hg, query_pt, cell_radius,
+                                                          &bin_indices, &bin_dists_sq );
+    size_t n_examined = 0;
+    if( max_n_neigh )
     {
-      uint32_t start_idx = work_idx * n_pts_per_task;
-      uint32_t end_idx = msh_min( (work_idx + 1) * n_pts_per_task, hg_sd->n_query_pts );
-      if( start_idx > hg_sd->n_query_pts ) { break; }
-      msh_hash_grid__work_opts_t* work_entry = work_array + work_idx;
-      work_entry->hg = hg;
-      work_entry->hg_sd = hg_sd;
-      work_entry->total_num_neighbors = &total_num_neighbors;
-      work_entry->start_idx = start_idx;
-      work_entry->end_idx = end_idx;
-      msh_jobs_push_work( hg_sd->work_ctx, msh_hash_grid__run_radius_search, work_entry );
+      msh_hash_grid_dist_storage_init( &storage, max_n_neigh, scratch_dists, scratch_indices );
+      for( uint32_t i = 0; i < n_visited_bins; ++i )
+      {
+        if( bin_dists_sq[i] >= cell_radius_sq ) { break; }
+        n_examined += msh_hash_grid__find_neighbors_in_bin( hg, bin_indices[i], radius_sq,
+                                                            query_pt, &storage );
+        if( storage.len >= max_n_neigh &&
+            storage.max_dist <= approx.prune_sq * bin_dists_sq[i] )
+        {
+          break;
+        }
+        if( n_examined >= approx.max_n_examined ) { break; }
+      }
+      if( storage.len )
+      {
+        msh_hg_array_fit( dists, first + storage.len );
+        msh_hg_array_fit( indices, first + storage.len );
+        memcpy( dists + first, scratch_dists, storage.len * sizeof(float) );
+        memcpy( indices + first, scratch_indices, storage.len * sizeof(int32_t) );
+        msh_hg_array__hdr( dists )->len   = first + storage.len;
+        msh_hg_array__hdr( indices )->len = first + storage.len;
+      }
     }
-    msh_jobs_complete_all_work( hg_sd->work_ctx );
-
-    return total_num_neighbors;
-#else
-    // NOTE(maciej): This does not work completely, as it sometimes overflows the queue
-    uint32_t volatile total_num_neighbors = 0;
-    uint32_t start_idx = 0;
-    int64_t pts_left = hg_sd->n_query_pts;
-
-    // NOTE(maciej): We could always just generate 16 jobs or smth like that to avoid malloc. Will need to test.
-    uint32_t work_idx = 0;
-    uint32_t n_tasks = pts_left / single_thread_limit + 1;
-    msh_hash_grid__work_opts_t* work_array = malloc( n_tasks * sizeof(msh_hash_grid__work_opts_t) );
-    while( pts_left > 0 )
+    else
     {
-      uint32_t count = (pts_left >= single_thread_limit) ? single_thread_limit : pts_left;
-      msh_hash_grid__work_opts_t* work_entry = work_array + work_idx++;
-      work_entry->hg = hg;
-      work_entry->hg_sd = hg_sd;
-      work_entry->total_num_neighbors = &total_num_neighbors;
-      work_entry->start_idx = start_idx;
-      work_entry->end_idx = start_idx + count;
-      msh_jobs_push_work( hg_sd->work_ctx, msh_hash_grid__run_radius_search, work_entry );
-      
-      pts_left -= single_thread_limit;
-      start_idx += single_thread_limit;
+      for( uint32_t i = 0; i < n_visited_bins; ++i )
+      {
+        if( bin_dists_sq[i] >= cell_radius_sq ) { break; }
+        n_examined += msh_hash_grid__append_neighbors_in_bin( hg, bin_indices[i], radius_sq,
+                                                              query_pt, &dists, &indices );
+        if( n_examined >= approx.max_n_examined ) { break; }
+      }
     }
-    msh_jobs_complete_all_work( hg_sd->work_ctx );
-    free( work_array );
 
-    return total_num_neighbors;
-#endif
+    size_t n_found = msh_hg_array_len( dists ) - first;
+    msh_hash_grid__sort_results( dists + first, indices + first, n_found,
+                                 hg_sd->sort, hg_sd->sort_top_m );
+
+    hg_sd->offsets[pt_idx + 1] = n_found;
+    if( hg_sd->n_neighbors ) { hg_sd->n_neighbors[pt_idx] = n_found; }
   }
-#else
-  return msh_hash_grid__radius_search( hg, hg_sd, 0, hg_sd->n_query_pts );
-#endif
+
+  MSH_HG_FREE( scratch_dists );
+  MSH_HG_FREE( scratch_indices );
+  msh_hg_array_free( bin_indices );
+  msh_hg_array_free( bin_dists_sq );
+  task->csr_buffers[chunk_idx].dists   = dists;
+  task->csr_buffers[chunk_idx].indices = indices;
+  return msh_hg_array_len( dists );
 }
 
+// Per chunk counts are turned into offsets, and chunk buffers are concatenated into exactly
+// sized output arrays.
+size_t
+msh_hash_grid__radius_search_csr( const msh_hash_grid__schedule_t* sched,
+                                  msh_hash_grid__search_task_t* task )
+{
+  msh_hash_grid_search_desc_t* hg_sd = task->hg_sd;
+  assert( hg_sd->offsets );
+
+  uint32_t n_query_pts = hg_sd->n_query_pts;
+  size_t* offsets      = hg_sd->offsets;
+  task->csr_buffers    = (msh_hash_grid__csr_buffer_t*)MSH_HG_CALLOC( sched->n_chunks,
+                                                            sizeof(msh_hash_grid__csr_buffer_t) );
+
+  msh_hash_grid__run( sched, msh_hash_grid__radius_search_csr_chunk, task );
+
+  offsets[0] = 0;
+  for( uint32_t i = 0; i < n_query_pts; ++i ) { offsets[i + 1] += offsets[i]; }
+  size_t total_num_neighbors = offsets[n_query_pts];
+
+  hg_sd->distances_sq = (float*)MSH_HG_MALLOC( MSH_HG_MAX( total_num_neighbors, 1 ) * sizeof(float) );
+  hg_sd->indices      = (int32_t*)MSH_HG_MALLOC( MSH_HG_MAX( total_num_neighbors, 1 ) * sizeof(int32_t) );
+  for( uint32_t i = 0; i < sched->n_chunks; ++i )
+  {
+    msh_hash_grid__csr_buffer_t* buffer = task->csr_buffers + i;
+    size_t n = msh_hg_array_len( buffer->dists );
+    if( n )
+    {
+      size_t first = offsets[ i * sched->grain ];
+      memcpy( hg_sd->distances_sq + first, buffer->dists, n * sizeof(float) );
+      memcpy( hg_sd->indices + first, buffer->indices, n * sizeof(int32_t) );
+    }
+    msh_hg_array_free( buffer->dists );
+    msh_hg_array_free( buffer->indices );
+  }
+  MSH_HG_FREE( task->csr_buffers );
+  task->csr_buffers = NULL;
 
+  return total_num_neighbors;
+}
 
 size_t msh_hash_grid_radius_search( const msh_hash_grid_t* hg,
                                     msh_hash_grid_search_desc_t* hg_sd )
 {
   assert( hg_sd->query_pts );
-  assert( hg_sd->distances_sq );
-  assert( hg_sd->indices );
   assert( hg_sd->radius > 0.0 );
   assert( hg_sd->n_query_pts > 0 );
-  assert( hg_sd->max_n_neigh > 0 );
 
-  // Unpack the some useful data from structs
-  enum { MAX_BIN_COUNT = 512, MAX_THREAD_COUNT = 512 };
-  uint32_t n_query_pts = hg_sd->n_query_pts;
-  size_t row_size      = hg_sd->max_n_neigh;
-  double radius        = hg_sd->radius;
-  uint64_t slab_size   = hg->_slab_size;
-  double cs            = hg->cell_size;
-  double ics           = hg->_inv_cell_size;
-  int64_t w            = hg->width;
-  int64_t h            = hg->height;
-  int64_t d            = hg->depth;
-  double radius_sq     = radius * radius;
-
-  uint32_t n_pts_per_thread = n_query_pts;
-  uint32_t total_num_neighbors = 0;
-  uint32_t num_neighbors_per_thread[MAX_THREAD_COUNT] = {0};
-  uint32_t num_threads = hg->_num_threads;
-  assert( num_threads <= MAX_THREAD_COUNT );
+  msh_hash_grid__schedule_t sched = msh_hash_grid__make_schedule( hg, msh_hash_grid__work_ctx( hg_sd ),
+                                                                  hg_sd->n_query_pts,
+                                                                  MSH_HG_MIN_GRAIN );
+  msh_hash_grid__search_task_t task = { hg, hg_sd, NULL };
 
-#if defined(_OPENMP)
-  #pragma omp parallel if (!hg->_dont_use_omp)
-  {
-    if( n_query_pts < num_threads ) { num_threads = n_query_pts; }
-    n_pts_per_thread = ceilf((float)n_query_pts / num_threads);
-    uint32_t thread_idx = omp_get_thread_num();
-#else
-  for( uint32_t thread_idx = 0; thread_idx < num_threads; ++thread_idx )
+  if( hg_sd->output_mode == MSH_HASH_GRID_OUTPUT_CSR )
   {
-#endif
-    if( thread_idx < num_threads )
-    {
-      uint32_t low_lim      = thread_idx * n_pts_per_thread;
-      uint32_t high_lim     = MSH_HG_MIN((thread_idx + 1) * n_pts_per_thread, n_query_pts);
-      uint32_t cur_n_pts    = high_lim - low_lim;
+    return msh_hash_grid__radius_search_csr( &sched, &task );
+  }
 
-      float* query_pt       = hg_sd->query_pts + low_lim * hg->_pts_dim;
-      size_t* n_neighbors   = hg_sd->n_neighbors ? (hg_sd->n_neighbors + low_lim) : NULL;
-      float* dists_sq       = hg_sd->distances_sq + (low_lim * row_size);
-      int32_t* indices      = hg_sd->indices + (low_lim * row_size);
+  assert( hg_sd->distances_sq );
+  assert( hg_sd->indices );
+  assert( hg_sd->max_n_neigh > 0 );
 
-      int32_t bin_indices[ MAX_BIN_COUNT ];
-      float bin_dists_sq[ MAX_BIN_COUNT ];
-      msh_hash_grid_dist_storage_t storage;
+  return msh_hash_grid__run( &sched, msh_hash_grid__radius_search_chunk, &task );
+}
 
-      for( uint32_t pt_idx = 0; pt_idx < cur_n_pts; ++pt_idx )
-      {
-        // Prep the storage for the next point
-        msh_hash_grid_dist_storage_init( &storage, row_size, dists_sq, indices );
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// kNN search
+////////////////////////////////////////////////////////////////////////////////////////////////////
 
-        // Normalize query pt with respect to grid
-        msh_hg_v3_t q;
-        if( hg->_pts_dim == 2 )
-        {
-          q = (msh_hg_v3_t) { query_pt[0] - hg->min_pt.x,
-                              query_pt[1] - hg->min_pt.y,
-                              0.0 };
-        }
-        else
-        {
-          q = (msh_hg_v3_t) { query_pt[0] - hg->min_pt.x,
-                              query_pt[1] - hg->min_pt.y,
-                              query_pt[2] - hg->min_pt.z };
-        }
+MSH_HG_INLINE void
+msh_hash_grid__add_bin_contents( const msh_hash_grid_t* hg, const msh_hg__bin_info_t bi,
+                                 const float* pt, msh_hash_grid_dist_storage_t* s )
+{
+  int n_pts = bi.length;
 
-        // Get base bin idx for query pt
-        int64_t ix = (int64_t)( q.x * ics );
-        int64_t iy = (int64_t)( q.y * ics );
-        int64_t iz = (int64_t)( q.z * ics );
-
-        // Decide where to look
-        int64_t px  = (int64_t)( (q.x + radius) * ics );
-        int64_t nx  = (int64_t)( (q.x - radius) * ics );
-        int64_t opx = px - ix;
-        int64_t onx = nx - ix;
-
-        int64_t py  = (int64_t)( (q.y + radius) * ics );
-        int64_t ny  = (int64_t)( (q.y - radius) * ics );
-        int64_t opy = py - iy;
-        int64_t ony = ny - iy;
-
-        int64_t pz  = (int64_t)( (q.z + radius) * ics );
-        int64_t nz  = (int64_t)( (q.z - radius) * ics );
-        int64_t opz = pz - iz;
-        int64_t onz = nz - iz;
-        uint32_t n_visited_bins = 0;
-        float dx, dy, dz;
-        int64_t cx, cy, cz;
-        for( int64_t oz = onz; oz <= opz; ++oz )
-        {
-          cz = (int64_t)iz + oz;
-          if( cz < 0 || cz >= d ) { continue; }
-          uint64_t idx_z = cz * slab_size;
+  if( hg->_pts_dim == 2 )
+  {
+    const msh_hg_v2i_t* data = &hg->data_buffer_2d[bi.offset];
+    for( int32_t i = 0; i < n_pts; ++i )
+    {
+      float vx = data[i].x - pt[0];
+      float vy = data[i].y - pt[1];
+      msh_hash_grid_dist_storage_push( s, vx * vx + vy * vy, data[i].i );
+    }
+    return;
+  }
+
+  const msh_hg_v3i_t* data = &hg->data_buffer[bi.offset];
+  for( int32_t i = 0; i < n_pts; ++i )
+  {
+    msh_hg_v3_t v = (msh_hg_v3_t){ data[i].x - pt[0], data[i].y - pt[1], data[i].z - pt[2] };
+    float dist_sq = v.x * v.x + v.y * v.y + v.z * v.z;
+
+    msh_hash_grid_dist_storage_push( s, dist_sq, data[i].i );
+  }
+}
 
-          if( oz < 0 )      { dz = q.z - (cz + 1) * cs; }
-          else if( oz > 0 ) { dz = cz * cs - q.z; }
-          else              { dz = 0.0f; }
+// Min-heap of non-empty cells, keyed on the squared distance from query to the cell
+typedef struct msh_hash_grid__cell_entry
+{
+  float dist_sq;
+  msh_hg__bin_info_t bi;
+} msh_hash_grid__cell_entry_t;
 
-          for( int64_t oy = ony; oy <= opy; ++oy )
-          {
-            cy = iy + oy;
-            if( cy < 0 || cy >= h ) { continue; }
-            uint64_t idx_y = cy * w;
+MSH_HG_INLINE void
+msh_hash_grid__cell_heap_push( msh_hg_array(msh_hash_grid__cell_entry_t)* heap,
+                               const msh_hash_grid__cell_entry_t entry )
+{
+  msh_hg_array_push( *heap, entry );
+  msh_hash_grid__cell_entry_t* h = *heap;
+  size_t i = msh_hg_array_len( h ) - 1;
+  while( i > 0 )
+  {
+    size_t j = (i - 1) >> 1;
+    if( h[j].dist_sq <= entry.dist_sq ) { break; }
+    h[i] = h[j];
+    i = j;
+  }
+  h[i] = entry;
+}
+
+MSH_HG_INLINE msh_hash_grid__cell_entry_t
+msh_hash_grid__cell_heap_pop( msh_hg_array(msh_hash_grid__cell_entry_t) heap )
+{
+  msh_hash_grid__cell_entry_t top = heap[0];
+  size_t len = --msh_hg_array__hdr( heap )->len;
+  msh_hash_grid__cell_entry_t last = heap[len];
+  size_t i = 0;
+  for( ;; )
+  {
+    size_t child = (i << 1) + 1;
+    if( child >= len ) { break; }
+    if( child + 1 < len && heap[child + 1].dist_sq < heap[child].dist_sq ) { child++; }
+    if( last.dist_sq <= heap[child].dist_sq ) { break; }
+    heap[i] = heap[child];
+    i = child;
+  }
+  if( len ) { heap[i] = last; }
+  return top;
+}
 
-            if( oy < 0 )      { dy = q.y - (cy + 1) * cs; }
-            else if( oy > 0 ) { dy = cy * cs - q.y; }
-            else              { dy = 0.0f; }
+// Lower bound on the distance from query 'q' to any cell at Chebyshev distance >= 'layer' from
+// query cell 'c'. Only sides of the shell that still intersect the grid are considered.
+MSH_HG_INLINE float
+msh_hash_grid__shell_lower_bound( const msh_hash_grid_t* hg, const float* q, const int64_t* c,
+                                  const int64_t layer )
+{
+  const int64_t n_cells[3] = { (int64_t)hg->width, (int64_t)hg->height, (int64_t)hg->depth };
+  float cs = hg->cell_size;
+  float lb = 1e30f;
+  for( int32_t a = 0; a < 3; ++a )
+  {
+    if( c[a] - layer >= 0 )
+    {
+      lb = MSH_HG_MIN( lb, MSH_HG_MAX( q[a] - (c[a] - layer + 1) * cs, 0.0f ) );
+    }
+    if( c[a] + layer < n_cells[a] )
+    {
+      lb = MSH_HG_MIN( lb, MSH_HG_MAX( (c[a] + layer) * cs - q[a], 0.0f ) );
+    }
+  }
+  return lb;
+}
 
-            for( int64_t ox = onx; ox <= opx; ++ox )
-            {
-              cx = ix + ox;
-              if( cx < 0 || cx >= w ) { continue; }
+// Pushes all non-empty cells at Chebyshev distance 'layer' from query cell 'c' that could still
+// contain one of the k nearest neighbors.
+void
+msh_hash_grid__push_shell( const msh_hash_grid_t* hg, const float* q, const int64_t* c,
+                           const int64_t layer, const msh_hash_grid_dist_storage_t* s,
+                           msh_hg_array(msh_hash_grid__cell_entry_t)* heap )
+{
+  float cs = hg->cell_size;
+  int64_t x0 = MSH_HG_MAX( c[0] - layer, 0 ), x1 = MSH_HG_MIN( c[0] + layer, (int64_t)hg->width - 1 );
+  int64_t y0 = MSH_HG_MAX( c[1] - layer, 0 ), y1 = MSH_HG_MIN( c[1] + layer, (int64_t)hg->height - 1 );
+  int64_t z0 = MSH_HG_MAX( c[2] - layer, 0 ), z1 = MSH_HG_MIN( c[2] + layer, (int64_t)hg->depth - 1 );
 
-              // assert( n_visited_bins < MAX_BIN_COUNT );
-              if( n_visited_bins >= MAX_BIN_COUNT ) { goto msh_hash_grid_lbl__find_neighbors; }
+  float dx, dy, dz;
+  for( int64_t cz = z0; cz <= z1; ++cz )
+  {
+    if( cz < c[2] )      { dz = q[2] - (cz + 1) * cs; }
+    else if( cz > c[2] ) { dz = cz * cs - q[2]; }
+    else                 { dz = 0.0f; }
 
-              bin_indices[n_visited_bins] = idx_z + idx_y + cx;
+    for( int64_t cy = y0; cy <= y1; ++cy )
+    {
+      if( cy < c[1] )      { dy = q[1] - (cy + 1) * cs; }
+      else if( cy > c[1] ) { dy = cy * cs - q[1]; }
+      else                 { dy = 0.0f; }
 
-              if( ox < 0 )      { dx = q.x - (cx + 1) * cs; }
-              else if( ox > 0 ) { dx = cx * cs - q.x; }
-              else              { dx = 0.0f; }
+      // Inside the shell only the two x-extremes belong to this layer
+      int64_t inc_x = 1;
+      int32_t on_shell = ( msh_abs( cz - c[2] ) == layer || msh_abs( cy - c[1] ) == layer );
+      if( !on_shell ) { inc_x = 2 * layer; }
 
-              bin_dists_sq[n_visited_bins] = dz * dz + dy * dy + dx * dx;
-              n_visited_bins++;
-            }
-          }
-        }
-        
-msh_hash_grid_lbl__find_neighbors:
-        msh_hash_grid__sort( bin_dists_sq, bin_indices, n_visited_bins );
+      for( int64_t cx = on_shell ? x0 : c[0] - layer; cx <= x1; cx += inc_x )
+      {
+        if( cx < x0 ) { continue; }
 
-        for( uint32_t i = 0; i < n_visited_bins; ++i )
-        {
-          msh_hash_grid__find_neighbors_in_bin( hg, bin_indices[i], radius_sq, query_pt, &storage );
-          if( storage.len >= row_size &&
-              storage.max_dist <= bin_dists_sq[i] )
-          {
-            break;
-          }
-        }
-        
+        if( cx < c[0] )      { dx = q[0] - (cx + 1) * cs; }
+        else if( cx > c[0] ) { dx = cx * cs - q[0]; }
+        else                 { dx = 0.0f; }
 
-        if( hg_sd->sort ) { msh_hash_grid__sort( dists_sq, indices, storage.len ); }
+        float dist_sq = dz * dz + dy * dy + dx * dx;
+        if( s->len >= s->cap && dist_sq >= s->max_dist ) { continue; }
 
-        if( n_neighbors ) { (*n_neighbors++) = storage.len; }
-        num_neighbors_per_thread[thread_idx] += storage.len;
+        uint64_t bin_idx = msh_hash_grid__bin_pt( hg, cx, cy, cz );
+        uint64_t* bin_table_idx = msh_hg_map_get( hg->bin_table, bin_idx );
+        if( !bin_table_idx ) { continue; }
 
-        // Advance pointers
-        dists_sq += row_size;
-        indices  += row_size;
-        query_pt += hg->_pts_dim;
+        msh_hash_grid__cell_entry_t entry = { dist_sq, hg->offsets[*bin_table_idx] };
+        msh_hash_grid__cell_heap_push( heap, entry );
       }
     }
   }
+}
 
-  for( uint32_t i = 0 ; i < num_threads; ++i )
+// Best-first kNN search - cells are visited in order of increasing distance to the query, and
+// the search stops once the closest unvisited cell is farther than the current k-th neighbor.
+void
+msh_hash_grid__knn_search_pt( const msh_hash_grid_t* hg, const float* query_pt,
+                              const msh_hash_grid__approx_t* approx,
+                              msh_hash_grid_dist_storage_t* s,
+                              msh_hg_array(msh_hash_grid__cell_entry_t)* heap )
+{
+  float q[3] = { query_pt[0] - hg->min_pt.x,
+                 query_pt[1] - hg->min_pt.y,
+                 (hg->_pts_dim == 2) ? 0.0f - hg->min_pt.z : query_pt[2] - hg->min_pt.z };
+  int64_t c[3] = { (int64_t)floorf( q[0] * hg->_inv_cell_size ),
+                   (int64_t)floorf( q[1] * hg->_inv_cell_size ),
+                   (int64_t)floorf( q[2] * hg->_inv_cell_size ) };
+  const int64_t n_cells[3] = { (int64_t)hg->width, (int64_t)hg->height, (int64_t)hg->depth };
+
+  // Queries outside of the grid start at the first layer that intersects it
+  int64_t layer = 0;
+  for( int32_t a = 0; a < 3; ++a )
   {
-    total_num_neighbors += num_neighbors_per_thread[i];
+    if( c[a] < 0 )                { layer = MSH_HG_MAX( layer, -c[a] ); }
+    if( c[a] > n_cells[a] - 1 )   { layer = MSH_HG_MAX( layer, c[a] - n_cells[a] + 1 ); }
   }
 
-  return total_num_neighbors;
-}
-
+  if( *heap ) { msh_hg_array__hdr( *heap )->len = 0; }
+  msh_hash_grid__push_shell( hg, q, c, layer, s, heap );
 
+  size_t n_examined = 0;
+  for( ;; )
+  {
+    // Expand shells until the next one cannot contain anything closer than the best cell so far
+    for( ;; )
+    {
+      float lb = msh_hash_grid__shell_lower_bound( hg, q, c, layer + 1 );
+      float lb_sq = lb * lb;
+      if( lb >= 1e30f ) { break; }
+      if( s->len >= s->cap && approx->prune_sq * lb_sq >= s->max_dist ) { break; }
+      if( msh_hg_array_len( *heap ) && lb_sq > (*heap)[0].dist_sq ) { break; }
+      layer++;
+      msh_hash_grid__push_shell( hg, q, c, layer, s, heap );
+    }
 
+    if( !msh_hg_array_len( *heap ) ) { break; }
+    msh_hash_grid__cell_entry_t cell = msh_hash_grid__cell_heap_pop( *heap );
+    if( s->len >= s->cap && approx->prune_sq * cell.dist_sq >= s->max_dist ) { break; }
+    msh_hash_grid__add_bin_contents( hg, cell.bi, query_pt, s );
+    n_examined += cell.bi.length;
+    if( n_examined >= approx->max_n_examined ) { break; }
+  }
+}
 
-MSH_HG_INLINE void
-msh_hash_grid__add_bin_contents( const msh_hash_grid_t* hg, const uint64_t bin_idx,
-                                 const float* pt, msh_hash_grid_dist_storage_t* s )
+size_t
+msh_hash_grid__knn_search_chunk( void* params, uint32_t chunk_idx, uint32_t begin, uint32_t end )
 {
-  uint64_t* bin_table_idx = msh_hg_map_get( hg->bin_table, bin_idx );
+  (void)chunk_idx;
+  msh_hash_grid__search_task_t* task = (msh_hash_grid__search_task_t*)params;
+  const msh_hash_grid_t* hg = task->hg;
+  msh_hash_grid_search_desc_t* hg_sd = task->hg_sd;
+  size_t k = hg_sd->k;
+  msh_hash_grid__approx_t approx = msh_hash_grid__make_approx( hg_sd );
 
-  if( !bin_table_idx ) { return; }
-  msh_hg__bin_info_t bi = hg->offsets[*bin_table_idx];
-  int n_pts = bi.length;
-  const msh_hg_v3i_t* data = &hg->data_buffer[bi.offset];
+  msh_hash_grid_dist_storage_t storage;
+  msh_hg_array(msh_hash_grid__cell_entry_t) cell_heap = NULL;
 
-  for( int32_t i = 0; i < n_pts; ++i )
+  size_t total_num_neighbors = 0;
+  for( uint32_t pt_idx = begin; pt_idx < end; ++pt_idx )
   {
+    msh_hg_v3_t q    = msh_hash_grid__to_local( hg, hg_sd->query_pts + (size_t)pt_idx * hg->_pts_dim );
+    float* query_pt  = &q.x;
+    float* dists_sq  = hg_sd->distances_sq + (size_t)pt_idx * k;
+    int32_t* indices = hg_sd->indices + (size_t)pt_idx * k;
 
-    msh_hg_v3_t v;
-    if( hg->_pts_dim == 2 )
-    {
-      v = (msh_hg_v3_t){ data[i].x - pt[0], data[i].y - pt[1], 0.0 };
-    }
-    else
-    {
-      v = (msh_hg_v3_t){ data[i].x - pt[0], data[i].y - pt[1], data[i].z - pt[2] };
-    }
-    float dist_sq = v.x * v.x + v.y * v.y + v.z * v.z;
+    // Prep the storage for the next point
+    msh_hash_grid_dist_storage_init( &storage, k, dists_sq, indices );
 
-    msh_hash_grid_dist_storage_push( s, dist_sq, data[i].i );
+    msh_hash_grid__knn_search_pt( hg, query_pt, &approx, &storage, &cell_heap );
+
+    msh_hash_grid__sort_results( dists_sq, indices, storage.len, hg_sd->sort, hg_sd->sort_top_m );
+
+    if( hg_sd->n_neighbors ) { hg_sd->n_neighbors[pt_idx] = storage.len; }
+    total_num_neighbors += storage.len;
   }
-  
+
+  msh_hg_array_free( cell_heap );
+  return total_num_neighbors;
 }
 
 size_t 
@@ -1302,157 +2583,1412 @@ msh_hash_grid_knn_search( const msh_hash_grid_t* hg,
   assert( hg_sd->distances_sq );
   assert( hg_sd->indices );
   assert( hg_sd->n_query_pts > 0 );
-  assert( hg_sd->max_n_neigh > 0 );
   assert( hg_sd->k > 0 );
 
-  // Unpack the some useful data from structs
-  enum { MAX_BIN_COUNT = 128, MAX_THREAD_COUNT = 128 };
-  uint32_t n_query_pts = hg_sd->n_query_pts;
-  uint32_t k           = hg_sd->k;
-  uint64_t slab_size   = hg->_slab_size;
-  int8_t sort          = hg_sd->sort;
-  float cs             = hg->cell_size;
-  int64_t w            = hg->width;
-  int64_t h            = hg->height;
-  int64_t d            = hg->depth;
-
-  uint32_t n_pts_per_thread = n_query_pts;
-  uint32_t total_num_neighbors = 0;
-  uint32_t num_neighbors_per_thread[MAX_THREAD_COUNT] = {0};
-  uint32_t num_threads = hg->_num_threads;
-  assert( num_threads <= MAX_THREAD_COUNT );
-#if defined(_OPENMP)
-  #pragma omp parallel if (!hg->_dont_use_omp)
+  msh_hash_grid__schedule_t sched = msh_hash_grid__make_schedule( hg, msh_hash_grid__work_ctx( hg_sd ),
+                                                                  hg_sd->n_query_pts,
+                                                                  MSH_HG_MIN_GRAIN );
+  msh_hash_grid__search_task_t task = { hg, hg_sd, NULL };
+  return msh_hash_grid__run( &sched, msh_hash_grid__knn_search_chunk, &task );
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Brute force search
+//
+// For small point sets searched only a few times, testing every point is cheaper than building
+// a grid. Points are copied into structure of arrays form, and a tile of queries is tested
+// against a block of points at a time: squared distances of the whole tile are computed first by
+// a branch free loop that the compiler vectorizes, and only then filtered into the per query
+// storage.
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#define MSH_HASH_GRID__BF_QUERY_TILE 4
+#define MSH_HASH_GRID__BF_BLOCK 256
+
+typedef struct msh_hash_grid__soa_pts
+{
+  float* x;
+  float* y;
+  float* z;
+  int32_t* i;
+  size_t n;
+} msh_hash_grid__soa_pts_t;
+
+typedef struct msh_hash_grid__bf_task
+{
+  const msh_hash_grid_t* hg;
+  msh_hash_grid_search_desc_t* hg_sd;
+  msh_hash_grid__soa_pts_t pts;
+  int32_t is_knn;
+} msh_hash_grid__bf_task_t;
+
+// Arrays are padded to a multiple of block size with points that are infinitely far away, so
+// that the distance loop always runs over full blocks.
+void
+msh_hash_grid__soa_alloc( msh_hash_grid__soa_pts_t* soa, size_t n )
+{
+  size_t cap = (n + MSH_HASH_GRID__BF_BLOCK - 1) / MSH_HASH_GRID__BF_BLOCK * MSH_HASH_GRID__BF_BLOCK;
+  float* block = (float*)MSH_HG_MALLOC( MSH_HG_MAX( cap, 1 ) * 4 * sizeof(float) );
+  soa->x = block;
+  soa->y = block + cap;
+  soa->z = block + 2 * cap;
+  soa->i = (int32_t*)(block + 3 * cap);
+  soa->n = n;
+  for( size_t i = n; i < cap; ++i )
   {
-    if( n_query_pts < num_threads ) { num_threads = n_query_pts; }
-    uint32_t thread_idx = omp_get_thread_num();
-#else
-  for( uint32_t thread_idx = 0; thread_idx < num_threads; ++thread_idx )
+    soa->x[i] = MSH_F32_MAX;
+    soa->y[i] = MSH_F32_MAX;
+    soa->z[i] = MSH_F32_MAX;
+    soa->i[i] = -1;
+  }
+}
+
+void
+msh_hash_grid__soa_free( msh_hash_grid__soa_pts_t* soa )
+{
+  MSH_HG_FREE( soa->x );
+  soa->x = NULL; soa->y = NULL; soa->z = NULL; soa->i = NULL;
+  soa->n = 0;
+}
+
+void
+msh_hash_grid__soa_from_pts( const msh_hash_grid_t* frame, const msh_hg_real_t* pts,
+                             const int32_t n_pts, msh_hash_grid__soa_pts_t* soa )
+{
+  msh_hash_grid__soa_alloc( soa, n_pts );
+  for( int32_t i = 0; i < n_pts; ++i )
   {
-#endif
-    if( thread_idx < num_threads )
-    {
-      uint32_t low_lim      = thread_idx * n_pts_per_thread;
-      uint32_t high_lim     = MSH_HG_MIN((thread_idx + 1) * n_pts_per_thread, n_query_pts);
-      uint32_t cur_n_pts    = high_lim - low_lim;
-
-      float *query_pt       = hg_sd->query_pts + low_lim * hg->_pts_dim;
-      size_t* n_neighbors   = hg_sd->n_neighbors ? (hg_sd->n_neighbors + low_lim) : NULL;
-      float* dists_sq       = hg_sd->distances_sq + (low_lim * k);
-      int32_t* indices      = hg_sd->indices + (low_lim * k);
-
-      int32_t bin_indices[ MAX_BIN_COUNT ];
-      msh_hash_grid_dist_storage_t storage;
-      
-      for( uint32_t pt_idx = 0; pt_idx < cur_n_pts; ++pt_idx )
-      {
-        // Prep the storage for the next point
-        msh_hash_grid_dist_storage_init( &storage, k, dists_sq, indices );
+    msh_hg_v3_t p = msh_hash_grid__to_local( frame, pts + (size_t)i * frame->_pts_dim );
+    soa->x[i] = p.x;
+    soa->y[i] = p.y;
+    soa->z[i] = p.z;
+    soa->i[i] = i;
+  }
+}
 
-        // Normalize query pt with respect to grid
-        float dx, dy, dz;
-        int64_t cx, cy, cz;
-        int32_t layer = 0;
-        int8_t should_break = 0;
+size_t
+msh_hash_grid__brute_force_chunk( void* params, uint32_t chunk_idx, uint32_t begin, uint32_t end )
+{
+  (void)chunk_idx;
+  msh_hash_grid__bf_task_t* task = (msh_hash_grid__bf_task_t*)params;
+  const msh_hash_grid_t* hg = task->hg;
+  msh_hash_grid_search_desc_t* hg_sd = task->hg_sd;
+  const msh_hash_grid__soa_pts_t* pts = &task->pts;
 
-        msh_hg_v3_t pt_prime;
-        if( hg->_pts_dim == 2 )
-        {
-          pt_prime = (msh_hg_v3_t) { query_pt[0] - hg->min_pt.x,
-                                     query_pt[1] - hg->min_pt.y,
-                                     0.0 };
-        }
-        else
+  size_t row_size = hg_sd->max_n_neigh;
+  float radius_sq = task->is_knn ? MSH_F32_MAX : hg_sd->radius * hg_sd->radius;
+
+  float tile[MSH_HASH_GRID__BF_QUERY_TILE][MSH_HASH_GRID__BF_BLOCK];
+  msh_hash_grid_dist_storage_t storage[MSH_HASH_GRID__BF_QUERY_TILE];
+  msh_hg_v3_t q[MSH_HASH_GRID__BF_QUERY_TILE];
+
+  size_t total_num_neighbors = 0;
+  for( uint32_t tile_begin = begin; tile_begin < end; tile_begin += MSH_HASH_GRID__BF_QUERY_TILE )
+  {
+    uint32_t n_q = MSH_HG_MIN( (uint32_t)MSH_HASH_GRID__BF_QUERY_TILE, end - tile_begin );
+    for( uint32_t j = 0; j < n_q; ++j )
+    {
+      size_t pt_idx = tile_begin + j;
+      q[j] = msh_hash_grid__to_local( hg, hg_sd->query_pts + pt_idx * hg->_pts_dim );
+      msh_hash_grid_dist_storage_init( &storage[j], row_size,
+                                       hg_sd->distances_sq + pt_idx * row_size,
+                                       hg_sd->indices + pt_idx * row_size );
+    }
+
+    for( size_t block_begin = 0; block_begin < pts->n; block_begin += MSH_HASH_GRID__BF_BLOCK )
+    {
+      size_t n_p = MSH_HG_MIN( (size_t)MSH_HASH_GRID__BF_BLOCK, pts->n - block_begin );
+      const float* restrict x = pts->x + block_begin;
+      const float* restrict y = pts->y + block_begin;
+      const float* restrict z = pts->z + block_begin;
+
+      // Distances of the tile, along with the number of candidates for each query
+      uint32_t n_candidates[MSH_HASH_GRID__BF_QUERY_TILE];
+      for( uint32_t j = 0; j < n_q; ++j )
+      {
+        const msh_hash_grid_dist_storage_t* s = &storage[j];
+        float threshold = (s->len >= s->cap) ? MSH_HG_MIN( s->max_dist, radius_sq ) : radius_sq;
+        float* restrict d = tile[j];
+        float qx = q[j].x, qy = q[j].y, qz = q[j].z;
+        uint32_t count = 0;
+        for( size_t p = 0; p < MSH_HASH_GRID__BF_BLOCK; ++p )
         {
-          pt_prime = (msh_hg_v3_t) { query_pt[0] - hg->min_pt.x,
-                                     query_pt[1] - hg->min_pt.y,
-                                     query_pt[2] - hg->min_pt.z };
+          float vx = x[p] - qx;
+          float vy = y[p] - qy;
+          float vz = z[p] - qz;
+          d[p] = vx * vx + vy * vy + vz * vz;
+          count += (d[p] < threshold);
         }
-        // get base bin for query
-        uint64_t ix = (uint64_t)( (pt_prime.x) * hg->_inv_cell_size );
-        uint64_t iy = (uint64_t)( (pt_prime.y) * hg->_inv_cell_size );
-        uint64_t iz = (uint64_t)( (pt_prime.z) * hg->_inv_cell_size );
-        while( true )
+        n_candidates[j] = count;
+      }
+
+      const int32_t* ids = pts->i + block_begin;
+      for( uint32_t j = 0; j < n_q; ++j )
+      {
+        if( !n_candidates[j] ) { continue; }
+        msh_hash_grid_dist_storage_t* s = &storage[j];
+        const float* d = tile[j];
+        float threshold = (s->len >= s->cap) ? MSH_HG_MIN( s->max_dist, radius_sq ) : radius_sq;
+        for( size_t p = 0; p < n_p; ++p )
         {
-          int32_t inc_x = 1;
-          uint32_t n_visited_bins = 0;
-          for( int64_t oz = -layer; oz <= layer; oz++ )
+          if( d[p] < threshold )
           {
-            cz = iz + oz;
-            if( cz < 0 || cz >= d ) continue;
-            uint64_t idx_z = cz * slab_size;
+            msh_hash_grid_dist_storage_push( s, d[p], ids[p] );
+            if( s->len >= s->cap ) { threshold = MSH_HG_MIN( s->max_dist, radius_sq ); }
+          }
+        }
+      }
+    }
+
+    for( uint32_t j = 0; j < n_q; ++j )
+    {
+      size_t pt_idx = tile_begin + j;
+      msh_hash_grid__sort_results( storage[j].dists, storage[j].indices, storage[j].len,
+                                   hg_sd->sort, hg_sd->sort_top_m );
+      if( hg_sd->n_neighbors ) { hg_sd->n_neighbors[pt_idx] = storage[j].len; }
+      total_num_neighbors += storage[j].len;
+    }
+  }
+  return total_num_neighbors;
+}
+
+size_t
+msh_hash_grid__brute_force_pts_search( const msh_hg_real_t* pts, const int32_t n_pts,
+                                       const int32_t dim, msh_hash_grid_search_desc_t* hg_sd,
+                                       int32_t is_knn )
+{
+  assert( dim == 2 || dim == 3 );
+  assert( pts || n_pts == 0 );
+  assert( hg_sd->query_pts );
+  assert( hg_sd->distances_sq );
+  assert( hg_sd->indices );
+  assert( hg_sd->n_query_pts > 0 );
+  assert( hg_sd->max_n_neigh > 0 );
+  assert( hg_sd->output_mode == MSH_HASH_GRID_OUTPUT_DENSE );
+
+  // Grid without any cells, only used for its local frame and thread settings
+  msh_hash_grid_t frame = {0};
+  msh_hash_grid__init_threads( &frame );
+  msh_hash_grid__compute_bbox( &frame, pts, n_pts, dim );
+
+  msh_hash_grid__soa_pts_t soa;
+  msh_hash_grid__soa_from_pts( &frame, pts, n_pts, &soa );
+  msh_hash_grid__schedule_t sched = msh_hash_grid__make_schedule( &frame, msh_hash_grid__work_ctx( hg_sd ),
+                                                                  hg_sd->n_query_pts,
+                                                                  MSH_HG_MIN_GRAIN );
+  msh_hash_grid__bf_task_t task = { &frame, hg_sd, soa, is_knn };
+  size_t n_neighbors = msh_hash_grid__run( &sched, msh_hash_grid__brute_force_chunk, &task );
+  msh_hash_grid__soa_free( &soa );
+  return n_neighbors;
+}
 
-            if( oz < 0 )      { dz = pt_prime.z - (cz + 1) * cs; }
-            else if( oz > 0 ) { dz = cz * cs - pt_prime.z; }
-            else              { dz = 0.0f; }
+size_t
+msh_hash_grid_brute_force_radius_search( const msh_hg_real_t* pts, const int32_t n_pts,
+                                         const int32_t dim, msh_hash_grid_search_desc_t* hg_sd )
+{
+  assert( hg_sd->radius > 0.0 );
+  return msh_hash_grid__brute_force_pts_search( pts, n_pts, dim, hg_sd, 0 );
+}
 
-            for( int64_t oy = -layer; oy <= layer; oy++ )
-            {
-              cy = iy + oy;
-              if( cy < 0 || cy >= h ) continue;
-              uint64_t idx_y = cy * w;
+size_t
+msh_hash_grid_brute_force_knn_search( const msh_hg_real_t* pts, const int32_t n_pts,
+                                      const int32_t dim, msh_hash_grid_search_desc_t* hg_sd )
+{
+  return msh_hash_grid__brute_force_pts_search( pts, n_pts, dim, hg_sd, 1 );
+}
 
-              if( oy < 0 )      { dy = pt_prime.y - (cy + 1) * cs; }
-              else if( oy > 0 ) { dy = cy * cs - pt_prime.y; }
-              else              { dy = 0.0f; }
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Range queries
+////////////////////////////////////////////////////////////////////////////////////////////////////
 
-              if( abs(oy) != layer && abs(oz) != layer ) { inc_x = 2 * layer; }
-              else                                       { inc_x = 1; }
+enum
+{
+  MSH_HASH_GRID__CELL_OUTSIDE = 0,
+  MSH_HASH_GRID__CELL_PARTIAL = 1,
+  MSH_HASH_GRID__CELL_INSIDE  = 2
+};
+
+// NOTE(maciej): Box ranges only use the bounding box. Frustum ranges use the bounding box of
+// frustum corners to select candidate cells, and planes to classify them.
+typedef struct msh_hash_grid__range
+{
+  msh_hg_v3_t min_pt;
+  msh_hg_v3_t max_pt;
+  const float* planes;
+  int32_t n_planes;
+} msh_hash_grid__range_t;
 
-              for( int64_t ox = -layer; ox <= layer; ox += inc_x )
-              {
-                cx = ix + ox;
-                if( cx < 0 || cx >= w ) continue;
+MSH_HG_INLINE int32_t
+msh_hash_grid__classify_cell( const msh_hash_grid__range_t* r, msh_hg_v3_t lo, msh_hg_v3_t hi )
+{
+  if( hi.x < r->min_pt.x || lo.x > r->max_pt.x ||
+      hi.y < r->min_pt.y || lo.y > r->max_pt.y ||
+      hi.z < r->min_pt.z || lo.z > r->max_pt.z ) { return MSH_HASH_GRID__CELL_OUTSIDE; }
 
-                if( ox < 0 )      { dx = pt_prime.x - (cx + 1) * cs; }
-                else if( ox > 0 ) { dx = cx * cs - pt_prime.x; }
-                else              { dx = 0.0f; }
+  if( !r->n_planes )
+  {
+    if( lo.x >= r->min_pt.x && hi.x <= r->max_pt.x &&
+        lo.y >= r->min_pt.y && hi.y <= r->max_pt.y &&
+        lo.z >= r->min_pt.z && hi.z <= r->max_pt.z ) { return MSH_HASH_GRID__CELL_INSIDE; }
+    return MSH_HASH_GRID__CELL_PARTIAL;
+  }
 
-                float dist_sq = dz * dz + dy * dy + dx * dx;
+  // Test the corner farthest along the plane normal to reject, and the closest one to accept
+  int32_t result = MSH_HASH_GRID__CELL_INSIDE;
+  for( int32_t i = 0; i < r->n_planes; ++i )
+  {
+    const float* pl = r->planes + 4 * i;
+    float far_x  = (pl[0] >= 0.0f) ? hi.x : lo.x;
+    float far_y  = (pl[1] >= 0.0f) ? hi.y : lo.y;
+    float far_z  = (pl[2] >= 0.0f) ? hi.z : lo.z;
+    float near_x = (pl[0] >= 0.0f) ? lo.x : hi.x;
+    float near_y = (pl[1] >= 0.0f) ? lo.y : hi.y;
+    float near_z = (pl[2] >= 0.0f) ? lo.z : hi.z;
+    if( pl[0] * far_x + pl[1] * far_y + pl[2] * far_z + pl[3] < 0.0f )
+    {
+      return MSH_HASH_GRID__CELL_OUTSIDE;
+    }
+    if( pl[0] * near_x + pl[1] * near_y + pl[2] * near_z + pl[3] < 0.0f )
+    {
+      result = MSH_HASH_GRID__CELL_PARTIAL;
+    }
+  }
+  return result;
+}
 
-                if( storage.len >= k &&
-                    dist_sq > storage.max_dist ) { continue; }
+MSH_HG_INLINE int32_t
+msh_hash_grid__range_contains( const msh_hash_grid__range_t* r, const msh_hg_v3i_t* p )
+{
+  if( p->x < r->min_pt.x || p->x > r->max_pt.x ||
+      p->y < r->min_pt.y || p->y > r->max_pt.y ||
+      p->z < r->min_pt.z || p->z > r->max_pt.z ) { return 0; }
 
-                assert( n_visited_bins < MAX_BIN_COUNT );
+  for( int32_t i = 0; i < r->n_planes; ++i )
+  {
+    const float* pl = r->planes + 4 * i;
+    if( pl[0] * p->x + pl[1] * p->y + pl[2] * p->z + pl[3] < 0.0f ) { return 0; }
+  }
+  return 1;
+}
 
-                bin_indices[n_visited_bins]  = idx_z + idx_y + cx;
+MSH_HG_INLINE int64_t
+msh_hash_grid__clamped_cell_coord( float v, double inv_cell_size, int64_t n_cells )
+{
+  double c = v * inv_cell_size;
+  if( c < 0.0 )              { return 0; }
+  if( c >= (double)n_cells ) { return n_cells - 1; }
+  return (int64_t)c;
+}
 
-                n_visited_bins++;
-              }
-            }
-          }
+MSH_HG_INLINE size_t
+msh_hash_grid__emit_span( const msh_hash_grid_t* hg, uint32_t begin, uint32_t end,
+                          int32_t* indices, size_t n_indices, size_t max_n_indices )
+{
+  for( uint32_t i = begin; i < end && n_indices < max_n_indices; ++i )
+  {
+    indices[n_indices++] = msh_hash_grid__load_pt( hg, i ).i;
+  }
+  return n_indices;
+}
 
-          for( uint32_t bin_idx = 0; bin_idx < n_visited_bins; ++bin_idx )
+size_t
+msh_hash_grid__range_query( const msh_hash_grid_t* hg, const msh_hash_grid__range_t* r,
+                            int32_t* indices, size_t max_n_indices )
+{
+  if( r->max_pt.x < hg->min_pt.x || r->min_pt.x > hg->max_pt.x ||
+      r->max_pt.y < hg->min_pt.y || r->min_pt.y > hg->max_pt.y ||
+      r->max_pt.z < hg->min_pt.z || r->min_pt.z > hg->max_pt.z ) { return 0; }
+
+  double cs  = hg->cell_size;
+  double ics = hg->_inv_cell_size;
+  int64_t x0 = msh_hash_grid__clamped_cell_coord( r->min_pt.x - hg->min_pt.x, ics, hg->width );
+  int64_t y0 = msh_hash_grid__clamped_cell_coord( r->min_pt.y - hg->min_pt.y, ics, hg->height );
+  int64_t z0 = msh_hash_grid__clamped_cell_coord( r->min_pt.z - hg->min_pt.z, ics, hg->depth );
+  int64_t x1 = msh_hash_grid__clamped_cell_coord( r->max_pt.x - hg->min_pt.x, ics, hg->width );
+  int64_t y1 = msh_hash_grid__clamped_cell_coord( r->max_pt.y - hg->min_pt.y, ics, hg->height );
+  int64_t z1 = msh_hash_grid__clamped_cell_coord( r->max_pt.z - hg->min_pt.z, ics, hg->depth );
+
+  size_t n_indices = 0;
+  for( int64_t cz = z0; cz <= z1; ++cz )
+  {
+    for( int64_t cy = y0; cy <= y1; ++cy )
+    {
+      // Bins within a row are stored contiguously in data_buffer, so consecutive cells that are
+      // fully inside the range can be emitted as a single span.
+      uint32_t span_begin = 0;
+      uint32_t span_end = 0;
+      for( int64_t cx = x0; cx <= x1; ++cx )
+      {
+        msh_hg_v3_t lo = { (float)(hg->min_pt.x + cx * cs),
+                           (float)(hg->min_pt.y + cy * cs),
+                           (float)(hg->min_pt.z + cz * cs) };
+        msh_hg_v3_t hi = { (float)(lo.x + cs), (float)(lo.y + cs), (float)(lo.z + cs) };
+        int32_t cell_class = msh_hash_grid__classify_cell( r, lo, hi );
+        if( cell_class == MSH_HASH_GRID__CELL_OUTSIDE ) { continue; }
+
+        uint64_t bin_idx = msh_hash_grid__bin_pt( hg, cx, cy, cz );
+        uint64_t* bin_table_idx = msh_hg_map_get( hg->bin_table, bin_idx );
+        if( !bin_table_idx ) { continue; }
+        msh_hg__bin_info_t bi = hg->offsets[*bin_table_idx];
+
+        if( cell_class == MSH_HASH_GRID__CELL_INSIDE )
+        {
+          if( span_end != bi.offset )
+          {
+            n_indices = msh_hash_grid__emit_span( hg, span_begin, span_end,
+                                                  indices, n_indices, max_n_indices );
+            span_begin = bi.offset;
+          }
+          span_end = bi.offset + bi.length;
+        }
+        else
+        {
+          for( uint32_t i = bi.offset; i < bi.offset + bi.length && n_indices < max_n_indices; ++i )
           {
-            msh_hash_grid__add_bin_contents( hg, bin_indices[bin_idx], query_pt, &storage );
+            msh_hg_v3i_t pt = msh_hash_grid__load_pt( hg, i );
+            if( msh_hash_grid__range_contains( r, &pt ) ) { indices[n_indices++] = pt.i; }
           }
-          
-          
-          layer++;
-          if( should_break ) { break; }
-          if( storage.len >= k ) { should_break = true; }
         }
-        if( n_neighbors ) { (*n_neighbors++) = storage.len; }
-        num_neighbors_per_thread[thread_idx] += storage.len;
+      }
+      n_indices = msh_hash_grid__emit_span( hg, span_begin, span_end,
+                                            indices, n_indices, max_n_indices );
+      if( n_indices >= max_n_indices ) { return n_indices; }
+    }
+  }
+  return n_indices;
+}
+
+// Point where three planes meet. Returns 0 if the planes do not intersect in a single point.
+int32_t
+msh_hash_grid__planes_intersection( const float* a, const float* b, const float* c, double* pt )
+{
+  double bc[3] = { b[1] * c[2] - b[2] * c[1], b[2] * c[0] - b[0] * c[2], b[0] * c[1] - b[1] * c[0] };
+  double ca[3] = { c[1] * a[2] - c[2] * a[1], c[2] * a[0] - c[0] * a[2], c[0] * a[1] - c[1] * a[0] };
+  double ab[3] = { a[1] * b[2] - a[2] * b[1], a[2] * b[0] - a[0] * b[2], a[0] * b[1] - a[1] * b[0] };
+  double det = a[0] * bc[0] + a[1] * bc[1] + a[2] * bc[2];
+  if( fabs( det ) < 1e-12 ) { return 0; }
+  for( int32_t i = 0; i < 3; ++i )
+  {
+    pt[i] = -( a[3] * bc[i] + b[3] * ca[i] + c[3] * ab[i] ) / det;
+  }
+  return 1;
+}
 
-        if( sort ) { msh_hash_grid__sort( dists_sq, indices, storage.len ); }
+void
+msh_hash_grid__frustum_range( const msh_hash_grid_t* hg, const float* planes,
+                              msh_hash_grid__range_t* r )
+{
+  r->planes   = planes;
+  r->n_planes = 6;
+  r->min_pt   = (msh_hg_v3_t){  1e30f,  1e30f,  1e30f };
+  r->max_pt   = (msh_hg_v3_t){ -1e30f, -1e30f, -1e30f };
 
-        // Advance pointers
-        dists_sq += k;
-        indices  += k;
-        query_pt += hg->_pts_dim;
-      }
+  // Corners are intersections of (left|right) x (bottom|top) x (near|far) planes
+  for( int32_t i = 0; i < 8; ++i )
+  {
+    double pt[3];
+    if( !msh_hash_grid__planes_intersection( planes + 4 * (0 + ((i >> 0) & 1)),
+                                             planes + 4 * (2 + ((i >> 1) & 1)),
+                                             planes + 4 * (4 + ((i >> 2) & 1)), pt ) )
+    {
+      r->min_pt = hg->min_pt;
+      r->max_pt = hg->max_pt;
+      return;
     }
+    r->min_pt.x = MSH_HG_MIN( r->min_pt.x, (float)pt[0] );
+    r->min_pt.y = MSH_HG_MIN( r->min_pt.y, (float)pt[1] );
+    r->min_pt.z = MSH_HG_MIN( r->min_pt.z, (float)pt[2] );
+    r->max_pt.x = MSH_HG_MAX( r->max_pt.x, (float)pt[0] );
+    r->max_pt.y = MSH_HG_MAX( r->max_pt.y, (float)pt[1] );
+    r->max_pt.z = MSH_HG_MAX( r->max_pt.z, (float)pt[2] );
   }
+}
+
+typedef struct msh_hash_grid__range_task
+{
+  const msh_hash_grid_t* hg;
+  msh_hash_grid_range_desc_t* hg_rd;
+  int32_t is_frustum;
+} msh_hash_grid__range_task_t;
 
-  for( uint32_t i = 0 ; i < num_threads; ++i )
+size_t
+msh_hash_grid__range_query_chunk( void* params, uint32_t chunk_idx, uint32_t begin, uint32_t end )
+{
+  (void)chunk_idx;
+  msh_hash_grid__range_task_t* task = (msh_hash_grid__range_task_t*)params;
+  const msh_hash_grid_t* hg = task->hg;
+  msh_hash_grid_range_desc_t* hg_rd = task->hg_rd;
+  size_t row_size = hg_rd->max_n_indices;
+
+  size_t total_num_indices = 0;
+  for( uint32_t range_idx = begin; range_idx < end; ++range_idx )
   {
-    total_num_neighbors += num_neighbors_per_thread[i];
+    msh_hash_grid__range_t range = {0};
+    float planes[24];
+    if( task->is_frustum )
+    {
+      // Move planes to grid local coordinates, n.(p + o) + d = n.p + (d + n.o)
+      const msh_hg_real_t* pl = hg_rd->frustums + 24 * range_idx;
+      for( int32_t i = 0; i < 6; ++i )
+      {
+        const msh_hg_real_t* src = pl + 4 * i;
+        planes[4 * i + 0] = (float)src[0];
+        planes[4 * i + 1] = (float)src[1];
+        planes[4 * i + 2] = (float)src[2];
+        planes[4 * i + 3] = (float)( (double)src[3] + src[0] * hg->origin[0] +
+                                     src[1] * hg->origin[1] + src[2] * hg->origin[2] );
+      }
+      msh_hash_grid__frustum_range( hg, planes, &range );
+    }
+    else if( hg->_pts_dim == 2 )
+    {
+      const msh_hg_real_t* box = hg_rd->boxes + 4 * range_idx;
+      range.min_pt   = msh_hash_grid__to_local( hg, box );
+      range.max_pt   = msh_hash_grid__to_local( hg, box + 2 );
+      range.min_pt.z = hg->min_pt.z;
+      range.max_pt.z = hg->max_pt.z;
+    }
+    else
+    {
+      const msh_hg_real_t* box = hg_rd->boxes + 6 * range_idx;
+      range.min_pt = msh_hash_grid__to_local( hg, box );
+      range.max_pt = msh_hash_grid__to_local( hg, box + 3 );
+    }
+
+    size_t n_indices = msh_hash_grid__range_query( hg, &range,
+                                                   hg_rd->indices + range_idx * row_size,
+                                                   row_size );
+    if( hg_rd->n_indices ) { hg_rd->n_indices[range_idx] = n_indices; }
+    total_num_indices += n_indices;
   }
 
-  return total_num_neighbors;
+  return total_num_indices;
+}
+
+size_t
+msh_hash_grid__range_queries( const msh_hash_grid_t* hg,
+                              msh_hash_grid_range_desc_t* hg_rd, const int32_t is_frustum )
+{
+  void* work_ctx = NULL;
+#ifdef MSH_JOBS
+  work_ctx = hg_rd->work_ctx;
+#endif
+  // Each range can touch many cells, so these are scheduled one by one
+  msh_hash_grid__schedule_t sched = msh_hash_grid__make_schedule( hg, work_ctx, hg_rd->n_ranges, 1 );
+  msh_hash_grid__range_task_t task = { hg, hg_rd, is_frustum };
+  return msh_hash_grid__run( &sched, msh_hash_grid__range_query_chunk, &task );
+}
+
+size_t
+msh_hash_grid_box_query( const msh_hash_grid_t* hg, msh_hash_grid_range_desc_t* hg_rd )
+{
+  assert( hg_rd->boxes );
+  assert( hg_rd->indices );
+  assert( hg_rd->max_n_indices > 0 );
+
+  return msh_hash_grid__range_queries( hg, hg_rd, 0 );
+}
+
+size_t
+msh_hash_grid_frustum_query( const msh_hash_grid_t* hg, msh_hash_grid_range_desc_t* hg_rd )
+{
+  assert( hg->_pts_dim == 3 );
+  assert( hg_rd->frustums );
+  assert( hg_rd->indices );
+  assert( hg_rd->max_n_indices > 0 );
+
+  return msh_hash_grid__range_queries( hg, hg_rd, 1 );
 }
 
+void
+msh_hash_grid_frustum_planes( const float* view, const float* proj, msh_hg_real_t* planes )
+{
+  // Combined matrix m = proj * view, both column major
+  float m[16];
+  for( int32_t c = 0; c < 4; ++c )
+  {
+    for( int32_t r = 0; r < 4; ++r )
+    {
+      m[4 * c + r] = proj[r]      * view[4 * c]     + proj[4 + r]  * view[4 * c + 1] +
+                     proj[8 + r]  * view[4 * c + 2] + proj[12 + r] * view[4 * c + 3];
+    }
+  }
+
+  // Gribb-Hartmann: plane i is row3 +/- row(i/2)
+  for( int32_t i = 0; i < 6; ++i )
+  {
+    int32_t row = i >> 1;
+    float sign = (i & 1) ? -1.0f : 1.0f;
+    msh_hg_real_t* pl = planes + 4 * i;
+    for( int32_t c = 0; c < 4; ++c )
+    {
+      pl[c] = m[4 * c + 3] + sign * m[4 * c + row];
+    }
+    msh_hg_real_t norm = (msh_hg_real_t)sqrt( pl[0] * pl[0] + pl[1] * pl[1] + pl[2] * pl[2] );
+    if( norm > 0.0f )
+    {
+      pl[0] /= norm; pl[1] /= norm; pl[2] /= norm; pl[3] /= norm;
+    }
+  }
+}
+
+#ifdef MSH_CAMERA
+void
+msh_hash_grid_frustum_planes_from_camera( const msh_camera_t* cam, msh_hg_real_t* planes )
+{
+  float view[16], proj[16];
+  for( int32_t i = 0; i < 16; ++i )
+  {
+    view[i] = (float)cam->view.data[i];
+    proj[i] = (float)cam->proj.data[i];
+  }
+  msh_hash_grid_frustum_planes( view, proj, planes );
+}
+#endif
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Per cell aggregation
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+size_t
+msh_hash_grid_n_cells( const msh_hash_grid_t* hg )
+{
+  return hg->bin_table->_len;
+}
+
+typedef struct msh_hash_grid__aggregate_task
+{
+  const msh_hash_grid_t* hg;
+  msh_hash_grid_cell_desc_t* hg_cd;
+} msh_hash_grid__aggregate_task_t;
+
+size_t
+msh_hash_grid__aggregate_chunk( void* params, uint32_t chunk_idx, uint32_t begin, uint32_t end )
+{
+  (void)chunk_idx;
+  msh_hash_grid__aggregate_task_t* task = (msh_hash_grid__aggregate_task_t*)params;
+  const msh_hash_grid_t* hg = task->hg;
+  msh_hash_grid_cell_desc_t* hg_cd = task->hg_cd;
+  size_t n_attribs = hg_cd->n_attribs;
+  int32_t dim = hg->_pts_dim;
+
+  double* attrib_sums = NULL;
+  if( hg_cd->mean_attribs && n_attribs )
+  {
+    attrib_sums = (double*)MSH_HG_MALLOC( n_attribs * sizeof(double) );
+  }
+
+  for( uint32_t cell_idx = begin; cell_idx < end; ++cell_idx )
+  {
+    msh_hg__bin_info_t bi = hg->offsets[cell_idx];
+    if( hg_cd->counts ) { hg_cd->counts[cell_idx] = bi.length; }
+    if( !bi.length ) { continue; }
+
+    // Sum in double, stored points are relative to origin, so this stays accurate
+    double c[3] = { 0.0, 0.0, 0.0 };
+    for( uint32_t i = bi.offset; i < bi.offset + bi.length; ++i )
+    {
+      msh_hg_v3i_t pt = msh_hash_grid__load_pt( hg, i );
+      c[0] += pt.x; c[1] += pt.y; c[2] += pt.z;
+    }
+    double inv_n = 1.0 / bi.length;
+    c[0] *= inv_n; c[1] *= inv_n; c[2] *= inv_n;
+
+    if( hg_cd->centroids )
+    {
+      for( int32_t j = 0; j < dim; ++j )
+      {
+        hg_cd->centroids[(size_t)cell_idx * dim + j] = (msh_hg_real_t)( c[j] + hg->origin[j] );
+      }
+    }
+
+    if( hg_cd->representatives )
+    {
+      int32_t best_idx = -1;
+      double best_dist_sq = 1e300;
+      for( uint32_t i = bi.offset; i < bi.offset + bi.length; ++i )
+      {
+        msh_hg_v3i_t pt = msh_hash_grid__load_pt( hg, i );
+        double vx = pt.x - c[0], vy = pt.y - c[1], vz = pt.z - c[2];
+        double dist_sq = vx * vx + vy * vy + vz * vz;
+        if( dist_sq < best_dist_sq ) { best_dist_sq = dist_sq; best_idx = pt.i; }
+      }
+      hg_cd->representatives[cell_idx] = best_idx;
+    }
+
+    if( attrib_sums )
+    {
+      MSH_HG_MEMSET( attrib_sums, 0, n_attribs * sizeof(double) );
+      for( uint32_t i = bi.offset; i < bi.offset + bi.length; ++i )
+      {
+        const float* attrib = hg_cd->attribs + (size_t)msh_hash_grid__load_pt( hg, i ).i * n_attribs;
+        for( size_t j = 0; j < n_attribs; ++j ) { attrib_sums[j] += attrib[j]; }
+      }
+      float* mean = hg_cd->mean_attribs + (size_t)cell_idx * n_attribs;
+      for( size_t j = 0; j < n_attribs; ++j ) { mean[j] = (float)( attrib_sums[j] * inv_n ); }
+    }
+  }
+
+  MSH_HG_FREE( attrib_sums );
+  return end - begin;
+}
+
+size_t
+msh_hash_grid_aggregate_cells( const msh_hash_grid_t* hg, msh_hash_grid_cell_desc_t* hg_cd )
+{
+  assert( !hg_cd->mean_attribs || !hg_cd->n_attribs || hg_cd->attribs );
+
+  size_t n_cells = msh_hash_grid_n_cells( hg );
+  if( !n_cells ) { return 0; }
+
+  void* work_ctx = NULL;
+#ifdef MSH_JOBS
+  work_ctx = hg_cd->work_ctx;
+#endif
+  msh_hash_grid__schedule_t sched = msh_hash_grid__make_schedule( hg, work_ctx, n_cells,
+                                                                  MSH_HG_MIN_GRAIN );
+  msh_hash_grid__aggregate_task_t task = { hg, hg_cd };
+  return msh_hash_grid__run( &sched, msh_hash_grid__aggregate_chunk, &task );
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Self join
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+typedef struct msh_hash_grid__pair_buffer
+{
+  msh_hg_array(int32_t) src;
+  msh_hg_array(int32_t) dst;
+  msh_hg_array(float) dists;
+} msh_hash_grid__pair_buffer_t;
+
+typedef struct msh_hash_grid__pairs_task
+{
+  const msh_hash_grid_t* hg;
+  msh_hash_grid_pairs_desc_t* hg_pd;
+  const uint64_t* cell_bin_idx;
+  msh_hg_array(int32_t) nbr_offsets;
+  float radius_sq;
+  msh_hash_grid__pair_buffer_t* buffers;
+} msh_hash_grid__pairs_task_t;
+
+MSH_HG_INLINE void
+msh_hash_grid__join_cells_2d( const msh_hg_v2i_t* a, uint32_t n_a, const msh_hg_v2i_t* b, uint32_t n_b,
+                              const int32_t same_cell, const float radius_sq,
+                              msh_hash_grid__pair_buffer_t* buffer )
+{
+  for( uint32_t i = 0; i < n_a; ++i )
+  {
+    for( uint32_t j = same_cell ? i + 1 : 0; j < n_b; ++j )
+    {
+      float vx = a[i].x - b[j].x;
+      float vy = a[i].y - b[j].y;
+      float dist_sq = vx * vx + vy * vy;
+      if( dist_sq < radius_sq )
+      {
+        msh_hg_array_push( buffer->src, a[i].i );
+        msh_hg_array_push( buffer->dst, b[j].i );
+        msh_hg_array_push( buffer->dists, dist_sq );
+      }
+    }
+  }
+}
+
+MSH_HG_INLINE void
+msh_hash_grid__join_cells( const msh_hg_v3i_t* a, uint32_t n_a, const msh_hg_v3i_t* b, uint32_t n_b,
+                           const int32_t same_cell, const float radius_sq,
+                           msh_hash_grid__pair_buffer_t* buffer )
+{
+  for( uint32_t i = 0; i < n_a; ++i )
+  {
+    for( uint32_t j = same_cell ? i + 1 : 0; j < n_b; ++j )
+    {
+      float vx = a[i].x - b[j].x;
+      float vy = a[i].y - b[j].y;
+      float vz = a[i].z - b[j].z;
+      float dist_sq = vx * vx + vy * vy + vz * vz;
+      if( dist_sq < radius_sq )
+      {
+        msh_hg_array_push( buffer->src, a[i].i );
+        msh_hg_array_push( buffer->dst, b[j].i );
+        msh_hg_array_push( buffer->dists, dist_sq );
+      }
+    }
+  }
+}
+
+MSH_HG_INLINE void
+msh_hash_grid__join_bins( const msh_hash_grid_t* hg, const msh_hg__bin_info_t a,
+                          const msh_hg__bin_info_t b, const int32_t same_cell, const float radius_sq,
+                          msh_hash_grid__pair_buffer_t* buffer )
+{
+  if( hg->_pts_dim == 2 )
+  {
+    msh_hash_grid__join_cells_2d( hg->data_buffer_2d + a.offset, a.length,
+                                  hg->data_buffer_2d + b.offset, b.length,
+                                  same_cell, radius_sq, buffer );
+  }
+  else
+  {
+    msh_hash_grid__join_cells( hg->data_buffer + a.offset, a.length,
+                               hg->data_buffer + b.offset, b.length,
+                               same_cell, radius_sq, buffer );
+  }
+}
+
+size_t
+msh_hash_grid__radius_pairs_chunk( void* params, uint32_t chunk_idx, uint32_t begin, uint32_t end )
+{
+  msh_hash_grid__pairs_task_t* task = (msh_hash_grid__pairs_task_t*)params;
+  const msh_hash_grid_t* hg = task->hg;
+  msh_hash_grid__pair_buffer_t* buffer = task->buffers + chunk_idx;
+  uint32_t n_nbr_offsets = msh_hg_array_len( task->nbr_offsets ) / 3;
+
+  for( uint32_t cell_idx = begin; cell_idx < end; ++cell_idx )
+  {
+    msh_hg__bin_info_t bi = hg->offsets[cell_idx];
+    msh_hash_grid__join_bins( hg, bi, bi, 1, task->radius_sq, buffer );
+
+    uint64_t bin_idx = task->cell_bin_idx[cell_idx];
+    int64_t cz = bin_idx / hg->_slab_size;
+    int64_t cy = (bin_idx % hg->_slab_size) / hg->width;
+    int64_t cx = bin_idx % hg->width;
+    for( uint32_t i = 0; i < n_nbr_offsets; ++i )
+    {
+      const int32_t* o = task->nbr_offsets + 3 * i;
+      int64_t nx = cx + o[0], ny = cy + o[1], nz = cz + o[2];
+      if( nx < 0 || nx >= (int64_t)hg->width ||
+          ny < 0 || ny >= (int64_t)hg->height ||
+          nz < 0 || nz >= (int64_t)hg->depth ) { continue; }
+
+      uint64_t* nbr_cell_idx = msh_hg_map_get( hg->bin_table, msh_hash_grid__bin_pt( hg, nx, ny, nz ) );
+      if( !nbr_cell_idx ) { continue; }
+      msh_hg__bin_info_t nbi = hg->offsets[*nbr_cell_idx];
+      msh_hash_grid__join_bins( hg, bi, nbi, 0, task->radius_sq, buffer );
+    }
+  }
+  return msh_hg_array_len( buffer->src );
+}
+
+size_t
+msh_hash_grid__sort_rows_chunk( void* params, uint32_t chunk_idx, uint32_t begin, uint32_t end )
+{
+  (void)chunk_idx;
+  msh_hash_grid_pairs_desc_t* hg_pd = (msh_hash_grid_pairs_desc_t*)params;
+  for( uint32_t i = begin; i < end; ++i )
+  {
+    size_t first = hg_pd->offsets[i];
+    msh_hash_grid__sort_results( hg_pd->distances_sq + first, hg_pd->indices + first,
+                                 hg_pd->offsets[i + 1] - first, MSH_HASH_GRID_SORT_FULL, 0 );
+  }
+  return end - begin;
+}
+
+size_t
+msh_hash_grid_radius_pairs( const msh_hash_grid_t* hg, msh_hash_grid_pairs_desc_t* hg_pd )
+{
+  assert( hg_pd->radius > 0.0f );
+  assert( hg_pd->offsets );
+
+  size_t n_pts   = hg->_n_pts;
+  size_t n_cells = msh_hash_grid_n_cells( hg );
+  void* work_ctx = NULL;
+#ifdef MSH_JOBS
+  work_ctx = hg_pd->work_ctx;
+#endif
+
+  // Cells are identified by their position in 'offsets', recover their grid coordinates
+  uint64_t* cell_bin_idx = (uint64_t*)MSH_HG_MALLOC( MSH_HG_MAX( n_cells, 1 ) * sizeof(uint64_t) );
+  for( size_t i = 0; i < hg->bin_table->_cap; ++i )
+  {
+    if( hg->bin_table->keys[i] ) { cell_bin_idx[ hg->bin_table->vals[i] ] = hg->bin_table->keys[i] - 1; }
+  }
+
+  // Forward half of the neighborhood - offsets that come after the cell in linear bin order,
+  // and that can contain points within radius
+  msh_hash_grid__pairs_task_t task = { 0 };
+  task.hg           = hg;
+  task.hg_pd        = hg_pd;
+  task.cell_bin_idx = cell_bin_idx;
+  task.radius_sq    = hg_pd->radius * hg_pd->radius;
+  int32_t reach     = (int32_t)ceil( hg_pd->radius * hg->_inv_cell_size );
+  int32_t reach_z   = (hg->_pts_dim == 2) ? 0 : reach;
+  for( int32_t oz = 0; oz <= reach_z; ++oz )
+  {
+    for( int32_t oy = (oz > 0) ? -reach : 0; oy <= reach; ++oy )
+    {
+      for( int32_t ox = (oz > 0 || oy > 0) ? -reach : 1; ox <= reach; ++ox )
+      {
+        double gx = MSH_HG_MAX( abs( ox ) - 1, 0 );
+        double gy = MSH_HG_MAX( abs( oy ) - 1, 0 );
+        double gz = MSH_HG_MAX( oz - 1, 0 );
+        double gap_sq = (gx * gx + gy * gy + gz * gz) * hg->cell_size * hg->cell_size;
+        if( gap_sq >= task.radius_sq ) { continue; }
+        msh_hg_array_push( task.nbr_offsets, ox );
+        msh_hg_array_push( task.nbr_offsets, oy );
+        msh_hg_array_push( task.nbr_offsets, oz );
+      }
+    }
+  }
+
+  msh_hash_grid__schedule_t sched = msh_hash_grid__make_schedule( hg, work_ctx, n_cells, 1 );
+  task.buffers = (msh_hash_grid__pair_buffer_t*)MSH_HG_CALLOC( MSH_HG_MAX( sched.n_chunks, 1 ),
+                                                               sizeof(msh_hash_grid__pair_buffer_t) );
+  if( n_cells ) { msh_hash_grid__run( &sched, msh_hash_grid__radius_pairs_chunk, &task ); }
+
+  // Count row sizes, then scatter edges into rows
+  size_t* offsets = hg_pd->offsets;
+  MSH_HG_MEMSET( offsets, 0, (n_pts + 1) * sizeof(size_t) );
+  for( uint32_t c = 0; c < sched.n_chunks; ++c )
+  {
+    msh_hash_grid__pair_buffer_t* buffer = task.buffers + c;
+    for( size_t i = 0; i < msh_hg_array_len( buffer->src ); ++i )
+    {
+      int32_t a = buffer->src[i], b = buffer->dst[i];
+      if( hg_pd->symmetric ) { offsets[a + 1]++; offsets[b + 1]++; }
+      else                   { offsets[MSH_HG_MIN( a, b ) + 1]++; }
+    }
+  }
+  for( size_t i = 0; i < n_pts; ++i ) { offsets[i + 1] += offsets[i]; }
+  size_t n_entries = offsets[n_pts];
+
+  hg_pd->indices      = (int32_t*)MSH_HG_MALLOC( MSH_HG_MAX( n_entries, 1 ) * sizeof(int32_t) );
+  hg_pd->distances_sq = (float*)MSH_HG_MALLOC( MSH_HG_MAX( n_entries, 1 ) * sizeof(float) );
+  size_t* cursor = (size_t*)MSH_HG_MALLOC( MSH_HG_MAX( n_pts, 1 ) * sizeof(size_t) );
+  memcpy( cursor, offsets, n_pts * sizeof(size_t) );
+  for( uint32_t c = 0; c < sched.n_chunks; ++c )
+  {
+    msh_hash_grid__pair_buffer_t* buffer = task.buffers + c;
+    for( size_t i = 0; i < msh_hg_array_len( buffer->src ); ++i )
+    {
+      int32_t a = buffer->src[i], b = buffer->dst[i];
+      float d = buffer->dists[i];
+      if( hg_pd->symmetric || a < b )
+      {
+        hg_pd->indices[cursor[a]] = b; hg_pd->distances_sq[cursor[a]++] = d;
+      }
+      if( hg_pd->symmetric || b < a )
+      {
+        hg_pd->indices[cursor[b]] = a; hg_pd->distances_sq[cursor[b]++] = d;
+      }
+    }
+    msh_hg_array_free( buffer->src );
+    msh_hg_array_free( buffer->dst );
+    msh_hg_array_free( buffer->dists );
+  }
+
+  if( hg_pd->sort && n_pts )
+  {
+    msh_hash_grid__schedule_t sort_sched = msh_hash_grid__make_schedule( hg, work_ctx, n_pts,
+                                                                         MSH_HG_MIN_GRAIN );
+    msh_hash_grid__run( &sort_sched, msh_hash_grid__sort_rows_chunk, hg_pd );
+  }
+
+  MSH_HG_FREE( cursor );
+  MSH_HG_FREE( task.buffers );
+  MSH_HG_FREE( cell_bin_idx );
+  msh_hg_array_free( task.nbr_offsets );
+  return n_entries;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Normal estimation
+//
+// Neighbors are never stored - each one is added to running sums of offsets from the query and
+// their outer products, from which the covariance follows directly. In radius mode points of a
+// cell share the list of cells they need to visit, which is built once per cell.
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Sums of offsets 'd' of neighbors from the query, and of their outer products (xx, xy, xz,
+// yy, yz, zz).
+typedef struct msh_hash_grid__cov_accum
+{
+  double n;
+  double s[3];
+  double ss[6];
+} msh_hash_grid__cov_accum_t;
+
+MSH_HG_INLINE void
+msh_hash_grid__cov_add( msh_hash_grid__cov_accum_t* acc, double dx, double dy, double dz )
+{
+  acc->n += 1.0;
+  acc->s[0] += dx; acc->s[1] += dy; acc->s[2] += dz;
+  acc->ss[0] += dx * dx; acc->ss[1] += dx * dy; acc->ss[2] += dx * dz;
+  acc->ss[3] += dy * dy; acc->ss[4] += dy * dz; acc->ss[5] += dz * dz;
+}
+
+MSH_HG_INLINE void
+msh_hash_grid__cross( const double* a, const double* b, double* c )
+{
+  c[0] = a[1] * b[2] - a[2] * b[1];
+  c[1] = a[2] * b[0] - a[0] * b[2];
+  c[2] = a[0] * b[1] - a[1] * b[0];
+}
+
+// Eigenvector of symmetric matrix 'a' (xx, xy, xz, yy, yz, zz) for eigenvalue 'lambda', as the
+// largest cross product of rows of a - lambda*I. Returns 0 if the eigenvalue is repeated, and
+// the eigenvector is not unique.
+int32_t
+msh_hash_grid__sym3_eigenvector( const double* a, const double lambda, double* v )
+{
+  double r[3][3] = { { a[0] - lambda, a[1], a[2] },
+                     { a[1], a[3] - lambda, a[4] },
+                     { a[2], a[4], a[5] - lambda } };
+  double c[3][3];
+  msh_hash_grid__cross( r[0], r[1], c[0] );
+  msh_hash_grid__cross( r[0], r[2], c[1] );
+  msh_hash_grid__cross( r[1], r[2], c[2] );
+
+  int32_t best = 0;
+  double best_len_sq = 0.0;
+  for( int32_t i = 0; i < 3; ++i )
+  {
+    double len_sq = c[i][0] * c[i][0] + c[i][1] * c[i][1] + c[i][2] * c[i][2];
+    if( len_sq > best_len_sq ) { best_len_sq = len_sq; best = i; }
+  }
+
+  double row_len_sq = 0.0;
+  for( int32_t i = 0; i < 3; ++i )
+  {
+    row_len_sq = MSH_HG_MAX( row_len_sq, r[i][0] * r[i][0] + r[i][1] * r[i][1] + r[i][2] * r[i][2] );
+  }
+  if( best_len_sq <= 1e-20 * row_len_sq * row_len_sq || best_len_sq == 0.0 ) { return 0; }
+
+  double inv_len = 1.0 / sqrt( best_len_sq );
+  v[0] = c[best][0] * inv_len;
+  v[1] = c[best][1] * inv_len;
+  v[2] = c[best][2] * inv_len;
+  return 1;
+}
+
+// Closed form eigen decomposition of symmetric 3x3 matrix 'a' (xx, xy, xz, yy, yz, zz). Writes
+// eigenvalues in increasing order and the eigenvector of the smallest one to 'normal'.
+void
+msh_hash_grid__sym3_smallest_eigenvector( const double* a, double* eigenvalues, double* normal )
+{
+  double p1 = a[1] * a[1] + a[2] * a[2] + a[4] * a[4];
+  double q  = (a[0] + a[3] + a[5]) / 3.0;
+  double e0, e1, e2;
+  if( p1 <= 1e-30 * q * q )
+  {
+    // Diagonal matrix, eigenvectors are the axes
+    int32_t axis = 0;
+    double d[3] = { a[0], a[3], a[5] };
+    if( d[1] < d[axis] ) { axis = 1; }
+    if( d[2] < d[axis] ) { axis = 2; }
+    e0 = d[axis];
+    e2 = MSH_HG_MAX3( d[0], d[1], d[2] );
+    e1 = d[0] + d[1] + d[2] - e0 - e2;
+    normal[0] = (axis == 0); normal[1] = (axis == 1); normal[2] = (axis == 2);
+  }
+  else
+  {
+    double b[6] = { a[0] - q, a[1], a[2], a[3] - q, a[4], a[5] - q };
+    double p2 = b[0] * b[0] + b[3] * b[3] + b[5] * b[5] + 2.0 * p1;
+    double p = sqrt( p2 / 6.0 );
+    double det = b[0] * (b[3] * b[5] - b[4] * b[4]) -
+                 b[1] * (b[1] * b[5] - b[4] * b[2]) +
+                 b[2] * (b[1] * b[4] - b[3] * b[2]);
+    double r = det / (2.0 * p * p * p);
+    r = MSH_HG_MIN( MSH_HG_MAX( r, -1.0 ), 1.0 );
+    double phi = acos( r ) / 3.0;
+    e2 = q + 2.0 * p * cos( phi );
+    e0 = q + 2.0 * p * cos( phi + (2.0 * 3.14159265358979323846 / 3.0) );
+    e1 = 3.0 * q - e0 - e2;
+
+    if( !msh_hash_grid__sym3_eigenvector( a, e0, normal ) )
+    {
+      // Smallest eigenvalue is repeated, any vector orthogonal to the largest eigenvector works
+      double v[3];
+      if( !msh_hash_grid__sym3_eigenvector( a, e2, v ) ) { v[0] = 0.0; v[1] = 0.0; v[2] = 1.0; }
+      double axis[3] = { 0.0, 0.0, 0.0 };
+      axis[ (fabs( v[0] ) < fabs( v[1] )) ? ((fabs( v[0] ) < fabs( v[2] )) ? 0 : 2)
+                                          : ((fabs( v[1] ) < fabs( v[2] )) ? 1 : 2) ] = 1.0;
+      msh_hash_grid__cross( v, axis, normal );
+      double inv_len = 1.0 / sqrt( normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2] );
+      normal[0] *= inv_len; normal[1] *= inv_len; normal[2] *= inv_len;
+    }
+  }
+  eigenvalues[0] = e0;
+  eigenvalues[1] = e1;
+  eigenvalues[2] = e2;
+}
+
+typedef struct msh_hash_grid__normals_task
+{
+  const msh_hash_grid_t* hg;
+  msh_hash_grid_normals_desc_t* hg_nd;
+  const int32_t* positions;
+} msh_hash_grid__normals_task_t;
+
+// Solves for the normal of point 'pt' with original index 'idx' and writes the outputs. Returns 1
+// if the point had enough neighbors.
+size_t
+msh_hash_grid__write_normal( const msh_hash_grid_t* hg, msh_hash_grid_normals_desc_t* hg_nd,
+                             const msh_hg_v3i_t pt, const msh_hash_grid__cov_accum_t* acc )
+{
+  float* normal = hg_nd->normals ? hg_nd->normals + (size_t)pt.i * 3 : NULL;
+  float* curvature = hg_nd->curvatures ? hg_nd->curvatures + pt.i : NULL;
+  if( acc->n < 3.0 )
+  {
+    if( normal )    { normal[0] = 0.0f; normal[1] = 0.0f; normal[2] = 0.0f; }
+    if( curvature ) { *curvature = 0.0f; }
+    return 0;
+  }
+
+  // Covariance about the neighborhood mean, from sums of offsets to the query
+  double inv_n = 1.0 / acc->n;
+  double m[3] = { acc->s[0] * inv_n, acc->s[1] * inv_n, acc->s[2] * inv_n };
+  double cov[6] = { acc->ss[0] * inv_n - m[0] * m[0], acc->ss[1] * inv_n - m[0] * m[1],
+                    acc->ss[2] * inv_n - m[0] * m[2], acc->ss[3] * inv_n - m[1] * m[1],
+                    acc->ss[4] * inv_n - m[1] * m[2], acc->ss[5] * inv_n - m[2] * m[2] };
+
+  double eigenvalues[3], n[3];
+  msh_hash_grid__sym3_smallest_eigenvector( cov, eigenvalues, n );
+
+  if( hg_nd->viewpoint )
+  {
+    double v[3] = { (double)hg_nd->viewpoint[0] - hg->origin[0] - pt.x,
+                    (double)hg_nd->viewpoint[1] - hg->origin[1] - pt.y,
+                    (double)hg_nd->viewpoint[2] - hg->origin[2] - pt.z };
+    if( n[0] * v[0] + n[1] * v[1] + n[2] * v[2] < 0.0 ) { n[0] = -n[0]; n[1] = -n[1]; n[2] = -n[2]; }
+  }
+
+  if( normal ) { normal[0] = (float)n[0]; normal[1] = (float)n[1]; normal[2] = (float)n[2]; }
+  if( curvature )
+  {
+    double sum = eigenvalues[0] + eigenvalues[1] + eigenvalues[2];
+    *curvature = (sum > 0.0) ? (float)( MSH_HG_MAX( eigenvalues[0], 0.0 ) / sum ) : 0.0f;
+  }
+  return 1;
+}
+
+size_t
+msh_hash_grid__normals_radius_chunk( void* params, uint32_t chunk_idx, uint32_t begin, uint32_t end )
+{
+  (void)chunk_idx;
+  msh_hash_grid__normals_task_t* task = (msh_hash_grid__normals_task_t*)params;
+  const msh_hash_grid_t* hg = task->hg;
+  msh_hash_grid_normals_desc_t* hg_nd = task->hg_nd;
+  float radius = hg_nd->radius;
+  float radius_sq = radius * radius;
+  double cs = hg->cell_size;
+  int64_t reach = (int64_t)ceil( radius * hg->_inv_cell_size );
+  const int64_t n_cells[3] = { (int64_t)hg->width, (int64_t)hg->height, (int64_t)hg->depth };
+
+  msh_hg_array(msh_hg__bin_info_t) nbr_bins = NULL;
+  size_t n_valid = 0;
+  for( uint32_t cell_idx = begin; cell_idx < end; ++cell_idx )
+  {
+    msh_hg__bin_info_t bi = hg->offsets[cell_idx];
+    if( !bi.length ) { continue; }
+
+    // Cells within radius of any point of this cell
+    const msh_hg_v3i_t* data = hg->data_buffer + bi.offset;
+    int64_t c[3] = { (int64_t)( (data[0].x - hg->min_pt.x) * hg->_inv_cell_size ),
+                     (int64_t)( (data[0].y - hg->min_pt.y) * hg->_inv_cell_size ),
+                     (int64_t)( (data[0].z - hg->min_pt.z) * hg->_inv_cell_size ) };
+    if( nbr_bins ) { msh_hg_array__hdr( nbr_bins )->len = 0; }
+    for( int64_t cz = MSH_HG_MAX( c[2] - reach, 0 ); cz <= MSH_HG_MIN( c[2] + reach, n_cells[2] - 1 ); ++cz )
+    {
+      for( int64_t cy = MSH_HG_MAX( c[1] - reach, 0 ); cy <= MSH_HG_MIN( c[1] + reach, n_cells[1] - 1 ); ++cy )
+      {
+        for( int64_t cx = MSH_HG_MAX( c[0] - reach, 0 ); cx <= MSH_HG_MIN( c[0] + reach, n_cells[0] - 1 ); ++cx )
+        {
+          double gx = MSH_HG_MAX( (double)msh_abs( cx - c[0] ) - 1.0, 0.0 ) * cs;
+          double gy = MSH_HG_MAX( (double)msh_abs( cy - c[1] ) - 1.0, 0.0 ) * cs;
+          double gz = MSH_HG_MAX( (double)msh_abs( cz - c[2] ) - 1.0, 0.0 ) * cs;
+          if( gx * gx + gy * gy + gz * gz >= radius_sq ) { continue; }
+          uint64_t* nbr_cell_idx = msh_hg_map_get( hg->bin_table, msh_hash_grid__bin_pt( hg, cx, cy, cz ) );
+          if( nbr_cell_idx ) { msh_hg_array_push( nbr_bins, hg->offsets[*nbr_cell_idx] ); }
+        }
+      }
+    }
+
+    size_t n_nbr_bins = msh_hg_array_len( nbr_bins );
+    for( uint32_t i = 0; i < bi.length; ++i )
+    {
+      msh_hg_v3i_t q = data[i];
+      msh_hash_grid__cov_accum_t acc = {0};
+      for( size_t b = 0; b < n_nbr_bins; ++b )
+      {
+        const msh_hg_v3i_t* nbr = hg->data_buffer + nbr_bins[b].offset;
+        for( uint32_t j = 0; j < nbr_bins[b].length; ++j )
+        {
+          float dx = nbr[j].x - q.x;
+          float dy = nbr[j].y - q.y;
+          float dz = nbr[j].z - q.z;
+          if( dx * dx + dy * dy + dz * dz < radius_sq ) { msh_hash_grid__cov_add( &acc, dx, dy, dz ); }
+        }
+      }
+      n_valid += msh_hash_grid__write_normal( hg, hg_nd, q, &acc );
+    }
+  }
+
+  msh_hg_array_free( nbr_bins );
+  return n_valid;
+}
+
+size_t
+msh_hash_grid__normals_knn_chunk( void* params, uint32_t chunk_idx, uint32_t begin, uint32_t end )
+{
+  (void)chunk_idx;
+  msh_hash_grid__normals_task_t* task = (msh_hash_grid__normals_task_t*)params;
+  const msh_hash_grid_t* hg = task->hg;
+  msh_hash_grid_normals_desc_t* hg_nd = task->hg_nd;
+  size_t k = hg_nd->k;
+  msh_hash_grid__approx_t approx = { 1.0f, SIZE_MAX };
+
+  // Only the k best candidates are kept while searching
+  float* dists_sq = (float*)MSH_HG_MALLOC( k * sizeof(float) );
+  int32_t* indices = (int32_t*)MSH_HG_MALLOC( k * sizeof(int32_t) );
+  msh_hash_grid_dist_storage_t storage;
+  msh_hg_array(msh_hash_grid__cell_entry_t) cell_heap = NULL;
+
+  size_t n_valid = 0;
+  for( uint32_t cell_idx = begin; cell_idx < end; ++cell_idx )
+  {
+    msh_hg__bin_info_t bi = hg->offsets[cell_idx];
+    for( uint32_t i = bi.offset; i < bi.offset + bi.length; ++i )
+    {
+      msh_hg_v3i_t q = hg->data_buffer[i];
+      msh_hash_grid_dist_storage_init( &storage, k, dists_sq, indices );
+      msh_hash_grid__knn_search_pt( hg, &q.x, &approx, &storage, &cell_heap );
+
+      msh_hash_grid__cov_accum_t acc = {0};
+      for( size_t j = 0; j < storage.len; ++j )
+      {
+        msh_hg_v3i_t nbr = hg->data_buffer[ task->positions[ indices[j] ] ];
+        msh_hash_grid__cov_add( &acc, nbr.x - q.x, nbr.y - q.y, nbr.z - q.z );
+      }
+      n_valid += msh_hash_grid__write_normal( hg, hg_nd, q, &acc );
+    }
+  }
+
+  msh_hg_array_free( cell_heap );
+  MSH_HG_FREE( dists_sq );
+  MSH_HG_FREE( indices );
+  return n_valid;
+}
+
+size_t
+msh_hash_grid_estimate_normals( const msh_hash_grid_t* hg, msh_hash_grid_normals_desc_t* hg_nd )
+{
+  assert( hg->_pts_dim == 3 );
+  assert( hg_nd->k > 0 || hg_nd->radius > 0.0f );
+
+  size_t n_cells = msh_hash_grid_n_cells( hg );
+  if( !n_cells ) { return 0; }
+
+  void* work_ctx = NULL;
+#ifdef MSH_JOBS
+  work_ctx = hg_nd->work_ctx;
+#endif
+  msh_hash_grid__schedule_t sched = msh_hash_grid__make_schedule( hg, work_ctx, n_cells,
+                                                                  MSH_HG_MIN_GRAIN );
+  msh_hash_grid__normals_task_t task = { hg, hg_nd, NULL };
+  if( !hg_nd->k )
+  {
+    return msh_hash_grid__run( &sched, msh_hash_grid__normals_radius_chunk, &task );
+  }
+
+  // kNN search reports input indices, so positions of points in data buffer are needed to
+  // get back to neighbor coordinates
+  int32_t* positions = (int32_t*)MSH_HG_MALLOC( hg->_n_pts * sizeof(int32_t) );
+  for( size_t i = 0; i < hg->_n_pts; ++i ) { positions[ hg->data_buffer[i].i ] = (int32_t)i; }
+  task.positions = positions;
+  size_t n_valid = msh_hash_grid__run( &sched, msh_hash_grid__normals_knn_chunk, &task );
+  MSH_HG_FREE( positions );
+  return n_valid;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Multi-resolution grid
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Spreads lower 21 bits of 'x' so that there are two zero bits between each of them
+MSH_HG_INLINE uint64_t
+msh_hash_grid__morton_split3( uint64_t x )
+{
+  x &= 0x1fffff;
+  x = (x | x << 32) & 0x1f00000000ffffULL;
+  x = (x | x << 16) & 0x1f0000ff0000ffULL;
+  x = (x | x << 8)  & 0x100f00f00f00f00fULL;
+  x = (x | x << 4)  & 0x10c30c30c30c30c3ULL;
+  x = (x | x << 2)  & 0x1249249249249249ULL;
+  return x;
+}
+
+typedef struct msh_hash_grid__morton_entry
+{
+  uint64_t code;
+  int32_t idx;
+} msh_hash_grid__morton_entry_t;
+
+int32_t
+msh_hash_grid__morton_compare( const void* a, const void* b )
+{
+  uint64_t ca = ((const msh_hash_grid__morton_entry_t*)a)->code;
+  uint64_t cb = ((const msh_hash_grid__morton_entry_t*)b)->code;
+  if( ca != cb ) { return (ca < cb) ? -1 : 1; }
+  return ((const msh_hash_grid__morton_entry_t*)a)->idx - ((const msh_hash_grid__morton_entry_t*)b)->idx;
+}
+
+void
+msh_hash_grid__mr_init( msh_hash_grid_mr_t* hgmr, const msh_hg_real_t* pts, const int32_t n_pts,
+                        const int32_t dim, const float min_radius, const float max_radius )
+{
+  assert( dim == 2 || dim == 3 );
+  assert( min_radius > 0.0f );
+  assert( max_radius >= min_radius );
+
+  hgmr->n_levels = 1;
+  while( min_radius * (1 << (hgmr->n_levels - 1)) < max_radius ) { hgmr->n_levels++; }
+  hgmr->levels = (msh_hash_grid_t*)MSH_HG_CALLOC( hgmr->n_levels, sizeof(msh_hash_grid_t) );
+
+  // Finest level determines cell coordinates, coarser levels just drop the lower bits
+  msh_hash_grid_t* fine = &hgmr->levels[0];
+  msh_hash_grid__compute_bbox( fine, pts, n_pts, dim );
+  fine->cell_size      = 2.0 * min_radius;
+  fine->_inv_cell_size = 1.0f / fine->cell_size;
+  fine->width          = (int)((fine->max_pt.x - fine->min_pt.x) / fine->cell_size + 1.0);
+  fine->height         = (int)((fine->max_pt.y - fine->min_pt.y) / fine->cell_size + 1.0);
+  fine->depth          = (int)((fine->max_pt.z - fine->min_pt.z) / fine->cell_size + 1.0);
+  assert( MSH_HG_MAX3( fine->width, fine->height, fine->depth ) <= (1 << 21) );
+
+  msh_hash_grid__morton_entry_t* entries =
+    (msh_hash_grid__morton_entry_t*)MSH_HG_MALLOC( n_pts * sizeof(msh_hash_grid__morton_entry_t) );
+  uint32_t* cell_coords = (uint32_t*)MSH_HG_MALLOC( 3 * n_pts * sizeof(uint32_t) );
+  for( int32_t i = 0; i < n_pts; ++i )
+  {
+    msh_hg_v3_t pt = msh_hash_grid__to_local( fine, &pts[ dim * i ] );
+    uint32_t* c = cell_coords + 3 * i;
+    c[0] = (uint32_t)( ( pt.x - fine->min_pt.x ) * fine->_inv_cell_size );
+    c[1] = (uint32_t)( ( pt.y - fine->min_pt.y ) * fine->_inv_cell_size );
+    c[2] = (dim == 2) ? 0 : (uint32_t)( ( pt.z - fine->min_pt.z ) * fine->_inv_cell_size );
+    entries[i].code = msh_hash_grid__morton_split3( c[0] ) |
+                      msh_hash_grid__morton_split3( c[1] ) << 1 |
+                      msh_hash_grid__morton_split3( c[2] ) << 2;
+    entries[i].idx  = i;
+  }
+  qsort( entries, n_pts, sizeof(msh_hash_grid__morton_entry_t), msh_hash_grid__morton_compare );
+
+  hgmr->data_buffer = MSH_HG_MALLOC( n_pts * msh_hash_grid__pt_size( dim ) );
+  for( int32_t i = 0; i < n_pts; ++i )
+  {
+    msh_hg_v3_t pt = msh_hash_grid__to_local( fine, &pts[ dim * entries[i].idx ] );
+    msh_hash_grid__store_pt( hgmr->data_buffer, dim, i,
+                             (msh_hg_v3i_t){ pt.x, pt.y, pt.z, entries[i].idx } );
+  }
+
+  // Cell of level l is the Morton code prefix without the lowest 3*l bits, so it is a contiguous
+  // run of the sorted buffer.
+  for( uint32_t l = 0; l < hgmr->n_levels; ++l )
+  {
+    msh_hash_grid_t* hg = &hgmr->levels[l];
+    hg->min_pt           = fine->min_pt;
+    hg->max_pt           = fine->max_pt;
+    hg->origin[0]        = fine->origin[0];
+    hg->origin[1]        = fine->origin[1];
+    hg->origin[2]        = fine->origin[2];
+    hg->cell_size        = fine->cell_size * (1 << l);
+    hg->_inv_cell_size   = 1.0f / hg->cell_size;
+    hg->width            = (fine->width + (1 << l) - 1) >> l;
+    hg->height           = (fine->height + (1 << l) - 1) >> l;
+    hg->depth            = (fine->depth + (1 << l) - 1) >> l;
+    hg->_slab_size       = hg->height * hg->width;
+    hg->_pts_dim         = dim;
+    hg->_n_pts           = n_pts;
+    hg->max_n_pts_in_bin = 0;
+    hg->data_buffer      = (msh_hg_v3i_t*)hgmr->data_buffer;
+    msh_hash_grid__init_threads( hg );
+
+    hg->bin_table = (msh_hg_map_t*)MSH_HG_CALLOC( 1, sizeof(msh_hg_map_t) );
+    msh_hg_map_init( hg->bin_table, 128 );
+    msh_hg_array( msh_hg__bin_info_t ) offsets = NULL;
+
+    uint32_t shift = 3 * l;
+    int32_t run_start = 0;
+    for( int32_t i = 1; i <= n_pts; ++i )
+    {
+      if( i < n_pts && (entries[i].code >> shift) == (entries[run_start].code >> shift) ) { continue; }
+
+      const uint32_t* c = cell_coords + 3 * entries[run_start].idx;
+      uint64_t bin_idx = msh_hash_grid__bin_pt( hg, c[0] >> l, c[1] >> l, c[2] >> l );
+      msh_hg_map_insert( hg->bin_table, bin_idx, msh_hg_array_len( offsets ) );
+      msh_hg__bin_info_t bi = { (uint32_t)run_start, (uint32_t)(i - run_start) };
+      msh_hg_array_push( offsets, bi );
+      hg->max_n_pts_in_bin = MSH_HG_MAX( hg->max_n_pts_in_bin, bi.length );
+      run_start = i;
+    }
+
+    // Copy out of the growable array, so that the level can be released like any other grid
+    size_t n_bins = msh_hg_array_len( offsets );
+    hg->offsets = (msh_hg__bin_info_t*)MSH_HG_MALLOC( MSH_HG_MAX( n_bins, 1 ) * sizeof(msh_hg__bin_info_t) );
+    if( n_bins ) { memcpy( hg->offsets, offsets, n_bins * sizeof(msh_hg__bin_info_t) ); }
+    msh_hg_array_free( offsets );
+  }
+
+  MSH_HG_FREE( entries );
+  MSH_HG_FREE( cell_coords );
+}
+
+void
+msh_hash_grid_mr_init_2d( msh_hash_grid_mr_t* hgmr, const msh_hg_real_t* pts, const int32_t n_pts,
+                          const float min_radius, const float max_radius )
+{
+  msh_hash_grid__mr_init( hgmr, pts, n_pts, 2, min_radius, max_radius );
+}
+
+void
+msh_hash_grid_mr_init_3d( msh_hash_grid_mr_t* hgmr, const msh_hg_real_t* pts, const int32_t n_pts,
+                          const float min_radius, const float max_radius )
+{
+  msh_hash_grid__mr_init( hgmr, pts, n_pts, 3, min_radius, max_radius );
+}
+
+void
+msh_hash_grid_mr_term( msh_hash_grid_mr_t* hgmr )
+{
+  for( uint32_t l = 0; l < hgmr->n_levels; ++l )
+  {
+    hgmr->levels[l].data_buffer = NULL;
+    msh_hash_grid_term( &hgmr->levels[l] );
+  }
+  MSH_HG_FREE( hgmr->levels );
+  MSH_HG_FREE( hgmr->data_buffer );
+  hgmr->levels      = NULL;
+  hgmr->data_buffer = NULL;
+  hgmr->n_levels    = 0;
+}
+
+const msh_hash_grid_t*
+msh_hash_grid_mr_select_level( const msh_hash_grid_mr_t* hgmr, const float radius )
+{
+  // Levels double in size, so pick the one where 2*radius is closest in log scale
+  uint32_t level = 0;
+  double target = 2.0 * radius;
+  while( level + 1 < hgmr->n_levels &&
+         hgmr->levels[level].cell_size * 1.41421356 < target ) { level++; }
+  return &hgmr->levels[level];
+}
+
+size_t
+msh_hash_grid_mr_radius_search( const msh_hash_grid_mr_t* hgmr,
+                                msh_hash_grid_search_desc_t* hg_sd )
+{
+  return msh_hash_grid_radius_search( msh_hash_grid_mr_select_level( hgmr, hg_sd->radius ), hg_sd );
+}
+
+size_t
+msh_hash_grid_mr_knn_search( const msh_hash_grid_mr_t* hgmr,
+                             msh_hash_grid_search_desc_t* hg_sd )
+{
+  const msh_hash_grid_t* hg = &hgmr->levels[0];
+  if( hg_sd->radius > 0.0f ) { hg = msh_hash_grid_mr_select_level( hgmr, hg_sd->radius ); }
+  return msh_hash_grid_knn_search( hg, hg_sd );
+}
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 // msh_array / msh_hg_map implementation
@@ -7,15 +7,15 @@
 [x] When enqueing wait if the queue is full - Remove spin printf
 [ ] Malloc overwrites
 [ ] Header / docs
-[ ] Error handling - thread detaching?
+[x] Error handling - thread detaching?
 
-[ ] Remove deadlock if a queue size == 1
-[ ] Add Multiple priority queuesg
+[x] Remove deadlock if a queue size == 1
+[x] Add Multiple priority queuesg
 [ ] Improve the test code
 [x] Implement functions wrappers fro winapi
 [x] Implement function wrappers for posix
-[ ] Multiple Producer / Multiple Consumer Queues?
-[ ] Async reading - check sokol async
+[x] Multiple Producer / Multiple Consumer Queues?
+[x] Async reading - check sokol async
 [ ] Avoid recompiling extra code if msh_std is present 
 [ ] Compare to fibers: https://github.com/JodiTheTigger/sewing
 
@@ -30,8 +30,15 @@ http://www.1024cores.net/home/lock-free-algorithms/queues/bounded-mpmc-queue
 #ifndef MSH_JOBS
 #define MSH_JOBS
 
+#ifndef MSH_JOBS_QUEUE_SIZE
 #define MSH_JOBS_QUEUE_SIZE 1024
+#endif
 #define MSH_JOBS_DEFAULT_THREAD_COUNT 0
+#define MSH_JOBS_DEFAULT_IO_THREAD_COUNT 1
+#ifndef MSH_JOBS_DEFAULT_SCRATCH_SIZE
+#define MSH_JOBS_DEFAULT_SCRATCH_SIZE (1 << 20)
+#endif
+#define MSH_JOBS_EXTERNAL_THREAD_IDX -1
 #define MSH_JOBS_JOB_SIGNATURE(name) uint32_t name(int thread_idx, void* params)
 typedef uint32_t (*msh_jobs_job_signature_t)( int thread_idx, void* data);
 
@@ -70,69 +77,235 @@ typedef uint32_t (*msh_jobs_job_signature_t)( int thread_idx, void* data);
 #define WIN32_LEAN_AND_MEAN
 #endif
 #include "windows.h"
+#pragma comment(lib, "Synchronization.lib") // WaitOnAddress
 
 #elif MSH_JOBS_PLATFORM_LINUX
 #include <pthread.h>    // threads
-#include <semaphore.h>  // semaphore
 #include <x86intrin.h>  // fences
 #include <unistd.h>     // sysconf
+#include <sched.h>      // sched_yield
+#include <fcntl.h>      // open - topology from sysfs
+#include <time.h>       // clock_gettime - tracing
+#include <errno.h>
+#include <sys/syscall.h>   // futex, affinity, io_uring
+#include <sys/mman.h>      // io_uring rings
+#include <sys/stat.h>      // fstat
+#include <sys/uio.h>       // iovec
+#include <linux/futex.h>
+#ifndef MSH_JOBS_NO_IO_URING
+#include <linux/io_uring.h>
+#endif
 
 #elif MSH_JOBS_PLATFORM_MACOS
 #include <pthread.h>    // threads
-#include <semaphore.h>  // semaphore
 #include <x86intrin.h>  // fences
 #include <unistd.h>     // sysconf
+#include <sched.h>      // sched_yield
 #include <sys/sysctl.h>
+#include <time.h>       // clock_gettime - tracing
+#include <errno.h>
+#include <fcntl.h>      // open
+#include <sys/stat.h>   // fstat
 #else
 #error "MSH_JOBS: Platform not supported!"
 #endif
 
 #if MSH_JOBS_PLATFORM_WINDOWS
 
-typedef HANDLE msh_jobs_semaphore_t;
 typedef HANDLE msh_jobs_thread_t;
+typedef DWORD msh_jobs_thread_id_t;
+typedef HANDLE msh_jobs_file_t;
 #define MSH_JOBS_READ_WRITE_BARRIER() _mm_mfence(); _ReadWriteBarrier()
-#define MSH_JOBS_READ_BARRIER() _mm_rfence(); _ReadBarrier()
+#define MSH_JOBS_READ_BARRIER() _mm_lfence(); _ReadBarrier()
 #define MSH_JOBS_WRITE_BARRIER() _mm_sfence(); _WriteBarrier()
+#define MSH_JOBS_THREAD_LOCAL __declspec(thread)
 typedef DWORD (*msh_jobs_thrd_proc_t)(void *params);
 
 #elif MSH_JOBS_PLATFORM_POSIX
 
-typedef sem_t msh_jobs_semaphore_t;
 typedef pthread_t msh_jobs_thread_t;
-#define MSH_JOBS_READ_WRITE_BARRIER() _mm_fence(); __asm__ volatile("" ::: "memory")
-#define MSH_JOBS_READ_BARRIER() _mm_rfence(); __asm__ volatile("" ::: "memory")
+typedef pthread_t msh_jobs_thread_id_t;
+typedef int msh_jobs_file_t;
+#define MSH_JOBS_READ_WRITE_BARRIER() _mm_mfence(); __asm__ volatile("" ::: "memory")
+#define MSH_JOBS_READ_BARRIER() _mm_lfence(); __asm__ volatile("" ::: "memory")
 #define MSH_JOBS_WRITE_BARRIER() _mm_sfence(); __asm__ volatile("" ::: "memory")
+#define MSH_JOBS_THREAD_LOCAL __thread
 typedef void* (*msh_jobs_thrd_proc_t)(void *params);
 
 #endif
 
 
-// NOTE(maciej): What other info about the processor we might want to have?
+typedef struct msh_jobs_logical_core_info
+{
+  uint32_t os_idx;       // cpu number as used by the OS, i.e. for pinning. Windows: within 'group'
+  uint32_t group;        // Windows processor group, 0 elsewhere
+  uint32_t core_idx;     // physical core, unique across packages
+  uint32_t package_idx;
+  uint32_t numa_node;    // 0 .. numa_node_count-1
+  uint32_t smt_idx;      // 0 for the first hardware thread of a physical core
+} msh_jobs_logical_core_info_t;
+
+// NOTE(maciej): Counts and cache sizes are filled on all platforms. The per logical core table
+// is filled on Linux (sysfs) and Windows; it is empty ('core_table_count' == 0) otherwise.
+// The table holds all logical cores found, and is released with msh_jobs_free_processor_info -
+// msh_jobs_term_ctx does that for the context's own copy. On Windows it covers all processor
+// groups, so machines with more than 64 logical cores are described fully as well.
+// Cache sizes are in bytes, per single cache instance, 0 when unknown.
 typedef struct msh_jobs_processor_info
 {
   uint32_t logical_core_count;
+  uint32_t physical_core_count;
+  uint32_t package_count;
+  uint32_t numa_node_count;
+  uint64_t l1d_cache_size;
+  uint64_t l2_cache_size;
+  uint64_t l3_cache_size;
+
+  uint32_t core_table_count;
+  msh_jobs_logical_core_info_t* core_table;
 } msh_jobs_processor_info_t;
 
+// NOTE(maciej): Counts unfinished jobs of a batch. Zero-initialize, pass to the '_counted' and
+// job graph functions, and wait for it with msh_jobs_wait_for_counter.
+typedef struct msh_jobs_counter
+{
+  uint32_t volatile value;
+} msh_jobs_counter_t;
+
 typedef struct msh_jobs_job_entry
 {
   uint32_t (*task)(int32_t, void*);
   void* data;
+  msh_jobs_counter_t* counter;
 } msh_jobs_job_entry_t;
 
+#ifndef MSH_JOBS_MAX_SUCCESSORS
+#define MSH_JOBS_MAX_SUCCESSORS 16
+#endif
+
+// NOTE(maciej): Node of a job graph. Storage is owned by the caller and has to outlive the job.
+typedef struct msh_jobs_job
+{
+  msh_jobs_job_signature_t task;
+  void* data;
+  msh_jobs_counter_t* counter;
+  struct msh_jobs_ctx* ctx;
+
+  uint32_t volatile n_pending;
+  uint32_t n_successors;
+  struct msh_jobs_job* successors[MSH_JOBS_MAX_SUCCESSORS];
+} msh_jobs_job_t;
+
+// NOTE(maciej): Chase-Lev work stealing deque. The owning thread pushes and pops jobs at the
+// bottom, other threads steal from the top. 'top' and 'bottom' live on separate cache lines, so
+// owner's pushes and pops do not bounce the line that thieves are fighting over.
+typedef struct msh_jobs_deque
+{
+  int64_t volatile top;
+  char _pad0[64 - sizeof(int64_t)];
+  int64_t volatile bottom;
+  char _pad1[64 - sizeof(int64_t)];
+  int64_t mask;
+  msh_jobs_job_entry_t* entries;
+} msh_jobs_deque_t;
+
+// NOTE(maciej): Bounded multi-producer / multi-consumer queue (Dmitry Vyukov's design, see link
+// at the top). Takes jobs pushed by threads that do not own a deque in the context.
+typedef struct msh_jobs_mpmc_cell
+{
+  int64_t volatile sequence;
+  msh_jobs_job_entry_t entry;
+} msh_jobs_mpmc_cell_t;
+
+typedef struct msh_jobs_mpmc_queue
+{
+  int64_t volatile enqueue_pos;
+  char _pad0[64 - sizeof(int64_t)];
+  int64_t volatile dequeue_pos;
+  char _pad1[64 - sizeof(int64_t)];
+  int64_t mask;
+  msh_jobs_mpmc_cell_t* cells;
+} msh_jobs_mpmc_queue_t;
+
+// NOTE(maciej): Eventcount - lets idle workers sleep without a semaphore post per job. Waiters
+// register, re-check the queues and sleep only if 'epoch' did not move in the meantime. Pushers
+// only bump the epoch and make a syscall when somebody is registered.
+typedef struct msh_jobs_eventcount
+{
+  uint32_t volatile epoch;
+  uint32_t volatile n_waiters;
+#if !MSH_JOBS_PLATFORM_WINDOWS && !MSH_JOBS_PLATFORM_LINUX
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+#endif
+} msh_jobs_eventcount_t;
+
 typedef struct msh_jobs_work_queue
 {
   uint32_t volatile completion_count;
   uint32_t volatile completion_goal;
-  uint32_t volatile next_entry_to_write;
-  uint32_t volatile next_entry_to_read;
 
-  uint32_t volatile max_job_count;
-  msh_jobs_job_entry_t* entries;
-  msh_jobs_semaphore_t semaphore_handle;
+  uint32_t deque_count;
+  msh_jobs_deque_t* deques;
+  msh_jobs_mpmc_queue_t injection_queue;
+  uint32_t node_queue_count;
+  msh_jobs_mpmc_queue_t* node_queues;
+  msh_jobs_mpmc_queue_t high_priority_queue;
+  msh_jobs_mpmc_queue_t background_queue;
+  msh_jobs_eventcount_t event;
+
+  msh_jobs_mpmc_queue_t io_queue;
+  msh_jobs_eventcount_t io_event;
 } msh_jobs_work_queue_t;
 
-struct msh_jobs_thread_into;
+// NOTE(maciej): Async read. Fill in the first block of fields and keep the struct alive until
+// the continuation has run. The continuation is pushed as a regular job once the data arrived,
+// and gets this struct as its 'params'.
+typedef struct msh_jobs_read
+{
+  msh_jobs_file_t file;
+  void* buffer;
+  uint64_t offset;
+  uint64_t size;
+  msh_jobs_job_signature_t continuation; // may be NULL
+  void* data;                            // for the continuation
+  msh_jobs_counter_t* counter;           // may be NULL, drops once the continuation finished
+
+  int64_t volatile result;               // bytes read, short only at the end of file, or -errno
+  struct msh_jobs_ctx* ctx;
+#if MSH_JOBS_PLATFORM_LINUX
+  struct iovec iov;
+#endif
+} msh_jobs_read_t;
+
+#if MSH_JOBS_PLATFORM_LINUX
+// NOTE(maciej): io_uring set up with raw syscalls. Any thread may submit, under 'submit_mutex';
+// a single completion thread reaps the results and pushes the continuations.
+typedef struct msh_jobs_io_ring
+{
+  int32_t fd;                     // -1 if reads go to the I/O threads
+  uint32_t volatile n_in_flight;
+  uint32_t max_in_flight;
+  uint32_t sq_mask;
+  uint32_t cq_mask;
+  uint32_t volatile* sq_head;
+  uint32_t volatile* sq_tail;
+  uint32_t* sq_array;
+  uint32_t volatile* cq_head;
+  uint32_t volatile* cq_tail;
+  void* sqes;
+  void* cqes;
+  void* sq_map;
+  size_t sq_map_size;
+  void* cq_map;
+  size_t cq_map_size;
+  size_t sqes_map_size;
+  pthread_mutex_t submit_mutex;
+  msh_jobs_thread_t completion_thread;
+} msh_jobs_io_ring_t;
+#endif
+
+struct msh_jobs_thread_info;
 
 typedef struct msh_jobs_ctx
 {
@@ -141,23 +314,203 @@ typedef struct msh_jobs_ctx
 
   struct msh_jobs_thread_info* thread_infos;
   uint32_t thread_count;
+  uint32_t io_thread_count;
+  uint64_t scratch_size;
+  uint32_t trace_size;
+  uint64_t trace_start;
+  msh_jobs_thread_id_t main_thread_id;
+  uint32_t volatile stop_requested;
+#if MSH_JOBS_PLATFORM_LINUX
+  msh_jobs_io_ring_t io_ring;
+#endif
 } msh_jobs_ctx_t;
 
+// NOTE(maciej): Bump allocator owned by a single thread. Allocated on first use.
+typedef struct msh_jobs_scratch
+{
+  uint8_t* base;
+  uint64_t capacity;
+  uint64_t used;
+} msh_jobs_scratch_t;
+
+// NOTE(maciej): Tracing. Each thread appends events to its own ring buffer and nobody else ever
+// writes to it, so recording takes no locks or atomics. Once a buffer is full the oldest events
+// are overwritten. Times are in nanoseconds of a monotonic clock.
+typedef enum msh_jobs_trace_event_type
+{
+  MSH_JOBS_TRACE_JOB,
+  MSH_JOBS_TRACE_IDLE,   // worker slept waiting for jobs
+} msh_jobs_trace_event_type_t;
+
+typedef struct msh_jobs_trace_event
+{
+  uint64_t start;
+  uint64_t end;
+  msh_jobs_job_signature_t task;
+  uint32_t type;
+  uint32_t queue_depth;  // jobs left in the thread's own deque when the event started
+} msh_jobs_trace_event_t;
+
+typedef struct msh_jobs_trace_buffer
+{
+  msh_jobs_trace_event_t* events;
+  uint64_t mask;
+  uint64_t volatile n_written;
+} msh_jobs_trace_buffer_t;
+
+typedef struct msh_jobs_thread_stats
+{
+  uint64_t n_jobs;
+  uint64_t n_steals;
+  uint64_t n_contended_steals;
+  uint64_t n_waits;
+  uint64_t idle_time;
+} msh_jobs_thread_stats_t;
+
 typedef struct msh_jobs_thread_info
 {
   msh_jobs_ctx_t *ctx;
   uint32_t idx;
+  uint32_t rand_state;
+  uint32_t numa_node;
+  int32_t cpu;           // os index of the logical core the thread is pinned to, -1 if not pinned
+  uint32_t cpu_group;    // processor group of 'cpu' (Windows only)
+  msh_jobs_scratch_t scratch;
+  msh_jobs_trace_buffer_t trace;
+  msh_jobs_thread_stats_t stats;
   msh_jobs_thread_t handle;
 } msh_jobs_thread_info_t;
 
+typedef struct msh_jobs_ctx_desc
+{
+  uint32_t n_threads;    // number of workers, 0 - one per logical core except the calling thread
+  int32_t pin_threads;   // pin each worker to one logical core (Linux and Windows only)
+  uint32_t n_io_threads; // number of threads that only run msh_jobs_push_io_work jobs
+  uint64_t scratch_size; // bytes of scratch memory per thread, 0 - MSH_JOBS_DEFAULT_SCRATCH_SIZE
+  uint32_t trace_size;   // trace events kept per thread, rounded up to a power of two, 0 - off
+  uint32_t io_ring_size; // Linux: io_uring depth for msh_jobs_read_async, 0 - use I/O threads
+} msh_jobs_ctx_desc_t;
+
+typedef enum msh_jobs_priority
+{
+  MSH_JOBS_PRIORITY_HIGH,
+  MSH_JOBS_PRIORITY_NORMAL,
+  MSH_JOBS_PRIORITY_BACKGROUND,
+  MSH_JOBS_PRIORITY_COUNT
+} msh_jobs_priority_t;
+
 
 char*   msh_jobs_get_platform_name();
 int32_t msh_jobs_get_processor_info( msh_jobs_processor_info_t* info );
+void    msh_jobs_free_processor_info( msh_jobs_processor_info_t* info );
 int32_t msh_jobs_init_ctx( msh_jobs_ctx_t* ctx, uint32_t n_threads );
+
+// NOTE(maciej): With 'pin_threads', workers are spread over NUMA nodes and physical cores before
+// any core gets a second worker on its SMT sibling. Each thread is assigned the NUMA node it runs
+// on, and prefers jobs pushed to that node with msh_jobs_push_work_on_node, as well as stealing
+// from workers on its own node. Without pinning all threads are considered to live on node 0.
+int32_t msh_jobs_init_ctx_desc( msh_jobs_ctx_t* ctx, const msh_jobs_ctx_desc_t* desc );
+// NOTE(maciej): Each thread owns a deque of jobs; idle threads steal from random victims. Jobs
+// can push sub-jobs from inside their task function - these land on the running worker's deque.
+// The thread that called msh_jobs_init_ctx owns deque 0. Any other thread may push as well; its
+// jobs go through a shared bounded queue, and if that is full the pushing thread runs the job
+// itself, with thread_idx set to MSH_JOBS_EXTERNAL_THREAD_IDX. Such threads do not run other
+// jobs while waiting for work to complete.
 int32_t msh_jobs_push_work( msh_jobs_ctx_t* ctx, msh_jobs_job_signature_t task, void* data );
 void    msh_jobs_complete_all_work( msh_jobs_ctx_t* ctx );
+
+// Pushes a job for the threads of a NUMA node, i.e. to process data that lives there. Threads
+// of other nodes only take it once they run out of work on their own node. 'counter' may be NULL.
+int32_t  msh_jobs_push_work_on_node( msh_jobs_ctx_t* ctx, uint32_t numa_node,
+                                     msh_jobs_job_signature_t task, void* data,
+                                     msh_jobs_counter_t* counter );
+uint32_t msh_jobs_get_thread_numa_node( msh_jobs_ctx_t* ctx, int32_t thread_idx );
+
+// NOTE(maciej): Everything else pushes jobs with normal priority. Workers look for high priority
+// jobs before each job they take, even ahead of their own deque, and take background jobs only
+// when there is nothing else to do. Running jobs are never interrupted, and jobs pushed from
+// within a high priority job are normal ones, unless pushed with this function. 'counter' may
+// be NULL.
+int32_t msh_jobs_push_work_priority( msh_jobs_ctx_t* ctx, msh_jobs_priority_t priority,
+                                     msh_jobs_job_signature_t task, void* data,
+                                     msh_jobs_counter_t* counter );
+
+// NOTE(maciej): Blocking work, like reading files, goes to a separate pool of I/O threads, so it
+// never occupies the compute workers. msh_jobs_init_ctx creates MSH_JOBS_DEFAULT_IO_THREAD_COUNT
+// of them, msh_jobs_init_ctx_desc 'n_io_threads'. I/O jobs get thread indices after the workers,
+// i.e. thread_count + 1 .. thread_count + io_thread_count, and behave like jobs of an external
+// thread when pushing work. With no I/O threads, or a full I/O queue, the calling thread runs
+// the job itself. 'counter' may be NULL.
+int32_t msh_jobs_push_io_work( msh_jobs_ctx_t* ctx, msh_jobs_job_signature_t task, void* data,
+                               msh_jobs_counter_t* counter );
+
+// NOTE(maciej): Temporary memory for the job running on 'thread_idx'. Everything allocated by a
+// job is released when the job returns - for parallel loops, when the 'fn' call for a chunk
+// returns - so there is nothing to free. Allocations are 16 byte aligned. Returns NULL when the
+// thread's 'scratch_size' bytes are used up, and for MSH_JOBS_EXTERNAL_THREAD_IDX, so callers
+// should be ready to fall back to malloc.
+void*   msh_jobs_scratch_alloc( msh_jobs_ctx_t* ctx, int32_t thread_idx, uint64_t size );
+
+// NOTE(maciej): With 'trace_size' set, every thread records the jobs it runs and the periods it
+// sleeps, and counts steals and waits in its 'stats'. This writes what is currently in the
+// buffers as Chrome trace event JSON, to be opened in chrome://tracing or ui.perfetto.dev. Jobs
+// are named after their task function's address. Safe to call while jobs run - events recorded
+// during the call may be missing. Needs <stdio.h> included before the implementation.
+int32_t msh_jobs_write_trace( msh_jobs_ctx_t* ctx, const char* filename );
+
+// NOTE(maciej): Reads 'size' bytes at 'offset' without blocking the calling thread, and pushes
+// read->continuation once done, so that many reads can be in flight while already arrived data
+// is being processed. With 'io_ring_size' set on Linux reads go through io_uring, and a single
+// thread waits for all completions. Otherwise, or when io_uring is unavailable or has
+// 'io_ring_size' * 2 reads in flight already, the read is a pread on one of the I/O threads.
+// Reads count as work for msh_jobs_complete_all_work.
+int32_t msh_jobs_read_async( msh_jobs_ctx_t* ctx, msh_jobs_read_t* read );
+int32_t msh_jobs_file_open( msh_jobs_file_t* file, const char* path );
+int64_t msh_jobs_file_size( msh_jobs_file_t file );
+void    msh_jobs_file_close( msh_jobs_file_t file );
 void    msh_jobs_term_ctx( msh_jobs_ctx_t* ctx );
 
+// NOTE(maciej): Fork/join. Jobs pushed with a counter decrement it once they finish, and
+// msh_jobs_wait_for_counter runs other jobs until it drops to zero. Unlike
+// msh_jobs_complete_all_work, waiting is fine from inside a job, and independent batches can
+// overlap.
+int32_t msh_jobs_push_work_counted( msh_jobs_ctx_t* ctx, msh_jobs_job_signature_t task, void* data,
+                                    msh_jobs_counter_t* counter );
+void    msh_jobs_wait_for_counter( msh_jobs_ctx_t* ctx, msh_jobs_counter_t* counter );
+
+// NOTE(maciej): Job graphs. Initialize the jobs, declare the edges with msh_jobs_job_depends_on
+// and submit them in any order. A job is pushed once all its predecessors have finished. All
+// edges of a job have to be declared before the job or any of its predecessors is submitted.
+// 'counter' may be NULL.
+void    msh_jobs_job_init( msh_jobs_job_t* job, msh_jobs_job_signature_t task, void* data,
+                           msh_jobs_counter_t* counter );
+void    msh_jobs_job_depends_on( msh_jobs_job_t* job, msh_jobs_job_t* predecessor );
+int32_t msh_jobs_submit_job( msh_jobs_ctx_t* ctx, msh_jobs_job_t* job );
+
+// NOTE(maciej): Data parallel loops over [begin, end). The range is split lazily - a thread only
+// splits off the upper half of its range when its own deque has run dry (i.e. somebody stole the
+// previous half), and otherwise keeps processing 'grain' sized chunks itself. Pass grain = 0 to
+// derive it from the thread count. Calling thread participates and returns once all is done.
+//
+// For the reduce variant, 'result' holds the identity on input and the reduction on output.
+// Every chunk is accumulated with 'fn' into a partial result initialized to the identity, and
+// partials are merged with 'combine' in the order of their ranges, so 'combine' only has to be
+// associative. 'result_size' can be at most MSH_JOBS_MAX_REDUCE_SIZE bytes.
+#ifndef MSH_JOBS_MAX_REDUCE_SIZE
+#define MSH_JOBS_MAX_REDUCE_SIZE 64
+#endif
+
+typedef void (*msh_jobs_range_fn_t)( int32_t thread_idx, uint64_t begin, uint64_t end, void* user );
+typedef void (*msh_jobs_reduce_fn_t)( int32_t thread_idx, uint64_t begin, uint64_t end,
+                                      void* partial, void* user );
+typedef void (*msh_jobs_combine_fn_t)( void* dst, const void* src, void* user );
+
+void    msh_jobs_parallel_for( msh_jobs_ctx_t* ctx, uint64_t begin, uint64_t end, uint64_t grain,
+                               msh_jobs_range_fn_t fn, void* user );
+void    msh_jobs_parallel_reduce( msh_jobs_ctx_t* ctx, uint64_t begin, uint64_t end, uint64_t grain,
+                                  msh_jobs_reduce_fn_t fn, msh_jobs_combine_fn_t combine,
+                                  void* result, size_t result_size, void* user );
+
 // sew_stitches_and_wait(sewing, jobs, 10); //-> Nice api, PAss array of jobs and run
 // job structure
 
@@ -173,6 +526,8 @@ typedef enum msh_jobs_error_codes
   MSH_JOBS_FAILED_TO_CREATE_THREAD = 1,
   MSH_JOBS_FAILED_TO_CREATE_SEMAPHORE = 2,
   MSH_JOBS_OUT_OF_MEMORY = 3,
+  MSH_JOBS_FAILED_TO_WRITE_FILE = 4,
+  MSH_JOBS_FAILED_TO_OPEN_FILE = 5,
 } msh_jobs_error_codes_t;
 
 int32_t
@@ -201,254 +556,1973 @@ msh_jobs_thread_detach( msh_jobs_thread_t *thread )
 #endif
 }
 
-int32_t
-msh_jobs_semaphore_create( msh_jobs_semaphore_t* sem, uint32_t initial_count, uint32_t maximum_count )
+void
+msh_jobs_thread_join( msh_jobs_thread_t *thread )
 {
-  int32_t err = MSH_JOBS_NO_ERR;
 #if MSH_JOBS_PLATFORM_WINDOWS
-  *sem = CreateSemaphoreA( NULL, initial_count, maximum_count, NULL );
-  if (*sem == NULL) { err = MSH_JOBS_FAILED_TO_CREATE_SEMAPHORE; }
+  WaitForSingleObject( *thread, INFINITE );
+  CloseHandle( *thread );
 #else
-  (void)initial_count;
-  (void)maximum_count;
-  int32_t pthread_err = sem_init( sem, 0, 0 );
-  if (pthread_err) { err = MSH_JOBS_FAILED_TO_CREATE_SEMAPHORE; }
+  pthread_join( *thread, NULL );
 #endif
-  return err;
 }
 
-void
-msh_jobs_semaphore_destroy( msh_jobs_semaphore_t* sem )
+uint32_t
+msh_jobs_atomic_add( uint32_t volatile *value, uint32_t val )
 {
 #if MSH_JOBS_PLATFORM_WINDOWS
-  CloseHandle( *sem );
+  return (uint32_t)InterlockedAdd( (LONG volatile*)value, val );
 #else
-  sem_destroy( sem );
+  return (uint32_t)__sync_fetch_and_add( value, val );
 #endif
 }
 
-void
-msh_jobs_semaphore_release( msh_jobs_semaphore_t* sem, int32_t release_count )
+uint32_t
+msh_jobs_atomic_increment( uint32_t volatile *value )
 {
 #if MSH_JOBS_PLATFORM_WINDOWS
-  ReleaseSemaphore( *sem, release_count, NULL );
+  return (uint32_t)InterlockedIncrement( (LONG volatile*)value );
 #else
-  (void)release_count;
-  sem_post( sem );
+  return (uint32_t)__sync_fetch_and_add( value, 1 );
 #endif
 }
 
-void
-msh_jobs_semaphore_wait( msh_jobs_semaphore_t* sem )
+// NOTE(maciej): Returns the decremented value
+uint32_t
+msh_jobs_atomic_decrement( uint32_t volatile *value )
 {
 #if MSH_JOBS_PLATFORM_WINDOWS
-  WaitForSingleObjectEx( *sem, INFINITE, FALSE );
+  return (uint32_t)InterlockedDecrement( (LONG volatile*)value );
 #else
-  sem_wait( sem );
+  return (uint32_t)__sync_sub_and_fetch( value, 1 );
 #endif
 }
 
 uint32_t
-msh_jobs_atomic_add( uint32_t volatile *value, uint32_t val )
+msh_jobs_atomic_compare_exchange( uint32_t volatile *dest, uint32_t new_val, uint32_t old_val )
 {
 #if MSH_JOBS_PLATFORM_WINDOWS
-  return (uint32_t)InterlockedAdd( (LONG volatile*)value, val );
+  return (uint32_t)InterlockedCompareExchange( (LONG volatile *)dest, new_val, old_val );
 #else
-  return (uint32_t)__sync_fetch_and_add( value, val );
+  return (uint32_t)__sync_val_compare_and_swap( dest, old_val, new_val );
 #endif
 }
 
-uint32_t
-msh_jobs_atomic_increment( uint32_t volatile *value )
+int64_t
+msh_jobs_atomic_compare_exchange64( int64_t volatile *dest, int64_t new_val, int64_t old_val )
 {
 #if MSH_JOBS_PLATFORM_WINDOWS
-  return (uint32_t)InterlockedIncrement( (LONG volatile*)value );
+  return (int64_t)InterlockedCompareExchange64( (LONG64 volatile *)dest, new_val, old_val );
 #else
-  return (uint32_t)__sync_fetch_and_add( value, 1 );
+  return (int64_t)__sync_val_compare_and_swap( dest, old_val, new_val );
 #endif
 }
 
-uint32_t
-msh_jobs_atomic_compare_exchange( uint32_t volatile *dest, uint32_t new_val, uint32_t old_val )
+void
+msh_jobs__sleep(uint64_t ms) {
+#if MSH_JOBS_PLATFORM_WINDOWS
+  Sleep((DWORD)ms);
+#elif MSH_JOBS_PLATFORM_POSIX
+  usleep(1000 * ms);
+#endif
+}
+
+uint64_t
+msh_jobs__time_now()
 {
 #if MSH_JOBS_PLATFORM_WINDOWS
-  return (uint32_t)InterlockedCompareExchange( (LONG volatile *)dest, new_val, old_val );
+  static LARGE_INTEGER freq = {0};
+  if( !freq.QuadPart ) { QueryPerformanceFrequency( &freq ); }
+  LARGE_INTEGER now;
+  QueryPerformanceCounter( &now );
+  uint64_t sec = (uint64_t)now.QuadPart / (uint64_t)freq.QuadPart;
+  uint64_t rem = (uint64_t)now.QuadPart % (uint64_t)freq.QuadPart;
+  return sec * 1000000000ull + rem * 1000000000ull / (uint64_t)freq.QuadPart;
 #else
-  return (uint32_t)__sync_val_compare_and_swap( dest, old_val, new_val );
+  struct timespec now;
+  clock_gettime( CLOCK_MONOTONIC, &now );
+  return (uint64_t)now.tv_sec * 1000000000ull + (uint64_t)now.tv_nsec;
 #endif
 }
 
 void
-msh_jobs__sleep(uint64_t ms) {
+msh_jobs__yield() {
 #if MSH_JOBS_PLATFORM_WINDOWS
-  Sleep((DWORD)ms);
+  SwitchToThread();
 #elif MSH_JOBS_PLATFORM_POSIX
-  usleep(1000 * ms);
+  sched_yield();
+#endif
+}
+
+msh_jobs_thread_id_t
+msh_jobs__current_thread_id()
+{
+#if MSH_JOBS_PLATFORM_WINDOWS
+  return GetCurrentThreadId();
+#else
+  return pthread_self();
 #endif
 }
 
 int32_t
-msh_jobs_push_work( msh_jobs_ctx_t* ctx, msh_jobs_job_signature_t task, void* data )
+msh_jobs__thread_id_equal( msh_jobs_thread_id_t a, msh_jobs_thread_id_t b )
 {
-  msh_jobs_work_queue_t* queue = &ctx->queue;
-  uint32_t next_entry_to_write = queue->next_entry_to_write;
-  uint32_t new_next_entry_to_write = (next_entry_to_write + 1) % queue->max_job_count;
-  while( new_next_entry_to_write == queue->next_entry_to_read ) { msh_jobs__sleep(1); };// Spin until we can write again
-  msh_jobs_job_entry_t *job = queue->entries + next_entry_to_write;
-  job->task = task;
-  job->data = data;
-  ++queue->completion_goal;
-  MSH_JOBS_WRITE_BARRIER();
-  queue->next_entry_to_write = new_next_entry_to_write;
-  msh_jobs_semaphore_release( &queue->semaphore_handle, 1 );
-  return MSH_JOBS_NO_ERR;
+#if MSH_JOBS_PLATFORM_WINDOWS
+  return a == b;
+#else
+  return pthread_equal( a, b );
+#endif
 }
 
 int32_t
-msh_jobs_execute_next_job_entry( int32_t thread_idx, msh_jobs_work_queue_t* queue )
+msh_jobs__eventcount_init( msh_jobs_eventcount_t* ec )
+{
+  ec->epoch = 0;
+  ec->n_waiters = 0;
+#if !MSH_JOBS_PLATFORM_WINDOWS && !MSH_JOBS_PLATFORM_LINUX
+  if( pthread_mutex_init( &ec->mutex, NULL ) ) { return MSH_JOBS_FAILED_TO_CREATE_SEMAPHORE; }
+  if( pthread_cond_init( &ec->cond, NULL ) )
+  {
+    pthread_mutex_destroy( &ec->mutex );
+    return MSH_JOBS_FAILED_TO_CREATE_SEMAPHORE;
+  }
+#endif
+  return MSH_JOBS_NO_ERR;
+}
+
+void
+msh_jobs__eventcount_term( msh_jobs_eventcount_t* ec )
+{
+#if !MSH_JOBS_PLATFORM_WINDOWS && !MSH_JOBS_PLATFORM_LINUX
+  pthread_cond_destroy( &ec->cond );
+  pthread_mutex_destroy( &ec->mutex );
+#else
+  (void)ec;
+#endif
+}
+
+// Register as a waiter. Check for work after this, and then either cancel or commit the wait.
+uint32_t
+msh_jobs__eventcount_prepare_wait( msh_jobs_eventcount_t* ec )
+{
+  msh_jobs_atomic_increment( &ec->n_waiters );
+  return ec->epoch;
+}
+
+void
+msh_jobs__eventcount_cancel_wait( msh_jobs_eventcount_t* ec )
+{
+  msh_jobs_atomic_decrement( &ec->n_waiters );
+}
+
+// Sleeps unless somebody notified since the matching prepare_wait. Wake ups may be spurious.
+void
+msh_jobs__eventcount_wait( msh_jobs_eventcount_t* ec, uint32_t key )
+{
+#if MSH_JOBS_PLATFORM_WINDOWS
+  WaitOnAddress( (volatile VOID*)&ec->epoch, &key, sizeof(key), INFINITE );
+#elif MSH_JOBS_PLATFORM_LINUX
+  syscall( SYS_futex, (uint32_t*)&ec->epoch, FUTEX_WAIT_PRIVATE, key, NULL, NULL, 0 );
+#else
+  pthread_mutex_lock( &ec->mutex );
+  while( ec->epoch == key ) { pthread_cond_wait( &ec->cond, &ec->mutex ); }
+  pthread_mutex_unlock( &ec->mutex );
+#endif
+  msh_jobs_atomic_decrement( &ec->n_waiters );
+}
+
+void
+msh_jobs__eventcount_notify( msh_jobs_eventcount_t* ec, int32_t notify_all )
 {
-  int32_t should_sleep = false;
-  if (!queue->entries ||
-       queue->completion_goal == 0 || 
-       queue->max_job_count == 0) { return true; }
+  MSH_JOBS_READ_WRITE_BARRIER();
+  if( !ec->n_waiters ) { return; }
+#if MSH_JOBS_PLATFORM_WINDOWS
+  msh_jobs_atomic_increment( &ec->epoch );
+  if( notify_all ) { WakeByAddressAll( (PVOID)&ec->epoch ); }
+  else             { WakeByAddressSingle( (PVOID)&ec->epoch ); }
+#elif MSH_JOBS_PLATFORM_LINUX
+  msh_jobs_atomic_increment( &ec->epoch );
+  syscall( SYS_futex, (uint32_t*)&ec->epoch, FUTEX_WAKE_PRIVATE, notify_all ? 0x7fffffff : 1,
+           NULL, NULL, 0 );
+#else
+  pthread_mutex_lock( &ec->mutex );
+  msh_jobs_atomic_increment( &ec->epoch );
+  if( notify_all ) { pthread_cond_broadcast( &ec->cond ); }
+  else             { pthread_cond_signal( &ec->cond ); }
+  pthread_mutex_unlock( &ec->mutex );
+#endif
+}
+
+// NOTE(maciej): Set by the worker threads, so that jobs pushing more work know whose deque
+// to use. Deque 0 belongs to the thread that created the context.
+static MSH_JOBS_THREAD_LOCAL msh_jobs_thread_info_t* msh_jobs__tls_thread_info = NULL;
 
-  uint32_t original_next_entry_to_read = queue->next_entry_to_read;
-  uint32_t new_next_entry_to_read = (original_next_entry_to_read + 1) % queue->max_job_count;
-  if( original_next_entry_to_read != queue->next_entry_to_write )
+// Returns NULL for threads that do not own a deque in 'ctx'
+msh_jobs_thread_info_t*
+msh_jobs__current_thread_info( msh_jobs_ctx_t* ctx )
+{
+  msh_jobs_thread_info_t* ti = msh_jobs__tls_thread_info;
+  if( ti && ti->ctx == ctx ) { return ti; }
+  if( msh_jobs__thread_id_equal( ctx->main_thread_id, msh_jobs__current_thread_id() ) )
   {
-    // 'increment' queue->next_entry_to_read here
-    uint32_t idx = msh_jobs_atomic_compare_exchange( &queue->next_entry_to_read,
-                                                     new_next_entry_to_read,
-                                                     original_next_entry_to_read );
-    if (idx == original_next_entry_to_read)
-    {
-      msh_jobs_job_entry_t* entry = queue->entries + idx;
-      entry->task( thread_idx, entry->data );
-      msh_jobs_atomic_increment( &queue->completion_count );
-    }
+    return &ctx->thread_infos[0];
   }
-  else
+  return NULL;
+}
+
+uint32_t
+msh_jobs__rand( msh_jobs_thread_info_t* ti )
+{
+  // xorshift32
+  uint32_t x = ti->rand_state;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  ti->rand_state = x;
+  return x;
+}
+
+int32_t
+msh_jobs__deque_init( msh_jobs_deque_t* dq, uint32_t capacity )
+{
+  assert( capacity && !(capacity & (capacity - 1)) );
+  dq->top = 0;
+  dq->bottom = 0;
+  dq->mask = capacity - 1;
+  dq->entries = (msh_jobs_job_entry_t*)malloc( capacity * sizeof(msh_jobs_job_entry_t) );
+  if( !dq->entries ) { return MSH_JOBS_OUT_OF_MEMORY; }
+  return MSH_JOBS_NO_ERR;
+}
+
+void
+msh_jobs__deque_free( msh_jobs_deque_t* dq )
+{
+  free( dq->entries );
+  dq->entries = NULL;
+  dq->top = 0;
+  dq->bottom = 0;
+  dq->mask = 0;
+}
+
+// Owner only. Returns false if the deque is full.
+int32_t
+msh_jobs__deque_push( msh_jobs_deque_t* dq, msh_jobs_job_entry_t job )
+{
+  int64_t b = dq->bottom;
+  int64_t t = dq->top;
+  if( b - t > dq->mask ) { return false; }
+  dq->entries[b & dq->mask] = job;
+  MSH_JOBS_WRITE_BARRIER();
+  dq->bottom = b + 1;
+  return true;
+}
+
+// Owner only. Takes the most recently pushed job.
+int32_t
+msh_jobs__deque_pop( msh_jobs_deque_t* dq, msh_jobs_job_entry_t* job )
+{
+  int64_t b = dq->bottom - 1;
+  dq->bottom = b;
+  MSH_JOBS_READ_WRITE_BARRIER();
+  int64_t t = dq->top;
+  if( t > b )
   {
-    should_sleep = true;
+    dq->bottom = b + 1;
+    return false;
   }
-  return should_sleep;
+
+  *job = dq->entries[b & dq->mask];
+  if( t != b ) { return true; }
+
+  // Last job in the deque - race the thieves for it.
+  int32_t won = (msh_jobs_atomic_compare_exchange64( &dq->top, t + 1, t ) == t);
+  dq->bottom = b + 1;
+  return won;
+}
+
+// Any thread. Takes the oldest job. Returns 1 on success, 0 if the deque was empty and -1 if
+// another thread took the job first.
+int32_t
+msh_jobs__deque_steal( msh_jobs_deque_t* dq, msh_jobs_job_entry_t* job )
+{
+  int64_t t = dq->top;
+  MSH_JOBS_READ_WRITE_BARRIER();
+  int64_t b = dq->bottom;
+  if( t >= b ) { return 0; }
+
+  *job = dq->entries[t & dq->mask];
+  if( msh_jobs_atomic_compare_exchange64( &dq->top, t + 1, t ) != t ) { return -1; }
+  return 1;
+}
+
+int32_t
+msh_jobs__mpmc_init( msh_jobs_mpmc_queue_t* q, uint32_t capacity )
+{
+  assert( capacity >= 2 && !(capacity & (capacity - 1)) );
+  q->cells = (msh_jobs_mpmc_cell_t*)malloc( capacity * sizeof(msh_jobs_mpmc_cell_t) );
+  if( !q->cells ) { return MSH_JOBS_OUT_OF_MEMORY; }
+  for( uint32_t i = 0; i < capacity; ++i ) { q->cells[i].sequence = i; }
+  q->mask = capacity - 1;
+  q->enqueue_pos = 0;
+  q->dequeue_pos = 0;
+  return MSH_JOBS_NO_ERR;
 }
 
 void
-msh_jobs_complete_all_work( msh_jobs_ctx_t* ctx )
+msh_jobs__mpmc_free( msh_jobs_mpmc_queue_t* q )
 {
-  uint32_t thrd_idx = 0;
-  if( !ctx->thread_infos || !ctx->queue.entries ) 
-  { 
-    return;
+  free( q->cells );
+  q->cells = NULL;
+  q->mask = 0;
+  q->enqueue_pos = 0;
+  q->dequeue_pos = 0;
+}
+
+// NOTE(maciej): Each cell's sequence number tells whose turn it is - it equals the position
+// when the cell is free for the producer at that position, and position + 1 once it holds a
+// job for the consumer at that position. Returns false if the queue is full.
+int32_t
+msh_jobs__mpmc_enqueue( msh_jobs_mpmc_queue_t* q, msh_jobs_job_entry_t job )
+{
+  msh_jobs_mpmc_cell_t* cell;
+  int64_t pos = q->enqueue_pos;
+  for( ;; )
+  {
+    cell = &q->cells[pos & q->mask];
+    int64_t dif = cell->sequence - pos;
+    if( dif == 0 )
+    {
+      int64_t prev = msh_jobs_atomic_compare_exchange64( &q->enqueue_pos, pos + 1, pos );
+      if( prev == pos ) { break; }
+      pos = prev;
+    }
+    else if( dif < 0 ) { return false; }
+    else { pos = q->enqueue_pos; }
   }
+  cell->entry = job;
+  MSH_JOBS_WRITE_BARRIER();
+  cell->sequence = pos + 1;
+  return true;
+}
 
-  while( ctx->queue.completion_goal != ctx->queue.completion_count )
+// Returns false if the queue is empty.
+int32_t
+msh_jobs__mpmc_dequeue( msh_jobs_mpmc_queue_t* q, msh_jobs_job_entry_t* job )
+{
+  msh_jobs_mpmc_cell_t* cell;
+  int64_t pos = q->dequeue_pos;
+  for( ;; )
   {
-    msh_jobs_execute_next_job_entry( thrd_idx, &ctx->queue );
+    cell = &q->cells[pos & q->mask];
+    int64_t dif = cell->sequence - (pos + 1);
+    if( dif == 0 )
+    {
+      int64_t prev = msh_jobs_atomic_compare_exchange64( &q->dequeue_pos, pos + 1, pos );
+      if( prev == pos ) { break; }
+      pos = prev;
+    }
+    else if( dif < 0 ) { return false; }
+    else { pos = q->dequeue_pos; }
   }
-  
-  ctx->queue.completion_goal = 0;
-  ctx->queue.completion_count = 0;
+  MSH_JOBS_READ_BARRIER();
+  *job = cell->entry;
+  MSH_JOBS_WRITE_BARRIER();
+  cell->sequence = pos + q->mask + 1;
+  return true;
 }
 
-#if MSH_JOBS_PLATFORM_WINDOWS
-DWORD WINAPI msh_jobs_thread_procedure(void *params)
-#else
-void* msh_jobs_thread_procedure(void* params )
-#endif
+// Steals from the deques of threads on ('same_node' == true) or off the node of the calling thread,
+// starting at a random victim. Returns 1 on success, 0 if all were empty, -1 on contention.
+int32_t
+msh_jobs__steal_job( msh_jobs_thread_info_t* ti, msh_jobs_job_entry_t* job, int32_t same_node )
 {
-  msh_jobs_thread_info_t* ti = (msh_jobs_thread_info_t*)params;
   msh_jobs_ctx_t* ctx = ti->ctx;
-  uint32_t thrd_idx = ti->idx;
-  for(;;)
+  uint32_t n_deques = ctx->queue.deque_count;
+  int32_t contended = false;
+  uint32_t victim = msh_jobs__rand( ti ) % n_deques;
+  for( uint32_t i = 0; i < n_deques; ++i, victim = (victim + 1 == n_deques) ? 0 : victim + 1 )
   {
-    if( msh_jobs_execute_next_job_entry( thrd_idx, &ctx->queue ) )
+    if( victim == ti->idx ) { continue; }
+    if( (ctx->thread_infos[victim].numa_node == ti->numa_node) != same_node ) { continue; }
+    int32_t result = msh_jobs__deque_steal( &ctx->queue.deques[victim], job );
+    if( ctx->trace_size )
     {
-      msh_jobs_semaphore_wait( &ctx->queue.semaphore_handle );
+      ti->stats.n_steals += ( result > 0 );
+      ti->stats.n_contended_steals += ( result < 0 );
     }
+    if( result > 0 ) { return 1; }
+    if( result < 0 ) { contended = true; }
   }
-  return 0;
+  return contended ? -1 : 0;
 }
 
+// Takes high priority jobs first. Then pops from the calling thread's own deque, from its node's
+// queue and the shared queue, and then tries to steal from threads on the same node. Only after
+// that it looks at other nodes' queues and threads. Background jobs are taken once every other
+// queue was seen empty.
 int32_t
-msh_jobs__init_queue( msh_jobs_ctx_t* ctx, uint32_t queue_size )
+msh_jobs__find_job( msh_jobs_thread_info_t* ti, msh_jobs_job_entry_t* job )
 {
-  ctx->queue.max_job_count = queue_size;
-  ctx->queue.completion_goal = 0;
-  ctx->queue.completion_count = 0;
-  ctx->queue.next_entry_to_read = 0;
-  ctx->queue.next_entry_to_write = 0;
-  ctx->queue.entries = (msh_jobs_job_entry_t*)malloc( ctx->queue.max_job_count * sizeof(msh_jobs_job_entry_t) );
-  if (!ctx->queue.entries) { return MSH_JOBS_OUT_OF_MEMORY; }
+  msh_jobs_work_queue_t* queue = &ti->ctx->queue;
+  if( msh_jobs__mpmc_dequeue( &queue->high_priority_queue, job ) ) { return true; }
+  if( msh_jobs__deque_pop( &queue->deques[ti->idx], job ) ) { return true; }
+  if( msh_jobs__mpmc_dequeue( &queue->node_queues[ti->numa_node], job ) ) { return true; }
+  if( msh_jobs__mpmc_dequeue( &queue->injection_queue, job ) ) { return true; }
 
-  return MSH_JOBS_NO_ERR;
-}
+  for( ;; )
+  {
+    int32_t result = msh_jobs__steal_job( ti, job, true );
+    if( result > 0 ) { return true; }
+    int32_t contended = ( result < 0 );
 
+    if( queue->node_queue_count > 1 )
+    {
+      for( uint32_t i = 1; i < queue->node_queue_count; ++i )
+      {
+        uint32_t node = ( ti->numa_node + i ) % queue->node_queue_count;
+        if( msh_jobs__mpmc_dequeue( &queue->node_queues[node], job ) ) { return true; }
+      }
+      result = msh_jobs__steal_job( ti, job, false );
+      if( result > 0 ) { return true; }
+      contended |= ( result < 0 );
+    }
+    if( !contended ) { return msh_jobs__mpmc_dequeue( &queue->background_queue, job ); }
+  }
+}
 
-int32_t
-msh_jobs__create_threads( msh_jobs_ctx_t* ctx, uint32_t n_threads )
+void*
+msh_jobs_scratch_alloc( msh_jobs_ctx_t* ctx, int32_t thread_idx, uint64_t size )
 {
-  assert( ctx->processor_info.logical_core_count > 0 );
-  int32_t err = MSH_JOBS_NO_ERR;
-  
-  // Semaphore
-  uint32_t initial_count = 0;
-  ctx->thread_count = n_threads ? n_threads : ctx->processor_info.logical_core_count - 1;
-  err = msh_jobs_semaphore_create( &ctx->queue.semaphore_handle, initial_count, ctx->thread_count );
-  if (err) { return err; }
-
-  // Thread info
-  ctx->thread_infos = (msh_jobs_thread_info_t*)malloc( ctx->thread_count * sizeof( msh_jobs_thread_info_t ) );
-  if (!ctx->thread_infos) { err = MSH_JOBS_OUT_OF_MEMORY; return err; }
-  
-  for( uint32_t thrd_idx = 0; thrd_idx < ctx->thread_count; ++thrd_idx )
+  if( thread_idx < 0 ) { return NULL; }
+  msh_jobs_scratch_t* scratch = &ctx->thread_infos[thread_idx].scratch;
+  if( !scratch->base )
   {
-    ctx->thread_infos[thrd_idx].idx = thrd_idx + 1;
-    ctx->thread_infos[thrd_idx].ctx = ctx;
-    err = msh_jobs_thread_create( &ctx->thread_infos[thrd_idx].handle,
-                                  msh_jobs_thread_procedure, &ctx->thread_infos[thrd_idx] );
-    if (err) { return err; }
+    scratch->base = (uint8_t*)malloc( ctx->scratch_size );
+    if( !scratch->base ) { return NULL; }
+    scratch->capacity = ctx->scratch_size;
   }
 
-  return err;
+  uint64_t offset = ( scratch->used + 15 ) & ~(uint64_t)15;
+  if( offset > scratch->capacity || size > scratch->capacity - offset ) { return NULL; }
+  scratch->used = offset + size;
+  return scratch->base + offset;
 }
 
-int32_t
-msh_jobs_init_ctx( msh_jobs_ctx_t* ctx, uint32_t n_threads )
+// Jobs nest (i.e. a job waiting for a counter runs other jobs), so instead of emptying the
+// scratch after each job, it is rolled back to where it was before the job started.
+uint64_t
+msh_jobs__scratch_mark( msh_jobs_ctx_t* ctx, int32_t thread_idx )
 {
-  int32_t err = MSH_JOBS_NO_ERR;
-  err = msh_jobs_get_processor_info( &ctx->processor_info );
-  if( err ) { return err; }
-  
-  err = msh_jobs__init_queue( ctx, MSH_JOBS_QUEUE_SIZE );
-  if( err ) { return err; }
-  
-  err = msh_jobs__create_threads( ctx, n_threads );
-  if( err ) { return err; }
-  
-  return err;
+  return ( thread_idx < 0 ) ? 0 : ctx->thread_infos[thread_idx].scratch.used;
 }
 
 void
-msh_jobs_term_ctx( msh_jobs_ctx_t* ctx )
+msh_jobs__scratch_reset( msh_jobs_ctx_t* ctx, int32_t thread_idx, uint64_t mark )
 {
-  msh_jobs_complete_all_work( ctx );
-  for( uint32_t i = 0; i < ctx->thread_count; ++i )
+  if( thread_idx >= 0 ) { ctx->thread_infos[thread_idx].scratch.used = mark; }
+}
+
+// Owner only
+void
+msh_jobs__trace( msh_jobs_thread_info_t* ti, msh_jobs_trace_event_t* event )
+{
+  msh_jobs_trace_buffer_t* tb = &ti->trace;
+  uint64_t n_written = tb->n_written;
+  tb->events[n_written & tb->mask] = *event;
+  MSH_JOBS_WRITE_BARRIER();
+  tb->n_written = n_written + 1;
+}
+
+void
+msh_jobs__execute_job( msh_jobs_ctx_t* ctx, int32_t thread_idx, msh_jobs_job_entry_t* job )
+{
+  uint64_t scratch_mark = msh_jobs__scratch_mark( ctx, thread_idx );
+  if( ctx->trace_size && thread_idx >= 0 )
   {
-    msh_jobs_thread_detach( &ctx->thread_infos[i].handle );
+    msh_jobs_thread_info_t* ti = &ctx->thread_infos[thread_idx];
+    msh_jobs_trace_event_t event = { 0, 0, job->task, MSH_JOBS_TRACE_JOB, 0 };
+    if( ti->idx < ctx->queue.deque_count )
+    {
+      msh_jobs_deque_t* dq = &ctx->queue.deques[ti->idx];
+      int64_t depth = dq->bottom - dq->top;
+      event.queue_depth = depth > 0 ? (uint32_t)depth : 0;
+    }
+    event.start = msh_jobs__time_now();
+    job->task( thread_idx, job->data );
+    event.end = msh_jobs__time_now();
+    ti->stats.n_jobs++;
+    msh_jobs__trace( ti, &event );
   }
-  free( ctx->thread_infos );
-  ctx->thread_infos = NULL;
-  ctx->queue.max_job_count = 0;
-  ctx->queue.completion_goal = 0;
-  ctx->queue.completion_count = 0;
-  ctx->queue.next_entry_to_read = 0;
-  ctx->queue.next_entry_to_write = 0;
-  free( ctx->queue.entries );
-  ctx->queue.entries = NULL;
-  msh_jobs_semaphore_release( &ctx->queue.semaphore_handle, ctx->thread_count );
-  msh_jobs_semaphore_destroy( &ctx->queue.semaphore_handle );
+  else
+  {
+    job->task( thread_idx, job->data );
+  }
+  msh_jobs__scratch_reset( ctx, thread_idx, scratch_mark );
+  if( job->counter ) { msh_jobs_atomic_decrement( &job->counter->value ); }
+  msh_jobs_atomic_increment( &ctx->queue.completion_count );
+}
+
+int32_t
+msh_jobs__push_entry( msh_jobs_ctx_t* ctx, msh_jobs_job_entry_t job )
+{
+  msh_jobs_work_queue_t* queue = &ctx->queue;
+  msh_jobs_thread_info_t* ti = msh_jobs__current_thread_info( ctx );
+  msh_jobs_atomic_increment( &queue->completion_goal );
+
+  // NOTE(maciej): Full queue means there is plenty of work for everyone already. Instead of
+  // waiting for space, the pushing thread does this one right away.
+  if( ti )
+  {
+    if( !msh_jobs__deque_push( &queue->deques[ti->idx], job ) )
+    {
+      msh_jobs__execute_job( ctx, ti->idx, &job );
+      return MSH_JOBS_NO_ERR;
+    }
+  }
+  else if( !msh_jobs__mpmc_enqueue( &queue->injection_queue, job ) )
+  {
+    msh_jobs__execute_job( ctx, MSH_JOBS_EXTERNAL_THREAD_IDX, &job );
+    return MSH_JOBS_NO_ERR;
+  }
+  msh_jobs__eventcount_notify( &queue->event, false );
+  return MSH_JOBS_NO_ERR;
+}
+
+int32_t
+msh_jobs_push_work( msh_jobs_ctx_t* ctx, msh_jobs_job_signature_t task, void* data )
+{
+  msh_jobs_job_entry_t job = { task, data, NULL };
+  return msh_jobs__push_entry( ctx, job );
+}
+
+int32_t
+msh_jobs_push_work_counted( msh_jobs_ctx_t* ctx, msh_jobs_job_signature_t task, void* data,
+                            msh_jobs_counter_t* counter )
+{
+  msh_jobs_job_entry_t job = { task, data, counter };
+  msh_jobs_atomic_increment( &counter->value );
+  return msh_jobs__push_entry( ctx, job );
+}
+
+// Pushes to one of the shared queues and wakes up a thread waiting on 'event'
+int32_t
+msh_jobs__push_shared( msh_jobs_ctx_t* ctx, msh_jobs_mpmc_queue_t* q, msh_jobs_eventcount_t* event,
+                       msh_jobs_job_entry_t job )
+{
+  if( job.counter ) { msh_jobs_atomic_increment( &job.counter->value ); }
+  msh_jobs_atomic_increment( &ctx->queue.completion_goal );
+
+  if( !msh_jobs__mpmc_enqueue( q, job ) )
+  {
+    msh_jobs_thread_info_t* ti = msh_jobs__current_thread_info( ctx );
+    msh_jobs__execute_job( ctx, ti ? (int32_t)ti->idx : MSH_JOBS_EXTERNAL_THREAD_IDX, &job );
+    return MSH_JOBS_NO_ERR;
+  }
+  msh_jobs__eventcount_notify( event, false );
+  return MSH_JOBS_NO_ERR;
+}
+
+int32_t
+msh_jobs_push_work_on_node( msh_jobs_ctx_t* ctx, uint32_t numa_node, msh_jobs_job_signature_t task,
+                            void* data, msh_jobs_counter_t* counter )
+{
+  msh_jobs_work_queue_t* queue = &ctx->queue;
+  msh_jobs_job_entry_t job = { task, data, counter };
+  return msh_jobs__push_shared( ctx, &queue->node_queues[numa_node % queue->node_queue_count],
+                                &queue->event, job );
+}
+
+int32_t
+msh_jobs_push_work_priority( msh_jobs_ctx_t* ctx, msh_jobs_priority_t priority,
+                             msh_jobs_job_signature_t task, void* data, msh_jobs_counter_t* counter )
+{
+  msh_jobs_work_queue_t* queue = &ctx->queue;
+  msh_jobs_job_entry_t job = { task, data, counter };
+  switch( priority )
+  {
+    case MSH_JOBS_PRIORITY_HIGH:
+      return msh_jobs__push_shared( ctx, &queue->high_priority_queue, &queue->event, job );
+    case MSH_JOBS_PRIORITY_BACKGROUND:
+      return msh_jobs__push_shared( ctx, &queue->background_queue, &queue->event, job );
+    default:
+      if( counter ) { msh_jobs_atomic_increment( &counter->value ); }
+      return msh_jobs__push_entry( ctx, job );
+  }
+}
+
+int32_t
+msh_jobs_push_io_work( msh_jobs_ctx_t* ctx, msh_jobs_job_signature_t task, void* data,
+                       msh_jobs_counter_t* counter )
+{
+  msh_jobs_job_entry_t job = { task, data, counter };
+  if( !ctx->io_thread_count )
+  {
+    msh_jobs_thread_info_t* ti = msh_jobs__current_thread_info( ctx );
+    if( counter ) { msh_jobs_atomic_increment( &counter->value ); }
+    msh_jobs_atomic_increment( &ctx->queue.completion_goal );
+    msh_jobs__execute_job( ctx, ti ? (int32_t)ti->idx : MSH_JOBS_EXTERNAL_THREAD_IDX, &job );
+    return MSH_JOBS_NO_ERR;
+  }
+  return msh_jobs__push_shared( ctx, &ctx->queue.io_queue, &ctx->queue.io_event, job );
+}
+
+uint32_t
+msh_jobs_get_thread_numa_node( msh_jobs_ctx_t* ctx, int32_t thread_idx )
+{
+  if( thread_idx < 0 || (uint32_t)thread_idx > ctx->thread_count + ctx->io_thread_count ) { return 0; }
+  return ctx->thread_infos[thread_idx].numa_node;
+}
+
+int32_t
+msh_jobs_execute_next_job_entry( msh_jobs_thread_info_t* ti )
+{
+  msh_jobs_work_queue_t* queue = &ti->ctx->queue;
+  if( !queue->deques ) { return true; }
+
+  msh_jobs_job_entry_t job;
+  if( !msh_jobs__find_job( ti, &job ) ) { return true; }
+
+  msh_jobs__execute_job( ti->ctx, ti->idx, &job );
+  return false;
+}
+
+void
+msh_jobs_wait_for_counter( msh_jobs_ctx_t* ctx, msh_jobs_counter_t* counter )
+{
+  msh_jobs_thread_info_t* ti = msh_jobs__current_thread_info( ctx );
+  while( counter->value )
+  {
+    if( !ti )                                       { msh_jobs__yield(); }
+    else if( msh_jobs_execute_next_job_entry( ti ) ) { _mm_pause(); }
+  }
+  MSH_JOBS_READ_BARRIER();
+}
+
+MSH_JOBS_JOB_SIGNATURE(msh_jobs__run_graph_job)
+{
+  msh_jobs_job_t* job = (msh_jobs_job_t*)params;
+  uint32_t result = job->task( thread_idx, job->data );
+
+  // NOTE(maciej): Successors are pushed before this job counts as finished, so neither its
+  // counter nor msh_jobs_complete_all_work can miss them.
+  for( uint32_t i = 0; i < job->n_successors; ++i )
+  {
+    msh_jobs_job_t* successor = job->successors[i];
+    if( msh_jobs_atomic_decrement( &successor->n_pending ) == 0 )
+    {
+      msh_jobs_job_entry_t entry = { msh_jobs__run_graph_job, successor, successor->counter };
+      msh_jobs__push_entry( successor->ctx, entry );
+    }
+  }
+  return result;
+}
+
+void
+msh_jobs_job_init( msh_jobs_job_t* job, msh_jobs_job_signature_t task, void* data,
+                   msh_jobs_counter_t* counter )
+{
+  job->task = task;
+  job->data = data;
+  job->counter = counter;
+  job->ctx = NULL;
+  job->n_pending = 1; // released by msh_jobs_submit_job
+  job->n_successors = 0;
+}
+
+void
+msh_jobs_job_depends_on( msh_jobs_job_t* job, msh_jobs_job_t* predecessor )
+{
+  assert( !job->ctx && !predecessor->ctx );
+  assert( predecessor->n_successors < MSH_JOBS_MAX_SUCCESSORS );
+  predecessor->successors[predecessor->n_successors++] = job;
+  job->n_pending++;
+}
+
+int32_t
+msh_jobs_submit_job( msh_jobs_ctx_t* ctx, msh_jobs_job_t* job )
+{
+  job->ctx = ctx;
+  if( job->counter ) { msh_jobs_atomic_increment( &job->counter->value ); }
+  if( msh_jobs_atomic_decrement( &job->n_pending ) == 0 )
+  {
+    msh_jobs_job_entry_t entry = { msh_jobs__run_graph_job, job, job->counter };
+    return msh_jobs__push_entry( ctx, entry );
+  }
+  return MSH_JOBS_NO_ERR;
+}
+
+// Parallel for / reduce
+
+#ifndef MSH_JOBS_CHUNKS_PER_THREAD
+#define MSH_JOBS_CHUNKS_PER_THREAD 8
+#endif
+
+typedef struct msh_jobs__range_desc
+{
+  msh_jobs_range_fn_t for_fn;
+  msh_jobs_reduce_fn_t reduce_fn;
+  msh_jobs_combine_fn_t combine_fn;
+  const void* identity;
+  size_t result_size;
+  uint64_t grain;
+  void* user;
+} msh_jobs__range_desc_t;
+
+typedef struct msh_jobs__range_task
+{
+  msh_jobs_ctx_t* ctx;
+  const msh_jobs__range_desc_t* desc;
+  uint64_t begin;
+  uint64_t end;
+  uint64_t partial[MSH_JOBS_MAX_REDUCE_SIZE / sizeof(uint64_t)];
+} msh_jobs__range_task_t;
+
+MSH_JOBS_JOB_SIGNATURE(msh_jobs__range_job);
+
+void
+msh_jobs__run_range_chunk( msh_jobs_ctx_t* ctx, const msh_jobs__range_desc_t* desc,
+                           int32_t thread_idx, uint64_t begin, uint64_t end, void* partial )
+{
+  uint64_t scratch_mark = msh_jobs__scratch_mark( ctx, thread_idx );
+  if( desc->reduce_fn ) { desc->reduce_fn( thread_idx, begin, end, partial, desc->user ); }
+  else                  { desc->for_fn( thread_idx, begin, end, desc->user ); }
+  msh_jobs__scratch_reset( ctx, thread_idx, scratch_mark );
+}
+
+void
+msh_jobs__run_range( msh_jobs__range_task_t* task, int32_t thread_idx )
+{
+  const msh_jobs__range_desc_t* desc = task->desc;
+  msh_jobs_ctx_t* ctx = task->ctx;
+  msh_jobs_thread_info_t* ti = msh_jobs__current_thread_info( ctx );
+  msh_jobs_deque_t* dq = ti ? &ctx->queue.deques[ti->idx] : NULL;
+
+  // NOTE(maciej): Halving the range at most 64 times gets it down to a single item
+  msh_jobs__range_task_t children[64];
+  uint32_t n_children = 0;
+  msh_jobs_counter_t counter = {0};
+
+  uint64_t begin = task->begin;
+  uint64_t end = task->end;
+  while( end - begin > desc->grain )
+  {
+    if( dq && dq->bottom - dq->top <= 0 )
+    {
+      uint64_t mid = begin + (end - begin) / 2;
+      msh_jobs__range_task_t* child = &children[n_children++];
+      child->ctx = ctx;
+      child->desc = desc;
+      child->begin = mid;
+      child->end = end;
+      if( desc->reduce_fn ) { memcpy( child->partial, desc->identity, desc->result_size ); }
+      msh_jobs_push_work_counted( ctx, msh_jobs__range_job, child, &counter );
+      end = mid;
+    }
+    else
+    {
+      msh_jobs__run_range_chunk( ctx, desc, thread_idx, begin, begin + desc->grain, task->partial );
+      begin += desc->grain;
+    }
+  }
+  msh_jobs__run_range_chunk( ctx, desc, thread_idx, begin, end, task->partial );
+  msh_jobs_wait_for_counter( ctx, &counter );
+
+  // Children were split off right to left
+  if( desc->reduce_fn )
+  {
+    for( int32_t i = (int32_t)n_children - 1; i >= 0; --i )
+    {
+      desc->combine_fn( task->partial, children[i].partial, desc->user );
+    }
+  }
+}
+
+MSH_JOBS_JOB_SIGNATURE(msh_jobs__range_job)
+{
+  msh_jobs__run_range( (msh_jobs__range_task_t*)params, thread_idx );
+  return 0;
+}
+
+void
+msh_jobs__parallel_range( msh_jobs_ctx_t* ctx, uint64_t begin, uint64_t end,
+                          msh_jobs__range_desc_t* desc, void* result )
+{
+  if( end <= begin ) { return; }
+  uint64_t n_items = end - begin;
+  uint32_t n_threads = ctx->thread_count + 1;
+  if( !desc->grain )
+  {
+    desc->grain = n_items / ((uint64_t)n_threads * MSH_JOBS_CHUNKS_PER_THREAD);
+    desc->grain = desc->grain ? desc->grain : 1;
+  }
+
+  msh_jobs_thread_info_t* ti = msh_jobs__current_thread_info( ctx );
+  int32_t thread_idx = ti ? (int32_t)ti->idx : MSH_JOBS_EXTERNAL_THREAD_IDX;
+  if( n_threads == 1 || n_items <= desc->grain )
+  {
+    msh_jobs__run_range_chunk( ctx, desc, thread_idx, begin, end, result );
+    return;
+  }
+
+  msh_jobs__range_task_t root;
+  root.ctx = ctx;
+  root.desc = desc;
+  root.begin = begin;
+  root.end = end;
+  if( desc->reduce_fn ) { memcpy( root.partial, desc->identity, desc->result_size ); }
+  if( ti )
+  {
+    msh_jobs__run_range( &root, thread_idx );
+  }
+  else
+  {
+    // Threads outside of the pool can't split the range - hand it over to the workers.
+    msh_jobs_counter_t counter = {0};
+    msh_jobs_push_work_counted( ctx, msh_jobs__range_job, &root, &counter );
+    msh_jobs_wait_for_counter( ctx, &counter );
+  }
+  if( desc->reduce_fn ) { memcpy( result, root.partial, desc->result_size ); }
+}
+
+void
+msh_jobs_parallel_for( msh_jobs_ctx_t* ctx, uint64_t begin, uint64_t end, uint64_t grain,
+                       msh_jobs_range_fn_t fn, void* user )
+{
+  msh_jobs__range_desc_t desc = { fn, NULL, NULL, NULL, 0, grain, user };
+  msh_jobs__parallel_range( ctx, begin, end, &desc, NULL );
+}
+
+void
+msh_jobs_parallel_reduce( msh_jobs_ctx_t* ctx, uint64_t begin, uint64_t end, uint64_t grain,
+                          msh_jobs_reduce_fn_t fn, msh_jobs_combine_fn_t combine,
+                          void* result, size_t result_size, void* user )
+{
+  assert( result_size <= MSH_JOBS_MAX_REDUCE_SIZE );
+  uint64_t identity[MSH_JOBS_MAX_REDUCE_SIZE / sizeof(uint64_t)];
+  memcpy( identity, result, result_size );
+  msh_jobs__range_desc_t desc = { NULL, fn, combine, identity, result_size, grain, user };
+  msh_jobs__parallel_range( ctx, begin, end, &desc, result );
+}
+
+void
+msh_jobs_complete_all_work( msh_jobs_ctx_t* ctx )
+{
+  if( !ctx->thread_infos || !ctx->queue.deques ) 
+  { 
+    return;
+  }
+
+  // NOTE(maciej): Jobs may push more jobs, but always before they are counted as completed. So
+  // reading the count before the goal guarantees that nothing was left behind when they match.
+  // Both only ever grow (wrapping around is fine, they are only compared for equality), since
+  // resetting them here would race with threads that push concurrently.
+  msh_jobs_thread_info_t* ti = msh_jobs__current_thread_info( ctx );
+  for( ;; )
+  {
+    uint32_t completion_count = ctx->queue.completion_count;
+    MSH_JOBS_READ_BARRIER();
+    if( completion_count == ctx->queue.completion_goal ) { break; }
+    if( !ti ) { msh_jobs__yield(); }
+    else      { msh_jobs_execute_next_job_entry( ti ); }
+  }
+}
+
+// Topology
+
+void
+msh_jobs_free_processor_info( msh_jobs_processor_info_t* info )
+{
+  free( info->core_table );
+  info->core_table = NULL;
+  info->core_table_count = 0;
+}
+
+#if MSH_JOBS_PLATFORM_LINUX
+int32_t
+msh_jobs__read_sysfs( const char* path, char* buf, int32_t buf_size )
+{
+  int fd = open( path, O_RDONLY );
+  if( fd < 0 ) { return -1; }
+  ssize_t len = read( fd, buf, buf_size - 1 );
+  close( fd );
+  if( len < 0 ) { return -1; }
+  buf[len] = 0;
+  return (int32_t)len;
+}
+
+// Writes "<prefix><idx><suffix>" to 'buf'
+const char*
+msh_jobs__sysfs_path( char* buf, const char* prefix, uint32_t idx, const char* suffix )
+{
+  char digits[16];
+  int32_t n_digits = 0;
+  do { digits[n_digits++] = (char)('0' + idx % 10); idx /= 10; } while( idx );
+  char* c = buf;
+  while( *prefix ) { *c++ = *prefix++; }
+  while( n_digits ) { *c++ = digits[--n_digits]; }
+  while( *suffix ) { *c++ = *suffix++; }
+  *c = 0;
+  return buf;
+}
+
+uint64_t
+msh_jobs__parse_uint( const char** str )
+{
+  uint64_t val = 0;
+  while( **str >= '0' && **str <= '9' ) { val = val * 10 + (uint64_t)(**str - '0'); (*str)++; }
+  return val;
+}
+
+// Returns the highest id in kernel's list format plus one, i.e. 12 for "0-3,8-11"
+uint32_t
+msh_jobs__list_size( const char* str )
+{
+  uint64_t size = 0;
+  while( *str >= '0' && *str <= '9' )
+  {
+    uint64_t last = msh_jobs__parse_uint( &str );
+    if( *str == '-' ) { str++; last = msh_jobs__parse_uint( &str ); }
+    if( last + 1 > size ) { size = last + 1; }
+    if( *str == ',' ) { str++; }
+  }
+  return (uint32_t)size;
+}
+
+// Parses kernel's list format, i.e. "0-3,8-11", and marks listed ids smaller than 'mask_size'
+void
+msh_jobs__parse_list( const char* str, uint8_t* mask, uint32_t mask_size )
+{
+  while( *str >= '0' && *str <= '9' )
+  {
+    uint64_t first = msh_jobs__parse_uint( &str );
+    uint64_t last = first;
+    if( *str == '-' ) { str++; last = msh_jobs__parse_uint( &str ); }
+    for( uint64_t i = first; i <= last && i < mask_size; ++i ) { mask[i] = 1; }
+    if( *str == ',' ) { str++; }
+  }
+}
+
+// NOTE(maciej): Tables are sized by the highest online cpu id, so machines with any number of
+// logical cores are fully described. Out of memory leaves the core table empty.
+void
+msh_jobs__get_topology_linux( msh_jobs_processor_info_t* info )
+{
+  char path[128];
+  char buf[4096];
+
+  if( msh_jobs__read_sysfs( "/sys/devices/system/cpu/online", buf, sizeof(buf) ) <= 0 ) { return; }
+  uint32_t n_cpu_ids = msh_jobs__list_size( buf );
+  uint8_t* online = (uint8_t*)calloc( n_cpu_ids, sizeof(uint8_t) );
+  uint8_t* cpus = (uint8_t*)calloc( n_cpu_ids, sizeof(uint8_t) );
+  uint32_t* cpu_node = (uint32_t*)calloc( n_cpu_ids, sizeof(uint32_t) );
+  info->core_table = (msh_jobs_logical_core_info_t*)calloc( n_cpu_ids,
+                                                            sizeof(msh_jobs_logical_core_info_t) );
+  if( !online || !cpus || !cpu_node || !info->core_table )
+  {
+    msh_jobs_free_processor_info( info );
+    n_cpu_ids = 0;
+  }
+  else
+  {
+    msh_jobs__parse_list( buf, online, n_cpu_ids );
+  }
+
+  // NUMA nodes, renumbered densely in the order of their ids
+  uint8_t node_ids[1024] = {0};
+  if( msh_jobs__read_sysfs( "/sys/devices/system/node/online", buf, sizeof(buf) ) > 0 )
+  {
+    msh_jobs__parse_list( buf, node_ids, sizeof(node_ids) );
+  }
+  for( uint32_t node_id = 0; node_id < sizeof(node_ids); ++node_id )
+  {
+    if( !node_ids[node_id] ) { continue; }
+    msh_jobs__sysfs_path( path, "/sys/devices/system/node/node", node_id, "/cpulist" );
+    if( msh_jobs__read_sysfs( path, buf, sizeof(buf) ) <= 0 ) { continue; }
+    if( n_cpu_ids ) { memset( cpus, 0, n_cpu_ids ); }
+    msh_jobs__parse_list( buf, cpus, n_cpu_ids );
+    for( uint32_t i = 0; i < n_cpu_ids; ++i )
+    {
+      if( cpus[i] ) { cpu_node[i] = info->numa_node_count; }
+    }
+    info->numa_node_count++;
+  }
+
+  // Logical cores. Offline ones have no topology directory.
+  for( uint32_t cpu = 0; cpu < n_cpu_ids; ++cpu )
+  {
+    if( !online[cpu] ) { continue; }
+    const char* c = buf;
+    msh_jobs__sysfs_path( path, "/sys/devices/system/cpu/cpu", cpu, "/topology/core_id" );
+    if( msh_jobs__read_sysfs( path, buf, sizeof(buf) ) <= 0 ) { continue; }
+    uint32_t core_id = (uint32_t)msh_jobs__parse_uint( &c );
+    c = buf;
+    msh_jobs__sysfs_path( path, "/sys/devices/system/cpu/cpu", cpu, "/topology/physical_package_id" );
+    if( msh_jobs__read_sysfs( path, buf, sizeof(buf) ) <= 0 ) { continue; }
+    uint32_t package_id = (uint32_t)msh_jobs__parse_uint( &c );
+
+    msh_jobs_logical_core_info_t* core = &info->core_table[info->core_table_count++];
+    core->os_idx = cpu;
+    core->core_idx = core_id;
+    core->package_idx = package_id;
+    core->numa_node = cpu_node[cpu];
+  }
+  free( online );
+  free( cpus );
+  free( cpu_node );
+
+  // Caches, as seen by the first cpu
+  for( uint32_t cache_idx = 0; cache_idx < 16; ++cache_idx )
+  {
+    char type[32];
+    msh_jobs__sysfs_path( path, "/sys/devices/system/cpu/cpu0/cache/index", cache_idx, "/type" );
+    if( msh_jobs__read_sysfs( path, type, sizeof(type) ) <= 0 ) { break; }
+    if( type[0] == 'I' ) { continue; } // Instruction
+
+    const char* c = buf;
+    msh_jobs__sysfs_path( path, "/sys/devices/system/cpu/cpu0/cache/index", cache_idx, "/level" );
+    if( msh_jobs__read_sysfs( path, buf, sizeof(buf) ) <= 0 ) { continue; }
+    uint64_t level = msh_jobs__parse_uint( &c );
+
+    c = buf;
+    msh_jobs__sysfs_path( path, "/sys/devices/system/cpu/cpu0/cache/index", cache_idx, "/size" );
+    if( msh_jobs__read_sysfs( path, buf, sizeof(buf) ) <= 0 ) { continue; }
+    uint64_t size = msh_jobs__parse_uint( &c );
+    if( *c == 'K' ) { size <<= 10; }
+    if( *c == 'M' ) { size <<= 20; }
+
+    if( level == 1 ) { info->l1d_cache_size = size; }
+    if( level == 2 ) { info->l2_cache_size = size; }
+    if( level == 3 ) { info->l3_cache_size = size; }
+  }
+}
+#endif
+
+#if MSH_JOBS_PLATFORM_WINDOWS
+// NOTE(maciej): GetLogicalProcessorInformation only describes the processor group of the calling
+// thread, i.e. at most 64 logical cores, so the extended version is used to see all groups.
+int32_t
+msh_jobs__group_mask_contains( const GROUP_AFFINITY* mask,
+                               const msh_jobs_logical_core_info_t* core )
+{
+  return mask->Group == core->group && ((mask->Mask >> core->os_idx) & 1);
+}
+
+void
+msh_jobs__get_topology_windows( msh_jobs_processor_info_t* info )
+{
+  DWORD len = 0;
+  GetLogicalProcessorInformationEx( RelationAll, NULL, &len );
+  char* buffer = (char*)malloc( len );
+  if( !buffer ) { return; }
+  if( !GetLogicalProcessorInformationEx( RelationAll,
+                                         (SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX*)buffer, &len ) )
+  {
+    free( buffer );
+    return;
+  }
+
+  // Entries have variable size
+  uint32_t n_logical = 0;
+  for( DWORD offset = 0; offset < len; )
+  {
+    SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX* e =
+      (SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX*)(buffer + offset);
+    offset += e->Size;
+    if( e->Relationship != RelationProcessorCore ) { continue; }
+    for( WORD g = 0; g < e->Processor.GroupCount; ++g )
+    {
+      for( uint32_t bit = 0; bit < sizeof(KAFFINITY) * 8; ++bit )
+      {
+        n_logical += ( e->Processor.GroupMask[g].Mask & ((KAFFINITY)1 << bit) ) != 0;
+      }
+    }
+  }
+  info->core_table = (msh_jobs_logical_core_info_t*)calloc( n_logical,
+                                                            sizeof(msh_jobs_logical_core_info_t) );
+  if( !info->core_table ) { free( buffer ); return; }
+
+  uint32_t n_cores = 0;
+  for( DWORD offset = 0; offset < len; )
+  {
+    SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX* e =
+      (SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX*)(buffer + offset);
+    offset += e->Size;
+    if( e->Relationship != RelationProcessorCore ) { continue; }
+    for( WORD g = 0; g < e->Processor.GroupCount; ++g )
+    {
+      const GROUP_AFFINITY* mask = &e->Processor.GroupMask[g];
+      for( uint32_t bit = 0; bit < sizeof(KAFFINITY) * 8; ++bit )
+      {
+        if( !(mask->Mask & ((KAFFINITY)1 << bit)) ) { continue; }
+        msh_jobs_logical_core_info_t* core = &info->core_table[info->core_table_count++];
+        core->os_idx = bit;
+        core->group = mask->Group;
+        core->core_idx = n_cores;
+        core->package_idx = 0;
+        core->numa_node = 0;
+      }
+    }
+    n_cores++;
+  }
+
+  uint32_t n_packages = 0;
+  for( DWORD offset = 0; offset < len; )
+  {
+    SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX* e =
+      (SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX*)(buffer + offset);
+    offset += e->Size;
+    if( e->Relationship == RelationProcessorPackage )
+    {
+      for( uint32_t j = 0; j < info->core_table_count; ++j )
+      {
+        msh_jobs_logical_core_info_t* core = &info->core_table[j];
+        for( WORD g = 0; g < e->Processor.GroupCount; ++g )
+        {
+          if( msh_jobs__group_mask_contains( &e->Processor.GroupMask[g], core ) )
+          {
+            core->package_idx = n_packages;
+          }
+        }
+      }
+      n_packages++;
+    }
+    else if( e->Relationship == RelationNumaNode )
+    {
+      for( uint32_t j = 0; j < info->core_table_count; ++j )
+      {
+        msh_jobs_logical_core_info_t* core = &info->core_table[j];
+        if( msh_jobs__group_mask_contains( &e->NumaNode.GroupMask, core ) )
+        {
+          core->numa_node = info->numa_node_count;
+        }
+      }
+      info->numa_node_count++;
+    }
+    else if( e->Relationship == RelationCache && e->Cache.Type != CacheInstruction )
+    {
+      if( e->Cache.Level == 1 ) { info->l1d_cache_size = e->Cache.CacheSize; }
+      if( e->Cache.Level == 2 ) { info->l2_cache_size = e->Cache.CacheSize; }
+      if( e->Cache.Level == 3 ) { info->l3_cache_size = e->Cache.CacheSize; }
+    }
+  }
+  free( buffer );
+}
+#endif
+
+// Renumbers (package, core) pairs into dense physical core indices, assigns SMT indices and
+// fills in the counts.
+void
+msh_jobs__finalize_topology( msh_jobs_processor_info_t* info )
+{
+  uint32_t* core_idx = (uint32_t*)malloc( (info->core_table_count + 1) * sizeof(uint32_t) );
+  if( !core_idx ) { msh_jobs_free_processor_info( info ); }
+  uint32_t n = info->core_table_count;
+  msh_jobs_logical_core_info_t* cores = info->core_table;
+  uint32_t n_physical = 0;
+  uint32_t n_packages = 0;
+  for( uint32_t i = 0; i < n; ++i )
+  {
+    core_idx[i] = n_physical;
+    cores[i].smt_idx = 0;
+    int32_t new_package = true;
+    for( uint32_t j = 0; j < i; ++j )
+    {
+      if( cores[j].package_idx != cores[i].package_idx ) { continue; }
+      new_package = false;
+      if( cores[j].core_idx == cores[i].core_idx )
+      {
+        core_idx[i] = core_idx[j];
+        cores[i].smt_idx++;
+      }
+    }
+    if( !cores[i].smt_idx ) { n_physical++; }
+    if( new_package ) { n_packages++; }
+  }
+  for( uint32_t i = 0; i < n; ++i ) { cores[i].core_idx = core_idx[i]; }
+  free( core_idx );
+
+  if( n )
+  {
+    info->physical_core_count = n_physical;
+    info->package_count = n_packages;
+  }
+  if( !info->physical_core_count ) { info->physical_core_count = info->logical_core_count; }
+  if( !info->package_count ) { info->package_count = 1; }
+  if( !info->numa_node_count ) { info->numa_node_count = 1; }
+  for( uint32_t i = 0; i < n; ++i )
+  {
+    if( cores[i].numa_node >= info->numa_node_count ) { cores[i].numa_node = 0; }
+  }
+}
+
+// NOTE(maciej): Orders logical cores for pinning - consecutive workers go round robin over NUMA
+// nodes, then over physical cores within the node, and SMT siblings come after all physical
+// cores got a worker. 'order' needs 'core_table_count' entries. Returns 0 if out of memory.
+uint32_t
+msh_jobs__pinning_order( const msh_jobs_processor_info_t* info, uint32_t* order )
+{
+  uint32_t n = info->core_table_count;
+  const msh_jobs_logical_core_info_t* cores = info->core_table;
+  uint64_t* keys = (uint64_t*)malloc( n * sizeof(uint64_t) );
+  if( !keys ) { return 0; }
+  for( uint32_t i = 0; i < n; ++i )
+  {
+    uint64_t rank_in_node = 0;
+    for( uint32_t j = 0; j < n; ++j )
+    {
+      rank_in_node += ( cores[j].smt_idx == 0 && cores[j].numa_node == cores[i].numa_node &&
+                        cores[j].core_idx < cores[i].core_idx );
+    }
+    keys[i] = ((uint64_t)cores[i].smt_idx << 40) | (rank_in_node << 20) | cores[i].numa_node;
+    order[i] = i;
+  }
+
+  for( uint32_t i = 1; i < n; ++i )
+  {
+    uint32_t idx = order[i];
+    int32_t j = (int32_t)i - 1;
+    while( j >= 0 && keys[order[j]] > keys[idx] ) { order[j + 1] = order[j]; j--; }
+    order[j + 1] = idx;
+  }
+  free( keys );
+  return n;
+}
+
+int32_t
+msh_jobs__pin_current_thread( uint32_t os_idx, uint32_t group )
+{
+#if MSH_JOBS_PLATFORM_WINDOWS
+  if( os_idx >= sizeof(KAFFINITY) * 8 ) { return false; }
+  GROUP_AFFINITY affinity;
+  memset( &affinity, 0, sizeof(affinity) );
+  affinity.Group = (WORD)group;
+  affinity.Mask = (KAFFINITY)1 << os_idx;
+  return SetThreadGroupAffinity( GetCurrentThread(), &affinity, NULL ) != 0;
+#elif MSH_JOBS_PLATFORM_LINUX
+  // Kernel treats cpus past the end of the mask as not set, so it only needs to reach 'os_idx'
+  enum { MASK_BITS = 8 * sizeof(unsigned long) };
+  size_t mask_size = (os_idx / MASK_BITS + 1) * sizeof(unsigned long);
+  unsigned long* mask = (unsigned long*)calloc( 1, mask_size );
+  if( !mask ) { return false; }
+  mask[os_idx / MASK_BITS] |= 1UL << (os_idx % MASK_BITS);
+  int32_t pinned = syscall( SYS_sched_setaffinity, 0, mask_size, mask ) == 0;
+  free( mask );
+  (void)group;
+  return pinned;
+#else
+  (void)os_idx;
+  (void)group;
+  return false;
+#endif
+}
+
+// Node of the logical core the calling thread currently runs on
+uint32_t
+msh_jobs__current_numa_node( const msh_jobs_processor_info_t* info )
+{
+  uint32_t os_idx = 0;
+  uint32_t group = 0;
+#if MSH_JOBS_PLATFORM_WINDOWS
+  PROCESSOR_NUMBER processor;
+  GetCurrentProcessorNumberEx( &processor );
+  os_idx = processor.Number;
+  group = processor.Group;
+#elif MSH_JOBS_PLATFORM_LINUX
+  unsigned cpu = 0;
+  if( syscall( SYS_getcpu, &cpu, NULL, NULL ) ) { return 0; }
+  os_idx = cpu;
+#endif
+  for( uint32_t i = 0; i < info->core_table_count; ++i )
+  {
+    if( info->core_table[i].os_idx == os_idx && info->core_table[i].group == group )
+    {
+      return info->core_table[i].numa_node;
+    }
+  }
+  return 0;
+}
+
+// Async reads
+
+int32_t
+msh_jobs_file_open( msh_jobs_file_t* file, const char* path )
+{
+#if MSH_JOBS_PLATFORM_WINDOWS
+  *file = CreateFileA( path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                       FILE_ATTRIBUTE_NORMAL, NULL );
+  if( *file == INVALID_HANDLE_VALUE ) { return MSH_JOBS_FAILED_TO_OPEN_FILE; }
+#else
+  *file = open( path, O_RDONLY );
+  if( *file < 0 ) { return MSH_JOBS_FAILED_TO_OPEN_FILE; }
+#endif
+  return MSH_JOBS_NO_ERR;
+}
+
+int64_t
+msh_jobs_file_size( msh_jobs_file_t file )
+{
+#if MSH_JOBS_PLATFORM_WINDOWS
+  LARGE_INTEGER size;
+  if( !GetFileSizeEx( file, &size ) ) { return -1; }
+  return (int64_t)size.QuadPart;
+#else
+  struct stat st;
+  if( fstat( file, &st ) ) { return -1; }
+  return (int64_t)st.st_size;
+#endif
+}
+
+void
+msh_jobs_file_close( msh_jobs_file_t file )
+{
+#if MSH_JOBS_PLATFORM_WINDOWS
+  CloseHandle( file );
+#else
+  close( file );
+#endif
+}
+
+int64_t
+msh_jobs__read_blocking( msh_jobs_read_t* read )
+{
+#if MSH_JOBS_PLATFORM_WINDOWS
+  OVERLAPPED ov = {0};
+  ov.Offset = (DWORD)read->offset;
+  ov.OffsetHigh = (DWORD)(read->offset >> 32);
+  DWORD n_read = 0;
+  DWORD size = read->size > 0xFFFFFFFFull ? 0xFFFFFFFF : (DWORD)read->size;
+  if( !ReadFile( read->file, read->buffer, size, &n_read, &ov ) )
+  {
+    DWORD err = GetLastError();
+    return ( err == ERROR_HANDLE_EOF ) ? 0 : -(int64_t)err;
+  }
+  return (int64_t)n_read;
+#else
+  ssize_t n_read;
+  do { n_read = pread( read->file, read->buffer, read->size, (off_t)read->offset ); }
+  while( n_read < 0 && errno == EINTR );
+  return ( n_read < 0 ) ? -(int64_t)errno : (int64_t)n_read;
+#endif
+}
+
+void
+msh_jobs__push_continuation( msh_jobs_read_t* read )
+{
+  if( !read->continuation ) { return; }
+  msh_jobs_job_entry_t job = { read->continuation, read, read->counter };
+  if( read->counter ) { msh_jobs_atomic_increment( &read->counter->value ); }
+  msh_jobs__push_entry( read->ctx, job );
+}
+
+MSH_JOBS_JOB_SIGNATURE(msh_jobs__read_job)
+{
+  (void)thread_idx;
+  msh_jobs_read_t* read = (msh_jobs_read_t*)params;
+  read->result = msh_jobs__read_blocking( read );
+  msh_jobs__push_continuation( read );
+  return 0;
+}
+
+#if MSH_JOBS_PLATFORM_LINUX && !defined(MSH_JOBS_NO_IO_URING) && defined(__NR_io_uring_setup)
+#define MSH_JOBS__IO_URING 1
+
+// Submits a single entry and has the kernel consume it right away, so the submission queue is
+// always empty when the mutex is released. NULL 'read' submits a no-op.
+int32_t
+msh_jobs__io_ring_submit( msh_jobs_io_ring_t* ring, msh_jobs_read_t* read )
+{
+  pthread_mutex_lock( &ring->submit_mutex );
+  uint32_t tail = *ring->sq_tail;
+  uint32_t idx = tail & ring->sq_mask;
+  struct io_uring_sqe* sqe = (struct io_uring_sqe*)ring->sqes + idx;
+  memset( sqe, 0, sizeof(*sqe) );
+  sqe->opcode = IORING_OP_NOP;
+  if( read )
+  {
+    read->iov.iov_base = read->buffer;
+    read->iov.iov_len = read->size;
+    sqe->opcode = IORING_OP_READV;
+    sqe->fd = read->file;
+    sqe->addr = (uint64_t)(uintptr_t)&read->iov;
+    sqe->len = 1;
+    sqe->off = read->offset;
+  }
+  sqe->user_data = (uint64_t)(uintptr_t)read;
+  ring->sq_array[idx] = idx;
+  MSH_JOBS_WRITE_BARRIER();
+  *ring->sq_tail = tail + 1;
+
+  long ret;
+  do { ret = syscall( __NR_io_uring_enter, ring->fd, 1, 0, 0, NULL, 0 ); }
+  while( ret < 0 && ( errno == EINTR || errno == EAGAIN ) );
+
+  // Take the entry back if the kernel did not consume it, so that it is not submitted later
+  int32_t submitted = ( *ring->sq_head != tail );
+  if( !submitted ) { *ring->sq_tail = tail; }
+  pthread_mutex_unlock( &ring->submit_mutex );
+  return submitted;
+}
+
+void*
+msh_jobs__io_ring_procedure( void* params )
+{
+  msh_jobs_ctx_t* ctx = (msh_jobs_ctx_t*)params;
+  msh_jobs_io_ring_t* ring = &ctx->io_ring;
+  for(;;)
+  {
+    uint32_t head = *ring->cq_head;
+    uint32_t tail = *ring->cq_tail;
+    MSH_JOBS_READ_BARRIER();
+    if( head == tail )
+    {
+      syscall( __NR_io_uring_enter, ring->fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0 );
+      continue;
+    }
+
+    struct io_uring_cqe* cqe = (struct io_uring_cqe*)ring->cqes + (head & ring->cq_mask);
+    msh_jobs_read_t* read = (msh_jobs_read_t*)(uintptr_t)cqe->user_data;
+    int32_t res = cqe->res;
+    MSH_JOBS_READ_WRITE_BARRIER();
+    *ring->cq_head = head + 1;
+
+    // No-op submitted by msh_jobs_term_ctx, after all reads have finished
+    if( !read ) { break; }
+
+    // NOTE(maciej): Continuation is pushed before the read counts as finished, like successors
+    // of a graph job.
+    read->result = res;
+    msh_jobs_atomic_decrement( &ring->n_in_flight );
+    msh_jobs__push_continuation( read );
+    if( read->counter ) { msh_jobs_atomic_decrement( &read->counter->value ); }
+    msh_jobs_atomic_increment( &ctx->queue.completion_count );
+  }
+  return 0;
+}
+
+void
+msh_jobs__io_ring_term( msh_jobs_io_ring_t* ring )
+{
+  if( ring->sqes ) { munmap( ring->sqes, ring->sqes_map_size ); }
+  if( ring->cq_map && ring->cq_map != ring->sq_map ) { munmap( ring->cq_map, ring->cq_map_size ); }
+  if( ring->sq_map ) { munmap( ring->sq_map, ring->sq_map_size ); }
+  if( ring->fd >= 0 ) { close( ring->fd ); }
+  memset( ring, 0, sizeof(*ring) );
+  ring->fd = -1;
+}
+
+// Leaves 'fd' at -1 if io_uring is not available, i.e. blocked by seccomp or an old kernel.
+void
+msh_jobs__io_ring_init( msh_jobs_ctx_t* ctx, uint32_t n_entries )
+{
+  msh_jobs_io_ring_t* ring = &ctx->io_ring;
+  struct io_uring_params params;
+  memset( &params, 0, sizeof(params) );
+  ring->fd = (int32_t)syscall( __NR_io_uring_setup, n_entries, &params );
+  if( ring->fd < 0 ) { ring->fd = -1; return; }
+
+  ring->sq_map_size = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+  ring->cq_map_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  ring->sqes_map_size = params.sq_entries * sizeof(struct io_uring_sqe);
+  ring->sq_map = mmap( NULL, ring->sq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                       ring->fd, IORING_OFF_SQ_RING );
+  ring->cq_map = mmap( NULL, ring->cq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                       ring->fd, IORING_OFF_CQ_RING );
+  ring->sqes = mmap( NULL, ring->sqes_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                     ring->fd, IORING_OFF_SQES );
+  if( ring->sq_map == MAP_FAILED ) { ring->sq_map = NULL; }
+  if( ring->cq_map == MAP_FAILED ) { ring->cq_map = NULL; }
+  if( ring->sqes == MAP_FAILED )   { ring->sqes = NULL; }
+  if( !ring->sq_map || !ring->cq_map || !ring->sqes ) { msh_jobs__io_ring_term( ring ); return; }
+
+  uint8_t* sq = (uint8_t*)ring->sq_map;
+  uint8_t* cq = (uint8_t*)ring->cq_map;
+  ring->sq_head  = (uint32_t volatile*)( sq + params.sq_off.head );
+  ring->sq_tail  = (uint32_t volatile*)( sq + params.sq_off.tail );
+  ring->sq_mask  = *(uint32_t*)( sq + params.sq_off.ring_mask );
+  ring->sq_array = (uint32_t*)( sq + params.sq_off.array );
+  ring->cq_head  = (uint32_t volatile*)( cq + params.cq_off.head );
+  ring->cq_tail  = (uint32_t volatile*)( cq + params.cq_off.tail );
+  ring->cq_mask  = *(uint32_t*)( cq + params.cq_off.ring_mask );
+  ring->cqes     = cq + params.cq_off.cqes;
+  ring->n_in_flight = 0;
+  ring->max_in_flight = params.cq_entries;
+
+  pthread_mutex_init( &ring->submit_mutex, NULL );
+  if( msh_jobs_thread_create( &ring->completion_thread, msh_jobs__io_ring_procedure, ctx ) )
+  {
+    pthread_mutex_destroy( &ring->submit_mutex );
+    msh_jobs__io_ring_term( ring );
+  }
+}
+
+void
+msh_jobs__io_ring_shutdown( msh_jobs_ctx_t* ctx )
+{
+  msh_jobs_io_ring_t* ring = &ctx->io_ring;
+  if( ring->fd < 0 ) { return; }
+  msh_jobs__io_ring_submit( ring, NULL );
+  msh_jobs_thread_join( &ring->completion_thread );
+  pthread_mutex_destroy( &ring->submit_mutex );
+  msh_jobs__io_ring_term( ring );
+}
+
+// Reserves a completion queue slot. Returns false if the ring is not in use or too busy.
+int32_t
+msh_jobs__io_ring_reserve( msh_jobs_io_ring_t* ring )
+{
+  if( ring->fd < 0 ) { return false; }
+  for( ;; )
+  {
+    uint32_t n_in_flight = ring->n_in_flight;
+    if( n_in_flight >= ring->max_in_flight ) { return false; }
+    if( msh_jobs_atomic_compare_exchange( &ring->n_in_flight, n_in_flight + 1, n_in_flight ) ==
+        n_in_flight )
+    {
+      return true;
+    }
+  }
+}
+#endif
+
+int32_t
+msh_jobs_read_async( msh_jobs_ctx_t* ctx, msh_jobs_read_t* read )
+{
+  read->ctx = ctx;
+  read->result = 0;
+#if MSH_JOBS__IO_URING
+  msh_jobs_io_ring_t* ring = &ctx->io_ring;
+  if( msh_jobs__io_ring_reserve( ring ) )
+  {
+    if( read->counter ) { msh_jobs_atomic_increment( &read->counter->value ); }
+    msh_jobs_atomic_increment( &ctx->queue.completion_goal );
+    if( msh_jobs__io_ring_submit( ring, read ) ) { return MSH_JOBS_NO_ERR; }
+
+    msh_jobs_atomic_decrement( &ring->n_in_flight );
+    if( read->counter ) { msh_jobs_atomic_decrement( &read->counter->value ); }
+    msh_jobs_atomic_decrement( &ctx->queue.completion_goal );
+  }
+#endif
+  return msh_jobs_push_io_work( ctx, msh_jobs__read_job, read, read->counter );
+}
+
+// Sleeps on 'ec' until notified, recording the idle period when tracing
+void
+msh_jobs__idle_wait( msh_jobs_thread_info_t* ti, msh_jobs_eventcount_t* ec, uint32_t key )
+{
+  if( !ti->ctx->trace_size )
+  {
+    msh_jobs__eventcount_wait( ec, key );
+    return;
+  }
+  msh_jobs_trace_event_t event = { msh_jobs__time_now(), 0, NULL, MSH_JOBS_TRACE_IDLE, 0 };
+  msh_jobs__eventcount_wait( ec, key );
+  event.end = msh_jobs__time_now();
+  ti->stats.n_waits++;
+  ti->stats.idle_time += event.end - event.start;
+  msh_jobs__trace( ti, &event );
+}
+
+#if MSH_JOBS_PLATFORM_WINDOWS
+DWORD WINAPI msh_jobs_thread_procedure(void *params)
+#else
+void* msh_jobs_thread_procedure(void* params )
+#endif
+{
+  msh_jobs_thread_info_t* ti = (msh_jobs_thread_info_t*)params;
+  msh_jobs_ctx_t* ctx = ti->ctx;
+  msh_jobs_work_queue_t* queue = &ctx->queue;
+  msh_jobs__tls_thread_info = ti;
+  if( ti->cpu >= 0 ) { msh_jobs__pin_current_thread( (uint32_t)ti->cpu, ti->cpu_group ); }
+  while( !ctx->stop_requested )
+  {
+    if( !msh_jobs_execute_next_job_entry( ti ) ) { continue; }
+
+    // NOTE(maciej): The stop flag is checked after registering as a waiter - either this sees
+    // it set, or msh_jobs_term_ctx sees the waiter and wakes it up.
+    uint32_t key = msh_jobs__eventcount_prepare_wait( &queue->event );
+    if( ctx->stop_requested )
+    {
+      msh_jobs__eventcount_cancel_wait( &queue->event );
+      break;
+    }
+    msh_jobs_job_entry_t job;
+    if( msh_jobs__find_job( ti, &job ) )
+    {
+      msh_jobs__eventcount_cancel_wait( &queue->event );
+      msh_jobs__execute_job( ctx, ti->idx, &job );
+      continue;
+    }
+    msh_jobs__idle_wait( ti, &queue->event, key );
+  }
+  return 0;
+}
+
+// NOTE(maciej): I/O threads do not set msh_jobs__tls_thread_info - they own no deque, and jobs
+// they push take the same path as jobs pushed by external threads.
+#if MSH_JOBS_PLATFORM_WINDOWS
+DWORD WINAPI msh_jobs_io_thread_procedure(void *params)
+#else
+void* msh_jobs_io_thread_procedure(void* params )
+#endif
+{
+  msh_jobs_thread_info_t* ti = (msh_jobs_thread_info_t*)params;
+  msh_jobs_ctx_t* ctx = ti->ctx;
+  msh_jobs_work_queue_t* queue = &ctx->queue;
+  while( !ctx->stop_requested )
+  {
+    msh_jobs_job_entry_t job;
+    if( msh_jobs__mpmc_dequeue( &queue->io_queue, &job ) )
+    {
+      msh_jobs__execute_job( ctx, ti->idx, &job );
+      continue;
+    }
+
+    uint32_t key = msh_jobs__eventcount_prepare_wait( &queue->io_event );
+    if( ctx->stop_requested )
+    {
+      msh_jobs__eventcount_cancel_wait( &queue->io_event );
+      break;
+    }
+    if( msh_jobs__mpmc_dequeue( &queue->io_queue, &job ) )
+    {
+      msh_jobs__eventcount_cancel_wait( &queue->io_event );
+      msh_jobs__execute_job( ctx, ti->idx, &job );
+      continue;
+    }
+    msh_jobs__idle_wait( ti, &queue->io_event, key );
+  }
+  return 0;
+}
+
+// Releases queue storage. Safe to call on a partially initialized queue, as long as it was zeroed
+// first. Event counts are terminated separately, since they might not have been initialized.
+void
+msh_jobs__free_queue( msh_jobs_ctx_t* ctx )
+{
+  ctx->queue.completion_goal = 0;
+  ctx->queue.completion_count = 0;
+  if( ctx->queue.deques )
+  {
+    for( uint32_t i = 0; i < ctx->queue.deque_count; ++i )
+    {
+      msh_jobs__deque_free( &ctx->queue.deques[i] );
+    }
+  }
+  free( ctx->queue.deques );
+  ctx->queue.deques = NULL;
+  ctx->queue.deque_count = 0;
+  msh_jobs__mpmc_free( &ctx->queue.injection_queue );
+  if( ctx->queue.node_queues )
+  {
+    for( uint32_t i = 0; i < ctx->queue.node_queue_count; ++i )
+    {
+      msh_jobs__mpmc_free( &ctx->queue.node_queues[i] );
+    }
+  }
+  free( ctx->queue.node_queues );
+  ctx->queue.node_queues = NULL;
+  ctx->queue.node_queue_count = 0;
+  msh_jobs__mpmc_free( &ctx->queue.high_priority_queue );
+  msh_jobs__mpmc_free( &ctx->queue.background_queue );
+  msh_jobs__mpmc_free( &ctx->queue.io_queue );
+}
+
+int32_t
+msh_jobs__init_queue_storage( msh_jobs_ctx_t* ctx, uint32_t n_deques, uint32_t queue_size )
+{
+  ctx->queue.deque_count = n_deques;
+  ctx->queue.deques = (msh_jobs_deque_t*)calloc( n_deques, sizeof(msh_jobs_deque_t) );
+  if (!ctx->queue.deques) { return MSH_JOBS_OUT_OF_MEMORY; }
+
+  for( uint32_t i = 0; i < n_deques; ++i )
+  {
+    int32_t err = msh_jobs__deque_init( &ctx->queue.deques[i], queue_size );
+    if (err) { return err; }
+  }
+
+  int32_t err = msh_jobs__mpmc_init( &ctx->queue.injection_queue, queue_size > 2 ? queue_size : 2 );
+  if (err) { return err; }
+
+  ctx->queue.node_queue_count = ctx->processor_info.numa_node_count;
+  ctx->queue.node_queues = (msh_jobs_mpmc_queue_t*)calloc( ctx->queue.node_queue_count,
+                                                           sizeof(msh_jobs_mpmc_queue_t) );
+  if (!ctx->queue.node_queues) { return MSH_JOBS_OUT_OF_MEMORY; }
+  for( uint32_t i = 0; i < ctx->queue.node_queue_count; ++i )
+  {
+    err = msh_jobs__mpmc_init( &ctx->queue.node_queues[i], queue_size > 2 ? queue_size : 2 );
+    if (err) { return err; }
+  }
+
+  err = msh_jobs__mpmc_init( &ctx->queue.high_priority_queue, queue_size > 2 ? queue_size : 2 );
+  if (err) { return err; }
+  err = msh_jobs__mpmc_init( &ctx->queue.background_queue, queue_size > 2 ? queue_size : 2 );
+  if (err) { return err; }
+  return msh_jobs__mpmc_init( &ctx->queue.io_queue, queue_size > 2 ? queue_size : 2 );
+}
+
+// Either fully initializes the queue, or leaves nothing behind that would need to be released
+int32_t
+msh_jobs__init_queue( msh_jobs_ctx_t* ctx, uint32_t n_deques, uint32_t queue_size )
+{
+  memset( &ctx->queue, 0, sizeof(ctx->queue) );
+  int32_t err = msh_jobs__init_queue_storage( ctx, n_deques, queue_size );
+  if( err ) { msh_jobs__free_queue( ctx ); return err; }
+
+  err = msh_jobs__eventcount_init( &ctx->queue.io_event );
+  if( err ) { msh_jobs__free_queue( ctx ); return err; }
+  err = msh_jobs__eventcount_init( &ctx->queue.event );
+  if( err )
+  {
+    msh_jobs__eventcount_term( &ctx->queue.io_event );
+    msh_jobs__free_queue( ctx );
+  }
+  return err;
+}
+
+// Asks threads 1 .. n_threads-1 to exit, wakes them up and waits until they are gone
+void
+msh_jobs__stop_threads( msh_jobs_ctx_t* ctx, uint32_t n_threads )
+{
+  ctx->stop_requested = true;
+  msh_jobs__eventcount_notify( &ctx->queue.event, true );
+  msh_jobs__eventcount_notify( &ctx->queue.io_event, true );
+  for( uint32_t i = 1; i < n_threads; ++i )
+  {
+    msh_jobs_thread_join( &ctx->thread_infos[i].handle );
+  }
+}
+
+// Threads using 'thread_infos' have to be joined already
+void
+msh_jobs__free_thread_infos( msh_jobs_ctx_t* ctx )
+{
+  for( uint32_t i = 0; i <= ctx->thread_count + ctx->io_thread_count; ++i )
+  {
+    free( ctx->thread_infos[i].scratch.base );
+    free( ctx->thread_infos[i].trace.events );
+  }
+  free( ctx->thread_infos );
+  ctx->thread_infos = NULL;
+  ctx->thread_count = 0;
+  ctx->io_thread_count = 0;
+}
+
+// On failure, threads that were already started are joined and 'thread_infos' is released
+int32_t
+msh_jobs__create_threads( msh_jobs_ctx_t* ctx, int32_t pin_threads )
+{
+  int32_t err = MSH_JOBS_NO_ERR;
+
+  // Thread info - slot 0 describes the main thread, I/O threads follow the workers
+  uint32_t n_infos = ctx->thread_count + 1 + ctx->io_thread_count;
+  ctx->thread_infos = (msh_jobs_thread_info_t*)calloc( n_infos, sizeof( msh_jobs_thread_info_t ) );
+  if (!ctx->thread_infos) { err = MSH_JOBS_OUT_OF_MEMORY; return err; }
+  
+  for( uint32_t thrd_idx = 0; thrd_idx < n_infos; ++thrd_idx )
+  {
+    ctx->thread_infos[thrd_idx].idx = thrd_idx;
+    ctx->thread_infos[thrd_idx].ctx = ctx;
+    ctx->thread_infos[thrd_idx].rand_state = 0x9E3779B9u * (thrd_idx + 1);
+    ctx->thread_infos[thrd_idx].numa_node = 0;
+    ctx->thread_infos[thrd_idx].cpu = -1;
+    if( ctx->trace_size )
+    {
+      msh_jobs_trace_buffer_t* tb = &ctx->thread_infos[thrd_idx].trace;
+      tb->events = (msh_jobs_trace_event_t*)malloc( ctx->trace_size * sizeof(msh_jobs_trace_event_t) );
+      if( !tb->events ) { msh_jobs__free_thread_infos( ctx ); return MSH_JOBS_OUT_OF_MEMORY; }
+      tb->mask = ctx->trace_size - 1;
+    }
+  }
+
+  // NOTE(maciej): Main thread is left where it is, but its node is still used to pick victims
+  const msh_jobs_processor_info_t* info = &ctx->processor_info;
+  if( pin_threads && info->core_table_count )
+  {
+    uint32_t* order = (uint32_t*)malloc( info->core_table_count * sizeof(uint32_t) );
+    uint32_t n_cores = order ? msh_jobs__pinning_order( info, order ) : 0;
+    if( !n_cores )
+    {
+      free( order );
+      msh_jobs__free_thread_infos( ctx );
+      return MSH_JOBS_OUT_OF_MEMORY;
+    }
+    ctx->thread_infos[0].numa_node = msh_jobs__current_numa_node( info );
+    for( uint32_t thrd_idx = 1; thrd_idx <= ctx->thread_count; ++thrd_idx )
+    {
+      const msh_jobs_logical_core_info_t* core = &info->core_table[order[(thrd_idx - 1) % n_cores]];
+      ctx->thread_infos[thrd_idx].numa_node = core->numa_node;
+      ctx->thread_infos[thrd_idx].cpu = (int32_t)core->os_idx;
+      ctx->thread_infos[thrd_idx].cpu_group = core->group;
+    }
+    free( order );
+  }
+
+  for( uint32_t thrd_idx = 1; thrd_idx <= ctx->thread_count; ++thrd_idx )
+  {
+    err = msh_jobs_thread_create( &ctx->thread_infos[thrd_idx].handle,
+                                  msh_jobs_thread_procedure, &ctx->thread_infos[thrd_idx] );
+    if (err)
+    {
+      msh_jobs__stop_threads( ctx, thrd_idx );
+      msh_jobs__free_thread_infos( ctx );
+      return err;
+    }
+  }
+
+  for( uint32_t thrd_idx = ctx->thread_count + 1; thrd_idx < n_infos; ++thrd_idx )
+  {
+    err = msh_jobs_thread_create( &ctx->thread_infos[thrd_idx].handle,
+                                  msh_jobs_io_thread_procedure, &ctx->thread_infos[thrd_idx] );
+    if (err)
+    {
+      msh_jobs__stop_threads( ctx, thrd_idx );
+      msh_jobs__free_thread_infos( ctx );
+      return err;
+    }
+  }
+
+  return err;
+}
+
+int32_t
+msh_jobs_init_ctx( msh_jobs_ctx_t* ctx, uint32_t n_threads )
+{
+  msh_jobs_ctx_desc_t desc = { n_threads, false, MSH_JOBS_DEFAULT_IO_THREAD_COUNT, 0, 0, 0 };
+  return msh_jobs_init_ctx_desc( ctx, &desc );
+}
+
+int32_t
+msh_jobs_init_ctx_desc( msh_jobs_ctx_t* ctx, const msh_jobs_ctx_desc_t* desc )
+{
+  int32_t err = MSH_JOBS_NO_ERR;
+  uint32_t n_threads = desc->n_threads;
+  ctx->thread_infos = NULL;
+#if MSH_JOBS_PLATFORM_LINUX
+  ctx->io_ring.fd = -1;
+#endif
+  err = msh_jobs_get_processor_info( &ctx->processor_info );
+  if( err ) { return err; }
+  assert( ctx->processor_info.logical_core_count > 0 );
+  ctx->thread_count = n_threads ? n_threads : ctx->processor_info.logical_core_count - 1;
+  ctx->io_thread_count = desc->n_io_threads;
+  ctx->scratch_size = desc->scratch_size ? desc->scratch_size : MSH_JOBS_DEFAULT_SCRATCH_SIZE;
+  ctx->trace_size = 0;
+  ctx->trace_start = msh_jobs__time_now();
+  if( desc->trace_size )
+  {
+    ctx->trace_size = 1;
+    while( ctx->trace_size < desc->trace_size ) { ctx->trace_size <<= 1; }
+  }
+  ctx->main_thread_id = msh_jobs__current_thread_id();
+  ctx->stop_requested = false;
+  
+  err = msh_jobs__init_queue( ctx, ctx->thread_count + 1, MSH_JOBS_QUEUE_SIZE );
+  if( err ) { msh_jobs_free_processor_info( &ctx->processor_info ); return err; }
+  
+  err = msh_jobs__create_threads( ctx, desc->pin_threads );
+  if( err )
+  {
+    msh_jobs__eventcount_term( &ctx->queue.event );
+    msh_jobs__eventcount_term( &ctx->queue.io_event );
+    msh_jobs__free_queue( ctx );
+    msh_jobs_free_processor_info( &ctx->processor_info );
+    return err;
+  }
+
+#if MSH_JOBS__IO_URING
+  if( desc->io_ring_size ) { msh_jobs__io_ring_init( ctx, desc->io_ring_size ); }
+#endif
+  
+  return err;
+}
+
+// NOTE(maciej): Finishes all pushed work, then stops and joins every thread of the context
+// before freeing anything they could still touch. Call it from the thread that created the context.
+void
+msh_jobs_term_ctx( msh_jobs_ctx_t* ctx )
+{
+  if( !ctx->thread_infos ) { return; }
+  msh_jobs_complete_all_work( ctx );
+#if MSH_JOBS__IO_URING
+  msh_jobs__io_ring_shutdown( ctx );
+#endif
+  msh_jobs__stop_threads( ctx, ctx->thread_count + 1 + ctx->io_thread_count );
+  msh_jobs__free_thread_infos( ctx );
+  msh_jobs__eventcount_term( &ctx->queue.event );
+  msh_jobs__eventcount_term( &ctx->queue.io_event );
+  msh_jobs__free_queue( ctx );
+  msh_jobs_free_processor_info( &ctx->processor_info );
+}
+
+int32_t
+msh_jobs_write_trace( msh_jobs_ctx_t* ctx, const char* filename )
+{
+  FILE* fp = fopen( filename, "w" );
+  if( !fp ) { return MSH_JOBS_FAILED_TO_WRITE_FILE; }
+
+  uint32_t n_threads = ctx->thread_infos ? ctx->thread_count + 1 + ctx->io_thread_count : 0;
+  msh_jobs_trace_event_t* events = NULL;
+  if( ctx->trace_size )
+  {
+    events = (msh_jobs_trace_event_t*)malloc( ctx->trace_size * sizeof(msh_jobs_trace_event_t) );
+    if( !events ) { fclose( fp ); return MSH_JOBS_OUT_OF_MEMORY; }
+  }
+
+  // Timestamps are relative to the creation of the context
+  uint64_t t0 = ctx->trace_start;
+  fprintf( fp, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n" );
+  fprintf( fp, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":0,\"args\":{\"name\":\"msh_jobs\"}}" );
+  for( uint32_t i = 0; i < n_threads; ++i )
+  {
+    msh_jobs_thread_info_t* ti = &ctx->thread_infos[i];
+    const char* kind = ( i == 0 ) ? "main" : ( i <= ctx->thread_count ? "worker" : "io" );
+    fprintf( fp, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%u,"
+                 "\"args\":{\"name\":\"%s %u: %llu jobs, %llu steals (%llu contended), "
+                 "%llu waits, %.3f ms idle\"}}",
+             i, kind, i, (unsigned long long)ti->stats.n_jobs,
+             (unsigned long long)ti->stats.n_steals,
+             (unsigned long long)ti->stats.n_contended_steals,
+             (unsigned long long)ti->stats.n_waits, (double)ti->stats.idle_time * 1e-6 );
+    if( !events ) { continue; }
+
+    // NOTE(maciej): The owner keeps writing while we copy. Whatever it could have overwritten
+    // in the meantime is dropped.
+    msh_jobs_trace_buffer_t* tb = &ti->trace;
+    uint64_t n_written = tb->n_written;
+    MSH_JOBS_READ_BARRIER();
+    uint64_t first = n_written > ctx->trace_size ? n_written - ctx->trace_size : 0;
+    for( uint64_t j = first; j < n_written; ++j ) { events[j - first] = tb->events[j & tb->mask]; }
+    MSH_JOBS_READ_BARRIER();
+    uint64_t n_overwritten = tb->n_written - first;
+    n_overwritten = n_overwritten > ctx->trace_size ? n_overwritten - ctx->trace_size : 0;
+
+    for( uint64_t j = first + n_overwritten; j < n_written; ++j )
+    {
+      msh_jobs_trace_event_t* ev = &events[j - first];
+      double ts = (double)(ev->start - t0) * 1e-3;
+      double dur = (double)(ev->end - ev->start) * 1e-3;
+      if( ev->type == MSH_JOBS_TRACE_IDLE )
+      {
+        fprintf( fp, ",\n{\"name\":\"idle\",\"cat\":\"wait\",\"ph\":\"X\",\"pid\":0,"
+                     "\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}", i, ts, dur );
+        continue;
+      }
+      fprintf( fp, ",\n{\"name\":\"job %p\",\"cat\":\"job\",\"ph\":\"X\",\"pid\":0,"
+                   "\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"queue_depth\":%u}}",
+               (void*)(uintptr_t)ev->task, i, ts, dur, ev->queue_depth );
+      if( i < ctx->queue.deque_count )
+      {
+        fprintf( fp, ",\n{\"name\":\"queue depth %u\",\"ph\":\"C\",\"pid\":0,\"ts\":%.3f,"
+                     "\"args\":{\"depth\":%u}}", i, ts, ev->queue_depth );
+      }
+    }
+  }
+  fprintf( fp, "\n]}\n" );
+
+  free( events );
+  int32_t err = ferror( fp ) ? MSH_JOBS_FAILED_TO_WRITE_FILE : MSH_JOBS_NO_ERR;
+  fclose( fp );
+  return err;
 }
 
 char* 
@@ -461,24 +2535,36 @@ int32_t
 msh_jobs_get_processor_info( msh_jobs_processor_info_t* info  )
 {
   int32_t error = MSH_JOBS_NO_ERR;
+  memset( info, 0, sizeof(*info) );
 #if MSH_JOBS_PLATFORM_WINDOWS
 
-  SYSTEM_INFO sysinfo;
-  GetSystemInfo(&sysinfo);
-  info->logical_core_count = sysinfo.dwNumberOfProcessors;
+  // Count processors of all groups, not only of the calling thread's one
+  info->logical_core_count = GetActiveProcessorCount( ALL_PROCESSOR_GROUPS );
+  msh_jobs__get_topology_windows( info );
 
 #elif MSH_JOBS_PLATFORM_LINUX
 
   info->logical_core_count = sysconf( _SC_NPROCESSORS_ONLN );
-  goto msh_jobs_get_processor_info_exit;
+  msh_jobs__get_topology_linux( info );
 
 #elif MSH_JOBS_PLATFORM_MACOS
 
   #warning "NOT TESTED ON MACOS - ASSUME IT DOES NOT WORK!"
-  size_t physical_count_len = sizeof(count);
-  sysctlbyname("hw.logicalcpu", &info->logical_core_count, &logical_count_len, NULL, 0);
+  size_t count_len = sizeof(uint32_t);
+  sysctlbyname("hw.logicalcpu", &info->logical_core_count, &count_len, NULL, 0);
+  count_len = sizeof(uint32_t);
+  sysctlbyname("hw.physicalcpu", &info->physical_core_count, &count_len, NULL, 0);
+  count_len = sizeof(uint32_t);
+  sysctlbyname("hw.packages", &info->package_count, &count_len, NULL, 0);
+  size_t size_len = sizeof(uint64_t);
+  sysctlbyname("hw.l1dcachesize", &info->l1d_cache_size, &size_len, NULL, 0);
+  size_len = sizeof(uint64_t);
+  sysctlbyname("hw.l2cachesize", &info->l2_cache_size, &size_len, NULL, 0);
+  size_len = sizeof(uint64_t);
+  sysctlbyname("hw.l3cachesize", &info->l3_cache_size, &size_len, NULL, 0);
 
 #endif
+  msh_jobs__finalize_topology( info );
 
   return error;
 }
@@ -0,0 +1,389 @@
+/* Benchmark for msh_hash_grid.h
+
+  Times grid construction, radius search and kNN search on a few standard point distributions:
+    - uniform   : points uniformly distributed in a unit cube
+    - clustered : points drawn from a number of gaussian blobs with varying spread
+    - surface   : points on a sphere and a torus, i.e. 2-manifold data, like scanned surfaces
+
+  Point counts go from 100K up to '--max_n_pts' in powers of 10. Radii are picked so that an
+  average uniform query finds roughly 8, 32 and 128 neighbors. Each search is repeated for
+  1, 2, 4, ... up to '--max_n_threads' threads (requires OpenMP). Results are reported as queries
+  per second, together with the grid memory footprint and the peak resident memory of the
+  process. Approximate search can be benchmarked with '--eps' and '--max_n_examined'.
+  First '--n_validate' queries of every search are checked against brute force, which
+  is also timed as a baseline.
+
+  Example:
+    gcc -O3 -fopenmp -I<path_to_msh> tests/msh_hash_grid_bench.c -lm -o hg_bench
+    ./hg_bench --max_n_pts 10000000 --max_n_threads 8
+*/
+#define MSH_STD_INCLUDE_LIBC_HEADERS
+#define MSH_STD_IMPLEMENTATION
+#define MSH_ARGPARSE_INCLUDE_HEADERS
+#define MSH_ARGPARSE_IMPLEMENTATION
+#define MSH_HASH_GRID_IMPLEMENTATION
+#include "msh/msh_std.h"
+#include "msh/msh_argparse.h"
+#include "msh/msh_hash_grid.h"
+
+#if defined(_WIN32)
+#include <windows.h>
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
+#else
+#include <sys/resource.h>
+#endif
+
+typedef enum bench_distribution
+{
+  BENCH_UNIFORM = 0,
+  BENCH_CLUSTERED,
+  BENCH_SURFACE,
+  BENCH_N_DISTRIBUTIONS
+} bench_distribution_t;
+
+static const char* bench_distribution_names[BENCH_N_DISTRIBUTIONS] =
+{
+  "uniform", "clustered", "surface"
+};
+
+typedef struct bench_opts
+{
+  int max_n_pts;
+  int max_n_threads;
+  int n_queries;
+  int n_validate;
+  int max_n_neigh;
+  int max_n_examined;
+  float eps;
+  int seed;
+} bench_opts_t;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Utilities
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+double
+bench_peak_memory_mb()
+{
+#if defined(_WIN32)
+  PROCESS_MEMORY_COUNTERS pmc;
+  if( GetProcessMemoryInfo( GetCurrentProcess(), &pmc, sizeof(pmc) ) )
+  {
+    return pmc.PeakWorkingSetSize / (1024.0 * 1024.0);
+  }
+  return 0.0;
+#else
+  struct rusage usage;
+  if( getrusage( RUSAGE_SELF, &usage ) ) { return 0.0; }
+#if defined(__APPLE__)
+  return usage.ru_maxrss / (1024.0 * 1024.0);
+#else
+  return usage.ru_maxrss / 1024.0;
+#endif
+#endif
+}
+
+double
+bench_grid_memory_mb( const msh_hash_grid_t* hg )
+{
+  size_t n_bytes = hg->_n_pts * sizeof(msh_hg_v3i_t) +
+                   hg->bin_table->_len * sizeof(msh_hg__bin_info_t) +
+                   hg->bin_table->_cap * 2 * sizeof(uint64_t);
+  return n_bytes / (1024.0 * 1024.0);
+}
+
+float
+bench_rand_normal( msh_rand_ctx_t* rand_gen )
+{
+  // Box-Muller
+  float u1 = msh_max( msh_rand_nextf( rand_gen ), 1e-7f );
+  float u2 = msh_rand_nextf( rand_gen );
+  return sqrtf( -2.0f * logf( u1 ) ) * cosf( 2.0f * MSH_PI * u2 );
+}
+
+void
+bench_generate_points( float* pts, int32_t n_pts, bench_distribution_t distribution,
+                       msh_rand_ctx_t* rand_gen )
+{
+  switch( distribution )
+  {
+    case BENCH_UNIFORM:
+      for( int32_t i = 0; i < 3 * n_pts; ++i ) { pts[i] = msh_rand_nextf( rand_gen ); }
+      break;
+
+    case BENCH_CLUSTERED:
+    {
+      enum { N_CLUSTERS = 64 };
+      float centers[N_CLUSTERS][4];
+      for( int32_t c = 0; c < N_CLUSTERS; ++c )
+      {
+        centers[c][0] = msh_rand_nextf( rand_gen );
+        centers[c][1] = msh_rand_nextf( rand_gen );
+        centers[c][2] = msh_rand_nextf( rand_gen );
+        centers[c][3] = 0.002f + 0.05f * msh_rand_nextf( rand_gen );
+      }
+      for( int32_t i = 0; i < n_pts; ++i )
+      {
+        const float* c = centers[ msh_rand_next( rand_gen ) % N_CLUSTERS ];
+        pts[3 * i + 0] = c[0] + c[3] * bench_rand_normal( rand_gen );
+        pts[3 * i + 1] = c[1] + c[3] * bench_rand_normal( rand_gen );
+        pts[3 * i + 2] = c[2] + c[3] * bench_rand_normal( rand_gen );
+      }
+      break;
+    }
+
+    case BENCH_SURFACE:
+      for( int32_t i = 0; i < n_pts; ++i )
+      {
+        float u = 2.0f * MSH_PI * msh_rand_nextf( rand_gen );
+        float v = msh_rand_nextf( rand_gen );
+        float* pt = pts + 3 * i;
+        if( i & 1 )
+        {
+          // sphere
+          float z = 2.0f * v - 1.0f;
+          float r = sqrtf( msh_max( 1.0f - z * z, 0.0f ) );
+          pt[0] = 0.3f + 0.25f * r * cosf( u );
+          pt[1] = 0.5f + 0.25f * r * sinf( u );
+          pt[2] = 0.5f + 0.25f * z;
+        }
+        else
+        {
+          // torus, not uniform in area, which gives some density variation
+          float w = 2.0f * MSH_PI * v;
+          float r = 0.25f + 0.08f * cosf( w );
+          pt[0] = 0.7f + r * cosf( u );
+          pt[1] = 0.5f + r * sinf( u );
+          pt[2] = 0.5f + 0.08f * sinf( w );
+        }
+      }
+      break;
+
+    default:
+      assert( 0 );
+  }
+}
+
+void
+bench_set_threads( msh_hash_grid_t* hg, int32_t n_threads )
+{
+  hg->_num_threads  = n_threads;
+  hg->_dont_use_omp = (n_threads == 1);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Brute force baseline
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Finds up to 'max_n' closest points within 'radius' (all points if radius <= 0), sorted.
+size_t
+bench_brute_force( const float* pts, int32_t n_pts, const float* query_pt, float radius,
+                   size_t max_n, float* dists_sq, float* scratch )
+{
+  float radius_sq = (radius > 0.0f) ? radius * radius : MSH_F32_MAX;
+  size_t n = 0;
+  for( int32_t i = 0; i < n_pts; ++i )
+  {
+    float dx = pts[3 * i + 0] - query_pt[0];
+    float dy = pts[3 * i + 1] - query_pt[1];
+    float dz = pts[3 * i + 2] - query_pt[2];
+    float d  = dx * dx + dy * dy + dz * dz;
+    if( d < radius_sq ) { scratch[n++] = d; }
+  }
+
+  // Partial selection sort is enough here - max_n is small
+  size_t n_out = msh_min( n, max_n );
+  for( size_t i = 0; i < n_out; ++i )
+  {
+    size_t min_idx = i;
+    for( size_t j = i + 1; j < n; ++j ) { if( scratch[j] < scratch[min_idx] ) { min_idx = j; } }
+    float tmp = scratch[i]; scratch[i] = scratch[min_idx]; scratch[min_idx] = tmp;
+    dists_sq[i] = scratch[i];
+  }
+  return n_out;
+}
+
+// Returns number of queries for which grid results differ from brute force
+int32_t
+bench_validate( const float* pts, int32_t n_pts, const float* query_pts, int32_t n_validate,
+                float radius, size_t row_size, const float* dists_sq, const size_t* n_neighbors,
+                double* brute_force_qps )
+{
+  float* ref     = (float*)malloc( row_size * sizeof(float) );
+  float* scratch = (float*)malloc( n_pts * sizeof(float) );
+  int32_t n_errors = 0;
+
+  uint64_t t1 = msh_time_now();
+  for( int32_t i = 0; i < n_validate; ++i )
+  {
+    size_t n_ref = bench_brute_force( pts, n_pts, query_pts + 3 * i, radius, row_size, ref, scratch );
+    int32_t ok = (n_ref == n_neighbors[i]);
+    for( size_t j = 0; ok && j < n_ref; ++j )
+    {
+      float d = dists_sq[i * row_size + j];
+      ok = fabsf( d - ref[j] ) <= 1e-5f * (1.0f + ref[j]);
+    }
+    n_errors += !ok;
+  }
+  uint64_t t2 = msh_time_now();
+  *brute_force_qps = n_validate / msh_max( msh_time_diff_sec( t2, t1 ), 1e-9 );
+
+  free( ref );
+  free( scratch );
+  return n_errors;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Benchmark
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void
+bench_run( const bench_opts_t* opts, bench_distribution_t distribution, int32_t n_pts )
+{
+  msh_rand_ctx_t rand_gen = {0};
+  msh_rand_init( &rand_gen, (uint64_t)opts->seed + n_pts + distribution );
+
+  float* pts = (float*)malloc( 3 * (size_t)n_pts * sizeof(float) );
+  if( !pts ) { printf( "| Could not allocate %d points, skipping\n", n_pts ); return; }
+  bench_generate_points( pts, n_pts, distribution, &rand_gen );
+
+  // Queries are a random subset of the input points
+  int32_t n_queries = msh_min( opts->n_queries, n_pts );
+  float* query_pts = (float*)malloc( 3 * (size_t)n_queries * sizeof(float) );
+  for( int32_t i = 0; i < n_queries; ++i )
+  {
+    int32_t idx = msh_rand_next( &rand_gen ) % n_pts;
+    memcpy( query_pts + 3 * i, pts + 3 * idx, 3 * sizeof(float) );
+  }
+  int32_t n_validate = msh_min( opts->n_validate, n_queries );
+
+  size_t row_size     = opts->max_n_neigh;
+  float* dists_sq     = (float*)malloc( (size_t)n_queries * row_size * sizeof(float) );
+  int32_t* indices    = (int32_t*)malloc( (size_t)n_queries * row_size * sizeof(int32_t) );
+  size_t* n_neighbors = (size_t*)malloc( (size_t)n_queries * sizeof(size_t) );
+
+  // Radii for roughly 8, 32 and 128 neighbors on uniform data. kNN uses matching k values.
+  float radii[3];
+  size_t ks[3] = { 8, 32, 128 };
+  for( int32_t i = 0; i < 3; ++i )
+  {
+    radii[i] = cbrtf( 3.0f * ks[i] / (4.0f * MSH_PI * n_pts) );
+    ks[i]    = msh_min( ks[i], row_size );
+  }
+
+  for( int32_t r = 0; r < 3; ++r )
+  {
+    msh_hash_grid_t hg = {0};
+    uint64_t t1 = msh_time_now();
+    msh_hash_grid_init_3d( &hg, pts, n_pts, radii[r] );
+    uint64_t t2 = msh_time_now();
+    printf( "| %-9s | %10d | init     | r=%8.5f | %10.2f ms | grid %8.1f MB | peak %8.1f MB\n",
+            bench_distribution_names[distribution], n_pts, radii[r],
+            msh_time_diff_ms( t2, t1 ), bench_grid_memory_mb( &hg ), bench_peak_memory_mb() );
+
+    for( int32_t search_type = 0; search_type < 2; ++search_type )
+    {
+      msh_hash_grid_search_desc_t search_desc =
+      {
+        .query_pts      = query_pts,
+        .n_query_pts    = n_queries,
+        .distances_sq   = dists_sq,
+        .indices        = indices,
+        .n_neighbors    = n_neighbors,
+        .sort           = 1,
+        .eps            = opts->eps,
+        .max_n_examined = opts->max_n_examined
+      };
+      if( search_type == 0 ) { search_desc.radius = radii[r]; search_desc.max_n_neigh = row_size; }
+      else                   { search_desc.k = ks[r]; }
+
+      for( int32_t n_threads = 1; n_threads <= opts->max_n_threads; n_threads *= 2 )
+      {
+        bench_set_threads( &hg, n_threads );
+        t1 = msh_time_now();
+        size_t n_found = (search_type == 0) ? msh_hash_grid_radius_search( &hg, &search_desc )
+                                            : msh_hash_grid_knn_search( &hg, &search_desc );
+        t2 = msh_time_now();
+        double qps = n_queries / msh_max( msh_time_diff_sec( t2, t1 ), 1e-9 );
+        char param[32];
+        if( search_type == 0 ) { snprintf( param, sizeof(param), "r=%8.5f", radii[r] ); }
+        else                   { snprintf( param, sizeof(param), "k=%8d", (int32_t)ks[r] ); }
+        printf( "| %-9s | %10d | %-8s | %s | %4d threads | %12.0f queries/s | avg %7.2f neigh\n",
+                bench_distribution_names[distribution], n_pts,
+                search_type == 0 ? "radius" : "knn", param,
+                n_threads, qps, (double)n_found / n_queries );
+      }
+
+      if( n_validate )
+      {
+        double brute_force_qps = 0.0;
+        size_t stride = (search_type == 0) ? row_size : ks[r];
+        int32_t n_errors = bench_validate( pts, n_pts, query_pts, n_validate,
+                                           search_type == 0 ? radii[r] : 0.0f, stride,
+                                           dists_sq, n_neighbors, &brute_force_qps );
+        printf( "| %-9s | %10d | %-8s | brute force %12.0f queries/s | %d / %d mismatches%s\n",
+                bench_distribution_names[distribution], n_pts,
+                search_type == 0 ? "radius" : "knn", brute_force_qps, n_errors, n_validate,
+                n_errors ? "  <-- FAILED" : "" );
+      }
+    }
+    msh_hash_grid_term( &hg );
+  }
+
+  free( pts );
+  free( query_pts );
+  free( dists_sq );
+  free( indices );
+  free( n_neighbors );
+}
+
+int
+main( int argc, char** argv )
+{
+  bench_opts_t opts =
+  {
+    .max_n_pts     = 1000000,
+    .max_n_threads = 1,
+    .n_queries     = 100000,
+    .n_validate    = 100,
+    .max_n_neigh   = 128,
+    .seed          = 12345
+  };
+#if defined(_OPENMP)
+  opts.max_n_threads = omp_get_max_threads();
+#endif
+
+  msh_argparse_t parser = {0};
+  msh_ap_init( &parser, "msh_hash_grid_bench", "Benchmarks msh_hash_grid.h on standard point sets" );
+  msh_ap_add_int_argument( &parser, "--max_n_pts", "-n", "Largest point count, counts go from 100K in powers of 10", &opts.max_n_pts, 1 );
+  msh_ap_add_int_argument( &parser, "--max_n_threads", "-t", "Largest thread count, counts go from 1 in powers of 2", &opts.max_n_threads, 1 );
+  msh_ap_add_int_argument( &parser, "--n_queries", "-q", "Number of queries per search", &opts.n_queries, 1 );
+  msh_ap_add_int_argument( &parser, "--n_validate", "-v", "Number of queries checked against brute force", &opts.n_validate, 1 );
+  msh_ap_add_int_argument( &parser, "--max_n_neigh", "-m", "Maximum number of neighbors stored per query", &opts.max_n_neigh, 1 );
+  msh_ap_add_float_argument( &parser, "--eps", "-e", "Approximate search epsilon, validation reports mismatches when non-zero", &opts.eps, 1 );
+  msh_ap_add_int_argument( &parser, "--max_n_examined", "-x", "Approximate search cap on points examined per query", &opts.max_n_examined, 1 );
+  msh_ap_add_int_argument( &parser, "--seed", "-s", "Random seed", &opts.seed, 1 );
+  if( !msh_ap_parse( &parser, argc, argv ) ) { return EXIT_FAILURE; }
+
+#if !defined(_OPENMP)
+  if( opts.max_n_threads > 1 )
+  {
+    printf( "| Compiled without OpenMP, running single threaded only\n" );
+    opts.max_n_threads = 1;
+  }
+#endif
+  opts.max_n_threads = msh_max( opts.max_n_threads, 1 );
+  opts.max_n_neigh   = msh_max( opts.max_n_neigh, 1 );
+
+  printf( "Running msh_hash_grid.h benchmarks!\n" );
+  for( int32_t distribution = 0; distribution < BENCH_N_DISTRIBUTIONS; ++distribution )
+  {
+    for( int64_t n_pts = 100000; n_pts <= opts.max_n_pts; n_pts *= 10 )
+    {
+      bench_run( &opts, (bench_distribution_t)distribution, (int32_t)n_pts );
+    }
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,245 @@
+/* Poor man's tests for msh_hash_grid.h built with MSH_HASH_GRID_DOUBLE_PRECISION.
+   Points use UTM-like coordinates, which floats cannot represent to better than half a meter. */
+#define MSH_STD_INCLUDE_LIBC_HEADERS
+#define MSH_STD_IMPLEMENTATION
+#define MSH_HASH_GRID_IMPLEMENTATION
+#define MSH_HASH_GRID_DOUBLE_PRECISION
+#include "msh/msh_std.h"
+#include "msh/msh_hash_grid.h"
+
+#define N_PTS 20000
+#define N_QUERIES 500
+#define TOLERANCE 1e-3
+
+double
+dist_sq( const double* a, const double* b )
+{
+  double dx = a[0] - b[0];
+  double dy = a[1] - b[1];
+  double dz = a[2] - b[2];
+  return dx * dx + dy * dy + dz * dz;
+}
+
+int
+double_compare( const void* a, const void* b )
+{
+  double da = *(const double*)a;
+  double db = *(const double*)b;
+  return (da > db) - (da < db);
+}
+
+double*
+generate_utm_points( size_t n_pts )
+{
+  msh_rand_ctx_t rand_gen = {0};
+  msh_rand_init( &rand_gen, 12346ULL );
+
+  // 40 x 40 x 8 meter block of points near 500000 E, 4000000 N
+  double* pts = malloc( sizeof(double) * 3 * n_pts );
+  for( size_t i = 0; i < n_pts; ++i )
+  {
+    pts[3 * i + 0] = 500000.0 + 40.0 * msh_rand_nextf( &rand_gen );
+    pts[3 * i + 1] = 4000000.0 + 40.0 * msh_rand_nextf( &rand_gen );
+    pts[3 * i + 2] = 120.0 + 8.0 * msh_rand_nextf( &rand_gen );
+  }
+  return pts;
+}
+
+void
+binning_test( const msh_hash_grid_t* hg, const double* pts, size_t n_pts )
+{
+  // every point is stored exactly once, at its position relative to the origin
+  uint8_t* seen = calloc( n_pts, 1 );
+  size_t n_stored = 0;
+  for( size_t b = 0; b < hg->bin_table->_len; ++b )
+  {
+    msh_hg__bin_info_t bin = hg->offsets[b];
+    msh_hg_v3i_t first = hg->data_buffer[bin.offset];
+    uint64_t cx = (uint64_t)( ( first.x - hg->min_pt.x ) * hg->_inv_cell_size );
+    uint64_t cy = (uint64_t)( ( first.y - hg->min_pt.y ) * hg->_inv_cell_size );
+    uint64_t cz = (uint64_t)( ( first.z - hg->min_pt.z ) * hg->_inv_cell_size );
+    for( uint32_t j = 0; j < bin.length; ++j )
+    {
+      msh_hg_v3i_t pt = hg->data_buffer[bin.offset + j];
+      assert( pt.i >= 0 && (size_t)pt.i < n_pts && !seen[pt.i] );
+      seen[pt.i] = 1;
+      n_stored++;
+
+      const double* ref = pts + 3 * pt.i;
+      assert( fabs( hg->origin[0] + pt.x - ref[0] ) < TOLERANCE );
+      assert( fabs( hg->origin[1] + pt.y - ref[1] ) < TOLERANCE );
+      assert( fabs( hg->origin[2] + pt.z - ref[2] ) < TOLERANCE );
+
+      // and all points of a bin fall into the same cell
+      assert( (uint64_t)( ( pt.x - hg->min_pt.x ) * hg->_inv_cell_size ) == cx );
+      assert( (uint64_t)( ( pt.y - hg->min_pt.y ) * hg->_inv_cell_size ) == cy );
+      assert( (uint64_t)( ( pt.z - hg->min_pt.z ) * hg->_inv_cell_size ) == cz );
+    }
+  }
+  assert( n_stored == n_pts );
+
+  // half a meter cells at this scale would collapse in single precision
+  assert( hg->bin_table->_len > n_pts / 4 );
+  free( seen );
+}
+
+void
+radius_search_test( const msh_hash_grid_t* hg, const double* pts, size_t n_pts, float radius )
+{
+  size_t max_n_neigh = 256;
+  msh_hash_grid_search_desc_t search_opts =
+  {
+    .query_pts = (double*)pts,
+    .n_query_pts = N_QUERIES,
+    .radius = radius,
+    .max_n_neigh = max_n_neigh,
+    .distances_sq = malloc( sizeof(float) * max_n_neigh * N_QUERIES ),
+    .indices = malloc( sizeof(int32_t) * max_n_neigh * N_QUERIES ),
+    .n_neighbors = malloc( sizeof(size_t) * N_QUERIES ),
+    .sort = 1
+  };
+  msh_hash_grid_radius_search( hg, &search_opts );
+
+  // compare against brute force, allowing for points right at the radius
+  for( size_t q = 0; q < N_QUERIES; ++q )
+  {
+    const double* query = pts + 3 * q;
+    size_t n_inner = 0, n_outer = 0;
+    for( size_t i = 0; i < n_pts; ++i )
+    {
+      double d = sqrt( dist_sq( query, pts + 3 * i ) );
+      if( d < radius - TOLERANCE ) { n_inner++; }
+      if( d < radius + TOLERANCE ) { n_outer++; }
+    }
+    size_t n_neigh = search_opts.n_neighbors[q];
+    assert( n_outer < max_n_neigh );
+    assert( n_inner <= n_neigh && n_neigh <= n_outer );
+    for( size_t j = 0; j < n_neigh; ++j )
+    {
+      int32_t idx = search_opts.indices[q * max_n_neigh + j];
+      double d = sqrt( dist_sq( query, pts + 3 * idx ) );
+      assert( d < radius + TOLERANCE );
+      assert( fabs( sqrt( search_opts.distances_sq[q * max_n_neigh + j] ) - d ) < TOLERANCE );
+    }
+  }
+
+  free( search_opts.distances_sq );
+  free( search_opts.indices );
+  free( search_opts.n_neighbors );
+}
+
+void
+knn_search_test( const msh_hash_grid_t* hg, const double* pts, size_t n_pts )
+{
+  size_t k = 8;
+  msh_hash_grid_search_desc_t search_opts =
+  {
+    .query_pts = (double*)pts,
+    .n_query_pts = N_QUERIES,
+    .k = k,
+    .distances_sq = malloc( sizeof(float) * k * N_QUERIES ),
+    .indices = malloc( sizeof(int32_t) * k * N_QUERIES ),
+    .n_neighbors = malloc( sizeof(size_t) * N_QUERIES ),
+    .sort = 1
+  };
+  msh_hash_grid_knn_search( hg, &search_opts );
+
+  // k smallest distances have to match the brute force ones
+  double* dists = malloc( sizeof(double) * n_pts );
+  for( size_t q = 0; q < N_QUERIES; ++q )
+  {
+    const double* query = pts + 3 * q;
+    for( size_t i = 0; i < n_pts; ++i ) { dists[i] = sqrt( dist_sq( query, pts + 3 * i ) ); }
+    qsort( dists, n_pts, sizeof(double), double_compare );
+
+    assert( search_opts.n_neighbors[q] == k );
+    for( size_t j = 0; j < k; ++j )
+    {
+      int32_t idx = search_opts.indices[q * k + j];
+      assert( fabs( sqrt( dist_sq( query, pts + 3 * idx ) ) - dists[j] ) < TOLERANCE );
+      assert( fabs( sqrt( search_opts.distances_sq[q * k + j] ) - dists[j] ) < TOLERANCE );
+    }
+  }
+
+  free( dists );
+  free( search_opts.distances_sq );
+  free( search_opts.indices );
+  free( search_opts.n_neighbors );
+}
+
+int32_t
+inside_box( const double* pt, const double* box, double margin )
+{
+  return pt[0] >= box[0] - margin && pt[1] >= box[1] - margin && pt[2] >= box[2] - margin &&
+         pt[0] <= box[3] + margin && pt[1] <= box[4] + margin && pt[2] <= box[5] + margin;
+}
+
+void
+box_query_test( const msh_hash_grid_t* hg, const double* pts, size_t n_pts )
+{
+  double boxes[12] = { 500010.25, 4000005.5, 121.0, 500012.75, 4000009.25, 125.5,
+                       499990.0, 4000030.0, 100.0, 500001.5, 4000050.0, 200.0 };
+  size_t max_n_indices = n_pts;
+  size_t n_indices[2] = {0};
+  msh_hash_grid_range_desc_t range_opts =
+  {
+    .boxes = boxes,
+    .n_ranges = 2,
+    .max_n_indices = max_n_indices,
+    .indices = malloc( sizeof(int32_t) * 2 * max_n_indices ),
+    .n_indices = n_indices
+  };
+  msh_hash_grid_box_query( hg, &range_opts );
+
+  for( size_t j = 0; j < 2; ++j )
+  {
+    const double* box = boxes + 6 * j;
+    size_t n_inner = 0, n_outer = 0;
+    for( size_t i = 0; i < n_pts; ++i )
+    {
+      if( inside_box( pts + 3 * i, box, -TOLERANCE ) ) { n_inner++; }
+      if( inside_box( pts + 3 * i, box, TOLERANCE ) )  { n_outer++; }
+    }
+    assert( n_inner > 0 );
+    assert( n_inner <= n_indices[j] && n_indices[j] <= n_outer );
+    for( size_t i = 0; i < n_indices[j]; ++i )
+    {
+      int32_t idx = range_opts.indices[j * max_n_indices + i];
+      assert( inside_box( pts + 3 * idx, box, TOLERANCE ) );
+    }
+  }
+
+  free( range_opts.indices );
+}
+
+int
+main()
+{
+  printf( "Running msh_hash_grid.h double precision tests!\n" );
+
+  double* pts = generate_utm_points( N_PTS );
+  float radius = 0.25f;
+  msh_hash_grid_t hg = {0};
+  msh_hash_grid_init_3d( &hg, pts, N_PTS, radius );
+
+  printf( "| Testing msh_hash_grid_init_3d binning\n" );
+  binning_test( &hg, pts, N_PTS );
+  printf( "|    -> Passed!\n" );
+
+  printf( "| Testing msh_hash_grid_radius_search\n" );
+  radius_search_test( &hg, pts, N_PTS, radius );
+  radius_search_test( &hg, pts, N_PTS, 0.5f * radius );
+  printf( "|    -> Passed!\n" );
+
+  printf( "| Testing msh_hash_grid_knn_search\n" );
+  knn_search_test( &hg, pts, N_PTS );
+  printf( "|    -> Passed!\n" );
+
+  printf( "| Testing msh_hash_grid_box_query\n" );
+  box_query_test( &hg, pts, N_PTS );
+  printf( "|    -> Passed!\n" );
+
+  msh_hash_grid_term( &hg );
+  free( pts );
+  return 0;
+}
@@ -2,9 +2,11 @@
 #define MSH_STD_INCLUDE_LIBC_HEADERS
 #define MSH_STD_IMPLEMENTATION
 #define MSH_VEC_MATH_IMPLEMENTATION
+#define MSH_JOBS_IMPLEMENTATION
 #define MSH_HASH_GRID_IMPLEMENTATION
 #include "msh/msh_std.h"
 #include "msh/msh_vec_math.h"
+#include "msh/msh_jobs.h"
 #include "msh/msh_hash_grid.h"
 
 msh_vec3_t
@@ -31,6 +33,82 @@ generate_random_point_within_sphere( msh_rand_ctx_t* rand_gen, msh_vec3_t center
   return generate_random_point_within_sphere_shell( rand_gen, center, radius, 0.0f );
 }
 
+void
+radius_search_csr_test()
+{
+  msh_rand_ctx_t rand_gen = {0};
+  msh_rand_init( &rand_gen, 12346ULL );
+  msh_array( msh_vec3_t ) pts = {0};
+
+  size_t n_pts = 5000;
+  for( size_t i = 0; i < n_pts; ++i )
+  {
+    msh_vec3_t pt = msh_vec3( msh_rand_nextf( &rand_gen ),
+                              msh_rand_nextf( &rand_gen ),
+                              msh_rand_nextf( &rand_gen ) );
+    msh_array_push( pts, pt );
+  }
+
+  float radius = 0.05f;
+  msh_hash_grid_t hg = {0};
+  msh_hash_grid_init_3d( &hg, (real32_t*)&pts[0], n_pts, radius );
+
+  // dense search with a limit large enough to find everything
+  size_t max_n_neigh = n_pts;
+  msh_hash_grid_search_desc_t dense_opts =
+  {
+    .query_pts = (float*)&pts[0],
+    .n_query_pts = n_pts,
+    .radius = radius,
+    .max_n_neigh = max_n_neigh,
+    .distances_sq = malloc( sizeof(real32_t) * max_n_neigh * n_pts ),
+    .indices = malloc( sizeof(int32_t) * max_n_neigh * n_pts ),
+    .n_neighbors = malloc( sizeof(size_t) * n_pts ),
+    .sort = 1
+  };
+  size_t n_dense = msh_hash_grid_radius_search( &hg, &dense_opts );
+
+  msh_hash_grid_search_desc_t csr_opts =
+  {
+    .query_pts = (float*)&pts[0],
+    .n_query_pts = n_pts,
+    .radius = radius,
+    .offsets = malloc( sizeof(size_t) * (n_pts + 1) ),
+    .output_mode = MSH_HASH_GRID_OUTPUT_CSR,
+    .sort = 1
+  };
+  size_t n_csr = msh_hash_grid_radius_search( &hg, &csr_opts );
+
+  assert( n_dense == n_csr );
+  assert( csr_opts.offsets[n_pts] == n_csr );
+  for( size_t i = 0; i < n_pts; ++i )
+  {
+    size_t n = csr_opts.offsets[i + 1] - csr_opts.offsets[i];
+    assert( n == dense_opts.n_neighbors[i] );
+    for( size_t j = 0; j < n; ++j )
+    {
+      assert( csr_opts.distances_sq[csr_opts.offsets[i] + j] ==
+              dense_opts.distances_sq[i * max_n_neigh + j] );
+    }
+  }
+
+  // limiting the neighbor count keeps the closest ones
+  free( csr_opts.distances_sq );
+  free( csr_opts.indices );
+  csr_opts.max_n_neigh = 4;
+  msh_hash_grid_radius_search( &hg, &csr_opts );
+  for( size_t i = 0; i < n_pts; ++i )
+  {
+    size_t n = csr_opts.offsets[i + 1] - csr_opts.offsets[i];
+    assert( n == msh_min( dense_opts.n_neighbors[i], 4 ) );
+    for( size_t j = 0; j < n; ++j )
+    {
+      assert( csr_opts.distances_sq[csr_opts.offsets[i] + j] ==
+              dense_opts.distances_sq[i * max_n_neigh + j] );
+    }
+  }
+}
+
 void
 knn_search_test()
 {
@@ -80,6 +158,81 @@ knn_search_test()
   }
 }
 
+int
+float_compare( const void* a, const void* b )
+{
+  float fa = *(const float*)a;
+  float fb = *(const float*)b;
+  return (fa > fb) - (fa < fb);
+}
+
+void
+knn_search_exact_test()
+{
+  msh_rand_ctx_t rand_gen = {0};
+  msh_rand_init( &rand_gen, 12346ULL );
+  msh_array( msh_vec3_t ) pts = {0};
+
+  // dense cluster and a sparse background, so that large k needs to go far from the query
+  for( size_t i = 0; i < 2000; ++i )
+  {
+    msh_vec3_t pt = generate_random_point_within_sphere( &rand_gen, msh_vec3_zeros(), 0.05f );
+    msh_array_push( pts, pt );
+  }
+  for( size_t i = 0; i < 500; ++i )
+  {
+    msh_vec3_t pt = msh_vec3( 4.0f * msh_rand_nextf( &rand_gen ) - 2.0f,
+                              4.0f * msh_rand_nextf( &rand_gen ) - 2.0f,
+                              4.0f * msh_rand_nextf( &rand_gen ) - 2.0f );
+    msh_array_push( pts, pt );
+  }
+  size_t n_pts = msh_array_len( pts );
+
+  msh_hash_grid_t hg = {0};
+  msh_hash_grid_init_3d( &hg, (real32_t*)&pts[0], n_pts, 0.02f );
+
+  msh_vec3_t queries[3] = { msh_vec3( 0.01f, 0.0f, 0.0f ),
+                            msh_vec3( 1.5f, -1.0f, 0.5f ),
+                            msh_vec3( 10.0f, 10.0f, -10.0f ) };
+  size_t ks[4] = { 1, 17, 700, 3000 };
+  float* brute_dists = malloc( sizeof(float) * n_pts );
+  for( size_t ki = 0; ki < 4; ++ki )
+  {
+    size_t k = ks[ki];
+    msh_hash_grid_search_desc_t search_opts =
+    {
+      .query_pts = (float*)queries,
+      .n_query_pts = 3,
+      .k = k,
+      .distances_sq = malloc( sizeof(real32_t) * k * 3 ),
+      .indices = malloc( sizeof(int32_t) * k * 3 ),
+      .n_neighbors = malloc( sizeof(size_t) * 3 ),
+      .sort = 1
+    };
+    msh_hash_grid_knn_search( &hg, &search_opts );
+
+    for( size_t qi = 0; qi < 3; ++qi )
+    {
+      for( size_t i = 0; i < n_pts; ++i )
+      {
+        brute_dists[i] = msh_vec3_norm_sq( msh_vec3_sub( pts[i], queries[qi] ) );
+      }
+      qsort( brute_dists, n_pts, sizeof(float), float_compare );
+
+      assert( search_opts.n_neighbors[qi] == msh_min( k, n_pts ) );
+      for( size_t i = 0; i < search_opts.n_neighbors[qi]; ++i )
+      {
+        assert( fabsf( search_opts.distances_sq[qi * k + i] - brute_dists[i] ) <=
+                1e-6f * (1.0f + brute_dists[i]) );
+      }
+    }
+    free( search_opts.distances_sq );
+    free( search_opts.indices );
+    free( search_opts.n_neighbors );
+  }
+  free( brute_dists );
+}
+
 void
 radius_search_test()
 {
@@ -167,6 +320,1106 @@ radius_search_test()
   }
 }
 
+void
+box_query_test()
+{
+  msh_rand_ctx_t rand_gen = {0};
+  msh_rand_init( &rand_gen, 12346ULL );
+  msh_array( msh_vec3_t ) pts = {0};
+
+  // generate points uniformly in a unit cube
+  for( size_t i = 0; i < 10000; ++i )
+  {
+    msh_vec3_t pt = msh_vec3( msh_rand_nextf( &rand_gen ),
+                              msh_rand_nextf( &rand_gen ),
+                              msh_rand_nextf( &rand_gen ) );
+    msh_array_push( pts, pt );
+  }
+
+  msh_hash_grid_t hg = {0};
+  msh_hash_grid_init_3d( &hg, (real32_t*)&pts[0], msh_array_len(pts), 0.05 );
+
+  float boxes[12] = { 0.2f, 0.3f, 0.1f, 0.7f, 0.55f, 0.9f,
+                      -1.0f, 0.9f, 0.5f, 0.1f, 2.0f, 0.6f };
+  size_t max_n_indices = msh_array_len(pts);
+  size_t n_indices[2] = {0};
+  msh_hash_grid_range_desc_t range_opts =
+  {
+    .boxes = boxes,
+    .n_ranges = 2,
+    .max_n_indices = max_n_indices,
+    .indices = malloc( sizeof(int32_t) * 2 * max_n_indices ),
+    .n_indices = n_indices
+  };
+  msh_hash_grid_box_query( &hg, &range_opts );
+
+  // compare against brute force
+  for( size_t j = 0; j < 2; ++j )
+  {
+    float* box = boxes + 6 * j;
+    size_t n_inside = 0;
+    for( size_t i = 0; i < msh_array_len(pts); ++i )
+    {
+      if( pts[i].x >= box[0] && pts[i].y >= box[1] && pts[i].z >= box[2] &&
+          pts[i].x <= box[3] && pts[i].y <= box[4] && pts[i].z <= box[5] ) { n_inside++; }
+    }
+    assert( n_indices[j] == n_inside );
+    for( size_t i = 0; i < n_indices[j]; ++i )
+    {
+      msh_vec3_t pt = pts[ range_opts.indices[j * max_n_indices + i] ];
+      assert( pt.x >= box[0] && pt.y >= box[1] && pt.z >= box[2] &&
+              pt.x <= box[3] && pt.y <= box[4] && pt.z <= box[5] );
+    }
+  }
+
+  // query for a frustum looking at the cube from the side
+  msh_mat4_t view = msh_look_at( msh_vec3( 0.5f, 0.5f, 3.0f ), msh_vec3( 0.5f, 0.5f, 0.5f ),
+                                 msh_vec3( 0.0f, 1.0f, 0.0f ) );
+  msh_mat4_t proj = msh_perspective( msh_deg2rad( 10.0f ), 1.0f, 2.1f, 3.0f );
+  float planes[24];
+  msh_hash_grid_frustum_planes( (float*)view.data, (float*)proj.data, planes );
+  range_opts.frustums = planes;
+  range_opts.n_ranges = 1;
+  msh_hash_grid_frustum_query( &hg, &range_opts );
+
+  size_t n_inside = 0;
+  for( size_t i = 0; i < msh_array_len(pts); ++i )
+  {
+    msh_vec4_t p = msh_mat4_vec4_mul( msh_mat4_mul( proj, view ),
+                                      msh_vec4( pts[i].x, pts[i].y, pts[i].z, 1.0f ) );
+    if( fabsf(p.x) <= p.w && fabsf(p.y) <= p.w && fabsf(p.z) <= p.w ) { n_inside++; }
+  }
+  assert( n_inside > 0 );
+  assert( msh_abs( (int64_t)n_indices[0] - (int64_t)n_inside ) <= 2 );
+}
+
+void
+snapshot_test()
+{
+  msh_rand_ctx_t rand_gen = {0};
+  msh_rand_init( &rand_gen, 12346ULL );
+  msh_array( msh_vec3_t ) pts = {0};
+
+  size_t n_pts = 5000;
+  for( size_t i = 0; i < n_pts; ++i )
+  {
+    msh_vec3_t pt = msh_vec3( msh_rand_nextf( &rand_gen ),
+                              msh_rand_nextf( &rand_gen ),
+                              msh_rand_nextf( &rand_gen ) );
+    msh_array_push( pts, pt );
+  }
+
+  msh_hash_grid_t hg = {0};
+  msh_hash_grid_init_3d( &hg, (real32_t*)&pts[0], n_pts, 0.05f );
+
+  const char* filename = "msh_hash_grid_snapshot_test.bin";
+  int32_t err = msh_hash_grid_save( &hg, filename );
+  assert( !err );
+
+  msh_hash_grid_t loaded_hg = {0};
+  err = msh_hash_grid_load( &loaded_hg, filename );
+  assert( !err );
+  remove( filename );
+
+  size_t k = 8;
+  msh_hash_grid_search_desc_t search_opts =
+  {
+    .query_pts = (float*)&pts[0],
+    .n_query_pts = n_pts,
+    .k = k,
+    .distances_sq = malloc( sizeof(real32_t) * k * n_pts ),
+    .indices = malloc( sizeof(int32_t) * k * n_pts ),
+    .sort = 1
+  };
+  msh_hash_grid_search_desc_t loaded_search_opts = search_opts;
+  loaded_search_opts.distances_sq = malloc( sizeof(real32_t) * k * n_pts );
+  loaded_search_opts.indices = malloc( sizeof(int32_t) * k * n_pts );
+
+  size_t n_neigh = msh_hash_grid_knn_search( &hg, &search_opts );
+  size_t loaded_n_neigh = msh_hash_grid_knn_search( &loaded_hg, &loaded_search_opts );
+  assert( n_neigh == loaded_n_neigh );
+  assert( !memcmp( search_opts.indices, loaded_search_opts.indices, sizeof(int32_t) * k * n_pts ) );
+
+  // corrupted snapshots are rejected
+  char garbage[128] = {0};
+  msh_hash_grid_t bad_hg = {0};
+  err = msh_hash_grid_init_from_snapshot( &bad_hg, garbage, sizeof(garbage) );
+  assert( err == MSH_HASH_GRID_INVALID_SNAPSHOT_ERR );
+
+  // truncated snapshot files are rejected
+  err = msh_hash_grid_save( &hg, filename );
+  assert( !err );
+  FILE* fp = fopen( filename, "rb" );
+  assert( fp );
+  fseek( fp, 0, SEEK_END );
+  size_t snapshot_size = (size_t)ftell( fp );
+  fseek( fp, 0, SEEK_SET );
+  char* block = malloc( snapshot_size + 64 );
+  char* snapshot = (char*)(((uintptr_t)block + 63) & ~(uintptr_t)63);
+  size_t n_read = fread( snapshot, 1, snapshot_size, fp );
+  assert( n_read == snapshot_size );
+  fclose( fp );
+
+  fp = fopen( filename, "wb" );
+  fwrite( snapshot, 1, snapshot_size / 2, fp );
+  fclose( fp );
+  err = msh_hash_grid_load( &bad_hg, filename );
+  assert( err == MSH_HASH_GRID_INVALID_SNAPSHOT_ERR );
+  remove( filename );
+
+  err = msh_hash_grid_init_from_snapshot( &bad_hg, snapshot, snapshot_size - 1 );
+  assert( err == MSH_HASH_GRID_INVALID_SNAPSHOT_ERR );
+
+  // section offsets pointing outside of the snapshot, or not aligned, are rejected
+  uint64_t* section_offsets = (uint64_t*)(snapshot + offsetof( msh_hash_grid__snapshot_header_t,
+                                                                  offsets_offset ));
+  for( int32_t i = 0; i < 4; ++i )
+  {
+    uint64_t offset = section_offsets[i];
+    uint64_t bad_offsets[3] = { offset + 8, UINT64_MAX - 63, 0 };
+    for( int32_t j = 0; j < 3; ++j )
+    {
+      section_offsets[i] = bad_offsets[j];
+      err = msh_hash_grid_init_from_snapshot( &bad_hg, snapshot, snapshot_size );
+      assert( err == MSH_HASH_GRID_INVALID_SNAPSHOT_ERR );
+    }
+    section_offsets[i] = offset;
+  }
+
+  // so are sections whose contents would make searches read out of bounds
+  msh_hash_grid__snapshot_header_t* hdr = (msh_hash_grid__snapshot_header_t*)snapshot;
+  msh_hg__bin_info_t* bins = (msh_hg__bin_info_t*)(snapshot + hdr->offsets_offset);
+  uint32_t bin_length = bins[0].length;
+  bins[0].length = 1000000;
+  err = msh_hash_grid_init_from_snapshot( &bad_hg, snapshot, snapshot_size );
+  assert( err == MSH_HASH_GRID_INVALID_SNAPSHOT_ERR );
+  bins[0].length = bin_length;
+
+  uint64_t* keys = (uint64_t*)(snapshot + hdr->keys_offset);
+  uint64_t* vals = (uint64_t*)(snapshot + hdr->vals_offset);
+  size_t slot = 0;
+  while( !keys[slot] ) { slot++; }
+  uint64_t val = vals[slot];
+  vals[slot] = hdr->n_bins;
+  err = msh_hash_grid_init_from_snapshot( &bad_hg, snapshot, snapshot_size );
+  assert( err == MSH_HASH_GRID_INVALID_SNAPSHOT_ERR );
+  vals[slot] = val;
+
+  uint64_t key = keys[slot];
+  keys[slot] = hdr->width * hdr->height * hdr->depth + 1;
+  err = msh_hash_grid_init_from_snapshot( &bad_hg, snapshot, snapshot_size );
+  assert( err == MSH_HASH_GRID_INVALID_SNAPSHOT_ERR );
+  keys[slot] = key;
+
+  double cell_size = hdr->cell_size;
+  hdr->cell_size = 0.0;
+  err = msh_hash_grid_init_from_snapshot( &bad_hg, snapshot, snapshot_size );
+  assert( err == MSH_HASH_GRID_INVALID_SNAPSHOT_ERR );
+  hdr->cell_size = cell_size;
+
+  uint64_t depth = hdr->depth;
+  hdr->depth = 0;
+  err = msh_hash_grid_init_from_snapshot( &bad_hg, snapshot, snapshot_size );
+  assert( err == MSH_HASH_GRID_INVALID_SNAPSHOT_ERR );
+  hdr->depth = depth;
+
+  err = msh_hash_grid_init_from_snapshot( &bad_hg, snapshot, snapshot_size );
+  assert( !err );
+  msh_hash_grid_term( &bad_hg );
+  free( block );
+
+  msh_hash_grid_term( &hg );
+  msh_hash_grid_term( &loaded_hg );
+}
+
+void
+multi_resolution_test()
+{
+  msh_rand_ctx_t rand_gen = {0};
+  msh_rand_init( &rand_gen, 12349ULL );
+  msh_array( msh_vec3_t ) pts = {0};
+
+  size_t n_pts = 4000;
+  for( size_t i = 0; i < n_pts; ++i )
+  {
+    msh_vec3_t pt = msh_vec3( msh_rand_nextf( &rand_gen ),
+                              msh_rand_nextf( &rand_gen ),
+                              msh_rand_nextf( &rand_gen ) );
+    msh_array_push( pts, pt );
+  }
+
+  msh_hash_grid_mr_t hgmr = {0};
+  msh_hash_grid_mr_init_3d( &hgmr, (real32_t*)&pts[0], n_pts, 0.01f, 0.2f );
+  assert( hgmr.n_levels == 6 );
+
+  // every radius should find exactly the points a brute force search does
+  float radii[4] = { 0.01f, 0.035f, 0.08f, 0.2f };
+  size_t n_query_pts = 200;
+  size_t max_n_neigh = n_pts;
+  float* dists = malloc( sizeof(real32_t) * max_n_neigh * n_query_pts );
+  int32_t* indices = malloc( sizeof(int32_t) * max_n_neigh * n_query_pts );
+  size_t* n_neighbors = malloc( sizeof(size_t) * n_query_pts );
+  for( int32_t r = 0; r < 4; ++r )
+  {
+    msh_hash_grid_search_desc_t opts =
+    {
+      .query_pts = (float*)&pts[0],
+      .n_query_pts = n_query_pts,
+      .radius = radii[r],
+      .max_n_neigh = max_n_neigh,
+      .distances_sq = dists,
+      .indices = indices,
+      .n_neighbors = n_neighbors,
+      .sort = 1
+    };
+    msh_hash_grid_mr_radius_search( &hgmr, &opts );
+
+    for( size_t i = 0; i < n_query_pts; ++i )
+    {
+      size_t n_brute = 0;
+      for( size_t j = 0; j < n_pts; ++j )
+      {
+        if( msh_vec3_norm_sq( msh_vec3_sub( pts[i], pts[j] ) ) < radii[r] * radii[r] ) { n_brute++; }
+      }
+      assert( n_brute == n_neighbors[i] );
+      for( size_t j = 0; j < n_neighbors[i]; ++j )
+      {
+        msh_vec3_t q = pts[ indices[i * max_n_neigh + j] ];
+        assert( msh_vec3_norm_sq( msh_vec3_sub( pts[i], q ) ) < radii[r] * radii[r] );
+      }
+    }
+  }
+
+  // kNN on any level should match a regular grid
+  msh_hash_grid_t hg = {0};
+  msh_hash_grid_init_3d( &hg, (real32_t*)&pts[0], n_pts, 0.05f );
+  size_t k = 8;
+  float* ref_dists = malloc( sizeof(real32_t) * k * n_query_pts );
+  msh_hash_grid_search_desc_t ref_opts =
+  {
+    .query_pts = (float*)&pts[0],
+    .n_query_pts = n_query_pts,
+    .k = k,
+    .distances_sq = ref_dists,
+    .indices = indices,
+    .n_neighbors = n_neighbors,
+    .sort = 1
+  };
+  msh_hash_grid_knn_search( &hg, &ref_opts );
+  for( int32_t r = 0; r < 4; ++r )
+  {
+    msh_hash_grid_search_desc_t opts = ref_opts;
+    opts.radius = radii[r];
+    opts.distances_sq = dists;
+    msh_hash_grid_mr_knn_search( &hgmr, &opts );
+    for( size_t i = 0; i < n_query_pts * k; ++i ) { assert( dists[i] == ref_dists[i] ); }
+  }
+
+  free( dists );
+  free( ref_dists );
+  free( indices );
+  free( n_neighbors );
+  msh_hash_grid_term( &hg );
+  msh_hash_grid_mr_term( &hgmr );
+  msh_array_free( pts );
+}
+
+void
+approximate_search_test()
+{
+  msh_rand_ctx_t rand_gen = {0};
+  msh_rand_init( &rand_gen, 12350ULL );
+  msh_array( msh_vec3_t ) pts = {0};
+
+  size_t n_pts = 20000;
+  for( size_t i = 0; i < n_pts; ++i )
+  {
+    msh_vec3_t pt = msh_vec3( msh_rand_nextf( &rand_gen ),
+                              msh_rand_nextf( &rand_gen ),
+                              msh_rand_nextf( &rand_gen ) );
+    msh_array_push( pts, pt );
+  }
+
+  float radius = 0.05f;
+  float eps = 0.5f;
+  msh_hash_grid_t hg = {0};
+  msh_hash_grid_init_3d( &hg, (real32_t*)&pts[0], n_pts, radius );
+
+  size_t n_query_pts = 500;
+  size_t max_n_neigh = n_pts;
+  msh_hash_grid_search_desc_t exact_opts =
+  {
+    .query_pts = (float*)&pts[0],
+    .n_query_pts = n_query_pts,
+    .radius = radius,
+    .max_n_neigh = max_n_neigh,
+    .distances_sq = malloc( sizeof(real32_t) * max_n_neigh * n_query_pts ),
+    .indices = malloc( sizeof(int32_t) * max_n_neigh * n_query_pts ),
+    .n_neighbors = malloc( sizeof(size_t) * n_query_pts ),
+    .sort = 1
+  };
+  msh_hash_grid_radius_search( &hg, &exact_opts );
+
+  // approximate radius search finds everything within radius / (1 + eps), and nothing outside
+  msh_hash_grid_search_desc_t approx_opts = exact_opts;
+  approx_opts.distances_sq = malloc( sizeof(real32_t) * max_n_neigh * n_query_pts );
+  approx_opts.indices = malloc( sizeof(int32_t) * max_n_neigh * n_query_pts );
+  approx_opts.n_neighbors = malloc( sizeof(size_t) * n_query_pts );
+  approx_opts.eps = eps;
+  msh_hash_grid_radius_search( &hg, &approx_opts );
+  float inner_radius_sq = (radius / (1.0f + eps)) * (radius / (1.0f + eps));
+  for( size_t i = 0; i < n_query_pts; ++i )
+  {
+    size_t n_inner = 0;
+    for( size_t j = 0; j < exact_opts.n_neighbors[i]; ++j )
+    {
+      n_inner += exact_opts.distances_sq[i * max_n_neigh + j] < inner_radius_sq;
+    }
+    assert( approx_opts.n_neighbors[i] >= n_inner );
+    assert( approx_opts.n_neighbors[i] <= exact_opts.n_neighbors[i] );
+    for( size_t j = 0; j < approx_opts.n_neighbors[i]; ++j )
+    {
+      assert( approx_opts.distances_sq[i * max_n_neigh + j] < radius * radius );
+    }
+  }
+
+  // limiting number of examined points still returns valid neighbors
+  approx_opts.eps = 0.0f;
+  approx_opts.max_n_examined = 16;
+  msh_hash_grid_radius_search( &hg, &approx_opts );
+  for( size_t i = 0; i < n_query_pts; ++i )
+  {
+    assert( approx_opts.n_neighbors[i] <= exact_opts.n_neighbors[i] );
+    for( size_t j = 0; j < approx_opts.n_neighbors[i]; ++j )
+    {
+      assert( approx_opts.distances_sq[i * max_n_neigh + j] < radius * radius );
+    }
+  }
+
+  // approximate kNN - i-th neighbor is within (1 + eps) of the true i-th neighbor
+  size_t k = 16;
+  exact_opts.k = k;
+  approx_opts.k = k;
+  approx_opts.eps = eps;
+  approx_opts.max_n_examined = 0;
+  msh_hash_grid_knn_search( &hg, &exact_opts );
+  msh_hash_grid_knn_search( &hg, &approx_opts );
+  for( size_t i = 0; i < n_query_pts; ++i )
+  {
+    assert( approx_opts.n_neighbors[i] == k );
+    for( size_t j = 0; j < k; ++j )
+    {
+      float d_exact  = exact_opts.distances_sq[i * k + j];
+      float d_approx = approx_opts.distances_sq[i * k + j];
+      assert( d_approx >= d_exact );
+      assert( d_approx <= (1.0f + eps) * (1.0f + eps) * d_exact * (1.0f + 1e-6f) );
+    }
+  }
+
+  free( exact_opts.distances_sq );
+  free( exact_opts.indices );
+  free( exact_opts.n_neighbors );
+  free( approx_opts.distances_sq );
+  free( approx_opts.indices );
+  free( approx_opts.n_neighbors );
+  msh_hash_grid_term( &hg );
+  msh_array_free( pts );
+}
+
+int
+uint64_compare( const void* a, const void* b )
+{
+  uint64_t ua = *(const uint64_t*)a;
+  uint64_t ub = *(const uint64_t*)b;
+  return (ua > ub) - (ua < ub);
+}
+
+void
+aggregate_cells_test()
+{
+  msh_rand_ctx_t rand_gen = {0};
+  msh_rand_init( &rand_gen, 12351ULL );
+  msh_array( msh_vec3_t ) pts = {0};
+
+  size_t n_pts = 20000;
+  for( size_t i = 0; i < n_pts; ++i )
+  {
+    msh_vec3_t pt = msh_vec3( msh_rand_nextf( &rand_gen ),
+                              msh_rand_nextf( &rand_gen ),
+                              msh_rand_nextf( &rand_gen ) );
+    msh_array_push( pts, pt );
+  }
+
+  float voxel_size = 0.1f;
+  msh_hash_grid_t hg = {0};
+  msh_hash_grid_init_3d( &hg, (real32_t*)&pts[0], n_pts, 0.5f * voxel_size );
+
+  // count distinct voxels by brute force
+  uint64_t* keys = malloc( n_pts * sizeof(uint64_t) );
+  for( size_t i = 0; i < n_pts; ++i )
+  {
+    uint64_t ix = (uint64_t)( (pts[i].x - hg.min_pt.x) * hg._inv_cell_size );
+    uint64_t iy = (uint64_t)( (pts[i].y - hg.min_pt.y) * hg._inv_cell_size );
+    uint64_t iz = (uint64_t)( (pts[i].z - hg.min_pt.z) * hg._inv_cell_size );
+    keys[i] = (iz * hg.height + iy) * hg.width + ix;
+  }
+  qsort( keys, n_pts, sizeof(uint64_t), uint64_compare );
+  size_t n_unique = 0;
+  for( size_t i = 0; i < n_pts; ++i ) { n_unique += ( i == 0 || keys[i] != keys[i - 1] ); }
+
+  size_t n_cells = msh_hash_grid_n_cells( &hg );
+  assert( n_cells == n_unique );
+
+  // points double as attributes, so mean attributes should match centroids
+  msh_hash_grid_cell_desc_t cell_desc =
+  {
+    .attribs = (float*)&pts[0],
+    .n_attribs = 3,
+    .counts = malloc( n_cells * sizeof(uint32_t) ),
+    .centroids = malloc( 3 * n_cells * sizeof(real32_t) ),
+    .mean_attribs = malloc( 3 * n_cells * sizeof(real32_t) ),
+    .representatives = malloc( n_cells * sizeof(int32_t) )
+  };
+  assert( msh_hash_grid_aggregate_cells( &hg, &cell_desc ) == n_cells );
+
+  size_t total_count = 0;
+  for( size_t i = 0; i < n_cells; ++i )
+  {
+    total_count += cell_desc.counts[i];
+    msh_vec3_t c = msh_vec3( cell_desc.centroids[3 * i + 0],
+                             cell_desc.centroids[3 * i + 1],
+                             cell_desc.centroids[3 * i + 2] );
+    for( int32_t j = 0; j < 3; ++j )
+    {
+      assert( fabsf( cell_desc.mean_attribs[3 * i + j] - cell_desc.centroids[3 * i + j] ) < 1e-5f );
+    }
+    msh_vec3_t r = pts[ cell_desc.representatives[i] ];
+    assert( msh_vec3_norm( msh_vec3_sub( r, c ) ) <= voxel_size * sqrtf( 3.0f ) );
+  }
+  assert( total_count == n_pts );
+
+  free( keys );
+  free( cell_desc.counts );
+  free( cell_desc.centroids );
+  free( cell_desc.mean_attribs );
+  free( cell_desc.representatives );
+  msh_hash_grid_term( &hg );
+  msh_array_free( pts );
+}
+
+void
+radius_pairs_test()
+{
+  msh_rand_ctx_t rand_gen = {0};
+  msh_rand_init( &rand_gen, 12352ULL );
+  msh_array( msh_vec3_t ) pts = {0};
+
+  size_t n_pts = 3000;
+  for( size_t i = 0; i < n_pts; ++i )
+  {
+    msh_vec3_t pt = msh_vec3( msh_rand_nextf( &rand_gen ),
+                              msh_rand_nextf( &rand_gen ),
+                              msh_rand_nextf( &rand_gen ) );
+    msh_array_push( pts, pt );
+  }
+
+  // radius larger than the one used to build the grid, so that pairs span multiple cells
+  float radius = 0.08f;
+  msh_hash_grid_t hg = {0};
+  msh_hash_grid_init_3d( &hg, (real32_t*)&pts[0], n_pts, 0.03f );
+
+  for( int32_t symmetric = 0; symmetric < 2; ++symmetric )
+  {
+    msh_hash_grid_pairs_desc_t pairs_desc =
+    {
+      .radius = radius,
+      .symmetric = symmetric,
+      .sort = 1,
+      .offsets = malloc( (n_pts + 1) * sizeof(size_t) )
+    };
+    size_t n_entries = msh_hash_grid_radius_pairs( &hg, &pairs_desc );
+    assert( pairs_desc.offsets[n_pts] == n_entries );
+
+    size_t n_brute = 0;
+    for( size_t i = 0; i < n_pts; ++i )
+    {
+      size_t first = pairs_desc.offsets[i];
+      size_t n = pairs_desc.offsets[i + 1] - first;
+      size_t n_row = 0;
+      for( size_t j = symmetric ? 0 : i + 1; j < n_pts; ++j )
+      {
+        if( i == j ) { continue; }
+        if( msh_vec3_norm_sq( msh_vec3_sub( pts[i], pts[j] ) ) < radius * radius ) { n_row++; }
+      }
+      assert( n == n_row );
+      n_brute += n_row;
+      for( size_t j = 0; j < n; ++j )
+      {
+        int32_t idx = pairs_desc.indices[first + j];
+        assert( symmetric || idx > (int32_t)i );
+        float dist_sq = msh_vec3_norm_sq( msh_vec3_sub( pts[i], pts[idx] ) );
+        assert( fabsf( dist_sq - pairs_desc.distances_sq[first + j] ) < 1e-6f );
+        if( j ) { assert( pairs_desc.distances_sq[first + j - 1] <= pairs_desc.distances_sq[first + j] ); }
+      }
+    }
+    assert( n_brute == n_entries );
+
+    free( pairs_desc.offsets );
+    free( pairs_desc.indices );
+    free( pairs_desc.distances_sq );
+  }
+
+  msh_hash_grid_term( &hg );
+  msh_array_free( pts );
+}
+
+void
+sort_modes_test()
+{
+  msh_rand_ctx_t rand_gen = {0};
+  msh_rand_init( &rand_gen, 12353ULL );
+  msh_array( msh_vec3_t ) pts = {0};
+
+  size_t n_pts = 10000;
+  for( size_t i = 0; i < n_pts; ++i )
+  {
+    msh_vec3_t pt = msh_vec3( msh_rand_nextf( &rand_gen ),
+                              msh_rand_nextf( &rand_gen ),
+                              msh_rand_nextf( &rand_gen ) );
+    msh_array_push( pts, pt );
+  }
+
+  msh_hash_grid_t hg = {0};
+  msh_hash_grid_init_3d( &hg, (real32_t*)&pts[0], n_pts, 0.05f );
+
+  // k values on both sides of the sorting network limit
+  size_t ks[2] = { 24, 100 };
+  size_t n_query_pts = 1000;
+  for( int32_t t = 0; t < 2; ++t )
+  {
+    size_t k = ks[t];
+    size_t top_m = 5;
+    msh_hash_grid_search_desc_t full_opts =
+    {
+      .query_pts = (float*)&pts[0],
+      .n_query_pts = n_query_pts,
+      .k = k,
+      .distances_sq = malloc( sizeof(real32_t) * k * n_query_pts ),
+      .indices = malloc( sizeof(int32_t) * k * n_query_pts ),
+      .n_neighbors = malloc( sizeof(size_t) * n_query_pts ),
+      .sort = MSH_HASH_GRID_SORT_FULL
+    };
+    msh_hash_grid_search_desc_t partial_opts = full_opts;
+    partial_opts.distances_sq = malloc( sizeof(real32_t) * k * n_query_pts );
+    partial_opts.indices = malloc( sizeof(int32_t) * k * n_query_pts );
+    partial_opts.sort = MSH_HASH_GRID_SORT_PARTIAL;
+    partial_opts.sort_top_m = top_m;
+
+    msh_hash_grid_knn_search( &hg, &full_opts );
+    msh_hash_grid_knn_search( &hg, &partial_opts );
+    for( size_t i = 0; i < n_query_pts; ++i )
+    {
+      float* full = full_opts.distances_sq + i * k;
+      float* partial = partial_opts.distances_sq + i * k;
+      for( size_t j = 1; j < k; ++j ) { assert( full[j - 1] <= full[j] ); }
+      for( size_t j = 0; j < top_m; ++j ) { assert( full[j] == partial[j] ); }
+      for( size_t j = top_m; j < k; ++j ) { assert( partial[j] >= partial[top_m - 1] ); }
+    }
+
+    free( full_opts.distances_sq );
+    free( full_opts.indices );
+    free( full_opts.n_neighbors );
+    free( partial_opts.distances_sq );
+    free( partial_opts.indices );
+  }
+
+  msh_hash_grid_term( &hg );
+  msh_array_free( pts );
+}
+
+void
+brute_force_test()
+{
+  msh_rand_ctx_t rand_gen = {0};
+  msh_rand_init( &rand_gen, 12354ULL );
+
+  size_t n_pts = 700;
+  real32_t* pts = malloc( sizeof(real32_t) * 3 * n_pts );
+  for( size_t i = 0; i < 3 * n_pts; ++i ) { pts[i] = msh_rand_nextf( &rand_gen ); }
+
+  size_t n_query_pts = 300;
+  size_t k = 16;
+  real32_t radius = 0.1f;
+  real32_t* ref_dists = malloc( sizeof(real32_t) * n_pts );
+  for( int32_t dim = 2; dim <= 3; ++dim )
+  {
+    msh_hash_grid_t hg = {0};
+    if( dim == 2 ) { msh_hash_grid_init_2d( &hg, pts, n_pts, radius ); }
+    else           { msh_hash_grid_init_3d( &hg, pts, n_pts, radius ); }
+
+    for( int32_t is_knn = 0; is_knn < 2; ++is_knn )
+    {
+      size_t row_size = is_knn ? k : n_pts;
+      msh_hash_grid_search_desc_t grid_opts =
+      {
+        .query_pts = pts,
+        .n_query_pts = n_query_pts,
+        .radius = radius,
+        .max_n_neigh = row_size,
+        .distances_sq = malloc( sizeof(real32_t) * row_size * n_query_pts ),
+        .indices = malloc( sizeof(int32_t) * row_size * n_query_pts ),
+        .n_neighbors = malloc( sizeof(size_t) * n_query_pts ),
+        .sort = MSH_HASH_GRID_SORT_FULL
+      };
+      msh_hash_grid_search_desc_t pts_opts = grid_opts;
+      pts_opts.distances_sq = malloc( sizeof(real32_t) * row_size * n_query_pts );
+      pts_opts.indices = malloc( sizeof(int32_t) * row_size * n_query_pts );
+      pts_opts.n_neighbors = malloc( sizeof(size_t) * n_query_pts );
+
+      size_t n_grid, n_brute;
+      if( is_knn )
+      {
+        n_grid  = msh_hash_grid_knn_search( &hg, &grid_opts );
+        n_brute = msh_hash_grid_brute_force_knn_search( pts, n_pts, dim, &pts_opts );
+      }
+      else
+      {
+        n_grid  = msh_hash_grid_radius_search( &hg, &grid_opts );
+        n_brute = msh_hash_grid_brute_force_radius_search( pts, n_pts, dim, &pts_opts );
+      }
+      assert( n_grid == n_brute );
+
+      for( size_t i = 0; i < n_query_pts; ++i )
+      {
+        const real32_t* q = pts + i * dim;
+        size_t n_ref = 0;
+        for( size_t j = 0; j < n_pts; ++j )
+        {
+          real32_t dist_sq = 0.0f;
+          for( int32_t c = 0; c < dim; ++c )
+          {
+            real32_t v = pts[j * dim + c] - q[c];
+            dist_sq += v * v;
+          }
+          if( is_knn || dist_sq < radius * radius ) { ref_dists[n_ref++] = dist_sq; }
+        }
+        qsort( ref_dists, n_ref, sizeof(real32_t), float_compare );
+        if( is_knn ) { n_ref = msh_min( n_ref, k ); }
+
+        assert( grid_opts.n_neighbors[i] == n_ref );
+        assert( pts_opts.n_neighbors[i] == n_ref );
+        for( size_t j = 0; j < n_ref; ++j )
+        {
+          real32_t* grid_dists = grid_opts.distances_sq + i * row_size;
+          real32_t* pts_dists = pts_opts.distances_sq + i * row_size;
+          int32_t* pts_indices = pts_opts.indices + i * row_size;
+          assert( fabsf( grid_dists[j] - ref_dists[j] ) < 1e-6f );
+          assert( fabsf( pts_dists[j] - ref_dists[j] ) < 1e-6f );
+          assert( pts_indices[j] >= 0 && pts_indices[j] < (int32_t)n_pts );
+        }
+      }
+
+      free( grid_opts.distances_sq );
+      free( grid_opts.indices );
+      free( grid_opts.n_neighbors );
+      free( pts_opts.distances_sq );
+      free( pts_opts.indices );
+      free( pts_opts.n_neighbors );
+    }
+    msh_hash_grid_term( &hg );
+  }
+
+  free( ref_dists );
+  free( pts );
+}
+
+void
+search_2d_test()
+{
+  msh_rand_ctx_t rand_gen = {0};
+  msh_rand_init( &rand_gen, 12355ULL );
+
+  size_t n_pts = 5000;
+  real32_t* pts = malloc( sizeof(real32_t) * 2 * n_pts );
+  for( size_t i = 0; i < 2 * n_pts; ++i ) { pts[i] = msh_rand_nextf( &rand_gen ); }
+
+  real32_t radius = 0.03f;
+  msh_hash_grid_t hg = {0};
+  msh_hash_grid_init_2d( &hg, pts, n_pts, radius );
+
+  // Radius and kNN search against brute force
+  size_t n_query_pts = 500;
+  size_t k = 10;
+  msh_hash_grid_search_desc_t radius_opts =
+  {
+    .query_pts = pts,
+    .n_query_pts = n_query_pts,
+    .radius = radius,
+    .max_n_neigh = n_pts,
+    .distances_sq = malloc( sizeof(real32_t) * n_pts * n_query_pts ),
+    .indices = malloc( sizeof(int32_t) * n_pts * n_query_pts ),
+    .n_neighbors = malloc( sizeof(size_t) * n_query_pts ),
+    .sort = MSH_HASH_GRID_SORT_FULL
+  };
+  msh_hash_grid_search_desc_t knn_opts = radius_opts;
+  knn_opts.k = k;
+  knn_opts.distances_sq = malloc( sizeof(real32_t) * k * n_query_pts );
+  knn_opts.indices = malloc( sizeof(int32_t) * k * n_query_pts );
+  knn_opts.n_neighbors = malloc( sizeof(size_t) * n_query_pts );
+  msh_hash_grid_search_desc_t brute_opts = knn_opts;
+  brute_opts.distances_sq = malloc( sizeof(real32_t) * k * n_query_pts );
+  brute_opts.indices = malloc( sizeof(int32_t) * k * n_query_pts );
+  brute_opts.n_neighbors = malloc( sizeof(size_t) * n_query_pts );
+
+  size_t n_radius_neigh = msh_hash_grid_radius_search( &hg, &radius_opts );
+  msh_hash_grid_knn_search( &hg, &knn_opts );
+  msh_hash_grid_brute_force_knn_search( pts, n_pts, 2, &brute_opts );
+
+  size_t n_ref_neigh = 0;
+  for( size_t i = 0; i < n_query_pts; ++i )
+  {
+    size_t n_inside = 0;
+    for( size_t j = 0; j < n_pts; ++j )
+    {
+      real32_t vx = pts[2 * j] - pts[2 * i];
+      real32_t vy = pts[2 * j + 1] - pts[2 * i + 1];
+      if( vx * vx + vy * vy < radius * radius ) { n_inside++; }
+    }
+    assert( radius_opts.n_neighbors[i] == n_inside );
+    n_ref_neigh += n_inside;
+
+    assert( knn_opts.n_neighbors[i] == k );
+    for( size_t j = 0; j < k; ++j )
+    {
+      assert( knn_opts.distances_sq[i * k + j] == brute_opts.distances_sq[i * k + j] );
+    }
+  }
+  assert( n_radius_neigh == n_ref_neigh );
+
+  // CSR output matches dense output
+  msh_hash_grid_search_desc_t csr_opts = radius_opts;
+  csr_opts.output_mode = MSH_HASH_GRID_OUTPUT_CSR;
+  csr_opts.max_n_neigh = 0;
+  csr_opts.offsets = malloc( sizeof(size_t) * (n_query_pts + 1) );
+  csr_opts.n_neighbors = NULL;
+  size_t n_csr_neigh = msh_hash_grid_radius_search( &hg, &csr_opts );
+  assert( n_csr_neigh == n_radius_neigh );
+  for( size_t i = 0; i < n_query_pts; ++i )
+  {
+    assert( csr_opts.offsets[i + 1] - csr_opts.offsets[i] == radius_opts.n_neighbors[i] );
+  }
+
+  // Box query
+  real32_t box[4] = { 0.2f, 0.3f, 0.45f, 0.5f };
+  size_t n_indices = 0;
+  msh_hash_grid_range_desc_t range_opts =
+  {
+    .boxes = box,
+    .n_ranges = 1,
+    .max_n_indices = n_pts,
+    .indices = malloc( sizeof(int32_t) * n_pts ),
+    .n_indices = &n_indices
+  };
+  msh_hash_grid_box_query( &hg, &range_opts );
+  size_t n_in_box = 0;
+  for( size_t i = 0; i < n_pts; ++i )
+  {
+    if( pts[2 * i] >= box[0] && pts[2 * i] <= box[2] &&
+        pts[2 * i + 1] >= box[1] && pts[2 * i + 1] <= box[3] ) { n_in_box++; }
+  }
+  assert( n_indices == n_in_box );
+
+  // Aggregation covers every point once, and pairs match the radius search
+  size_t n_cells = msh_hash_grid_n_cells( &hg );
+  uint32_t* counts = malloc( sizeof(uint32_t) * n_cells );
+  msh_hash_grid_cell_desc_t cell_opts = { .counts = counts };
+  msh_hash_grid_aggregate_cells( &hg, &cell_opts );
+  size_t n_counted = 0;
+  for( size_t i = 0; i < n_cells; ++i ) { n_counted += counts[i]; }
+  assert( n_counted == n_pts );
+
+  msh_hash_grid_pairs_desc_t pairs_opts =
+  {
+    .radius = radius,
+    .symmetric = 1,
+    .offsets = malloc( sizeof(size_t) * (n_pts + 1) )
+  };
+  msh_hash_grid_radius_pairs( &hg, &pairs_opts );
+  for( size_t i = 0; i < n_query_pts; ++i )
+  {
+    // Pairs do not include the point itself
+    assert( pairs_opts.offsets[i + 1] - pairs_opts.offsets[i] + 1 == radius_opts.n_neighbors[i] );
+  }
+
+  // Snapshot and multi-resolution grid use the same 2d storage
+  const char* filename = "msh_hash_grid_snapshot_2d_test.bin";
+  int32_t err = msh_hash_grid_save( &hg, filename );
+  assert( !err );
+  msh_hash_grid_t loaded_hg = {0};
+  err = msh_hash_grid_load( &loaded_hg, filename );
+  assert( !err );
+  remove( filename );
+
+  msh_hash_grid_mr_t hgmr = {0};
+  msh_hash_grid_mr_init_2d( &hgmr, pts, n_pts, radius, 4.0f * radius );
+
+  msh_hash_grid_search_desc_t other_opts = knn_opts;
+  other_opts.distances_sq = brute_opts.distances_sq;
+  other_opts.indices = brute_opts.indices;
+  other_opts.n_neighbors = brute_opts.n_neighbors;
+  for( int32_t t = 0; t < 2; ++t )
+  {
+    if( t == 0 ) { msh_hash_grid_knn_search( &loaded_hg, &other_opts ); }
+    else         { msh_hash_grid_mr_knn_search( &hgmr, &other_opts ); }
+    for( size_t i = 0; i < k * n_query_pts; ++i )
+    {
+      assert( other_opts.distances_sq[i] == knn_opts.distances_sq[i] );
+    }
+  }
+
+  msh_hash_grid_mr_term( &hgmr );
+  msh_hash_grid_term( &loaded_hg );
+  msh_hash_grid_term( &hg );
+  free( pairs_opts.offsets );
+  free( pairs_opts.indices );
+  free( pairs_opts.distances_sq );
+  free( counts );
+  free( range_opts.indices );
+  free( csr_opts.offsets );
+  free( csr_opts.indices );
+  free( csr_opts.distances_sq );
+  free( radius_opts.distances_sq );
+  free( radius_opts.indices );
+  free( radius_opts.n_neighbors );
+  free( knn_opts.distances_sq );
+  free( knn_opts.indices );
+  free( knn_opts.n_neighbors );
+  free( brute_opts.distances_sq );
+  free( brute_opts.indices );
+  free( brute_opts.n_neighbors );
+  free( pts );
+}
+
+void
+estimate_normals_test()
+{
+  msh_rand_ctx_t rand_gen = {0};
+  msh_rand_init( &rand_gen, 12356ULL );
+
+  // Unit sphere, with normals oriented towards its center
+  size_t n_pts = 20000;
+  real32_t* pts = malloc( sizeof(real32_t) * 3 * n_pts );
+  for( size_t i = 0; i < n_pts; ++i )
+  {
+    msh_vec3_t pt = generate_random_point_within_sphere_shell( &rand_gen, msh_vec3_zeros(),
+                                                               1.0f, 0.99999f );
+    pt = msh_vec3_normalize( pt );
+    pts[3 * i] = pt.x; pts[3 * i + 1] = pt.y; pts[3 * i + 2] = pt.z;
+  }
+
+  real32_t radius = 0.08f;
+  msh_hash_grid_t hg = {0};
+  msh_hash_grid_init_3d( &hg, pts, n_pts, radius );
+
+  real32_t center[3] = { 0.0f, 0.0f, 0.0f };
+  real32_t* normals = malloc( sizeof(real32_t) * 3 * n_pts );
+  real32_t* curvatures = malloc( sizeof(real32_t) * n_pts );
+  for( int32_t use_knn = 0; use_knn < 2; ++use_knn )
+  {
+    msh_hash_grid_normals_desc_t normals_opts =
+    {
+      .radius = radius,
+      .k = use_knn ? 16 : 0,
+      .viewpoint = center,
+      .normals = normals,
+      .curvatures = curvatures
+    };
+    size_t n_valid = msh_hash_grid_estimate_normals( &hg, &normals_opts );
+    assert( n_valid == n_pts );
+    for( size_t i = 0; i < n_pts; ++i )
+    {
+      real32_t* n = normals + 3 * i;
+      real32_t* p = pts + 3 * i;
+      real32_t len = sqrtf( n[0] * n[0] + n[1] * n[1] + n[2] * n[2] );
+      assert( fabsf( len - 1.0f ) < 1e-4f );
+      assert( -(n[0] * p[0] + n[1] * p[1] + n[2] * p[2]) > 0.99f );
+      assert( curvatures[i] >= 0.0f && curvatures[i] < 0.01f );
+    }
+  }
+  msh_hash_grid_term( &hg );
+
+  // Points on a line have no unique normal, but it should still be a unit vector orthogonal to it
+  size_t n_line_pts = 100;
+  for( size_t i = 0; i < n_line_pts; ++i )
+  {
+    pts[3 * i] = i * 0.01f; pts[3 * i + 1] = i * 0.02f; pts[3 * i + 2] = 0.5f;
+  }
+  msh_hash_grid_init_3d( &hg, pts, n_line_pts, 0.05f );
+  msh_hash_grid_normals_desc_t line_opts = { .radius = 0.05f, .normals = normals };
+  size_t n_valid = msh_hash_grid_estimate_normals( &hg, &line_opts );
+  assert( n_valid == n_line_pts );
+  for( size_t i = 0; i < n_line_pts; ++i )
+  {
+    real32_t* n = normals + 3 * i;
+    assert( fabsf( n[0] * n[0] + n[1] * n[1] + n[2] * n[2] - 1.0f ) < 1e-4f );
+    assert( fabsf( n[0] * 0.01f + n[1] * 0.02f ) < 1e-4f );
+  }
+  msh_hash_grid_term( &hg );
+
+  free( normals );
+  free( curvatures );
+  free( pts );
+}
+
+void
+jobs_test()
+{
+  msh_rand_ctx_t rand_gen = {0};
+  msh_rand_init( &rand_gen, 12352ULL );
+  msh_array( msh_vec3_t ) pts = {0};
+
+  size_t n_pts = 20000;
+  for( size_t i = 0; i < n_pts; ++i )
+  {
+    msh_vec3_t pt = msh_vec3( msh_rand_nextf( &rand_gen ),
+                              msh_rand_nextf( &rand_gen ),
+                              msh_rand_nextf( &rand_gen ) );
+    msh_array_push( pts, pt );
+  }
+
+  float radius = 0.04f;
+  msh_hash_grid_t hg = {0};
+  msh_hash_grid_init_3d( &hg, (real32_t*)&pts[0], n_pts, radius );
+
+  msh_jobs_ctx_t work_ctx = {0};
+  int32_t err = msh_jobs_init_ctx( &work_ctx, 3 );
+  assert( !err );
+
+  // every query is run serially first, and then again with the same descriptor on 'work_ctx'
+  // dense radius search
+  size_t max_n_neigh = 32;
+  msh_hash_grid_search_desc_t serial_opts =
+  {
+    .query_pts = (float*)&pts[0],
+    .n_query_pts = n_pts,
+    .radius = radius,
+    .max_n_neigh = max_n_neigh,
+    .distances_sq = malloc( sizeof(real32_t) * max_n_neigh * n_pts ),
+    .indices = malloc( sizeof(int32_t) * max_n_neigh * n_pts ),
+    .n_neighbors = malloc( sizeof(size_t) * n_pts ),
+    .sort = 1
+  };
+  msh_hash_grid_search_desc_t jobs_opts = serial_opts;
+  jobs_opts.distances_sq = malloc( sizeof(real32_t) * max_n_neigh * n_pts );
+  jobs_opts.indices = malloc( sizeof(int32_t) * max_n_neigh * n_pts );
+  jobs_opts.n_neighbors = malloc( sizeof(size_t) * n_pts );
+  jobs_opts.work_ctx = &work_ctx;
+
+  size_t n_serial = msh_hash_grid_radius_search( &hg, &serial_opts );
+  size_t n_jobs = msh_hash_grid_radius_search( &hg, &jobs_opts );
+  assert( n_serial > 0 && n_serial == n_jobs );
+  assert( !memcmp( serial_opts.n_neighbors, jobs_opts.n_neighbors, sizeof(size_t) * n_pts ) );
+  for( size_t i = 0; i < n_pts; ++i )
+  {
+    size_t row = i * max_n_neigh;
+    for( size_t j = 0; j < serial_opts.n_neighbors[i]; ++j )
+    {
+      assert( serial_opts.indices[row + j] == jobs_opts.indices[row + j] );
+      assert( serial_opts.distances_sq[row + j] == jobs_opts.distances_sq[row + j] );
+    }
+  }
+
+  // kNN search, reusing the same buffers
+  size_t k = 8;
+  serial_opts.k = k;
+  jobs_opts.k = k;
+  n_serial = msh_hash_grid_knn_search( &hg, &serial_opts );
+  n_jobs = msh_hash_grid_knn_search( &hg, &jobs_opts );
+  assert( n_serial == k * n_pts && n_serial == n_jobs );
+  assert( !memcmp( serial_opts.indices, jobs_opts.indices, sizeof(int32_t) * k * n_pts ) );
+  assert( !memcmp( serial_opts.distances_sq, jobs_opts.distances_sq, sizeof(real32_t) * k * n_pts ) );
+
+  // CSR radius search
+  msh_hash_grid_search_desc_t serial_csr_opts =
+  {
+    .query_pts = (float*)&pts[0],
+    .n_query_pts = n_pts,
+    .radius = radius,
+    .offsets = malloc( sizeof(size_t) * (n_pts + 1) ),
+    .output_mode = MSH_HASH_GRID_OUTPUT_CSR,
+    .sort = 1
+  };
+  msh_hash_grid_search_desc_t jobs_csr_opts = serial_csr_opts;
+  jobs_csr_opts.offsets = malloc( sizeof(size_t) * (n_pts + 1) );
+  jobs_csr_opts.work_ctx = &work_ctx;
+  n_serial = msh_hash_grid_radius_search( &hg, &serial_csr_opts );
+  n_jobs = msh_hash_grid_radius_search( &hg, &jobs_csr_opts );
+  assert( n_serial > 0 && n_serial == n_jobs );
+  assert( !memcmp( serial_csr_opts.offsets, jobs_csr_opts.offsets, sizeof(size_t) * (n_pts + 1) ) );
+  assert( !memcmp( serial_csr_opts.indices, jobs_csr_opts.indices, sizeof(int32_t) * n_serial ) );
+  assert( !memcmp( serial_csr_opts.distances_sq, jobs_csr_opts.distances_sq,
+                   sizeof(real32_t) * n_serial ) );
+
+  // box query
+  float boxes[12] = { 0.2f, 0.3f, 0.1f, 0.7f, 0.55f, 0.9f,
+                      -1.0f, 0.9f, 0.5f, 0.1f, 2.0f, 0.6f };
+  size_t max_n_indices = n_pts;
+  size_t serial_n_indices[2] = {0};
+  size_t jobs_n_indices[2] = {0};
+  msh_hash_grid_range_desc_t serial_range_opts =
+  {
+    .boxes = boxes,
+    .n_ranges = 2,
+    .max_n_indices = max_n_indices,
+    .indices = malloc( sizeof(int32_t) * 2 * max_n_indices ),
+    .n_indices = serial_n_indices
+  };
+  msh_hash_grid_range_desc_t jobs_range_opts = serial_range_opts;
+  jobs_range_opts.indices = malloc( sizeof(int32_t) * 2 * max_n_indices );
+  jobs_range_opts.n_indices = jobs_n_indices;
+  jobs_range_opts.work_ctx = &work_ctx;
+  n_serial = msh_hash_grid_box_query( &hg, &serial_range_opts );
+  n_jobs = msh_hash_grid_box_query( &hg, &jobs_range_opts );
+  assert( n_serial > 0 && n_serial == n_jobs );
+  for( size_t j = 0; j < 2; ++j )
+  {
+    assert( serial_n_indices[j] == jobs_n_indices[j] );
+    assert( !memcmp( serial_range_opts.indices + j * max_n_indices,
+                     jobs_range_opts.indices + j * max_n_indices,
+                     sizeof(int32_t) * serial_n_indices[j] ) );
+  }
+
+  // per cell aggregation
+  size_t n_cells = msh_hash_grid_n_cells( &hg );
+  msh_hash_grid_cell_desc_t serial_cell_desc =
+  {
+    .attribs = (float*)&pts[0],
+    .n_attribs = 3,
+    .counts = malloc( n_cells * sizeof(uint32_t) ),
+    .centroids = malloc( 3 * n_cells * sizeof(real32_t) ),
+    .mean_attribs = malloc( 3 * n_cells * sizeof(real32_t) ),
+    .representatives = malloc( n_cells * sizeof(int32_t) )
+  };
+  msh_hash_grid_cell_desc_t jobs_cell_desc = serial_cell_desc;
+  jobs_cell_desc.counts = malloc( n_cells * sizeof(uint32_t) );
+  jobs_cell_desc.centroids = malloc( 3 * n_cells * sizeof(real32_t) );
+  jobs_cell_desc.mean_attribs = malloc( 3 * n_cells * sizeof(real32_t) );
+  jobs_cell_desc.representatives = malloc( n_cells * sizeof(int32_t) );
+  jobs_cell_desc.work_ctx = &work_ctx;
+  assert( msh_hash_grid_aggregate_cells( &hg, &serial_cell_desc ) == n_cells );
+  assert( msh_hash_grid_aggregate_cells( &hg, &jobs_cell_desc ) == n_cells );
+  assert( !memcmp( serial_cell_desc.counts, jobs_cell_desc.counts, n_cells * sizeof(uint32_t) ) );
+  assert( !memcmp( serial_cell_desc.centroids, jobs_cell_desc.centroids,
+                   3 * n_cells * sizeof(real32_t) ) );
+  assert( !memcmp( serial_cell_desc.mean_attribs, jobs_cell_desc.mean_attribs,
+                   3 * n_cells * sizeof(real32_t) ) );
+  assert( !memcmp( serial_cell_desc.representatives, jobs_cell_desc.representatives,
+                   n_cells * sizeof(int32_t) ) );
+
+  msh_jobs_term_ctx( &work_ctx );
+  msh_hash_grid_term( &hg );
+}
+
 int
 main()
 {
@@ -176,8 +1429,57 @@ main()
   radius_search_test();
   printf( "|    -> Passed!\n" );
 
+  printf( "| Testing msh_hash_grid_radius_search with CSR output\n" );
+  radius_search_csr_test();
+  printf( "|    -> Passed!\n" );
+
   printf( "| Testing msh_hash_grid_knn_search\n" );
   knn_search_test();
+  knn_search_exact_test();
+  printf( "|    -> Passed!\n" );
+
+  printf( "| Testing msh_hash_grid_box_query / msh_hash_grid_frustum_query\n" );
+  box_query_test();
+  printf( "|    -> Passed!\n" );
+
+  printf( "| Testing msh_hash_grid_save / msh_hash_grid_load\n" );
+  snapshot_test();
+  printf( "|    -> Passed!\n" );
+
+  printf( "| Testing msh_hash_grid_mr_radius_search / msh_hash_grid_mr_knn_search\n" );
+  multi_resolution_test();
+  printf( "|    -> Passed!\n" );
+
+  printf( "| Testing approximate msh_hash_grid_radius_search / msh_hash_grid_knn_search\n" );
+  approximate_search_test();
+  printf( "|    -> Passed!\n" );
+
+  printf( "| Testing msh_hash_grid_aggregate_cells\n" );
+  aggregate_cells_test();
+  printf( "|    -> Passed!\n" );
+
+  printf( "| Testing msh_hash_grid_radius_pairs\n" );
+  radius_pairs_test();
+  printf( "|    -> Passed!\n" );
+
+  printf( "| Testing msh_hash_grid_search_desc_t sort modes\n" );
+  sort_modes_test();
+  printf( "|    -> Passed!\n" );
+
+  printf( "| Testing msh_hash_grid_brute_force_radius_search / msh_hash_grid_brute_force_knn_search\n" );
+  brute_force_test();
+  printf( "|    -> Passed!\n" );
+
+  printf( "| Testing 2d msh_hash_grid_t\n" );
+  search_2d_test();
+  printf( "|    -> Passed!\n" );
+
+  printf( "| Testing msh_hash_grid_estimate_normals\n" );
+  estimate_normals_test();
+  printf( "|    -> Passed!\n" );
+
+  printf( "| Testing msh_hash_grid searches on msh_jobs_ctx_t\n" );
+  jobs_test();
   printf( "|    -> Passed!\n" );
 
   return 1;
@@ -3,6 +3,7 @@
 // #define MSH_STD_IMPLEMENTATION
 // #include "msh_std.h"
 #include <stdio.h>
+#include <stdlib.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <string.h>
@@ -13,16 +14,731 @@
 MSH_JOBS_JOB_SIGNATURE(task_a) 
 {
   // msh_sleep(1000);
-  Sleep(1000);
+  msh_jobs__sleep(10);
   printf("%6d | TASK_A %s\n", thread_idx, (char*)params );
   return 0;
 }
 
+typedef struct spawn_tree
+{
+  msh_jobs_ctx_t* ctx;
+  struct spawn_node* nodes;
+  uint32_t n_nodes;
+  uint32_t volatile counter;
+} spawn_tree_t;
+
+typedef struct spawn_node
+{
+  spawn_tree_t* tree;
+  uint32_t idx;
+} spawn_node_t;
+
+// Each job spawns the two children of its node in an implicit binary tree
+MSH_JOBS_JOB_SIGNATURE(spawn_task)
+{
+  (void)thread_idx;
+  spawn_node_t* node = (spawn_node_t*)params;
+  spawn_tree_t* tree = node->tree;
+  msh_jobs_atomic_increment( &tree->counter );
+  for( uint32_t child = 2 * node->idx + 1; child <= 2 * node->idx + 2; ++child )
+  {
+    if( child < tree->n_nodes ) { msh_jobs_push_work( tree->ctx, spawn_task, &tree->nodes[child] ); }
+  }
+  return 0;
+}
+
+MSH_JOBS_JOB_SIGNATURE(count_task)
+{
+  (void)thread_idx;
+  msh_jobs_atomic_increment( (uint32_t volatile*)params );
+  return 0;
+}
+
+void
+sub_jobs_test( msh_jobs_ctx_t* work_ctx )
+{
+  for( uint32_t depth = 0; depth < 16; depth += 3 )
+  {
+    spawn_tree_t tree = { work_ctx, NULL, (2u << depth) - 1, 0 };
+    tree.nodes = (spawn_node_t*)malloc( tree.n_nodes * sizeof(spawn_node_t) );
+    for( uint32_t i = 0; i < tree.n_nodes; ++i )
+    {
+      tree.nodes[i].tree = &tree;
+      tree.nodes[i].idx = i;
+    }
+    msh_jobs_push_work( work_ctx, spawn_task, &tree.nodes[0] );
+    msh_jobs_complete_all_work( work_ctx );
+    assert( tree.counter == tree.n_nodes );
+    free( tree.nodes );
+  }
+}
+
+typedef struct fork_join_params
+{
+  msh_jobs_ctx_t* ctx;
+  uint32_t begin;
+  uint32_t end;
+  uint64_t sum;
+} fork_join_params_t;
+
+// Sums [begin, end) by splitting in halves and waiting for both of them from within the job.
+MSH_JOBS_JOB_SIGNATURE(fork_join_sum_task)
+{
+  (void)thread_idx;
+  fork_join_params_t* p = (fork_join_params_t*)params;
+  if( p->end - p->begin <= 64 )
+  {
+    p->sum = 0;
+    for( uint32_t i = p->begin; i < p->end; ++i ) { p->sum += i; }
+    return 0;
+  }
+  uint32_t mid = p->begin + (p->end - p->begin) / 2;
+  fork_join_params_t halves[2] = { { p->ctx, p->begin, mid, 0 }, { p->ctx, mid, p->end, 0 } };
+  msh_jobs_counter_t counter = {0};
+  msh_jobs_push_work_counted( p->ctx, fork_join_sum_task, &halves[0], &counter );
+  msh_jobs_push_work_counted( p->ctx, fork_join_sum_task, &halves[1], &counter );
+  msh_jobs_wait_for_counter( p->ctx, &counter );
+  p->sum = halves[0].sum + halves[1].sum;
+  return 0;
+}
+
+void
+fork_join_test( msh_jobs_ctx_t* work_ctx )
+{
+  uint32_t n = 100000;
+  fork_join_params_t root = { work_ctx, 0, n, 0 };
+  msh_jobs_counter_t counter = {0};
+  msh_jobs_push_work_counted( work_ctx, fork_join_sum_task, &root, &counter );
+  msh_jobs_wait_for_counter( work_ctx, &counter );
+  assert( counter.value == 0 );
+  assert( root.sum == (uint64_t)n * (n - 1) / 2 );
+}
+
+enum { STAGE_LOAD, STAGE_NORMALS, STAGE_DOWNSAMPLE, STAGE_WRITE, N_STAGES };
+
+typedef struct pipeline_file
+{
+  uint32_t volatile stages_done;
+  uint32_t volatile* n_written;
+  uint32_t write_order;
+} pipeline_file_t;
+
+typedef struct pipeline_stage
+{
+  pipeline_file_t* file;
+  uint32_t stage;
+} pipeline_stage_t;
+
+MSH_JOBS_JOB_SIGNATURE(pipeline_stage_task)
+{
+  (void)thread_idx;
+  pipeline_stage_t* s = (pipeline_stage_t*)params;
+  assert( s->file->stages_done == s->stage );
+  if( s->stage == STAGE_WRITE )
+  {
+    // Writes are chained, so nobody else touches 'n_written' right now
+    s->file->write_order = *s->file->n_written;
+    msh_jobs_atomic_increment( s->file->n_written );
+  }
+  msh_jobs_atomic_increment( &s->file->stages_done );
+  return 0;
+}
+
+// load -> normals -> downsample -> write chain per file. Files are independent, except that
+// they have to be written in order.
+void
+job_graph_test( msh_jobs_ctx_t* work_ctx )
+{
+  enum { N_FILES = 32 };
+  pipeline_file_t files[N_FILES] = {0};
+  pipeline_stage_t stages[N_FILES][N_STAGES];
+  msh_jobs_job_t jobs[N_FILES][N_STAGES];
+  uint32_t volatile n_written = 0;
+  msh_jobs_counter_t counter = {0};
+
+  for( uint32_t i = 0; i < N_FILES; ++i )
+  {
+    files[i].n_written = &n_written;
+    for( uint32_t j = 0; j < N_STAGES; ++j )
+    {
+      stages[i][j].file = &files[i];
+      stages[i][j].stage = j;
+      msh_jobs_job_init( &jobs[i][j], pipeline_stage_task, &stages[i][j], &counter );
+      if( j > 0 ) { msh_jobs_job_depends_on( &jobs[i][j], &jobs[i][j-1] ); }
+    }
+    if( i > 0 ) { msh_jobs_job_depends_on( &jobs[i][STAGE_WRITE], &jobs[i-1][STAGE_WRITE] ); }
+  }
+
+  // Submit backwards, so that most jobs get submitted before their predecessors.
+  for( int32_t i = N_FILES - 1; i >= 0; --i )
+  {
+    for( int32_t j = N_STAGES - 1; j >= 0; --j ) { msh_jobs_submit_job( work_ctx, &jobs[i][j] ); }
+  }
+  msh_jobs_wait_for_counter( work_ctx, &counter );
+
+  assert( n_written == N_FILES );
+  for( uint32_t i = 0; i < N_FILES; ++i )
+  {
+    assert( files[i].stages_done == N_STAGES );
+    assert( files[i].write_order == i );
+  }
+}
+
+void
+mark_range( int32_t thread_idx, uint64_t begin, uint64_t end, void* user )
+{
+  (void)thread_idx;
+  uint32_t volatile* marks = (uint32_t volatile*)user;
+  for( uint64_t i = begin; i < end; ++i ) { msh_jobs_atomic_increment( &marks[i] ); }
+}
+
+typedef struct range_sum
+{
+  uint64_t sum;
+  uint64_t first;
+  uint64_t last;
+  uint32_t in_order;
+} range_sum_t;
+
+void
+range_sum_combine( void* dst, const void* src, void* user )
+{
+  (void)user;
+  range_sum_t* a = (range_sum_t*)dst;
+  const range_sum_t* b = (const range_sum_t*)src;
+  if( !b->in_order ) { return; } // identity
+  if( !a->in_order ) { *a = *b; return; }
+  a->in_order = (a->in_order == 1 && b->in_order == 1 && a->last == b->first) ? 1 : 2;
+  a->sum += b->sum;
+  a->last = b->last;
+}
+
+void
+range_sum_reduce( int32_t thread_idx, uint64_t begin, uint64_t end, void* partial, void* user )
+{
+  (void)thread_idx;
+  (void)user;
+  range_sum_t chunk = { 0, begin, end, 1 };
+  for( uint64_t i = begin; i < end; ++i ) { chunk.sum += i; }
+  range_sum_combine( partial, &chunk, NULL );
+}
+
+typedef struct nested_for_params
+{
+  msh_jobs_ctx_t* ctx;
+  uint32_t volatile* marks;
+  uint64_t n_inner;
+} nested_for_params_t;
+
+void
+nested_outer_range( int32_t thread_idx, uint64_t begin, uint64_t end, void* user )
+{
+  (void)thread_idx;
+  nested_for_params_t* p = (nested_for_params_t*)user;
+  for( uint64_t i = begin; i < end; ++i )
+  {
+    msh_jobs_parallel_for( p->ctx, i * p->n_inner, (i + 1) * p->n_inner, 16, mark_range,
+                           (void*)p->marks );
+  }
+}
+
+void
+parallel_for_test( msh_jobs_ctx_t* work_ctx )
+{
+  uint64_t n = 100003;
+  uint32_t volatile* marks = (uint32_t volatile*)calloc( n, sizeof(uint32_t) );
+  uint64_t grains[] = { 0, 1, 7, 1000, 200000 };
+  for( uint32_t g = 0; g < sizeof(grains) / sizeof(grains[0]); ++g )
+  {
+    memset( (void*)marks, 0, n * sizeof(uint32_t) );
+    msh_jobs_parallel_for( work_ctx, 0, n, grains[g], mark_range, (void*)marks );
+    for( uint64_t i = 0; i < n; ++i ) { assert( marks[i] == 1 ); }
+
+    range_sum_t result = {0};
+    msh_jobs_parallel_reduce( work_ctx, 10, n, grains[g], range_sum_reduce, range_sum_combine,
+                              &result, sizeof(result), NULL );
+    assert( result.in_order == 1 );
+    assert( result.first == 10 && result.last == n );
+    assert( result.sum == n * (n - 1) / 2 - 45 );
+  }
+
+  // Parallel for called from within parallel for
+  memset( (void*)marks, 0, n * sizeof(uint32_t) );
+  nested_for_params_t params = { work_ctx, marks, 1000 };
+  msh_jobs_parallel_for( work_ctx, 0, n / params.n_inner, 1, nested_outer_range, &params );
+  for( uint64_t i = 0; i < n; ++i ) { assert( marks[i] == (i < (n / 1000) * 1000) ); }
+
+  // Empty range
+  range_sum_t result = {0};
+  msh_jobs_parallel_reduce( work_ctx, 5, 5, 0, range_sum_reduce, range_sum_combine,
+                            &result, sizeof(result), NULL );
+  assert( result.in_order == 0 && result.sum == 0 );
+  free( (void*)marks );
+}
+
+typedef struct external_producer_params
+{
+  msh_jobs_ctx_t* ctx;
+  uint32_t volatile* n_done;
+  uint32_t volatile marks[5000];
+  uint32_t n_bad_marks;
+} external_producer_params_t;
+
+MSH_JOBS_JOB_SIGNATURE(external_mark_task)
+{
+  (void)thread_idx;
+  msh_jobs_atomic_increment( (uint32_t volatile*)params );
+  return 0;
+}
+
+// Pushes jobs from a thread that is neither a worker nor the thread that created the context
+#if MSH_JOBS_PLATFORM_WINDOWS
+DWORD WINAPI external_producer( void* params )
+#else
+void* external_producer( void* params )
+#endif
+{
+  external_producer_params_t* p = (external_producer_params_t*)params;
+  msh_jobs_counter_t counter = {0};
+  uint32_t n = sizeof(p->marks) / sizeof(p->marks[0]);
+  for( uint32_t i = 0; i < n; ++i )
+  {
+    msh_jobs_push_work_counted( p->ctx, external_mark_task, (void*)&p->marks[i], &counter );
+  }
+  msh_jobs_wait_for_counter( p->ctx, &counter );
+  for( uint32_t i = 0; i < n; ++i ) { p->n_bad_marks += (p->marks[i] != 1); }
+  msh_jobs_atomic_increment( p->n_done );
+  return 0;
+}
+
+void
+external_producers_test( msh_jobs_ctx_t* work_ctx )
+{
+  enum { N_PRODUCERS = 4 };
+  uint32_t volatile n_done = 0;
+  external_producer_params_t* params = 
+    (external_producer_params_t*)calloc( N_PRODUCERS, sizeof(external_producer_params_t) );
+  msh_jobs_thread_t threads[N_PRODUCERS];
+  for( uint32_t i = 0; i < N_PRODUCERS; ++i )
+  {
+    params[i].ctx = work_ctx;
+    params[i].n_done = &n_done;
+    int32_t err = msh_jobs_thread_create( &threads[i], external_producer, &params[i] );
+    assert( !err );
+  }
+  for( uint32_t i = 0; i < N_PRODUCERS; ++i )
+  {
+    msh_jobs_thread_join( &threads[i] );
+    assert( params[i].n_bad_marks == 0 );
+  }
+  assert( n_done == N_PRODUCERS );
+  free( params );
+}
+
+void
+overflow_test( msh_jobs_ctx_t* work_ctx )
+{
+  // More jobs than a single deque can hold - the overflow runs on the pushing thread.
+  uint32_t volatile counter = 0;
+  uint32_t n_jobs = 4 * MSH_JOBS_QUEUE_SIZE + 3;
+  for( uint32_t i = 0; i < n_jobs; ++i )
+  {
+    msh_jobs_push_work( work_ctx, count_task, (void*)&counter );
+  }
+  msh_jobs_complete_all_work( work_ctx );
+  assert( counter == n_jobs );
+}
+
+typedef struct node_job
+{
+  msh_jobs_ctx_t* ctx;
+  uint32_t node;
+  uint32_t volatile* n_done;
+  uint32_t volatile n_bad_nodes;
+} node_job_t;
+
+MSH_JOBS_JOB_SIGNATURE(node_task)
+{
+  node_job_t* job = (node_job_t*)params;
+  if( msh_jobs_get_thread_numa_node( job->ctx, thread_idx ) >= 
+      job->ctx->processor_info.numa_node_count )
+  {
+    job->n_bad_nodes++;
+  }
+  msh_jobs_atomic_increment( job->n_done );
+  return 0;
+}
+
+void
+topology_test( msh_jobs_ctx_t* work_ctx )
+{
+  msh_jobs_processor_info_t* info = &work_ctx->processor_info;
+  printf( "|    Cores: %u logical, %u physical, %u packages, %u NUMA nodes\n",
+          info->logical_core_count, info->physical_core_count, info->package_count,
+          info->numa_node_count );
+  printf( "|    Caches: L1d %lluKB, L2 %lluKB, L3 %lluKB\n",
+          (unsigned long long)info->l1d_cache_size >> 10,
+          (unsigned long long)info->l2_cache_size >> 10,
+          (unsigned long long)info->l3_cache_size >> 10 );
+  assert( info->physical_core_count >= 1 );
+  assert( info->physical_core_count <= info->logical_core_count );
+  assert( info->package_count >= 1 );
+  assert( info->numa_node_count >= 1 );
+  for( uint32_t i = 0; i < info->core_table_count; ++i )
+  {
+    assert( info->core_table[i].core_idx < info->physical_core_count );
+    assert( info->core_table[i].package_idx < info->package_count );
+    assert( info->core_table[i].numa_node < info->numa_node_count );
+  }
+
+  // Standalone query owns its table, listing every core once
+  msh_jobs_processor_info_t own_info;
+  msh_jobs_get_processor_info( &own_info );
+  assert( own_info.core_table_count == info->core_table_count );
+  assert( own_info.core_table_count <= own_info.logical_core_count );
+  for( uint32_t i = 0; i < own_info.core_table_count; ++i )
+  {
+    for( uint32_t j = 0; j < i; ++j )
+    {
+      assert( own_info.core_table[i].os_idx != own_info.core_table[j].os_idx ||
+              own_info.core_table[i].group != own_info.core_table[j].group );
+    }
+  }
+  msh_jobs_free_processor_info( &own_info );
+  assert( !own_info.core_table && !own_info.core_table_count );
+
+  for( uint32_t i = 0; i <= work_ctx->thread_count; ++i )
+  {
+    assert( msh_jobs_get_thread_numa_node( work_ctx, i ) < info->numa_node_count );
+  }
+
+  // Jobs pushed to every node, including ones that do not exist, all have to run.
+  enum { N_JOBS = 256 };
+  uint32_t volatile n_done = 0;
+  msh_jobs_counter_t counter = {0};
+  node_job_t* jobs = (node_job_t*)calloc( N_JOBS, sizeof(node_job_t) );
+  for( uint32_t i = 0; i < N_JOBS; ++i )
+  {
+    jobs[i].ctx = work_ctx;
+    jobs[i].node = i % (info->numa_node_count + 1);
+    jobs[i].n_done = &n_done;
+    msh_jobs_push_work_on_node( work_ctx, jobs[i].node, node_task, &jobs[i], &counter );
+  }
+  msh_jobs_wait_for_counter( work_ctx, &counter );
+  assert( n_done == N_JOBS );
+  for( uint32_t i = 0; i < N_JOBS; ++i ) { assert( jobs[i].n_bad_nodes == 0 ); }
+  msh_jobs_complete_all_work( work_ctx );
+  free( jobs );
+}
+
+typedef struct gate
+{
+  uint32_t volatile n_entered;
+  uint32_t volatile released;
+} gate_t;
+
+MSH_JOBS_JOB_SIGNATURE(gate_task)
+{
+  (void)thread_idx;
+  gate_t* gate = (gate_t*)params;
+  msh_jobs_atomic_increment( &gate->n_entered );
+  while( !gate->released ) { msh_jobs__yield(); }
+  return 0;
+}
+
+typedef struct priority_log
+{
+  uint32_t volatile n_entries;
+  uint32_t entries[64];
+} priority_log_t;
+
+typedef struct priority_job
+{
+  priority_log_t* log;
+  uint32_t priority;
+} priority_job_t;
+
+MSH_JOBS_JOB_SIGNATURE(priority_task)
+{
+  (void)thread_idx;
+  priority_job_t* job = (priority_job_t*)params;
+  uint32_t idx = job->log->n_entries;
+  msh_jobs_atomic_increment( &job->log->n_entries );
+  job->log->entries[idx] = job->priority;
+  return 0;
+}
+
+typedef struct io_job
+{
+  msh_jobs_ctx_t* ctx;
+  int32_t thread_idx;
+} io_job_t;
+
+MSH_JOBS_JOB_SIGNATURE(io_task)
+{
+  io_job_t* job = (io_job_t*)params;
+  msh_jobs__sleep( 1 );
+  job->thread_idx = thread_idx;
+  return 0;
+}
+
+void
+priority_test( msh_jobs_ctx_t* work_ctx )
+{
+  // Keep all workers busy, so that the main thread is the only one running the jobs below.
+  gate_t gate = {0};
+  for( uint32_t i = 0; i < work_ctx->thread_count; ++i )
+  {
+    msh_jobs_push_work( work_ctx, gate_task, &gate );
+  }
+  while( gate.n_entered != work_ctx->thread_count ) { msh_jobs__yield(); }
+
+  // I/O jobs still run, on their own threads
+  enum { N_IO_JOBS = 8 };
+  io_job_t io_jobs[N_IO_JOBS];
+  msh_jobs_counter_t io_counter = {0};
+  for( uint32_t i = 0; i < N_IO_JOBS; ++i )
+  {
+    io_jobs[i].ctx = work_ctx;
+    io_jobs[i].thread_idx = -1;
+    msh_jobs_push_io_work( work_ctx, io_task, &io_jobs[i], &io_counter );
+  }
+  msh_jobs_wait_for_counter( work_ctx, &io_counter );
+  for( uint32_t i = 0; i < N_IO_JOBS; ++i )
+  {
+    assert( io_jobs[i].thread_idx > (int32_t)work_ctx->thread_count );
+    assert( io_jobs[i].thread_idx <= (int32_t)(work_ctx->thread_count + work_ctx->io_thread_count) );
+  }
+
+  // Pushed in the reverse order, run high to background
+  enum { N_PER_PRIORITY = 8 };
+  priority_log_t log = {0};
+  priority_job_t jobs[MSH_JOBS_PRIORITY_COUNT * N_PER_PRIORITY];
+  msh_jobs_counter_t counter = {0};
+  for( int32_t p = MSH_JOBS_PRIORITY_COUNT - 1; p >= 0; --p )
+  {
+    for( uint32_t i = 0; i < N_PER_PRIORITY; ++i )
+    {
+      priority_job_t* job = &jobs[p * N_PER_PRIORITY + i];
+      job->log = &log;
+      job->priority = (uint32_t)p;
+      msh_jobs_push_work_priority( work_ctx, (msh_jobs_priority_t)p, priority_task, job, &counter );
+    }
+  }
+  msh_jobs_wait_for_counter( work_ctx, &counter );
+  assert( log.n_entries == MSH_JOBS_PRIORITY_COUNT * N_PER_PRIORITY );
+  for( uint32_t i = 0; i < log.n_entries; ++i )
+  {
+    assert( log.entries[i] == i / N_PER_PRIORITY );
+  }
+
+  gate.released = true;
+  msh_jobs_complete_all_work( work_ctx );
+}
+
+typedef struct scratch_params
+{
+  msh_jobs_ctx_t* ctx;
+  uint32_t volatile n_bad;
+} scratch_params_t;
+
+// Every chunk starts with an empty scratch, so the first allocation is always at its base.
+void
+scratch_range( int32_t thread_idx, uint64_t begin, uint64_t end, void* user )
+{
+  scratch_params_t* p = (scratch_params_t*)user;
+  msh_jobs_scratch_t* scratch = &p->ctx->thread_infos[thread_idx].scratch;
+  uint64_t n = end - begin;
+  uint64_t* a = (uint64_t*)msh_jobs_scratch_alloc( p->ctx, thread_idx, n * sizeof(uint64_t) );
+  char* b = (char*)msh_jobs_scratch_alloc( p->ctx, thread_idx, 3 );
+  uint64_t* c = (uint64_t*)msh_jobs_scratch_alloc( p->ctx, thread_idx, n * sizeof(uint64_t) );
+  if( (uint8_t*)a != scratch->base || !b || !c || ((uintptr_t)c & 15) )
+  {
+    msh_jobs_atomic_increment( &p->n_bad );
+    return;
+  }
+  for( uint64_t i = 0; i < n; ++i ) { a[i] = begin + i; c[i] = ~(begin + i); }
+  for( uint64_t i = 0; i < n; ++i )
+  {
+    if( a[i] != begin + i || c[i] != ~(begin + i) ) { msh_jobs_atomic_increment( &p->n_bad ); }
+  }
+}
+
+void
+scratch_test( msh_jobs_ctx_t* work_ctx )
+{
+  scratch_params_t params = { work_ctx, 0 };
+  msh_jobs_parallel_for( work_ctx, 0, 100000, 64, scratch_range, &params );
+  assert( params.n_bad == 0 );
+  assert( msh_jobs_scratch_alloc( work_ctx, 0, work_ctx->scratch_size + 1 ) == NULL );
+  assert( msh_jobs_scratch_alloc( work_ctx, MSH_JOBS_EXTERNAL_THREAD_IDX, 16 ) == NULL );
+  for( uint32_t i = 0; i <= work_ctx->thread_count; ++i )
+  {
+    assert( work_ctx->thread_infos[i].scratch.used == 0 );
+  }
+}
+
+void
+trace_test()
+{
+  msh_jobs_ctx_t ctx = {0};
+  msh_jobs_ctx_desc_t desc = { 2, false, 1, 0, 100, 0 };
+  int32_t err = msh_jobs_init_ctx_desc( &ctx, &desc );
+  assert( !err );
+  assert( ctx.trace_size == 128 );
+
+  enum { N_JOBS = 1000 };
+  uint32_t volatile counter = 0;
+  for( uint32_t i = 0; i < N_JOBS; ++i )
+  {
+    if( i % 10 ) { msh_jobs_push_work( &ctx, count_task, (void*)&counter ); }
+    else         { msh_jobs_push_io_work( &ctx, count_task, (void*)&counter, NULL ); }
+  }
+  msh_jobs_complete_all_work( &ctx );
+  assert( counter == N_JOBS );
+
+  uint64_t n_jobs = 0;
+  for( uint32_t i = 0; i <= ctx.thread_count + ctx.io_thread_count; ++i )
+  {
+    n_jobs += ctx.thread_infos[i].stats.n_jobs;
+    assert( ctx.thread_infos[i].trace.n_written == ctx.thread_infos[i].stats.n_jobs +
+                                                    ctx.thread_infos[i].stats.n_waits );
+  }
+  assert( n_jobs == N_JOBS );
+
+  const char* filename = "msh_jobs_test_trace.json";
+  err = msh_jobs_write_trace( &ctx, filename );
+  assert( !err );
+  msh_jobs_term_ctx( &ctx );
+
+  // Every thread keeps at most 'trace_size' of its latest events
+  FILE* fp = fopen( filename, "r" );
+  assert( fp );
+  char line[512];
+  uint32_t n_lines = 0;
+  uint32_t n_events = 0;
+  while( fgets( line, sizeof(line), fp ) )
+  {
+    if( n_lines++ == 0 ) { assert( !strncmp( line, "{\"displayTimeUnit\"", 18 ) ); }
+    n_events += ( strstr( line, "\"ph\":\"X\"" ) != NULL );
+  }
+  fclose( fp );
+  remove( filename );
+  assert( !strcmp( line, "]}\n" ) );
+  assert( n_events > 0 && n_events <= 4 * 128 );
+}
+
+typedef struct read_check
+{
+  uint32_t first_value;
+  uint32_t volatile* n_good;
+} read_check_t;
+
+// Continuation - the data has arrived by the time it runs
+MSH_JOBS_JOB_SIGNATURE(check_read_task)
+{
+  (void)thread_idx;
+  msh_jobs_read_t* read = (msh_jobs_read_t*)params;
+  read_check_t* check = (read_check_t*)read->data;
+  const uint32_t* values = (const uint32_t*)read->buffer;
+  int32_t good = ( read->result == (int64_t)read->size );
+  for( uint64_t i = 0; good && i < read->size / sizeof(uint32_t); ++i )
+  {
+    good = ( values[i] == check->first_value + i );
+  }
+  if( good ) { msh_jobs_atomic_increment( check->n_good ); }
+  return 0;
+}
+
+void
+async_read_test( msh_jobs_ctx_t* work_ctx )
+{
+  enum { N_READS = 64, N_VALUES_PER_READ = 4096 };
+  const char* filename = "msh_jobs_test_read.bin";
+  uint32_t* values = (uint32_t*)malloc( N_READS * N_VALUES_PER_READ * sizeof(uint32_t) );
+  for( uint32_t i = 0; i < N_READS * N_VALUES_PER_READ; ++i ) { values[i] = i; }
+  FILE* fp = fopen( filename, "wb" );
+  assert( fp );
+  fwrite( values, sizeof(uint32_t), N_READS * N_VALUES_PER_READ, fp );
+  fclose( fp );
+  memset( values, 0, N_READS * N_VALUES_PER_READ * sizeof(uint32_t) );
+
+  msh_jobs_file_t file;
+  int32_t err = msh_jobs_file_open( &file, filename );
+  assert( !err );
+  int64_t file_size = msh_jobs_file_size( file );
+  assert( file_size == N_READS * N_VALUES_PER_READ * sizeof(uint32_t) );
+
+  // All reads in flight at once, issued back to front
+  uint32_t volatile n_good = 0;
+  msh_jobs_counter_t counter = {0};
+  msh_jobs_read_t reads[N_READS + 1] = {{0}};
+  read_check_t checks[N_READS];
+  for( int32_t i = N_READS - 1; i >= 0; --i )
+  {
+    checks[i].first_value = i * N_VALUES_PER_READ;
+    checks[i].n_good = &n_good;
+    reads[i].file = file;
+    reads[i].buffer = values + i * N_VALUES_PER_READ;
+    reads[i].offset = (uint64_t)i * N_VALUES_PER_READ * sizeof(uint32_t);
+    reads[i].size = N_VALUES_PER_READ * sizeof(uint32_t);
+    reads[i].continuation = check_read_task;
+    reads[i].data = &checks[i];
+    reads[i].counter = &counter;
+    msh_jobs_read_async( work_ctx, &reads[i] );
+  }
+
+  // Reading past the end gives nothing, without a continuation nor a counter
+  char byte = 0;
+  reads[N_READS].file = file;
+  reads[N_READS].buffer = &byte;
+  reads[N_READS].offset = (uint64_t)file_size;
+  reads[N_READS].size = 1;
+  msh_jobs_read_async( work_ctx, &reads[N_READS] );
+
+  msh_jobs_wait_for_counter( work_ctx, &counter );
+  assert( n_good == N_READS );
+  msh_jobs_complete_all_work( work_ctx );
+  assert( reads[N_READS].result == 0 );
+
+  msh_jobs_file_close( file );
+  remove( filename );
+  free( values );
+}
+
+void
+init_term_test()
+{
+  // Contexts created and destroyed in a loop must finish their work and leave no threads behind.
+  for( uint32_t round = 0; round < 32; ++round )
+  {
+    msh_jobs_ctx_t ctx = {0};
+    msh_jobs_ctx_desc_t desc = { 1 + round % 4, false, round % 3, 0, 0, round % 2 ? 8u : 0u };
+    int32_t err = msh_jobs_init_ctx_desc( &ctx, &desc );
+    assert( !err );
+
+    uint32_t volatile counter = 0;
+    for( uint32_t i = 0; i < 64; ++i )
+    {
+      msh_jobs_push_work( &ctx, count_task, (void*)&counter );
+    }
+    for( uint32_t i = 0; i < 4; ++i )
+    {
+      msh_jobs_push_io_work( &ctx, count_task, (void*)&counter, NULL );
+    }
+    msh_jobs_term_ctx( &ctx );
+    assert( counter == 68 );
+    assert( ctx.thread_infos == NULL && ctx.queue.deques == NULL );
+    msh_jobs_term_ctx( &ctx );
+  }
+}
+
 int32_t 
 main()
 {
   msh_jobs_ctx_t work_ctx = {0};
-  msh_jobs_init_ctx( &work_ctx, 1 );
+  msh_jobs_ctx_desc_t desc = { 3, true, 2, 64 * 1024, 0, 0 };
+  msh_jobs_init_ctx_desc( &work_ctx, &desc );
   printf("Running on %s\n", msh_jobs_get_platform_name() );
   printf("Spawned Thread Count: %d | Logical Core Count: %d\n", 
           work_ctx.thread_count,
@@ -31,30 +747,12 @@ main()
   // uint64_t t1, t2;
   // t1 = msh_time_now();
 
-  msh_jobs_push_work( &work_ctx, task_a, "00" );
-  msh_jobs_push_work( &work_ctx, task_a, "01" );
-  msh_jobs_push_work( &work_ctx, task_a, "02" );
-  msh_jobs_push_work( &work_ctx, task_a, "03" );
-  msh_jobs_push_work( &work_ctx, task_a, "04" );
-  msh_jobs_push_work( &work_ctx, task_a, "05" );
-  msh_jobs_push_work( &work_ctx, task_a, "06" );
-  msh_jobs_push_work( &work_ctx, task_a, "07" );
-  msh_jobs_push_work( &work_ctx, task_a, "08" );
-  msh_jobs_push_work( &work_ctx, task_a, "09" );
-  msh_jobs_push_work( &work_ctx, task_a, "10" );
-  msh_jobs_push_work( &work_ctx, task_a, "11" );
-  msh_jobs_push_work( &work_ctx, task_a, "12" );
-  msh_jobs_push_work( &work_ctx, task_a, "13" );
-  msh_jobs_push_work( &work_ctx, task_a, "14" );
-  msh_jobs_push_work( &work_ctx, task_a, "15" );
-  msh_jobs_push_work( &work_ctx, task_a, "16" );
-  msh_jobs_push_work( &work_ctx, task_a, "17" );
-  msh_jobs_push_work( &work_ctx, task_a, "18" );
-  msh_jobs_push_work( &work_ctx, task_a, "19" );
-  msh_jobs_push_work( &work_ctx, task_a, "20" );
-  msh_jobs_push_work( &work_ctx, task_a, "21" );
-  msh_jobs_push_work( &work_ctx, task_a, "22" );
-  msh_jobs_push_work( &work_ctx, task_a, "23" );
+  char labels[24][3];
+  for( int32_t i = 0; i < 24; ++i )
+  {
+    snprintf( labels[i], 3, "%02d", i % 100 );
+    msh_jobs_push_work( &work_ctx, task_a, labels[i] );
+  }
 
   printf("TEST\n");
 
@@ -62,9 +760,67 @@ main()
   // t2 = msh_time_now();
   // printf("Time: %f\n", msh_time_diff_ms(t2, t1));
 
+  printf( "| Testing sub-jobs pushed from within jobs\n" );
+  sub_jobs_test( &work_ctx );
+  printf( "|    -> Passed!\n" );
+
+  printf( "| Testing msh_jobs_push_work_counted / msh_jobs_wait_for_counter\n" );
+  fork_join_test( &work_ctx );
+  printf( "|    -> Passed!\n" );
+
+  printf( "| Testing job graphs\n" );
+  job_graph_test( &work_ctx );
+  printf( "|    -> Passed!\n" );
+
+  printf( "| Testing msh_jobs_parallel_for / msh_jobs_parallel_reduce\n" );
+  parallel_for_test( &work_ctx );
+  printf( "|    -> Passed!\n" );
+
+  printf( "| Testing pushing jobs from threads outside of the pool\n" );
+  external_producers_test( &work_ctx );
+  printf( "|    -> Passed!\n" );
+
+  printf( "| Testing pushing more jobs than a deque holds\n" );
+  overflow_test( &work_ctx );
+  printf( "|    -> Passed!\n" );
+
+  printf( "| Testing job priorities and I/O threads\n" );
+  priority_test( &work_ctx );
+  printf( "|    -> Passed!\n" );
+
+  printf( "| Testing per thread scratch memory\n" );
+  scratch_test( &work_ctx );
+  printf( "|    -> Passed!\n" );
+
+  printf( "| Testing async reads on I/O threads\n" );
+  async_read_test( &work_ctx );
+  printf( "|    -> Passed!\n" );
+
+  printf( "| Testing topology discovery and NUMA node queues\n" );
+  topology_test( &work_ctx );
+  printf( "|    -> Passed!\n" );
+
   msh_jobs_term_ctx( &work_ctx );
-  
 
+  printf( "| Testing async reads with the I/O ring\n" );
+  {
+    // Ring smaller than the number of reads, so that some still go to the I/O threads
+    msh_jobs_ctx_t ring_ctx = {0};
+    msh_jobs_ctx_desc_t ring_desc = { 2, false, 1, 0, 0, 8 };
+    int32_t err = msh_jobs_init_ctx_desc( &ring_ctx, &ring_desc );
+    assert( !err );
+    async_read_test( &ring_ctx );
+    msh_jobs_term_ctx( &ring_ctx );
+  }
+  printf( "|    -> Passed!\n" );
+
+  printf( "| Testing scheduler tracing\n" );
+  trace_test();
+  printf( "|    -> Passed!\n" );
+
+  printf( "| Testing creating and destroying contexts\n" );
+  init_term_test();
+  printf( "|    -> Passed!\n" );
 
   return 0;
 }